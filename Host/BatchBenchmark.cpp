@@ -0,0 +1,143 @@
+//
+//  BatchBenchmark.cpp
+//  VoodooI2CELAN
+//
+//  Copyright © 2017 Kishor Prins. All rights reserved.
+//
+
+// Checks that every batch kernel this machine can run decodes exactly like
+// decode_ELAN_report(), then measures frames/sec of each across batch sizes
+//
+// usage: elan_batch_benchmark [frames per size] [seed]
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+#include "BatchDecoder.hpp"
+#include "SyntheticReports.hpp"
+
+static const size_t kBatchSizes[] = { 1, 16, 256, 4096, 65536 };
+static const int kRounds = 5;
+
+/* Compares a batch with decode_ELAN_report() run on every frame
+ *
+ * @return the number of frames that differ
+ */
+static uint64_t verify(const VoodooI2CELANDecodeContext& context, const uint8_t* frames, size_t count,
+                       const BatchReports& batch) {
+    uint64_t mismatches = 0;
+    for (size_t i = 0; i < count; i++) {
+        VoodooI2CELANReport report;
+        VoodooI2CELANReportStatus status = decode_ELAN_report(context, frames + i * ETP_MAX_REPORT_LEN, &report);
+        bool valid = status == kVoodooI2CELANReportValid;
+        bool same = batch.status[i] == status &&
+                    batch.contact_mask[i] == (valid ? report.contact_mask : 0) &&
+                    batch.button[i] == (valid && report.button) &&
+                    batch.hover[i] == (valid && report.hover);
+        for (int slot = 0; slot < ETP_MAX_FINGERS; slot++) {
+            size_t at = slot * count + i;
+            bool present = valid && (report.contact_mask & (1U << slot));
+            const VoodooI2CELANContact& contact = report.contacts[slot];
+            same = same && batch.x[at] == (present ? contact.x : 0) && batch.y[at] == (present ? contact.y : 0) &&
+                   batch.pressure[at] == (present ? contact.pressure : 0) &&
+                   batch.mk_x[at] == (present ? contact.mk_x : 0) && batch.mk_y[at] == (present ? contact.mk_y : 0);
+        }
+        if (!same)
+            mismatches++;
+    }
+    return mismatches;
+}
+
+/* Decodes the whole pool in batches of @batch_size with @kernel
+ *
+ * @return the elapsed seconds
+ */
+static double run(BatchDecodeKernel kernel, const VoodooI2CELANDecodeContext& context, const std::vector<uint8_t>& pool,
+                  size_t batch_size, uint64_t* checksum) {
+    size_t total = pool.size() / ETP_MAX_REPORT_LEN;
+    BatchReports batch;
+
+    std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+    for (size_t first = 0; first + batch_size <= total; first += batch_size) {
+        *checksum += decode_ELAN_batch(context, &pool[first * ETP_MAX_REPORT_LEN], batch_size, &batch, kernel);
+        *checksum += batch.x[batch_size - 1] ^ batch.y[0];
+    }
+    std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
+    return std::chrono::duration<double>(end - begin).count();
+}
+
+int main(int argc, char** argv) {
+    size_t total = argc > 1 ? strtoull(argv[1], NULL, 0) : 1 << 20;
+    uint32_t seed = argc > 2 ? static_cast<uint32_t>(strtoul(argv[2], NULL, 0)) : 0xBA7CBA7C;
+    if (!seed)
+        seed = 1;
+    // whole batches of the biggest size
+    size_t largest = kBatchSizes[sizeof(kBatchSizes) / sizeof(kBatchSizes[0]) - 1];
+    total = total < largest ? largest : total - total % largest;
+
+    std::vector<uint8_t> pool(total * ETP_MAX_REPORT_LEN);
+    for (size_t i = 0; i < total; i++)
+        make_random_report(&seed, &pool[i * ETP_MAX_REPORT_LEN]);
+
+    VoodooI2CELANDecodeContext context;
+    context.logical_max_x = 3200;
+    context.logical_max_y = 2000;
+    context.pressure_adjustment = ETP_PRESSURE_OFFSET;
+    context.width_per_trace_x = 3;
+    context.width_per_trace_y = 3;
+    context.invert_y = true;
+
+    // every kernel has to agree with the scalar decoder, bit for bit, odd batch sizes included
+    uint64_t mismatches = 0;
+    const int pressure_adjustments[] = { 0, ETP_PRESSURE_OFFSET, 7 };
+    const size_t check_size = 4097;
+    for (int kernel = 0; kernel < kBatchDecodeKernelCount; kernel++) {
+        if (!batch_decode_kernel_supported(static_cast<BatchDecodeKernel>(kernel)))
+            continue;
+        for (int variant = 0; variant < 6; variant++) {
+            VoodooI2CELANDecodeContext check = context;
+            check.pressure_adjustment = pressure_adjustments[variant / 2];
+            check.invert_y = variant & 1;
+            BatchReports batch;
+            decode_ELAN_batch(check, &pool[0], check_size, &batch, static_cast<BatchDecodeKernel>(kernel));
+            mismatches += verify(check, &pool[0], check_size, batch);
+        }
+    }
+
+    printf("frames:         %zu per batch size, best of %d rounds\n", total, kRounds);
+    printf("%-10s", "batch");
+    for (int kernel = 0; kernel < kBatchDecodeKernelCount; kernel++)
+        printf("%16s", batch_decode_kernel_name(static_cast<BatchDecodeKernel>(kernel)));
+    printf("\n");
+
+    uint64_t checksum = 0;
+    for (size_t size = 0; size < sizeof(kBatchSizes) / sizeof(kBatchSizes[0]); size++) {
+        double best[kBatchDecodeKernelCount] = { 0 };
+        // interleaved, so no kernel gets the quieter machine
+        for (int round = 0; round < kRounds; round++) {
+            for (int kernel = 0; kernel < kBatchDecodeKernelCount; kernel++) {
+                if (!batch_decode_kernel_supported(static_cast<BatchDecodeKernel>(kernel)))
+                    continue;
+                double seconds = run(static_cast<BatchDecodeKernel>(kernel), context, pool, kBatchSizes[size], &checksum);
+                if (!round || seconds < best[kernel])
+                    best[kernel] = seconds;
+            }
+        }
+
+        printf("%-10zu", kBatchSizes[size]);
+        for (int kernel = 0; kernel < kBatchDecodeKernelCount; kernel++) {
+            if (best[kernel])
+                printf("%16.0f", total / best[kernel]);
+            else
+                printf("%16s", "-");
+        }
+        printf("\n");
+    }
+
+    printf("best kernel:    %s\n", batch_decode_kernel_name(best_batch_decode_kernel()));
+    printf("checksum:       %llx\n", static_cast<unsigned long long>(checksum));
+    printf("bit exact:      %s (%llu mismatches)\n", mismatches ? "no" : "yes", static_cast<unsigned long long>(mismatches));
+    return mismatches ? 1 : 0;
+}
@@ -0,0 +1,291 @@
+//
+//  BatchDecoder.cpp
+//  VoodooI2CELAN
+//
+//  Copyright © 2017 Kishor Prins. All rights reserved.
+//
+
+#include "BatchDecoder.hpp"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define ELAN_BATCH_X86 1
+#include <immintrin.h>
+#endif
+
+void BatchReports::resize(size_t frames) {
+    this->frames = frames;
+    status.assign(frames, 0);
+    contact_mask.assign(frames, 0);
+    button.assign(frames, 0);
+    hover.assign(frames, 0);
+    x.assign(frames * ETP_MAX_FINGERS, 0);
+    y.assign(frames * ETP_MAX_FINGERS, 0);
+    pressure.assign(frames * ETP_MAX_FINGERS, 0);
+    mk_x.assign(frames * ETP_MAX_FINGERS, 0);
+    mk_y.assign(frames * ETP_MAX_FINGERS, 0);
+}
+
+bool batch_decode_kernel_supported(BatchDecodeKernel kernel) {
+    switch (kernel) {
+        case kBatchDecodeScalar:
+            return true;
+#ifdef ELAN_BATCH_X86
+        case kBatchDecodeSSSE3:
+            return __builtin_cpu_supports("ssse3");
+        case kBatchDecodeAVX2:
+            return __builtin_cpu_supports("avx2");
+#endif
+        default:
+            return false;
+    }
+}
+
+BatchDecodeKernel best_batch_decode_kernel() {
+    for (int kernel = kBatchDecodeKernelCount - 1; kernel > kBatchDecodeScalar; kernel--) {
+        if (batch_decode_kernel_supported(static_cast<BatchDecodeKernel>(kernel)))
+            return static_cast<BatchDecodeKernel>(kernel);
+    }
+    return kBatchDecodeScalar;
+}
+
+const char* batch_decode_kernel_name(BatchDecodeKernel kernel) {
+    switch (kernel) {
+        case kBatchDecodeScalar: return "scalar";
+        case kBatchDecodeSSSE3: return "ssse3";
+        case kBatchDecodeAVX2: return "avx2";
+        case kBatchDecodeKernelCount: break;
+    }
+    return "unknown";
+}
+
+/* Fills in the per frame values of a report
+ *
+ * @return the contact mask, 0 for anything but a valid report
+ */
+static uint8_t store_header(const uint8_t* frame, size_t index, BatchReports* reports) {
+    VoodooI2CELANReportStatus status = classify_ELAN_report(frame);
+    reports->status[index] = status;
+    if (status != kVoodooI2CELANReportValid)
+        return 0;
+
+    uint8_t tp_info = frame[ETP_TOUCH_INFO_OFFSET];
+    uint8_t mask = (tp_info >> 3) & ((1U << ETP_MAX_FINGERS) - 1);
+    reports->contact_mask[index] = mask;
+    reports->button[index] = tp_info & 0x01;
+    reports->hover[index] = (frame[ETP_HOVER_INFO_OFFSET] & ETP_HOVER_EVENT) != 0;
+    return mask;
+}
+
+/* Moves the unpacked finger records of a frame into their slots, finger data is packed so
+ * the n-th record belongs to the n-th slot in the contact mask
+ */
+static void store_contacts(size_t index, uint8_t mask, const uint16_t* x, const uint16_t* y, const uint16_t* pressure,
+                           const uint16_t* mk, BatchReports* reports) {
+    size_t frames = reports->frames;
+    int record = 0;
+    for (int slot = 0; slot < ETP_MAX_FINGERS; slot++) {
+        if (!(mask & (1U << slot)))
+            continue;
+        size_t at = slot * frames + index;
+        reports->x[at] = x[record];
+        reports->y[at] = y[record];
+        reports->pressure[at] = pressure[record];
+        reports->mk_x[at] = mk[record] & 0x0f;
+        reports->mk_y[at] = mk[record] >> 4;
+        record++;
+    }
+}
+
+static size_t decode_scalar(const VoodooI2CELANDecodeContext& context, const uint8_t* frames, size_t count, BatchReports* reports) {
+    size_t valid = 0;
+    VoodooI2CELANReport report;
+
+    for (size_t i = 0; i < count; i++) {
+        const uint8_t* frame = frames + i * ETP_MAX_REPORT_LEN;
+        if (!store_header(frame, i, reports) || decode_ELAN_report(context, frame, &report) != kVoodooI2CELANReportValid)
+            continue;
+        valid++;
+        for (int slot = 0; slot < ETP_MAX_FINGERS; slot++) {
+            if (!(report.contact_mask & (1U << slot)))
+                continue;
+            size_t at = slot * count + i;
+            reports->x[at] = report.contacts[slot].x;
+            reports->y[at] = report.contacts[slot].y;
+            reports->pressure[at] = report.contacts[slot].pressure;
+            reports->mk_x[at] = report.contacts[slot].mk_x;
+            reports->mk_y[at] = report.contacts[slot].mk_y;
+        }
+    }
+    return valid;
+}
+
+#ifdef ELAN_BATCH_X86
+
+/* The finger data of a frame is read as two overlapping 16 byte loads, bytes 4-19 hold
+ * records 0-2 and bytes 18-33 records 3 and 4, neither reads past the frame
+ */
+#define ELAN_BATCH_LOW_LOAD ETP_FINGER_DATA_OFFSET
+#define ELAN_BATCH_HIGH_LOAD (ETP_MAX_REPORT_LEN - 16)
+
+enum {
+    kBatchFieldX = 0,   // byte 1, high nibble of byte 0 on top
+    kBatchFieldY,       // byte 2, low nibble of byte 0 on top
+    kBatchFieldPressure,
+    kBatchFieldMK,
+    kBatchFieldCount
+};
+
+/* pshufb masks that gather one field of every record into its own 16 bit lane */
+struct BatchShuffleMasks {
+    uint8_t low[kBatchFieldCount][16];
+    uint8_t high[kBatchFieldCount][16];
+};
+
+static BatchShuffleMasks build_shuffle_masks() {
+    static const int low_byte[kBatchFieldCount] = { 1, 2, 4, 3 };
+    static const int high_byte[kBatchFieldCount] = { 0, 0, -1, -1 };
+    BatchShuffleMasks masks;
+
+    for (int field = 0; field < kBatchFieldCount; field++) {
+        for (int lane = 0; lane < 8; lane++) {
+            int offset = ETP_FINGER_DATA_OFFSET + lane * ETP_FINGER_DATA_LEN;
+            bool in_low = lane < 3;
+            bool in_high = lane >= 3 && lane < ETP_MAX_FINGERS;
+            int low_base = offset - ELAN_BATCH_LOW_LOAD;
+            int high_base = offset - ELAN_BATCH_HIGH_LOAD;
+            // 0x80 zeroes the byte
+            masks.low[field][lane * 2] = in_low ? low_base + low_byte[field] : 0x80;
+            masks.low[field][lane * 2 + 1] = in_low && high_byte[field] >= 0 ? low_base + high_byte[field] : 0x80;
+            masks.high[field][lane * 2] = in_high ? high_base + low_byte[field] : 0x80;
+            masks.high[field][lane * 2 + 1] = in_high && high_byte[field] >= 0 ? high_base + high_byte[field] : 0x80;
+        }
+    }
+    return masks;
+}
+
+static const BatchShuffleMasks& shuffle_masks() {
+    static const BatchShuffleMasks masks = build_shuffle_masks();
+    return masks;
+}
+
+/* Decodes frames @begin up to @count of the buffer */
+__attribute__((target("ssse3")))
+static size_t decode_ssse3(const VoodooI2CELANDecodeContext& context, const uint8_t* frames, size_t begin, size_t count,
+                           BatchReports* reports) {
+    const BatchShuffleMasks& masks = shuffle_masks();
+    __m128i low_masks[kBatchFieldCount], high_masks[kBatchFieldCount];
+    for (int field = 0; field < kBatchFieldCount; field++) {
+        low_masks[field] = _mm_loadu_si128(reinterpret_cast<const __m128i*>(masks.low[field]));
+        high_masks[field] = _mm_loadu_si128(reinterpret_cast<const __m128i*>(masks.high[field]));
+    }
+    const __m128i x_high = _mm_set1_epi16(0x0F00);
+    const __m128i low_byte = _mm_set1_epi16(0x00FF);
+    const __m128i y_bits = _mm_set1_epi16(0x0FFF);
+    const __m128i max_y = _mm_set1_epi16(static_cast<int16_t>(context.logical_max_y));
+    const __m128i pressure_adjustment = _mm_set1_epi16(static_cast<int16_t>(context.pressure_adjustment));
+    const __m128i max_pressure = _mm_set1_epi16(ETP_MAX_PRESSURE);
+
+    size_t valid = 0;
+    uint16_t x[8], y[8], pressure[8], mk[8];
+    for (size_t i = begin; i < count; i++) {
+        const uint8_t* frame = frames + i * ETP_MAX_REPORT_LEN;
+        uint8_t mask = store_header(frame, i, reports);
+        if (reports->status[i] != kVoodooI2CELANReportValid)
+            continue;
+        valid++;
+        if (!mask)
+            continue;
+
+        __m128i low = _mm_loadu_si128(reinterpret_cast<const __m128i*>(frame + ELAN_BATCH_LOW_LOAD));
+        __m128i high = _mm_loadu_si128(reinterpret_cast<const __m128i*>(frame + ELAN_BATCH_HIGH_LOAD));
+        __m128i fields[kBatchFieldCount];
+        for (int field = 0; field < kBatchFieldCount; field++)
+            fields[field] = _mm_or_si128(_mm_shuffle_epi8(low, low_masks[field]), _mm_shuffle_epi8(high, high_masks[field]));
+
+        __m128i vx = _mm_or_si128(_mm_and_si128(_mm_srli_epi16(fields[kBatchFieldX], 4), x_high), _mm_and_si128(fields[kBatchFieldX], low_byte));
+        __m128i vy = _mm_and_si128(fields[kBatchFieldY], y_bits);
+        if (context.invert_y)
+            vy = _mm_sub_epi16(max_y, vy);
+        __m128i vp = _mm_min_epi16(_mm_add_epi16(fields[kBatchFieldPressure], pressure_adjustment), max_pressure);
+
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(x), vx);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(y), vy);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(pressure), vp);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(mk), fields[kBatchFieldMK]);
+        store_contacts(i, mask, x, y, pressure, mk, reports);
+    }
+    return valid;
+}
+
+__attribute__((target("avx2")))
+static size_t decode_avx2(const VoodooI2CELANDecodeContext& context, const uint8_t* frames, size_t count, BatchReports* reports) {
+    const BatchShuffleMasks& masks = shuffle_masks();
+    __m256i low_masks[kBatchFieldCount], high_masks[kBatchFieldCount];
+    for (int field = 0; field < kBatchFieldCount; field++) {
+        // pshufb works within each 128 bit half, so both frames use the same mask
+        low_masks[field] = _mm256_broadcastsi128_si256(_mm_loadu_si128(reinterpret_cast<const __m128i*>(masks.low[field])));
+        high_masks[field] = _mm256_broadcastsi128_si256(_mm_loadu_si128(reinterpret_cast<const __m128i*>(masks.high[field])));
+    }
+    const __m256i x_high = _mm256_set1_epi16(0x0F00);
+    const __m256i low_byte = _mm256_set1_epi16(0x00FF);
+    const __m256i y_bits = _mm256_set1_epi16(0x0FFF);
+    const __m256i max_y = _mm256_set1_epi16(static_cast<int16_t>(context.logical_max_y));
+    const __m256i pressure_adjustment = _mm256_set1_epi16(static_cast<int16_t>(context.pressure_adjustment));
+    const __m256i max_pressure = _mm256_set1_epi16(ETP_MAX_PRESSURE);
+
+    size_t valid = 0;
+    uint16_t x[16], y[16], pressure[16], mk[16];
+    size_t i = 0;
+    for (; i + 1 < count; i += 2) {
+        const uint8_t* first = frames + i * ETP_MAX_REPORT_LEN;
+        const uint8_t* second = first + ETP_MAX_REPORT_LEN;
+        uint8_t first_mask = store_header(first, i, reports);
+        uint8_t second_mask = store_header(second, i + 1, reports);
+        valid += (reports->status[i] == kVoodooI2CELANReportValid) + (reports->status[i + 1] == kVoodooI2CELANReportValid);
+        if (!first_mask && !second_mask)
+            continue;
+
+        __m256i low = _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_loadu_si128(reinterpret_cast<const __m128i*>(first + ELAN_BATCH_LOW_LOAD))),
+                                              _mm_loadu_si128(reinterpret_cast<const __m128i*>(second + ELAN_BATCH_LOW_LOAD)), 1);
+        __m256i high = _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_loadu_si128(reinterpret_cast<const __m128i*>(first + ELAN_BATCH_HIGH_LOAD))),
+                                               _mm_loadu_si128(reinterpret_cast<const __m128i*>(second + ELAN_BATCH_HIGH_LOAD)), 1);
+        __m256i fields[kBatchFieldCount];
+        for (int field = 0; field < kBatchFieldCount; field++)
+            fields[field] = _mm256_or_si256(_mm256_shuffle_epi8(low, low_masks[field]), _mm256_shuffle_epi8(high, high_masks[field]));
+
+        __m256i vx = _mm256_or_si256(_mm256_and_si256(_mm256_srli_epi16(fields[kBatchFieldX], 4), x_high), _mm256_and_si256(fields[kBatchFieldX], low_byte));
+        __m256i vy = _mm256_and_si256(fields[kBatchFieldY], y_bits);
+        if (context.invert_y)
+            vy = _mm256_sub_epi16(max_y, vy);
+        __m256i vp = _mm256_min_epi16(_mm256_add_epi16(fields[kBatchFieldPressure], pressure_adjustment), max_pressure);
+
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(x), vx);
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(y), vy);
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(pressure), vp);
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(mk), fields[kBatchFieldMK]);
+        store_contacts(i, first_mask, x, y, pressure, mk, reports);
+        store_contacts(i + 1, second_mask, x + 8, y + 8, pressure + 8, mk + 8, reports);
+    }
+
+    // an odd frame out, any AVX2 machine has SSSE3
+    if (i < count)
+        valid += decode_ssse3(context, frames, i, count, reports);
+    return valid;
+}
+
+#endif /* ELAN_BATCH_X86 */
+
+size_t decode_ELAN_batch(const VoodooI2CELANDecodeContext& context, const uint8_t* frames, size_t count,
+                         BatchReports* reports, BatchDecodeKernel kernel) {
+    reports->resize(count);
+    switch (kernel) {
+#ifdef ELAN_BATCH_X86
+        case kBatchDecodeSSSE3:
+            return decode_ssse3(context, frames, 0, count, reports);
+        case kBatchDecodeAVX2:
+            return decode_avx2(context, frames, count, reports);
+#endif
+        default:
+            return decode_scalar(context, frames, count, reports);
+    }
+}
@@ -0,0 +1,64 @@
+//
+//  BatchDecoder.hpp
+//  VoodooI2CELAN
+//
+//  Copyright © 2017 Kishor Prins. All rights reserved.
+//
+
+#ifndef VOODOOI2C_ELAN_HOST_BATCH_DECODER_HPP
+#define VOODOOI2C_ELAN_HOST_BATCH_DECODER_HPP
+
+#include <vector>
+
+#include "VoodooI2CELANReportDecoder.hpp"
+
+/* How decode_ELAN_batch() unpacks the finger data */
+enum BatchDecodeKernel {
+    kBatchDecodeScalar = 0,  // decode_ELAN_report() for every frame
+    kBatchDecodeSSSE3,       // one frame per 128 bit register
+    kBatchDecodeAVX2,        // two frames per 256 bit register
+    kBatchDecodeKernelCount
+};
+
+/* Decoded frames as structure of arrays, for offline processing of large traces
+ *
+ * Per frame values are indexed by frame, per contact values by
+ * slot * frames + frame, so all of one slot's X coordinates are contiguous.
+ * Slots without a contact and frames that are not valid reports hold 0.
+ */
+struct BatchReports {
+    void resize(size_t frames);
+
+    size_t frames;
+    std::vector<uint8_t> status;  // VoodooI2CELANReportStatus
+    std::vector<uint8_t> contact_mask;
+    std::vector<uint8_t> button;
+    std::vector<uint8_t> hover;
+    std::vector<uint16_t> x;
+    std::vector<uint16_t> y;
+    std::vector<uint16_t> pressure;
+    std::vector<uint8_t> mk_x;
+    std::vector<uint8_t> mk_y;
+};
+
+/* Tells whether this machine can run a kernel */
+bool batch_decode_kernel_supported(BatchDecodeKernel kernel);
+/* The fastest kernel this machine can run */
+BatchDecodeKernel best_batch_decode_kernel();
+const char* batch_decode_kernel_name(BatchDecodeKernel kernel);
+
+/* Decodes a contiguous buffer of frames
+ * @context the per-device decode constants
+ * @frames @count frames of ETP_MAX_REPORT_LEN bytes each, back to back
+ * @reports receives the decoded frames, resized to @count
+ * @kernel how to decode, must be supported
+ *
+ * Every kernel gives exactly the same results as decode_ELAN_report(), width_x and
+ * width_y are left out as they are just mk_x and mk_y scaled.
+ *
+ * @return the number of valid reports
+ */
+size_t decode_ELAN_batch(const VoodooI2CELANDecodeContext& context, const uint8_t* frames, size_t count,
+                         BatchReports* reports, BatchDecodeKernel kernel);
+
+#endif /* VOODOOI2C_ELAN_HOST_BATCH_DECODER_HPP */
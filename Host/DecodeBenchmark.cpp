@@ -0,0 +1,231 @@
+//
+//  DecodeBenchmark.cpp
+//  VoodooI2CELAN
+//
+//  Copyright © 2017 Kishor Prins. All rights reserved.
+//
+
+// Measures the cost of decode_ELAN_report() on synthetic reports against the
+// kernel select_ELAN_decode_kernel() picks, after checking that every kernel
+// decodes exactly like decode_ELAN_report(), then what the coordinate
+// transform adds on top of it, after checking it against a plain
+// implementation for every rotation and mirroring with an active area and
+// scaling
+//
+// usage: elan_decode_benchmark [reports] [seed]
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+#include "VoodooI2CELANCoordinateTransform.hpp"
+#include "VoodooI2CELANReportDecoder.hpp"
+
+#include "SyntheticReports.hpp"
+
+static const size_t kReportPoolSize = 4096;
+static const int kRounds = 5;
+
+struct DecodeRun {
+    double seconds;
+    uint64_t valid;
+    uint64_t contacts;
+    uint64_t checksum;
+};
+
+/* Decodes @total_reports reports from @pool with @decode, and transforms them if there is a @transform */
+static DecodeRun run(VoodooI2CELANDecodeKernel decode, const VoodooI2CELANDecodeContext& context,
+                     const std::vector<uint8_t>& pool, uint64_t total_reports,
+                     const VoodooI2CELANCoordinateTransform* transform = NULL) {
+    VoodooI2CELANReport report;
+    DecodeRun result = { 0, 0, 0, 0 };
+
+    std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+    for (uint64_t i = 0; i < total_reports; i++) {
+        const uint8_t* data = &pool[(i % kReportPoolSize) * ETP_MAX_REPORT_LEN];
+        if (decode(context, data, &report) != kVoodooI2CELANReportValid)
+            continue;
+        if (transform)
+            transform->apply(&report);
+        result.valid++;
+        result.contacts += report.contact_count;
+        for (int slot = 0; slot < ETP_MAX_FINGERS; slot++) {
+            if (report.contact_mask & (1U << slot))
+                result.checksum += report.contacts[slot].x ^ report.contacts[slot].y ^ report.contacts[slot].pressure;
+        }
+    }
+    std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
+    result.seconds = std::chrono::duration<double>(end - begin).count();
+    return result;
+}
+
+static void print_run(const char* name, const DecodeRun& result, uint64_t total_reports) {
+    printf("%s:\n", name);
+    printf("  reports:      %llu (%llu valid, %llu contacts)\n",
+           static_cast<unsigned long long>(total_reports),
+           static_cast<unsigned long long>(result.valid),
+           static_cast<unsigned long long>(result.contacts));
+    printf("  elapsed:      %.3f s\n", result.seconds);
+    printf("  reports/sec:  %.0f\n", total_reports / result.seconds);
+    printf("  ns/report:    %.2f\n", result.seconds * 1e9 / total_reports);
+    printf("  checksum:     %llx\n", static_cast<unsigned long long>(result.checksum));
+}
+
+static int64_t clamp(int64_t value, int64_t max) {
+    return value < 0 ? 0 : value > max ? max : value;
+}
+
+/* Where @config puts a contact, the obvious way, with the active area @min_x, @min_y to @max_x, @max_y */
+static void reference_transform(const VoodooI2CELANTransformConfig& config, int64_t min_x, int64_t min_y, int64_t max_x, int64_t max_y,
+                                const VoodooI2CELANContact& in, int64_t* out_x, int64_t* out_y) {
+    int64_t width = max_x - min_x, height = max_y - min_y;
+    int64_t u = clamp(in.x - min_x, width), v = clamp(in.y - min_y, height);
+    int64_t x = u, y = v, range_x = width, range_y = height;
+    switch (config.rotation) {
+        case 90: x = v; y = width - u; range_x = height; range_y = width; break;
+        case 180: x = width - u; y = height - v; break;
+        case 270: x = height - v; y = u; range_x = height; range_y = width; break;
+    }
+    if (config.mirror_x)
+        x = range_x - x;
+    if (config.mirror_y)
+        y = range_y - y;
+    int64_t scaled_x = config.scaled_max_x ? config.scaled_max_x : range_x;
+    int64_t scaled_y = config.scaled_max_y ? config.scaled_max_y : range_y;
+    *out_x = (x * scaled_x * 2 + range_x) / (range_x * 2);
+    *out_y = (y * scaled_y * 2 + range_y) / (range_y * 2);
+}
+
+/* Counts the contacts the transform puts somewhere else than the reference does, the fixed point scale may be a count off */
+static uint64_t check_transform(const VoodooI2CELANDecodeContext& context, const std::vector<uint8_t>& pool) {
+    uint64_t mismatches = 0;
+    for (int variant = 0; variant < 32; variant++) {
+        VoodooI2CELANTransformConfig config;
+        memset(&config, 0, sizeof(config));
+        config.rotation = (variant & 3) * 90;
+        config.mirror_x = variant & 4;
+        config.mirror_y = variant & 8;
+        if (variant & 16) {
+            config.active_min_x = 150;
+            config.active_min_y = 100;
+            config.active_max_x = 3050;
+            config.active_max_y = 1900;
+            config.scaled_max_x = 4096;
+            config.scaled_max_y = 3072;
+        }
+        VoodooI2CELANCoordinateTransform transform;
+        if (!transform.configure(config, context.logical_max_x, context.logical_max_y, 1000, 600)) {
+            mismatches++;
+            continue;
+        }
+        int64_t max_x = config.active_max_x ? config.active_max_x : context.logical_max_x;
+        int64_t max_y = config.active_max_y ? config.active_max_y : context.logical_max_y;
+        bool swap = config.rotation == 90 || config.rotation == 270;
+
+        for (size_t i = 0; i < kReportPoolSize; i++) {
+            VoodooI2CELANReport decoded, transformed;
+            if (decode_ELAN_report(context, &pool[i * ETP_MAX_REPORT_LEN], &decoded) != kVoodooI2CELANReportValid)
+                continue;
+            transformed = decoded;
+            transform.apply(&transformed);
+            for (int slot = 0; slot < ETP_MAX_FINGERS; slot++) {
+                if (!(decoded.contact_mask & (1U << slot)))
+                    continue;
+                const VoodooI2CELANContact& in = decoded.contacts[slot];
+                const VoodooI2CELANContact& out = transformed.contacts[slot];
+                int64_t x, y;
+                reference_transform(config, config.active_min_x, config.active_min_y, max_x, max_y, in, &x, &y);
+                if (transform.identity()) {
+                    // left as decoded, even outside the range
+                    x = in.x;
+                    y = in.y;
+                }
+                if (x - out.x > 1 || out.x - x > 1 || y - out.y > 1 || out.y - y > 1 || (!transform.identity() && out.x > transform.logical_max_x) ||
+                    (!transform.identity() && out.y > transform.logical_max_y) || out.pressure != in.pressure || out.mk_x != (swap ? in.mk_y : in.mk_x) ||
+                    out.mk_y != (swap ? in.mk_x : in.mk_y) || out.width_x != (swap ? in.width_y : in.width_x) ||
+                    out.width_y != (swap ? in.width_x : in.width_y))
+                    mismatches++;
+            }
+        }
+    }
+    return mismatches;
+}
+
+int main(int argc, char** argv) {
+    uint64_t total_reports = argc > 1 ? strtoull(argv[1], NULL, 0) : 20000000ULL;
+    uint32_t seed = argc > 2 ? static_cast<uint32_t>(strtoul(argv[2], NULL, 0)) : 0x5D5D5D5D;
+    if (!seed)
+        seed = 1;
+
+    std::vector<uint8_t> pool(kReportPoolSize * ETP_MAX_REPORT_LEN);
+    for (size_t i = 0; i < kReportPoolSize; i++)
+        make_random_report(&seed, &pool[i * ETP_MAX_REPORT_LEN]);
+
+    VoodooI2CELANDecodeContext context;
+    context.logical_max_x = 3200;
+    context.logical_max_y = 2000;
+    context.pressure_adjustment = ETP_PRESSURE_OFFSET;
+    context.width_per_trace_x = 3;
+    context.width_per_trace_y = 3;
+    context.invert_y = true;
+
+    // every kernel has to agree with the generic decoder, bit for bit
+    uint64_t mismatches = 0;
+    const int pressure_adjustments[] = { 0, ETP_PRESSURE_OFFSET, 7 };
+    for (int variant = 0; variant < 12; variant++) {
+        VoodooI2CELANDecodeContext check = context;
+        check.pressure_adjustment = pressure_adjustments[variant / 4];
+        check.invert_y = variant & 2;
+        check.width_per_trace_x = variant & 1 ? 3 : 0;
+        check.width_per_trace_y = variant & 1 ? 4 : 0;
+        VoodooI2CELANDecodeKernel kernel = select_ELAN_decode_kernel(check);
+
+        for (size_t i = 0; i < kReportPoolSize; i++) {
+            const uint8_t* data = &pool[i * ETP_MAX_REPORT_LEN];
+            VoodooI2CELANReport expected, actual;
+            memset(&expected, 0, sizeof(expected));
+            memset(&actual, 0, sizeof(actual));
+            if (decode_ELAN_report(check, data, &expected) != kernel(check, data, &actual) ||
+                memcmp(&expected, &actual, sizeof(expected)))
+                mismatches++;
+        }
+    }
+
+    uint64_t transform_mismatches = check_transform(context, pool);
+    VoodooI2CELANTransformConfig config;
+    memset(&config, 0, sizeof(config));
+    config.rotation = 90;
+    config.mirror_x = true;
+    config.active_max_x = 3100;
+    config.scaled_max_x = 4096;
+    config.scaled_max_y = 4096;
+    VoodooI2CELANCoordinateTransform transform;
+    transform.configure(config, context.logical_max_x, context.logical_max_y, 1000, 600);
+
+    // the best of a few interleaved rounds, so neither decoder gets the quieter machine
+    DecodeRun generic, kernel, transformed;
+    VoodooI2CELANDecodeKernel selected = select_ELAN_decode_kernel(context);
+    for (int round = 0; round < kRounds; round++) {
+        DecodeRun result = run(decode_ELAN_report, context, pool, total_reports / kRounds);
+        if (!round || result.seconds < generic.seconds)
+            generic = result;
+        result = run(selected, context, pool, total_reports / kRounds);
+        if (!round || result.seconds < kernel.seconds)
+            kernel = result;
+        result = run(selected, context, pool, total_reports / kRounds, &transform);
+        if (!round || result.seconds < transformed.seconds)
+            transformed = result;
+    }
+    print_run("generic", generic, total_reports / kRounds);
+    print_run("kernel", kernel, total_reports / kRounds);
+    print_run("kernel + transform", transformed, total_reports / kRounds);
+    printf("speedup:        %.2fx\n", generic.seconds / kernel.seconds);
+    printf("transform:      %.2f ns/report\n", (transformed.seconds - kernel.seconds) * 1e9 / (total_reports / kRounds));
+    printf("bit exact:      %s (%llu mismatches over 12 contexts)\n", mismatches ? "no" : "yes",
+           static_cast<unsigned long long>(mismatches));
+    printf("transform:      %s (%llu contacts off over 32 configurations)\n", transform_mismatches ? "wrong" : "matches",
+           static_cast<unsigned long long>(transform_mismatches));
+    return mismatches || transform_mismatches ? 1 : 0;
+}
@@ -0,0 +1,238 @@
+//
+//  DispatchBenchmark.cpp
+//  VoodooI2CELAN
+//
+//  Copyright © 2017 Kishor Prins. All rights reserved.
+//
+
+// Compares the per report cost of the two ways parse_ELAN_report() has fed
+// decoded contacts to the transducers:
+//
+//   lookup  rebuild the decode context, OSArray::getObject + OSDynamicCast per
+//           slot and a fresh multitouch event for every report
+//   slots   precomputed decode context, a fixed transducer slot table and a
+//           reused event
+//
+// OSArray and OSDynamicCast are stood in for by a bounds checked vector of
+// base class pointers and dynamic_cast, the transducer by a struct with the
+// same update pattern as VoodooI2CDigitiserTransducer.
+//
+// usage: elan_dispatch_benchmark [reports] [seed]
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+#include "VoodooI2CELANReportDecoder.hpp"
+
+#include "SyntheticReports.hpp"
+
+static const size_t kReportPoolSize = 4096;
+
+struct BenchObject {
+    virtual ~BenchObject() {}
+};
+
+struct BenchAxis {
+    uint32_t value;
+    uint32_t last;
+    uint64_t timestamp;
+
+    void update(uint32_t new_value, uint64_t now) {
+        last = value;
+        value = new_value;
+        timestamp = now;
+    }
+};
+
+struct BenchTransducer : BenchObject {
+    int type;
+    bool is_valid;
+    uint32_t logical_max_x;
+    uint32_t logical_max_y;
+    BenchAxis x;
+    BenchAxis y;
+    BenchAxis button;
+    BenchAxis tip_switch;
+    BenchAxis confidence;
+    uint32_t id;
+};
+
+struct BenchArray {
+    std::vector<BenchObject*> objects;
+
+    BenchObject* getObject(size_t index) const {
+        return index < objects.size() ? objects[index] : NULL;
+    }
+};
+
+struct BenchInterface {
+    uint32_t logical_max_x;
+    uint32_t logical_max_y;
+};
+
+struct BenchEvent {
+    uint8_t contact_count;
+    const BenchArray* transducers;
+};
+
+// keeps the optimiser from discarding the dispatched events
+static volatile uint64_t event_sink;
+
+static void dispatch(const BenchEvent& event) {
+    event_sink += event.contact_count + reinterpret_cast<uintptr_t>(event.transducers);
+}
+
+static void update_transducer(BenchTransducer* transducer, const VoodooI2CELANReport& report, int slot,
+                              uint32_t logical_max_x, uint32_t logical_max_y, uint64_t now) {
+    transducer->type = 1;
+    bool valid = report.contact_mask & (1U << slot);
+    transducer->is_valid = valid;
+    if (valid) {
+        const VoodooI2CELANContact& contact = report.contacts[slot];
+        transducer->logical_max_x = logical_max_x;
+        transducer->logical_max_y = logical_max_y;
+        transducer->x.update(contact.x, now);
+        transducer->y.update(contact.y, now);
+        transducer->button.update(report.button, now);
+        if (!transducer->tip_switch.value)
+            transducer->confidence.update(1, now);
+        if (transducer->confidence.value)
+            transducer->confidence.update(contact.pressure < 80 && contact.width_x < 25 && contact.width_y < 25, now);
+        transducer->tip_switch.update(1, now);
+    } else {
+        transducer->x.update(transducer->x.last, now);
+        transducer->y.update(transducer->y.last, now);
+        transducer->button.update(0, now);
+        transducer->tip_switch.update(0, now);
+        transducer->confidence.update(0, now);
+    }
+    transducer->id = slot;
+}
+
+// The per device state parse_ELAN_report() reads from
+struct BenchDevice {
+    BenchInterface* mt_interface;
+    int pressure_adjustment;
+    uint32_t width_per_trace_x;
+    uint32_t width_per_trace_y;
+};
+
+static uint64_t run_lookup(const BenchDevice& device, const BenchArray& transducers,
+                           const std::vector<uint8_t>& pool, uint64_t total_reports) {
+    uint64_t dispatched = 0;
+    for (uint64_t i = 0; i < total_reports; i++) {
+        const uint8_t* data = &pool[(i % kReportPoolSize) * ETP_MAX_REPORT_LEN];
+
+        VoodooI2CELANDecodeContext context;
+        context.logical_max_x = device.mt_interface ? device.mt_interface->logical_max_x : 0;
+        context.logical_max_y = device.mt_interface ? device.mt_interface->logical_max_y : 0;
+        context.pressure_adjustment = device.pressure_adjustment;
+        context.width_per_trace_x = device.width_per_trace_x;
+        context.width_per_trace_y = device.width_per_trace_y;
+        context.invert_y = device.mt_interface != NULL;
+
+        VoodooI2CELANReport report;
+        if (decode_ELAN_report(context, data, &report) != kVoodooI2CELANReportValid)
+            continue;
+
+        for (int slot = 0; slot < ETP_MAX_FINGERS; slot++) {
+            BenchTransducer* transducer = dynamic_cast<BenchTransducer*>(transducers.getObject(slot));
+            if (!transducer)
+                continue;
+            uint32_t logical_max_x = device.mt_interface ? device.mt_interface->logical_max_x : 0;
+            uint32_t logical_max_y = device.mt_interface ? device.mt_interface->logical_max_y : 0;
+            update_transducer(transducer, report, slot, logical_max_x, logical_max_y, i);
+        }
+
+        BenchEvent event;
+        event.contact_count = report.contact_count;
+        event.transducers = &transducers;
+        dispatch(event);
+        dispatched++;
+    }
+    return dispatched;
+}
+
+static uint64_t run_slots(const BenchDevice& device, const BenchArray& transducers,
+                          const std::vector<uint8_t>& pool, uint64_t total_reports) {
+    BenchTransducer* transducer_slots[ETP_MAX_FINGERS];
+    for (int slot = 0; slot < ETP_MAX_FINGERS; slot++)
+        transducer_slots[slot] = dynamic_cast<BenchTransducer*>(transducers.getObject(slot));
+
+    VoodooI2CELANDecodeContext context;
+    context.logical_max_x = device.mt_interface ? device.mt_interface->logical_max_x : 0;
+    context.logical_max_y = device.mt_interface ? device.mt_interface->logical_max_y : 0;
+    context.pressure_adjustment = device.pressure_adjustment;
+    context.width_per_trace_x = device.width_per_trace_x;
+    context.width_per_trace_y = device.width_per_trace_y;
+    context.invert_y = device.mt_interface != NULL;
+
+    VoodooI2CELANReport report;
+    BenchEvent event;
+    event.transducers = &transducers;
+
+    uint64_t dispatched = 0;
+    for (uint64_t i = 0; i < total_reports; i++) {
+        const uint8_t* data = &pool[(i % kReportPoolSize) * ETP_MAX_REPORT_LEN];
+        if (decode_ELAN_report(context, data, &report) != kVoodooI2CELANReportValid)
+            continue;
+
+        for (int slot = 0; slot < ETP_MAX_FINGERS; slot++)
+            update_transducer(transducer_slots[slot], report, slot, context.logical_max_x, context.logical_max_y, i);
+
+        event.contact_count = report.contact_count;
+        dispatch(event);
+        dispatched++;
+    }
+    return dispatched;
+}
+
+typedef uint64_t (*BenchRun)(const BenchDevice&, const BenchArray&, const std::vector<uint8_t>&, uint64_t);
+
+static double measure(BenchRun run, const BenchDevice& device, const BenchArray& transducers,
+                      const std::vector<uint8_t>& pool, uint64_t total_reports, uint64_t* dispatched) {
+    std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+    *dispatched = run(device, transducers, pool, total_reports);
+    std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
+    return std::chrono::duration<double>(end - begin).count() * 1e9 / total_reports;
+}
+
+int main(int argc, char** argv) {
+    uint64_t total_reports = argc > 1 ? strtoull(argv[1], NULL, 0) : 20000000ULL;
+    uint32_t seed = argc > 2 ? static_cast<uint32_t>(strtoul(argv[2], NULL, 0)) : 0x5D5D5D5D;
+    if (!seed)
+        seed = 1;
+    if (!total_reports)
+        total_reports = 1;
+
+    std::vector<uint8_t> pool(kReportPoolSize * ETP_MAX_REPORT_LEN);
+    for (size_t i = 0; i < kReportPoolSize; i++)
+        make_random_report(&seed, &pool[i * ETP_MAX_REPORT_LEN]);
+
+    BenchInterface mt_interface = { 3200, 2000 };
+    BenchDevice device = { &mt_interface, ETP_PRESSURE_OFFSET, 3, 3 };
+
+    BenchArray transducers;
+    for (int slot = 0; slot < ETP_MAX_FINGERS; slot++)
+        transducers.objects.push_back(new BenchTransducer());
+
+    uint64_t dispatched_lookup, dispatched_slots;
+    // warm up both paths once so neither pays for cold caches
+    measure(run_lookup, device, transducers, pool, kReportPoolSize, &dispatched_lookup);
+    measure(run_slots, device, transducers, pool, kReportPoolSize, &dispatched_slots);
+
+    double lookup_ns = measure(run_lookup, device, transducers, pool, total_reports, &dispatched_lookup);
+    double slots_ns = measure(run_slots, device, transducers, pool, total_reports, &dispatched_slots);
+
+    printf("reports:     %llu (%llu dispatched)\n", static_cast<unsigned long long>(total_reports),
+           static_cast<unsigned long long>(dispatched_slots));
+    printf("lookup:      %.2f ns/report\n", lookup_ns);
+    printf("slots:       %.2f ns/report\n", slots_ns);
+    printf("saving:      %.2f ns/report (%.1f%%)\n", lookup_ns - slots_ns, 100.0 * (lookup_ns - slots_ns) / lookup_ns);
+
+    for (size_t i = 0; i < transducers.objects.size(); i++)
+        delete transducers.objects[i];
+    return dispatched_lookup == dispatched_slots ? 0 : 1;
+}
@@ -0,0 +1,125 @@
+//
+//  FirmwareBenchmark.cpp
+//  VoodooI2CELAN
+//
+//  Copyright © 2017 Kishor Prins. All rights reserved.
+//
+
+// Flashes an image into the mock touchpad's simulated boot loader and prints
+// the modelled throughput, with pages checked one at a time as Linux does
+// against several pages in flight, then repeats the update with pages the
+// touchpad fails, bus errors and sleep or a power loss half way through.
+// Every run has to end with the touchpad running the image.
+//
+// usage: elan_firmware_benchmark [seed]
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+#include "ReplayDriver.hpp"
+
+enum Fault {
+    kFaultNone = 0,
+    kFaultPageErrors,   // the touchpad fails every 50th page it programs
+    kFaultBusErrors,    // a few transfers fail, then the touchpad stops answering for a while
+    kFaultSleep,        // system sleep half way through, the touchpad keeps power
+    kFaultPowerLoss     // system sleep half way through, the touchpad loses power
+};
+
+struct Scenario {
+    const char* name;
+    uint32_t page_delay_ms;
+    uint32_t check_interval;
+    Fault fault;
+};
+
+static bool run(const Scenario& scenario, const std::vector<uint8_t>& image) {
+    ReplayDriver driver;
+    if (!driver.start()) {
+        printf("%-28s init failed\n", scenario.name);
+        return false;
+    }
+    driver.firmware_updater.configure(scenario.page_delay_ms, scenario.check_interval);
+    if (scenario.fault == kFaultPageErrors)
+        driver.nub.iap.fail_every = 50;
+
+    uint64_t transfers = driver.nub.reads + driver.nub.writes + driver.nub.write_reads;
+    if (!driver.begin_firmware_update(image.data(), static_cast<uint32_t>(image.size()))) {
+        printf("%-28s refused: %s\n", scenario.name, driver.firmware_updater.last_error);
+        return false;
+    }
+
+    bool faulted = false;
+    while (driver.firmware_step() || driver.firmware_updater.busy()) {
+        if (faulted || driver.nub.iap.pages_programmed < driver.firmware_updater.pages_total() / 2)
+            continue;
+        faulted = true;
+        switch (scenario.fault) {
+            case kFaultBusErrors:
+                driver.nub.inject_failures(2, kIOReturnNotResponding);
+                // retried in place, then enough in a row for the updater to pick up where the touchpad is
+                for (int i = 0; i < 4 && driver.firmware_step(); i++) {
+                }
+                driver.nub.inject_failures(ETP_RETRY_COUNT, kIOReturnNotResponding);
+                break;
+            case kFaultSleep:
+            case kFaultPowerLoss:
+                driver.suspend_device();
+                if (scenario.fault == kFaultPowerLoss)
+                    driver.nub.power_cycle();
+                driver.nub.sleep(5000);
+                driver.resume_firmware_update();
+                break;
+            case kFaultNone:
+            case kFaultPageErrors:
+                break;
+        }
+    }
+
+    const VoodooI2CELANFirmwareUpdater& updater = driver.firmware_updater;
+    transfers = driver.nub.reads + driver.nub.writes + driver.nub.write_reads - transfers;
+    bool flashed = updater.state() == kVoodooI2CELANFirmwareSucceeded && driver.device_info_cached &&
+                   driver.device_info.fw_checksum == updater.image_checksum;
+    size_t offset = updater.layout.first_page * updater.layout.page_size;
+    size_t size = (updater.layout.page_count - updater.layout.first_page) * updater.layout.page_size;
+    flashed = flashed && driver.nub.iap.flash.size() >= offset + size && !memcmp(&driver.nub.iap.flash[offset], &image[offset], size);
+
+    printf("%-28s %-9s %7.0f ms %6.1f pages/s  input off %7.0f ms  %5.2f transfers/page  %4llu retried %llu restarts %llu resumes %llu busy\n",
+           scenario.name, VoodooI2CELANFirmwareUpdater::state_name(updater.state()), updater.total_ns / 1e6,
+           updater.write_ns ? updater.pages_total() * 1e9 / updater.write_ns : 0.0, driver.firmware_input_off_ns / 1e6,
+           static_cast<double>(transfers) / updater.pages_total(), static_cast<unsigned long long>(updater.page_retries),
+           static_cast<unsigned long long>(updater.restarts), static_cast<unsigned long long>(updater.resumes),
+           static_cast<unsigned long long>(driver.nub.iap.busy_rejects));
+    if (!flashed)
+        printf("  the touchpad is not running the image: %s, checksum 0x%04x, expected 0x%04x\n",
+               updater.last_error ? updater.last_error : "flash differs", updater.device_checksum, updater.image_checksum);
+    return flashed;
+}
+
+int main(int argc, char** argv) {
+    uint32_t seed = argc > 1 ? static_cast<uint32_t>(strtoul(argv[1], NULL, 0)) : 1;
+
+    // the IC type and IAP version of the mock's default registers
+    std::vector<uint8_t> image;
+    if (!MockIAPTarget::make_image(0x0D, 0x02, 8192, seed, &image)) {
+        fprintf(stderr, "cannot build an image for the mock touchpad\n");
+        return 1;
+    }
+
+    static const Scenario scenarios[] = {
+        { "check every page", 0, 1, kFaultNone },
+        { "pipelined, check every 8", 0, 8, kFaultNone },
+        { "pipelined, check every 32", 0, 32, kFaultNone },
+        { "pipelined, 31 ms pages", 31, 8, kFaultNone },
+        { "page errors", 0, 8, kFaultPageErrors },
+        { "bus errors", 0, 8, kFaultBusErrors },
+        { "sleep half way", 0, 8, kFaultSleep },
+        { "power loss half way", 0, 8, kFaultPowerLoss },
+    };
+    bool ok = true;
+    for (size_t i = 0; i < sizeof(scenarios) / sizeof(scenarios[0]); i++)
+        ok = run(scenarios[i], image) && ok;
+    return ok ? 0 : 1;
+}
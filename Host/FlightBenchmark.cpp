@@ -0,0 +1,191 @@
+//
+//  FlightBenchmark.cpp
+//  VoodooI2CELAN
+//
+//  Copyright © 2017 Kishor Prins. All rights reserved.
+//
+
+// Measures what VoodooI2CELANFlightRecorder costs the report path and checks
+// what it keeps
+//
+//   record    ns per record_report(), against the same loop without it
+//   contended the same while a second thread records keyboard events, as
+//             message() may in the kext
+//   dump      freezing, copying out every entry and thawing, as an anomaly does
+//
+// and prints the memory the recorder takes, all of it part of the driver
+// object. Each measurement is the best of several interleaved rounds, the
+// reports are a synthetic session decoded up front.
+//
+// usage: elan_flight_benchmark [--frames N] [--rounds N] [--seed N]
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+#include "SyntheticReports.hpp"
+#include "VoodooI2CELANFlightRecorder.hpp"
+
+static uint64_t host_ns() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+struct BenchReports {
+    std::vector<TraceRecord> records;
+    std::vector<VoodooI2CELANReportStatus> statuses;
+};
+
+// what the report path does around record_report(), so the difference is the recorder alone
+static uint64_t run_reports(const BenchReports& reports, VoodooI2CELANFlightRecorder* recorder, uint64_t* checksum) {
+    uint64_t begin = host_ns();
+    for (size_t i = 0; i < reports.records.size(); i++) {
+        const TraceRecord& record = reports.records[i];
+        *checksum += record.frame[ETP_REPORT_ID_OFFSET] + reports.statuses[i];
+        if (recorder && recorder->record_report(record.timestamp_ns, record.frame, reports.statuses[i]) != kVoodooI2CELANFlightAnomalyNone)
+            (*checksum)++;
+    }
+    return host_ns() - begin;
+}
+
+static uint64_t run_dumps(VoodooI2CELANFlightRecorder* recorder, uint32_t dumps, uint64_t* checksum) {
+    VoodooI2CELANFlightEntry entry;
+    uint64_t begin = host_ns();
+    for (uint32_t i = 0; i < dumps; i++) {
+        recorder->freeze(kVoodooI2CELANFlightAnomalyRequested, i);
+        for (uint32_t j = 0; j < recorder->count(); j++) {
+            if (recorder->entry(j, &entry))
+                *checksum += entry.value;
+        }
+        recorder->thaw();
+    }
+    return host_ns() - begin;
+}
+
+// the last entries held have to be the last reports recorded, oldest first
+static bool check_reports(const BenchReports& reports, const VoodooI2CELANFlightRecorder& recorder) {
+    std::vector<size_t> recorded;
+    for (size_t i = 0; i < reports.records.size(); i++) {
+        if (reports.statuses[i] != kVoodooI2CELANReportEmpty)
+            recorded.push_back(i);
+    }
+    uint32_t count = recorder.count();
+    if (count != std::min<size_t>(recorded.size(), ELAN_FLIGHT_RECORDER_DEPTH)) {
+        fprintf(stderr, "recorder holds %u entries, expected %zu\n", count, std::min<size_t>(recorded.size(), ELAN_FLIGHT_RECORDER_DEPTH));
+        return false;
+    }
+    VoodooI2CELANFlightEntry entry;
+    for (uint32_t i = 0; i < count; i++) {
+        const TraceRecord& record = reports.records[recorded[recorded.size() - count + i]];
+        if (!recorder.entry(i, &entry) || entry.event != kVoodooI2CELANFlightReport || entry.timestamp_ns != record.timestamp_ns ||
+            memcmp(entry.data, record.frame, ETP_MAX_REPORT_LEN)) {
+            fprintf(stderr, "entry %u does not match the report recorded there\n", i);
+            return false;
+        }
+    }
+    return true;
+}
+
+// with a second writer, each writer's entries still have to come out in the order it wrote them
+static bool check_interleaved(const VoodooI2CELANFlightRecorder& recorder) {
+    uint64_t last_ns[kVoodooI2CELANFlightEventCount] = { 0 };
+    VoodooI2CELANFlightEntry entry;
+    for (uint32_t i = 0; i < recorder.count(); i++) {
+        if (!recorder.entry(i, &entry))
+            continue;
+        if (entry.timestamp_ns < last_ns[entry.event]) {
+            fprintf(stderr, "%s entries out of order at %u\n", VoodooI2CELANFlightRecorder::event_name(static_cast<VoodooI2CELANFlightEvent>(entry.event)), i);
+            return false;
+        }
+        last_ns[entry.event] = entry.timestamp_ns;
+    }
+    return true;
+}
+
+int main(int argc, char** argv) {
+    size_t frames = 200000;
+    int rounds = 7;
+    uint32_t seed = 0x464C5452;
+
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "--frames") && i + 1 < argc)
+            frames = strtoull(argv[++i], NULL, 0);
+        else if (!strcmp(argv[i], "--rounds") && i + 1 < argc)
+            rounds = std::max(1, atoi(argv[++i]));
+        else if (!strcmp(argv[i], "--seed") && i + 1 < argc)
+            seed = static_cast<uint32_t>(strtoul(argv[++i], NULL, 0));
+        else {
+            fprintf(stderr, "usage: %s [--frames N] [--rounds N] [--seed N]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    BenchReports reports;
+    synthesize_session(seed, frames, 100, 0, &reports.records);
+    if (reports.records.empty()) {
+        fprintf(stderr, "Trace is empty\n");
+        return 1;
+    }
+    VoodooI2CELANDecodeContext context;
+    memset(&context, 0, sizeof(context));
+    context.logical_max_x = 3000;
+    context.logical_max_y = 2000;
+    VoodooI2CELANReport report;
+    for (size_t i = 0; i < reports.records.size(); i++)
+        reports.statuses.push_back(decode_ELAN_report(context, reports.records[i].frame, &report));
+
+    // only the allocation is off the report path, the recorder never allocates
+    VoodooI2CELANFlightRecorder* recorder = new VoodooI2CELANFlightRecorder();
+    uint64_t checksum = 0;
+    uint64_t best_base = UINT64_MAX, best_record = UINT64_MAX, best_contended = UINT64_MAX, best_dump = UINT64_MAX;
+    uint64_t keyboard_entries = 0;
+    const uint32_t dumps = 1000;
+    bool ok = true;
+
+    for (int round = 0; round < rounds; round++) {
+        best_base = std::min(best_base, run_reports(reports, NULL, &checksum));
+
+        recorder->thaw();
+        best_record = std::min(best_record, run_reports(reports, recorder, &checksum));
+        ok = ok && check_reports(reports, *recorder);
+
+        std::atomic<bool> started(false), done(false);
+        std::thread keyboard([&]() {
+            uint32_t code = 0;
+            started.store(true, std::memory_order_release);
+            while (!done.load(std::memory_order_acquire)) {
+                recorder->record(kVoodooI2CELANFlightKeyboard, host_ns(), code & 0x3fff, &code, sizeof(code));
+                code++;
+                keyboard_entries++;
+            }
+        });
+        while (!started.load(std::memory_order_acquire)) {
+        }
+        best_contended = std::min(best_contended, run_reports(reports, recorder, &checksum));
+        done.store(true, std::memory_order_release);
+        keyboard.join();
+        ok = ok && check_interleaved(*recorder);
+
+        best_dump = std::min(best_dump, run_dumps(recorder, dumps, &checksum));
+    }
+
+    size_t count = reports.records.size();
+    double base = static_cast<double>(best_base) / count;
+    printf("reports:    %zu, %llu keyboard entries recorded alongside over %d rounds\n", count,
+           static_cast<unsigned long long>(keyboard_entries), rounds);
+    printf("memory:     %zu bytes, %d entries of %zu bytes, nothing allocated\n", sizeof(VoodooI2CELANFlightRecorder),
+           ELAN_FLIGHT_RECORDER_DEPTH, sizeof(VoodooI2CELANFlightEntry));
+    printf("record:     %6.2f ns/report (%.2f ns over the loop alone)\n", static_cast<double>(best_record) / count,
+           static_cast<double>(best_record) / count - base);
+    printf("contended:  %6.2f ns/report (%.2f ns over the loop alone)\n", static_cast<double>(best_contended) / count,
+           static_cast<double>(best_contended) / count - base);
+    printf("dump:       %6.2f us per freeze, copy out of %u entries and thaw\n", static_cast<double>(best_dump) / dumps / 1000,
+           recorder->count());
+    printf("checks:     %s (checksum %llx)\n", ok ? "passed" : "FAILED", static_cast<unsigned long long>(checksum));
+    delete recorder;
+    return ok ? 0 : 1;
+}
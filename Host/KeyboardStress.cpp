@@ -0,0 +1,165 @@
+//
+//  KeyboardStress.cpp
+//  VoodooI2CELAN
+//
+//  Copyright © 2017 Kishor Prins. All rights reserved.
+//
+
+// Replays a synthetic session through ReplayDriver while a second thread
+// hammers its VoodooI2CELANKeyboardState with key presses and touchpad
+// switches, the way the keyboard driver calls message() in the kext, and
+// checks that
+//
+//   the quiet deadline seen by the report path never moves backwards
+//   the state left behind is the newest key press and the last switch
+//
+// Key presses are stamped with the replay's current trace time, give or take
+// a few milliseconds, so they do make reports quiet. Build with
+// -fsanitize=thread to have the handoff checked for data races as well.
+//
+// usage: elan_keyboard_stress [--frames N] [--seed N] [--key-interval-us N] [--toggle N]
+//
+//   --key-interval-us  time between key presses, 0 presses as fast as possible
+//   --toggle           switch the touchpad off or back on every N key presses, 0 never does
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+#include "ReplayDriver.hpp"
+#include "SyntheticReports.hpp"
+
+static uint64_t host_ns() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static void spin_until(uint64_t deadline_ns) {
+    while (host_ns() < deadline_ns) {
+    }
+}
+
+struct KeyboardResult {
+    KeyboardResult() : presses(0), toggles(0), latest_until(0), enabled(true) {}
+
+    uint64_t presses;
+    uint64_t toggles;
+    // what the state has to hold once the keyboard is done
+    uint64_t latest_until;
+    bool enabled;
+};
+
+int main(int argc, char** argv) {
+    size_t frames = 1000000;
+    uint32_t seed = 0x4B4B4B4B;
+    uint32_t key_interval_us = 0;
+    uint32_t toggle = 64;
+
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "--frames") && i + 1 < argc)
+            frames = strtoull(argv[++i], NULL, 0);
+        else if (!strcmp(argv[i], "--seed") && i + 1 < argc)
+            seed = static_cast<uint32_t>(strtoul(argv[++i], NULL, 0));
+        else if (!strcmp(argv[i], "--key-interval-us") && i + 1 < argc)
+            key_interval_us = static_cast<uint32_t>(strtoul(argv[++i], NULL, 0));
+        else if (!strcmp(argv[i], "--toggle") && i + 1 < argc)
+            toggle = static_cast<uint32_t>(strtoul(argv[++i], NULL, 0));
+        else {
+            fprintf(stderr, "usage: %s [--frames N] [--seed N] [--key-interval-us N] [--toggle N]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    std::vector<TraceRecord> records;
+    synthesize_session(seed, frames, 100, 0, &records);
+    if (records.empty()) {
+        fprintf(stderr, "Trace is empty\n");
+        return 1;
+    }
+
+    ReplayDriver* driver = new ReplayDriver();
+    if (!driver->start()) {
+        fprintf(stderr, "Failed to init device during %s step: %s\n",
+                VoodooI2CELANProtocol::init_step_name(driver->init_sequencer.step()), driver->protocol.last_error);
+        return 1;
+    }
+    const uint64_t quiet_ns = ELAN_QUIET_TIME_AFTER_TYPING * 1000000ULL;
+
+    std::atomic<uint64_t> trace_now_ns(records.front().timestamp_ns);
+    std::atomic<bool> replay_done(false);
+    KeyboardResult keys;
+
+    std::thread keyboard([&]() {
+        uint32_t state = seed ? seed : 1;
+        uint64_t next_ns = host_ns();
+        while (!replay_done.load(std::memory_order_acquire)) {
+            if (key_interval_us) {
+                next_ns += key_interval_us * 1000ULL;
+                spin_until(next_ns);
+            }
+            // xorshift, the keyboard does not need the session's generator
+            state ^= state << 13;
+            state ^= state >> 17;
+            state ^= state << 5;
+
+            // some presses arrive late, older than one already seen
+            uint64_t key_ns = trace_now_ns.load(std::memory_order_relaxed) + (state % 10) * 1000000ULL;
+            key_ns = key_ns > 5000000ULL ? key_ns - 5000000ULL : 0;
+            driver->keyboard.key_pressed(key_ns);
+            if (key_ns + quiet_ns > keys.latest_until)
+                keys.latest_until = key_ns + quiet_ns;
+            keys.presses++;
+
+            if (toggle && keys.presses % toggle == 0) {
+                keys.enabled = !keys.enabled;
+                driver->keyboard.set_enabled(keys.enabled);
+                keys.toggles++;
+            }
+        }
+    });
+
+    uint64_t last_until = 0;
+    uint64_t backwards = 0;
+    uint64_t begin = host_ns();
+    for (size_t i = 0; i < records.size(); i++) {
+        const TraceRecord& record = records[i];
+        trace_now_ns.store(record.timestamp_ns, std::memory_order_relaxed);
+
+        if (record.type == kTraceRecordReadError)
+            driver->nub.inject_failures(1, record.status);
+        else
+            driver->nub.queue_report(record.frame);
+        driver->interrupt_occurred(record.timestamp_ns, 1);
+
+        uint64_t until = driver->keyboard.snapshot() & ~ELAN_KEYBOARD_DISABLED;
+        if (until < last_until)
+            backwards++;
+        last_until = until;
+    }
+    uint64_t replayed_ns = host_ns() - begin;
+    replay_done.store(true, std::memory_order_release);
+    keyboard.join();
+
+    uint64_t final_state = driver->keyboard.snapshot();
+    bool state_ok = (final_state & ~ELAN_KEYBOARD_DISABLED) == keys.latest_until &&
+                    VoodooI2CELANKeyboardState::ignored(final_state) == !keys.enabled;
+
+    const ReplayStats& stats = driver->stats;
+    printf("replay:       %zu records, %.0f reports/sec\n", records.size(), records.size() / (replayed_ns / 1e9));
+    printf("keyboard:     %llu key presses, %llu switches, %.0f messages/sec\n",
+           static_cast<unsigned long long>(keys.presses), static_cast<unsigned long long>(keys.toggles),
+           (keys.presses + keys.toggles) / (replayed_ns / 1e9));
+    printf("reports:      %llu valid, %llu ignored while switched off, %llu quiet after typing, %llu frames dispatched\n",
+           static_cast<unsigned long long>(stats.valid_reports), static_cast<unsigned long long>(stats.ignored_reports),
+           static_cast<unsigned long long>(stats.quiet_reports), static_cast<unsigned long long>(stats.dispatched));
+    printf("integrity:    %llu times the deadline moved backwards, final state %s\n",
+           static_cast<unsigned long long>(backwards), state_ok ? "matches" : "does not match");
+
+    bool ok = !backwards && state_ok;
+    delete driver;
+    printf("%s\n", ok ? "PASS" : "FAIL");
+    return ok ? 0 : 1;
+}
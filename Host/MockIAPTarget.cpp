@@ -0,0 +1,176 @@
+//
+//  MockIAPTarget.cpp
+//  VoodooI2CELAN
+//
+//  Copyright © 2017 Kishor Prins. All rights reserved.
+//
+
+#include "MockIAPTarget.hpp"
+
+#include <cstring>
+
+#include "VoodooI2CELANFirmwareUpdater.hpp"
+
+MockIAPTarget::MockIAPTarget() :
+    program_ns(30000000),
+    fail_every(0),
+    main_mode(true),
+    firmware_valid(true),
+    key_armed(false),
+    page_size(ETP_FW_PAGE_SIZE),
+    next_page(0),
+    iap_checksum(0),
+    errors(0),
+    pages_programmed(0),
+    page_errors(0),
+    busy_rejects(0),
+    flashes(0),
+    boot_size(0),
+    busy_until_ns(0),
+    programs(0) {
+}
+
+void MockIAPTarget::configure(uint32_t flash_size, uint32_t boot_size) {
+    flash.assign(flash_size, 0xff);
+    this->boot_size = boot_size;
+}
+
+bool MockIAPTarget::make_image(uint8_t ic_type, uint8_t iap_version, uint32_t boot_size, uint32_t seed, std::vector<uint8_t>* image) {
+    VoodooI2CELANFirmwareLayout layout;
+    if (!VoodooI2CELANFirmwareUpdater::page_layout(ic_type, iap_version, &layout))
+        return false;
+
+    // code for most of the flash, erased (0xff) after it, the signature at the very end
+    uint32_t size = layout.signature_offset + ETP_FW_SIGNATURE_SIZE;
+    image->assign(size, 0xff);
+    uint32_t state = seed ? seed : 1;
+    for (uint32_t i = 0; i < size * 3 / 4; i++) {
+        state ^= state << 13;
+        state ^= state >> 17;
+        state ^= state << 5;
+        (*image)[i] = static_cast<uint8_t>(state);
+    }
+    uint16_t iap_start = boot_size / 2;
+    (*image)[ETP_IAP_START_ADDR * 2] = iap_start & 0xff;
+    (*image)[ETP_IAP_START_ADDR * 2 + 1] = iap_start >> 8;
+    static const uint8_t signature[ETP_FW_SIGNATURE_SIZE] = { 0xAA, 0x55, 0xCC, 0x33, 0xFF, 0xFF };
+    memcpy(&(*image)[layout.signature_offset], signature, sizeof(signature));
+    return true;
+}
+
+bool MockIAPTarget::write_page(const uint8_t* values, uint16_t length, uint64_t now_ns) {
+    if (length <= 4 || values[0] != ETP_I2C_IAP_REG_L || values[1] != ETP_I2C_IAP_REG_H)
+        return false;
+
+    if (main_mode || !key_armed || length != page_size + 4 || next_page >= page_count()) {
+        errors |= ETP_FW_IAP_INTF_ERR;
+        return true;
+    }
+    // nothing is taken after a failed page until the error has been read
+    if (errors) {
+        errors |= ETP_FW_IAP_INTF_ERR;
+        return true;
+    }
+    if (now_ns < busy_until_ns) {
+        errors |= ETP_FW_IAP_INTF_ERR;
+        busy_rejects++;
+        return true;
+    }
+
+    const uint8_t* page = values + 2;
+    uint16_t checksum = values[page_size + 2] | (values[page_size + 3] << 8);
+    busy_until_ns = now_ns + program_ns;
+    if (checksum != VoodooI2CELANFirmwareUpdater::page_checksum(page, page_size) || (fail_every && ++programs % fail_every == 0)) {
+        errors |= ETP_FW_IAP_PAGE_ERR;
+        page_errors++;
+        return true;
+    }
+
+    memcpy(&flash[next_page * page_size], page, page_size);
+    next_page++;
+    iap_checksum += checksum;
+    pages_programmed++;
+    return true;
+}
+
+bool MockIAPTarget::write_command(uint16_t reg, uint16_t cmd) {
+    switch (reg) {
+        case ETP_I2C_IAP_CMD:
+            if (cmd != ETP_I2C_IAP_PASSWORD)
+                return true;
+            if (main_mode) {
+                // the boot loader takes over, the main firmware is gone until every page has been written
+                main_mode = false;
+                firmware_valid = false;
+                key_armed = false;
+                return true;
+            }
+            key_armed = true;
+            next_page = first_page();
+            iap_checksum = 0;
+            return true;
+        case ETP_I2C_IAP_RESET_CMD:
+            if (cmd == ETP_I2C_IAP_RESET && !main_mode) {
+                key_armed = false;
+                next_page = first_page();
+                iap_checksum = 0;
+                errors = 0;
+            }
+            return true;
+        case ETP_I2C_IAP_TYPE_CMD:
+            if (!main_mode && (cmd * 2 == ETP_FW_PAGE_SIZE || cmd * 2 == ETP_FW_PAGE_SIZE_128 || cmd * 2 == ETP_FW_PAGE_SIZE_512))
+                page_size = cmd * 2;
+            return true;
+        case ETP_I2C_IAP_CTRL_CMD:
+        case ETP_I2C_IAP_CHECKSUM_CMD:
+            return true;
+    }
+    return false;
+}
+
+bool MockIAPTarget::read_register(uint16_t reg, uint8_t* values, uint16_t length) {
+    uint16_t value;
+    switch (reg) {
+        case ETP_I2C_IAP_CTRL_CMD:
+            value = (main_mode ? ETP_I2C_MAIN_MODE_ON : 0) | errors;
+            errors = 0;
+            break;
+        case ETP_I2C_IAP_CMD:
+            value = key_armed ? ETP_I2C_IAP_PASSWORD : 0;
+            break;
+        case ETP_I2C_IAP_CHECKSUM_CMD:
+            value = iap_checksum;
+            break;
+        case ETP_I2C_IAP_TYPE_CMD:
+            value = page_size / 2;
+            break;
+        default:
+            return false;
+    }
+    memset(values, 0, length);
+    if (length > 0)
+        values[0] = value & 0xff;
+    if (length > 1)
+        values[1] = value >> 8;
+    return true;
+}
+
+bool MockIAPTarget::reset() {
+    bool flashed = !main_mode && key_armed && next_page == page_count();
+    if (flashed) {
+        firmware_valid = true;
+        flashes++;
+    }
+    main_mode = firmware_valid;
+    key_armed = false;
+    errors = 0;
+    busy_until_ns = 0;
+    return flashed;
+}
+
+uint16_t MockIAPTarget::firmware_checksum() const {
+    uint16_t checksum = 0;
+    for (uint32_t offset = boot_size; offset + ETP_FW_PAGE_SIZE <= flash.size(); offset += ETP_FW_PAGE_SIZE)
+        checksum += VoodooI2CELANFirmwareUpdater::page_checksum(&flash[offset], ETP_FW_PAGE_SIZE);
+    return checksum;
+}
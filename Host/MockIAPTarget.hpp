@@ -0,0 +1,103 @@
+//
+//  MockIAPTarget.hpp
+//  VoodooI2CELAN
+//
+//  Copyright © 2017 Kishor Prins. All rights reserved.
+//
+
+#ifndef VOODOOI2C_ELAN_HOST_MOCK_IAP_TARGET_HPP
+#define VOODOOI2C_ELAN_HOST_MOCK_IAP_TARGET_HPP
+
+#include <stdint.h>
+#include <vector>
+
+#include "VoodooI2CELANPortability.hpp"
+#include "VoodooI2CElanConstants.h"
+
+/* The in application programming side of the mock ELAN device
+ *
+ * The first flash key switches the device from its main firmware to IAP mode,
+ * which invalidates the main firmware, the second unlocks the flash and
+ * starts writing at the first page after the boot loader. Pages are taken in
+ * order, each has to carry the sum of its words and arrive once the previous
+ * one has been programmed, a page that does not is flagged in the control
+ * register and dropped. The flags stay set until the control register is
+ * read, and no page is taken while they are. A reset or power cycle boots the main firmware again once every page
+ * has been written, the device stays in IAP mode otherwise.
+ */
+
+class MockIAPTarget {
+ public:
+    MockIAPTarget();
+
+    /* Sets the flash up for a device
+     * @flash_size the size of the flash in bytes, the image size Linux expects for the IC type
+     * @boot_size the bytes of boot loader at the start of the flash, which are never written
+     */
+    void configure(uint32_t flash_size, uint32_t boot_size);
+    /* Builds an image that fits the device
+     * @ic_type @iap_version the device, see VoodooI2CELANFirmwareUpdater::page_layout()
+     * @boot_size the bytes of boot loader, as in configure()
+     * @seed varies the contents
+     * @image receives the image
+     *
+     * @return false if the IC type is unknown
+     */
+    static bool make_image(uint8_t ic_type, uint8_t iap_version, uint32_t boot_size, uint32_t seed, std::vector<uint8_t>* image);
+
+    /* Takes a page write
+     * @now_ns the mock's virtual time
+     *
+     * @return false if the transfer is not a page write
+     */
+    bool write_page(const uint8_t* values, uint16_t length, uint64_t now_ns);
+    /* Takes a command written to an IAP register
+     *
+     * @return false if @reg is not an IAP register
+     */
+    bool write_command(uint16_t reg, uint16_t cmd);
+    /* Serves a read of an IAP register
+     *
+     * @return false if @reg is not an IAP register
+     */
+    bool read_register(uint16_t reg, uint8_t* values, uint16_t length);
+    /* Resets the device, or models it losing power
+     *
+     * @return true if this booted the main firmware just written
+     */
+    bool reset();
+
+    /* The sum of the words of the main firmware, what its checksum register reports */
+    uint16_t firmware_checksum() const;
+
+    /* Time it takes to program a page */
+    uint64_t program_ns;
+    /* Fail every Nth page programmed, 0 never does */
+    unsigned fail_every;
+
+    bool main_mode;
+    bool firmware_valid;
+    bool key_armed;
+    uint16_t page_size;
+    uint32_t next_page;
+    uint16_t iap_checksum;
+    uint16_t errors;
+    std::vector<uint8_t> flash;
+
+    /* Counters since construction */
+    uint64_t pages_programmed;
+    uint64_t page_errors;
+    // pages that came in while the previous one was still being programmed
+    uint64_t busy_rejects;
+    unsigned flashes;
+
+ private:
+    uint32_t boot_size;
+    uint64_t busy_until_ns;
+    uint64_t programs;
+
+    uint32_t first_page() const { return boot_size / page_size; }
+    uint32_t page_count() const { return static_cast<uint32_t>(flash.size() / page_size); }
+};
+
+#endif /* VOODOOI2C_ELAN_HOST_MOCK_IAP_TARGET_HPP */
@@ -0,0 +1,257 @@
+//
+//  MockNub.cpp
+//  VoodooI2CELAN
+//
+//  Copyright © 2017 Kishor Prins. All rights reserved.
+//
+
+#include "MockNub.hpp"
+
+#include <chrono>
+#include <cstring>
+
+MockNub::MockNub() :
+    timing_mode(kMockNubTimingVirtual),
+    awake(false),
+    powered(true),
+    absolute_mode(false),
+    wedge(kMockNubWedgeNone),
+    resets(0),
+    calibration_mode(false),
+    nominal_min_baseline(1850),
+    nominal_max_baseline(2150),
+    baseline_drift(0),
+    calibration_checks(3),
+    calibrations(0),
+    reads(0),
+    writes(0),
+    write_reads(0),
+    bus_ns(0),
+    sleep_ns(0),
+    virtual_ns(0),
+    reset_ack_pending(false),
+    failures_pending(0),
+    calibration_checks_left(0),
+    failure_status(kIOReturnSuccess) {
+    load_default_registers();
+    // the flash of the IC type above, with an 8KB boot loader
+    iap.configure(896 * ETP_FW_PAGE_SIZE, 8192);
+}
+
+void MockNub::load_default_registers() {
+    registers.clear();
+
+    set_register16(ETP_I2C_UNIQUEID_CMD, 0x003E);
+    set_register16(ETP_I2C_FW_VERSION_CMD, 0x0003);
+    // IC type is the high byte of the SM version
+    set_register16(ETP_I2C_SM_VERSION_CMD, 0x0D01);
+    set_register16(ETP_I2C_FW_CHECKSUM_CMD, 0x1234);
+    set_register16(ETP_I2C_IAP_VERSION_CMD, 0x0002);
+    set_register16(ETP_I2C_PRESSURE_CMD, 0x0010);
+    set_register16(ETP_I2C_MAX_X_AXIS_CMD, 3056);
+    set_register16(ETP_I2C_MAX_Y_AXIS_CMD, 1740);
+    set_register16(ETP_I2C_XY_TRACENUM_CMD, (15 << 8) | 27);
+    set_register16(ETP_I2C_RESOLUTION_CMD, 0x0303);
+    set_register16(ETP_I2C_POWER_CMD, 0x0000);
+
+    uint8_t descriptor[ETP_I2C_REPORT_DESC_LENGTH];
+    for (size_t i = 0; i < sizeof(descriptor); i++)
+        descriptor[i] = static_cast<uint8_t>(i * 7 + 1);
+    set_register(ETP_I2C_DESC_CMD, descriptor, ETP_I2C_DESC_LENGTH);
+    set_register(ETP_I2C_REPORT_DESC_CMD, descriptor, ETP_I2C_REPORT_DESC_LENGTH);
+}
+
+void MockNub::set_register(uint16_t reg, const uint8_t* data, size_t length) {
+    registers[reg].assign(data, data + length);
+}
+
+void MockNub::set_register16(uint16_t reg, uint16_t value) {
+    uint8_t data[2] = { static_cast<uint8_t>(value & 0xff), static_cast<uint8_t>(value >> 8) };
+    set_register(reg, data, sizeof(data));
+}
+
+void MockNub::queue_report(const uint8_t* report) {
+    reports.push_back(std::vector<uint8_t>(report, report + ETP_MAX_REPORT_LEN));
+}
+
+void MockNub::power_cycle() {
+    awake = false;
+    powered = true;
+    set_register16(ETP_I2C_POWER_CMD, 0x0000);
+    absolute_mode = false;
+    calibration_mode = false;
+    calibration_checks_left = 0;
+    wedge = kMockNubWedgeNone;
+    reset_ack_pending = false;
+    reports.clear();
+    if (iap.reset())
+        set_register16(ETP_I2C_FW_CHECKSUM_CMD, iap.firmware_checksum());
+}
+
+void MockNub::inject_failures(unsigned count, IOReturn error) {
+    failures_pending = count;
+    failure_status = error;
+}
+
+bool MockNub::take_failure(IOReturn* status) {
+    if (!failures_pending)
+        return false;
+    failures_pending--;
+    *status = failure_status;
+    return true;
+}
+
+void MockNub::account_transfer(size_t bytes) {
+    uint64_t ns = timing.transfer_overhead_ns + static_cast<uint64_t>(bytes) * timing.ns_per_byte;
+    virtual_ns += ns;
+    bus_ns += ns;
+
+    if (timing_mode == kMockNubTimingSpin) {
+        std::chrono::steady_clock::time_point until = std::chrono::steady_clock::now() + std::chrono::nanoseconds(ns);
+        while (std::chrono::steady_clock::now() < until) {
+        }
+    }
+}
+
+IOReturn MockNub::readI2C(uint8_t* values, uint16_t length) {
+    reads++;
+    account_transfer(length);
+
+    IOReturn status;
+    if (take_failure(&status))
+        return status;
+
+    memset(values, 0, length);
+
+    if (reset_ack_pending && length == ETP_I2C_INF_LENGTH) {
+        // the reset acknowledgement is two zero bytes
+        reset_ack_pending = false;
+        return kIOReturnSuccess;
+    }
+
+    if (wedge != kMockNubWedgeNone && length == ETP_MAX_REPORT_LEN) {
+        if (!reports.empty())
+            reports.pop_front();
+        if (wedge == kMockNubWedgeErrors)
+            return kIOReturnNotResponding;
+        return kIOReturnSuccess;
+    }
+
+    // with no report pending the device returns an empty (zero length) report, the boot loader never reports
+    if (!awake || !powered || !absolute_mode || !iap.main_mode || reports.empty())
+        return kIOReturnSuccess;
+
+    const std::vector<uint8_t>& report = reports.front();
+    memcpy(values, report.data(), length < report.size() ? length : report.size());
+    reports.pop_front();
+    return kIOReturnSuccess;
+}
+
+IOReturn MockNub::writeI2C(uint8_t* values, uint16_t length) {
+    writes++;
+    account_transfer(length);
+
+    IOReturn status;
+    if (take_failure(&status))
+        return status;
+
+    if (iap.write_page(values, length, virtual_ns))
+        return kIOReturnSuccess;
+    if (length < 4)
+        return kIOReturnBadArgument;
+
+    uint16_t reg = values[0] | (values[1] << 8);
+    uint16_t cmd = values[2] | (values[3] << 8);
+    command_log.push_back(std::make_pair(reg, cmd));
+    if (iap.write_command(reg, cmd))
+        return kIOReturnSuccess;
+
+    if (reg == ETP_I2C_STAND_CMD) {
+        switch (cmd) {
+            case ETP_I2C_RESET:
+                resets++;
+                awake = true;
+                wedge = kMockNubWedgeNone;
+                absolute_mode = false;
+                calibration_mode = false;
+                calibration_checks_left = 0;
+                reset_ack_pending = true;
+                reports.clear();
+                if (iap.reset())
+                    set_register16(ETP_I2C_FW_CHECKSUM_CMD, iap.firmware_checksum());
+                break;
+            case ETP_I2C_WAKE_UP:
+                awake = true;
+                break;
+            case ETP_I2C_SLEEP:
+                awake = false;
+                break;
+        }
+    } else if (reg == ETP_I2C_SET_CMD) {
+        absolute_mode = cmd & ETP_ENABLE_ABS;
+        calibration_mode = cmd & ETP_ENABLE_CALIBRATE;
+        wedge = kMockNubWedgeNone;
+    } else if (reg == ETP_I2C_POWER_CMD) {
+        powered = !(cmd & ETP_DISABLE_POWER);
+        set_register16(reg, cmd);
+    } else if (reg == ETP_I2C_CALIBRATE_CMD && calibration_mode) {
+        calibration_checks_left = calibration_checks ? calibration_checks : 1;
+    }
+    return kIOReturnSuccess;
+}
+
+IOReturn MockNub::writeReadI2C(uint8_t* write_buffer, uint16_t write_length, uint8_t* read_buffer, uint16_t read_length) {
+    write_reads++;
+    account_transfer(write_length + read_length);
+
+    IOReturn status;
+    if (take_failure(&status))
+        return status;
+
+    // the calibration result is read with only the low byte of its register, as an SMBus block:
+    // the byte count, then the data, of which the first byte is the result
+    if (write_length == 1 && write_buffer[0] == (ETP_I2C_CALIBRATE_CMD & 0xff) && read_length) {
+        if (calibration_checks_left && !--calibration_checks_left) {
+            baseline_drift = 0;
+            calibrations++;
+        }
+        memset(read_buffer, 0, read_length);
+        read_buffer[0] = 1;
+        if (read_length > 1)
+            read_buffer[1] = calibration_checks_left ? 1 : 0;
+        return kIOReturnSuccess;
+    }
+    if (write_length < 2)
+        return kIOReturnBadArgument;
+
+    uint16_t reg = write_buffer[0] | (write_buffer[1] << 8);
+    if (iap.read_register(reg, read_buffer, read_length))
+        return kIOReturnSuccess;
+    if (reg == ETP_I2C_MAX_BASELINE_CMD || reg == ETP_I2C_MIN_BASELINE_CMD) {
+        // outside calibration mode there is nothing meaningful to read
+        int32_t value = 0;
+        if (calibration_mode)
+            value = reg == ETP_I2C_MAX_BASELINE_CMD ? nominal_max_baseline + static_cast<int32_t>(baseline_drift)
+                                                     : nominal_min_baseline - static_cast<int32_t>(baseline_drift);
+        value = value < 0 ? 0 : (value > 0xffff ? 0xffff : value);
+        memset(read_buffer, 0, read_length);
+        if (read_length > 0)
+            read_buffer[0] = value & 0xff;
+        if (read_length > 1)
+            read_buffer[1] = value >> 8;
+        return kIOReturnSuccess;
+    }
+    std::map<uint16_t, std::vector<uint8_t>>::const_iterator it = registers.find(reg);
+    if (it == registers.end())
+        return kIOReturnNotFound;
+
+    memset(read_buffer, 0, read_length);
+    memcpy(read_buffer, it->second.data(), read_length < it->second.size() ? read_length : it->second.size());
+    return kIOReturnSuccess;
+}
+
+void MockNub::sleep(uint32_t ms) {
+    // sleeps are only ever modelled, nobody wants to wait for them on the host
+    virtual_ns += static_cast<uint64_t>(ms) * 1000000ULL;
+    sleep_ns += static_cast<uint64_t>(ms) * 1000000ULL;
+}
@@ -0,0 +1,131 @@
+//
+//  MockNub.hpp
+//  VoodooI2CELAN
+//
+//  Copyright © 2017 Kishor Prins. All rights reserved.
+//
+
+#ifndef VOODOOI2C_ELAN_HOST_MOCK_NUB_HPP
+#define VOODOOI2C_ELAN_HOST_MOCK_NUB_HPP
+
+#include <deque>
+#include <map>
+#include <vector>
+
+#include "MockIAPTarget.hpp"
+#include "VoodooI2CELANBus.hpp"
+#include "VoodooI2CElanConstants.h"
+
+/* How the mock accounts for the time a real I2C transfer would take */
+enum MockNubTimingMode {
+    kMockNubTimingVirtual = 0,  // only advance the mock's virtual clock
+    kMockNubTimingSpin          // also busy-wait so wall clock latency is realistic
+};
+
+/* How a wedged controller misbehaves until it is programmed again */
+enum MockNubWedge {
+    kMockNubWedgeNone = 0,
+    kMockNubWedgeErrors,    // every report read fails
+    kMockNubWedgeSilent     // reports are lost, reads find nothing pending
+};
+
+/* Bus timing model, defaults match a 400kHz fast mode bus */
+struct MockNubTiming {
+    uint32_t transfer_overhead_ns;
+    uint32_t ns_per_byte;
+
+    MockNubTiming() : transfer_overhead_ns(30000), ns_per_byte(22500) {}
+};
+
+/* Stands in for VoodooI2CDeviceNub + an ELAN touchpad
+ *
+ * Register reads are served from a table that defaults to a plausible ELAN
+ * device, reports are served from a FIFO that the replay tools fill from a
+ * trace. Every transfer advances a virtual clock according to the timing
+ * model so init and resume costs can be measured without hardware. Firmware
+ * updates go to the IAP target, which is set up to match the IC type of the
+ * default registers.
+ */
+
+class MockNub : public VoodooI2CELANBus {
+ public:
+    MockNub();
+
+    IOReturn readI2C(uint8_t* values, uint16_t length) override;
+    IOReturn writeI2C(uint8_t* values, uint16_t length) override;
+    IOReturn writeReadI2C(uint8_t* write_buffer, uint16_t write_length, uint8_t* read_buffer, uint16_t read_length) override;
+    void sleep(uint32_t ms) override;
+
+    /* Fills the register table with the responses of a typical ELAN0651 */
+    void load_default_registers();
+    /* Sets the bytes returned when @reg is read */
+    void set_register(uint16_t reg, const uint8_t* data, size_t length);
+    /* Sets a 2 byte little endian register */
+    void set_register16(uint16_t reg, uint16_t value);
+
+    /* Queues a report to be returned by the next report sized readI2C() */
+    void queue_report(const uint8_t* report);
+    size_t pending_reports() const { return reports.size(); }
+    void clear_reports() { reports.clear(); }
+
+    /* Models the device losing power across system sleep, all state set by commands is lost */
+    void power_cycle();
+
+    /* Makes the next @count transfers fail with @error */
+    void inject_failures(unsigned count, IOReturn error);
+    /* Wedges the controller's report path, a reset or setting the mode again clears it */
+    void wedge_controller(MockNubWedge mode) { wedge = mode; }
+    /* Has the sensor baselines drift @counts further away from nominal, until the next calibration */
+    void drift_baselines(uint32_t counts) { baseline_drift += counts; }
+
+    MockNubTimingMode timing_mode;
+    MockNubTiming timing;
+
+    /* Virtual time spent on the bus and sleeping since construction */
+    uint64_t now_ns() const { return virtual_ns; }
+    void advance(uint64_t ns) { virtual_ns += ns; }
+
+    /* Device state as driven by the commands written to it */
+    bool awake;
+    bool powered;
+    bool absolute_mode;
+    MockNubWedge wedge;
+    unsigned resets;
+    bool calibration_mode;
+    /* The baselines read in calibration mode are nominal_min_baseline - baseline_drift
+     * and nominal_max_baseline + baseline_drift
+     */
+    uint16_t nominal_min_baseline;
+    uint16_t nominal_max_baseline;
+    uint32_t baseline_drift;
+    /* Result checks a calibration takes to finish, and the calibrations finished */
+    unsigned calibration_checks;
+    unsigned calibrations;
+
+    /* Transfer counters */
+    uint64_t reads;
+    uint64_t writes;
+    uint64_t write_reads;
+    uint64_t bus_ns;
+    uint64_t sleep_ns;
+
+    /* The flash and boot loader of the device */
+    MockIAPTarget iap;
+
+    /* Every (register, command) pair written, in order */
+    std::vector<std::pair<uint16_t, uint16_t>> command_log;
+
+ private:
+    std::map<uint16_t, std::vector<uint8_t>> registers;
+    std::deque<std::vector<uint8_t>> reports;
+    uint64_t virtual_ns;
+    bool reset_ack_pending;
+    unsigned failures_pending;
+    unsigned calibration_checks_left;
+    IOReturn failure_status;
+
+    bool take_failure(IOReturn* status);
+    void account_transfer(size_t bytes);
+};
+
+#endif /* VOODOOI2C_ELAN_HOST_MOCK_NUB_HPP */
@@ -0,0 +1,148 @@
+//
+//  RawStreamReader.cpp
+//  VoodooI2CELAN
+//
+//  Copyright © 2017 Kishor Prins. All rights reserved.
+//
+
+#include "RawStreamReader.hpp"
+
+#include <cstring>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+bool RawStreamReader::open(const void* memory, size_t length, bool from_oldest) {
+    header = NULL;
+    error = NULL;
+    lost = 0;
+    read_entries = 0;
+
+    if (length < sizeof(VoodooI2CELANRawStreamHeader)) {
+        error = "too short for the header";
+        return false;
+    }
+    // only waiting is ever written through this
+    VoodooI2CELANRawStreamHeader* layout = static_cast<VoodooI2CELANRawStreamHeader*>(const_cast<void*>(memory));
+    if (__atomic_load_n(&layout->magic, __ATOMIC_ACQUIRE) != ELAN_RAW_STREAM_MAGIC) {
+        error = "not a raw report stream";
+        return false;
+    }
+    if (layout->version != ELAN_RAW_STREAM_VERSION) {
+        error = "unsupported version";
+        return false;
+    }
+    // newer producers may grow the header and the entries, the fields read here stay where they are
+    if (layout->header_size < sizeof(VoodooI2CELANRawStreamHeader) || layout->entry_size < sizeof(VoodooI2CELANRawStreamEntry) ||
+        !layout->capacity || (layout->capacity & (layout->capacity - 1))) {
+        error = "malformed header";
+        return false;
+    }
+    if (layout->header_size + static_cast<size_t>(layout->capacity) * layout->entry_size > length) {
+        error = "entries run past the mapping";
+        return false;
+    }
+
+    header = layout;
+    entries = static_cast<const uint8_t*>(memory) + layout->header_size;
+    capacity = layout->capacity;
+    entry_size = layout->entry_size;
+    uint64_t head = __atomic_load_n(&header->head, __ATOMIC_ACQUIRE);
+    next = head;
+    if (from_oldest)
+        next = head > capacity ? head - capacity : 0;
+    return true;
+}
+
+RawStreamRead RawStreamReader::read(VoodooI2CELANRawStreamEntry* entry) {
+    if (!header)
+        return kRawStreamClosed;
+
+    for (;;) {
+        // look at the flags first, an entry published before the stream closed is still read
+        bool closed = __atomic_load_n(&header->flags, __ATOMIC_ACQUIRE) & ELAN_RAW_STREAM_CLOSED;
+        uint64_t head = __atomic_load_n(&header->head, __ATOMIC_ACQUIRE);
+        if (next >= head)
+            return closed ? kRawStreamClosed : kRawStreamEmpty;
+        if (head - next > capacity) {
+            lost += head - next - capacity;
+            next = head - capacity;
+        }
+
+        const VoodooI2CELANRawStreamEntry* slot = reinterpret_cast<const VoodooI2CELANRawStreamEntry*>(entries + (next % capacity) * entry_size);
+        uint64_t before = __atomic_load_n(&slot->sequence, __ATOMIC_ACQUIRE);
+        memcpy(entry, slot, sizeof(*entry));
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        uint64_t after = __atomic_load_n(&slot->sequence, __ATOMIC_RELAXED);
+        if (before == next + 1 && after == before) {
+            entry->sequence = before;
+            next++;
+            read_entries++;
+            return kRawStreamEntry;
+        }
+        // head is only published after the entry, so a sequence other than next + 1 means the
+        // producer lapped us, skip to the oldest entry it is not about to overwrite
+        head = __atomic_load_n(&header->head, __ATOMIC_ACQUIRE);
+        uint64_t resume = head >= capacity ? head - capacity + 1 : 0;
+        if (resume <= next)
+            resume = next + 1;
+        lost += resume - next;
+        next = resume;
+    }
+}
+
+bool RawStreamReader::prepare_wait() {
+    if (!header)
+        return false;
+    __atomic_store_n(&header->waiting, 1, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&header->head, __ATOMIC_SEQ_CST) == next)
+        return true;
+    __atomic_store_n(&header->waiting, 0, __ATOMIC_RELAXED);
+    return false;
+}
+
+uint64_t RawStreamReader::backlog() const {
+    if (!header)
+        return 0;
+    return __atomic_load_n(&header->head, __ATOMIC_ACQUIRE) - next;
+}
+
+bool RawStreamReader::closed() const {
+    return !header || (__atomic_load_n(&header->flags, __ATOMIC_ACQUIRE) & ELAN_RAW_STREAM_CLOSED);
+}
+
+void* create_raw_stream_file(const char* path, uint32_t capacity, size_t* length) {
+    int fd = ::open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+        return NULL;
+
+    *length = VoodooI2CELANRawStream::memory_size(capacity);
+    void* memory = MAP_FAILED;
+    if (!ftruncate(fd, static_cast<off_t>(*length)))
+        memory = mmap(NULL, *length, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    return memory == MAP_FAILED ? NULL : memory;
+}
+
+void* map_raw_stream_file(const char* path, size_t* length) {
+    int fd = ::open(path, O_RDWR);
+    if (fd < 0)
+        return NULL;
+
+    struct stat info;
+    void* memory = MAP_FAILED;
+    if (!fstat(fd, &info) && info.st_size > 0) {
+        *length = static_cast<size_t>(info.st_size);
+        // read and write, the reader sets the waiting flag
+        memory = mmap(NULL, *length, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    }
+    close(fd);
+    return memory == MAP_FAILED ? NULL : memory;
+}
+
+void unmap_raw_stream_file(void* memory, size_t length) {
+    if (memory)
+        munmap(memory, length);
+}
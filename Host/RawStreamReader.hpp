@@ -0,0 +1,89 @@
+//
+//  RawStreamReader.hpp
+//  VoodooI2CELAN
+//
+//  Copyright © 2017 Kishor Prins. All rights reserved.
+//
+
+#ifndef VOODOOI2C_ELAN_HOST_RAW_STREAM_READER_HPP
+#define VOODOOI2C_ELAN_HOST_RAW_STREAM_READER_HPP
+
+#include <cstddef>
+
+#include "VoodooI2CELANRawStream.hpp"
+
+/* Reader side of the raw report stream, see VoodooI2CELANRawStream.hpp for the layout
+ *
+ * Works on any mapping of the stream: the driver's memory mapped through its
+ * user client on macOS, or a file shared with elan_replay --stream anywhere.
+ * Readers only ever write the waiting flag, so any number of them can follow
+ * the same stream, but only one of them can be notified.
+ */
+
+enum RawStreamRead {
+    kRawStreamEntry = 0,  // an entry was copied out
+    kRawStreamEmpty,      // nothing new has been published
+    kRawStreamClosed      // nothing new has been published and the producer has gone away
+};
+
+class RawStreamReader {
+ public:
+    RawStreamReader() : lost(0), read_entries(0), error(NULL), header(NULL), entries(NULL), capacity(0), entry_size(0), next(0) {}
+
+    /* Checks the layout of a mapped stream
+     * @memory @length the mapping
+     * @from_oldest start at the oldest entry still in the ring instead of the next one published
+     *
+     * @return false if the memory does not hold a stream this reader understands, error says why
+     */
+    bool open(const void* memory, size_t length, bool from_oldest);
+
+    /* Copies out the next entry, skipping over any the producer overwrote first
+     * @entry receives the entry
+     *
+     * @return kRawStreamEntry if @entry was filled in
+     */
+    RawStreamRead read(VoodooI2CELANRawStreamEntry* entry);
+
+    /* Asks the producer to notify this reader once it publishes the next entry
+     *
+     * @return false if an entry was published meanwhile, the reader must not wait then
+     */
+    bool prepare_wait();
+
+    /* Entries published since this reader last caught up */
+    uint64_t backlog() const;
+    /* Tells whether the producer has gone away */
+    bool closed() const;
+
+    // entries overwritten before they could be read
+    uint64_t lost;
+    uint64_t read_entries;
+    const char* error;
+
+ private:
+    VoodooI2CELANRawStreamHeader* header;
+    const uint8_t* entries;
+    uint32_t capacity;
+    uint32_t entry_size;
+    uint64_t next;
+};
+
+/* Creates a file holding an empty stream for @capacity entries and maps it shared
+ * @path the file, e.g. in /dev/shm
+ * @length receives the length of the mapping
+ *
+ * @return the mapping, NULL on failure
+ */
+void* create_raw_stream_file(const char* path, uint32_t capacity, size_t* length);
+/* Maps an existing stream file shared, for reading
+ * @path the file
+ * @length receives the length of the mapping
+ *
+ * @return the mapping, NULL on failure
+ */
+void* map_raw_stream_file(const char* path, size_t* length);
+/* Unmaps a mapping returned by create_raw_stream_file() or map_raw_stream_file() */
+void unmap_raw_stream_file(void* memory, size_t length);
+
+#endif /* VOODOOI2C_ELAN_HOST_RAW_STREAM_READER_HPP */
@@ -0,0 +1,462 @@
+//
+//  Replay.cpp
+//  VoodooI2CELAN
+//
+//  Copyright © 2017 Kishor Prins. All rights reserved.
+//
+
+// Replays a recorded (or synthesized) report stream through the driver's
+// protocol and decode code on top of MockNub
+//
+// usage: elan_replay [--speed N] [--frames N] [--rate HZ] [--seed N] [--hover N] [--spin-bus] [--init-failures N]
+//                    [--backlog N] [--corrupt N] [--wedge N] [--contact-filter DEADBAND,SPEED] [--predict MS]
+//                    [--idle TIMEOUT_MS,PROBE_MS,WINDOW_MS] [--poll ACTIVE_MS,IDLE_MS,DELAY_MS] [--stream PATH]
+//                    [--baseline INTERVAL_MS,THRESHOLD,DRIFT_PER_MIN[,QUIET_MS]] [--flight-dump] [trace]
+//
+//   --speed     replay speed relative to the recording, 0 replays as fast as possible (default)
+//   --frames    number of frames to synthesize when no trace is given
+//   --hover     synthesize N hover reports before every touch, for a device that reports hover
+//   --spin-bus  busy-wait for the modelled I2C transfer time so latencies include it
+//   --init-failures  fail the first N transfers of the init sequence to exercise its retries
+//   --backlog   deliver N reports per interrupt, as when the work loop falls behind
+//   --corrupt   turn every Nth report into an invalid report, a short report or a failed read
+//   --wedge     wedge the controller every N reports, reads fail or, while touched, the reports stop
+//   --contact-filter  deadband and smoothing speed in hundredths of a mm, off by default like in the kext
+//   --predict   extrapolate contacts MS ahead and check the predictions against the trace
+//   --idle      put the device to sleep after TIMEOUT_MS without reports, probing every PROBE_MS
+//   --poll      instead of interrupts, poll on the trace's timeline and compare the
+//               adaptive scheduler against polling at a fixed ACTIVE_MS
+//   --stream    publish every report read to a raw report stream in the file at PATH, for elan_stream
+//   --baseline  sample the baselines every INTERVAL_MS once nothing has been reported for QUIET_MS,
+//               recalibrating past a drift of THRESHOLD, while the mock's baselines drift by
+//               DRIFT_PER_MIN counts per minute of the trace
+//   --flight-dump  print the flight recorder as it was at the last anomaly
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <thread>
+#include <vector>
+
+#include "RawStreamReader.hpp"
+#include "ReplayDriver.hpp"
+#include "SyntheticReports.hpp"
+#include "Trace.hpp"
+
+typedef std::chrono::steady_clock replay_clock;
+
+static uint64_t percentile(const std::vector<uint64_t>& sorted, double p) {
+    if (sorted.empty())
+        return 0;
+    size_t index = static_cast<size_t>(p * (sorted.size() - 1) + 0.5);
+    return sorted[index];
+}
+
+// Polls the device on the recording's timeline, as simulateInterrupt() would
+static void print_intervals(const char* name, const VoodooI2CELANReportIntervalStats& intervals) {
+    printf("%-16s %llu intervals, mean %u us (%.2f Hz), min %u us, max %u us, stddev %u us, jitter %u us\n", name,
+           static_cast<unsigned long long>(intervals.samples()), intervals.mean_us(), intervals.rate_mhz() / 1000.0,
+           intervals.min_us, intervals.max_us, intervals.stddev_us(), intervals.jitter_us);
+}
+
+static void print_flight_dump(const ReplayDriver& driver) {
+    const std::vector<VoodooI2CELANFlightEntry>& entries = driver.flight_dump;
+    if (entries.empty())
+        return;
+    uint64_t frozen_ns = driver.flight_recorder.last_freeze_ns;
+    printf("flight dump:     %zu entries before %s at %.3f s\n", entries.size(),
+           VoodooI2CELANFlightRecorder::anomaly_name(driver.flight_recorder.last_anomaly), frozen_ns / 1e9);
+    for (size_t i = 0; i < entries.size(); i++) {
+        const VoodooI2CELANFlightEntry& entry = entries[i];
+        VoodooI2CELANFlightEvent event = static_cast<VoodooI2CELANFlightEvent>(entry.event);
+        printf("  %10.3f ms %-9s ", -((frozen_ns - entry.timestamp_ns) / 1e6), VoodooI2CELANFlightRecorder::event_name(event));
+        if (event == kVoodooI2CELANFlightReset)
+            printf("%s", VoodooI2CELANFlightRecorder::reset_name(static_cast<VoodooI2CELANFlightResetKind>(entry.value)));
+        else if (event == kVoodooI2CELANFlightAnomaly)
+            printf("%s", VoodooI2CELANFlightRecorder::anomaly_name(static_cast<VoodooI2CELANFlightAnomaly>(entry.value)));
+        else
+            printf("0x%x", entry.value);
+        if (entry.length)
+            printf(" ");
+        for (int j = 0; j < entry.length; j++)
+            printf("%02x", entry.data[j]);
+        printf("\n");
+    }
+}
+
+static bool replay_polled(const char* name, const std::vector<TraceRecord>& records,
+                          uint32_t active_us, uint32_t idle_us, uint32_t idle_delay_ms) {
+    ReplayDriver driver;
+    if (!driver.start()) {
+        fprintf(stderr, "Failed to init device: %s\n", driver.protocol.last_error);
+        return false;
+    }
+    driver.poll_scheduler.configure(active_us, idle_us, idle_delay_ms);
+
+    uint64_t now = records.front().timestamp_ns;
+    driver.poll_scheduler.reset(now);
+
+    std::deque<uint64_t> pending;
+    std::vector<uint64_t> latencies;
+    latencies.reserve(records.size());
+    uint64_t bus_ns_before = driver.nub.bus_ns;
+
+    size_t next = 0;
+    while (next < records.size() || !pending.empty()) {
+        for (; next < records.size() && records[next].timestamp_ns <= now; next++) {
+            if (records[next].type == kTraceRecordReadError) {
+                driver.nub.inject_failures(1, records[next].status);
+            } else {
+                driver.nub.queue_report(records[next].frame);
+                pending.push_back(records[next].timestamp_ns);
+            }
+        }
+
+        size_t queued = driver.nub.pending_reports();
+        uint32_t interval_us = driver.poll(now);
+        if (driver.nub.pending_reports() < queued) {
+            latencies.push_back(now - pending.front());
+            pending.pop_front();
+        }
+        now += interval_us * 1000ULL;
+    }
+
+    double seconds = (now - records.front().timestamp_ns) / 1e9;
+    const VoodooI2CELANPollScheduler& scheduler = driver.poll_scheduler;
+    std::sort(latencies.begin(), latencies.end());
+    printf("%-9s %9llu polls %7.1f/s  %5.1f%% empty  bus %5.2f%%  report latency p50 %.2f ms p99 %.2f ms\n", name,
+           static_cast<unsigned long long>(scheduler.polls), scheduler.polls / seconds,
+           scheduler.polls ? 100.0 * scheduler.empty_polls / scheduler.polls : 0.0,
+           (driver.nub.bus_ns - bus_ns_before) / 1e7 / seconds,
+           percentile(latencies, 0.50) / 1e6, percentile(latencies, 0.99) / 1e6);
+    print_intervals("  report interval", driver.report_intervals);
+    return true;
+}
+
+int main(int argc, char** argv) {
+    double speed = 0;
+    size_t frames = 100000;
+    uint32_t rate = 100;
+    uint32_t seed = 0x5D5D5D5D;
+    uint32_t hover_frames = 0;
+    bool spin_bus = false;
+    unsigned init_failures = 0;
+    bool poll = false;
+    size_t backlog = 1;
+    size_t corrupt = 0;
+    size_t wedge = 0;
+    bool idle = false;
+    uint32_t contact_deadband = ELAN_CONTACT_DEADBAND;
+    uint32_t contact_smoothing_speed = ELAN_CONTACT_SMOOTHING_SPEED;
+    uint32_t prediction_horizon = ELAN_PREDICTION_HORIZON;
+    uint32_t idle_timeout_ms = 0, idle_probe_ms = 0, idle_window_ms = 0;
+    uint32_t poll_active_ms = 5, poll_idle_ms = 100, poll_idle_delay_ms = 1000;
+    const char* trace_path = NULL;
+    const char* stream_path = NULL;
+    bool flight_dump = false;
+    bool baseline = false;
+    uint32_t baseline_interval_ms = ELAN_BASELINE_INTERVAL, baseline_threshold = ELAN_BASELINE_DRIFT_THRESHOLD;
+    uint32_t baseline_quiet_ms = ELAN_BASELINE_QUIET_TIME;
+    double baseline_drift_per_min = 0;
+
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "--speed") && i + 1 < argc)
+            speed = atof(argv[++i]);
+        else if (!strcmp(argv[i], "--frames") && i + 1 < argc)
+            frames = strtoull(argv[++i], NULL, 0);
+        else if (!strcmp(argv[i], "--rate") && i + 1 < argc)
+            rate = static_cast<uint32_t>(strtoul(argv[++i], NULL, 0));
+        else if (!strcmp(argv[i], "--seed") && i + 1 < argc)
+            seed = static_cast<uint32_t>(strtoul(argv[++i], NULL, 0));
+        else if (!strcmp(argv[i], "--hover") && i + 1 < argc)
+            hover_frames = static_cast<uint32_t>(strtoul(argv[++i], NULL, 0));
+        else if (!strcmp(argv[i], "--spin-bus"))
+            spin_bus = true;
+        else if (!strcmp(argv[i], "--corrupt") && i + 1 < argc)
+            corrupt = strtoull(argv[++i], NULL, 0);
+        else if (!strcmp(argv[i], "--wedge") && i + 1 < argc)
+            wedge = strtoull(argv[++i], NULL, 0);
+        else if (!strcmp(argv[i], "--backlog") && i + 1 < argc)
+            backlog = std::max<size_t>(1, strtoull(argv[++i], NULL, 0));
+        else if (!strcmp(argv[i], "--contact-filter") && i + 1 < argc)
+            sscanf(argv[++i], "%u,%u", &contact_deadband, &contact_smoothing_speed);
+        else if (!strcmp(argv[i], "--predict") && i + 1 < argc)
+            prediction_horizon = static_cast<uint32_t>(strtoul(argv[++i], NULL, 0));
+        else if (!strcmp(argv[i], "--idle") && i + 1 < argc) {
+            idle = true;
+            sscanf(argv[++i], "%u,%u,%u", &idle_timeout_ms, &idle_probe_ms, &idle_window_ms);
+        } else if (!strcmp(argv[i], "--poll") && i + 1 < argc) {
+            poll = true;
+            sscanf(argv[++i], "%u,%u,%u", &poll_active_ms, &poll_idle_ms, &poll_idle_delay_ms);
+        } else if (!strcmp(argv[i], "--stream") && i + 1 < argc)
+            stream_path = argv[++i];
+        else if (!strcmp(argv[i], "--baseline") && i + 1 < argc) {
+            baseline = true;
+            sscanf(argv[++i], "%u,%u,%lf,%u", &baseline_interval_ms, &baseline_threshold, &baseline_drift_per_min, &baseline_quiet_ms);
+        } else if (!strcmp(argv[i], "--flight-dump"))
+            flight_dump = true;
+        else if (!strcmp(argv[i], "--init-failures") && i + 1 < argc)
+            init_failures = static_cast<unsigned>(strtoul(argv[++i], NULL, 0));
+        else if (argv[i][0] != '-')
+            trace_path = argv[i];
+        else {
+            fprintf(stderr, "usage: %s [--speed N] [--frames N] [--rate HZ] [--seed N] [--hover N] [--spin-bus] [--init-failures N] [--backlog N] [--corrupt N] [--wedge N] [--contact-filter DEADBAND,SPEED] [--predict MS] [--idle TIMEOUT_MS,PROBE_MS,WINDOW_MS] [--poll ACTIVE_MS,IDLE_MS,DELAY_MS] [--stream PATH] [--baseline INTERVAL_MS,THRESHOLD,DRIFT_PER_MIN[,QUIET_MS]] [--flight-dump] [trace]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    std::vector<TraceRecord> records;
+    if (trace_path) {
+        if (!load_trace(trace_path, &records)) {
+            fprintf(stderr, "Could not read trace %s\n", trace_path);
+            return 1;
+        }
+    } else {
+        synthesize_session(seed, frames, rate, hover_frames, &records);
+    }
+    if (records.empty()) {
+        fprintf(stderr, "Trace is empty\n");
+        return 1;
+    }
+    for (size_t i = corrupt; corrupt && i < records.size(); i += corrupt) {
+        TraceRecord& record = records[i];
+        switch ((i / corrupt) % 3) {
+            case 0:
+                record.type = kTraceRecordReadError;
+                record.status = kIOReturnNotResponding;
+                break;
+            case 1:
+                record.frame[ETP_REPORT_ID_OFFSET] = 0x5E;
+                break;
+            case 2:
+                record.frame[0] = ETP_MAX_REPORT_LEN / 2;
+                break;
+        }
+    }
+
+    if (poll) {
+        bool ok = replay_polled("fixed", records, poll_active_ms * 1000, poll_active_ms * 1000, 0) &&
+                  replay_polled("adaptive", records, poll_active_ms * 1000, poll_idle_ms * 1000, poll_idle_delay_ms);
+        return ok ? 0 : 1;
+    }
+
+    ReplayDriver driver;
+    driver.nub.inject_failures(init_failures, kIOReturnNotResponding);
+    if (!driver.start()) {
+        fprintf(stderr, "Failed to init device during %s step: %s\n",
+                VoodooI2CELANProtocol::init_step_name(driver.init_sequencer.step()), driver.protocol.last_error);
+        return 1;
+    }
+    if (spin_bus)
+        driver.nub.timing_mode = kMockNubTimingSpin;
+    driver.configure_contact_filter(contact_deadband, contact_smoothing_speed, prediction_horizon);
+
+    size_t stream_length = 0;
+    void* stream_memory = NULL;
+    if (stream_path) {
+        stream_memory = create_raw_stream_file(stream_path, ELAN_RAW_STREAM_DEPTH, &stream_length);
+        if (!stream_memory || !driver.raw_stream.attach(stream_memory, stream_length)) {
+            fprintf(stderr, "Could not create stream %s\n", stream_path);
+            return 1;
+        }
+    }
+
+    std::vector<uint64_t> latencies;
+    latencies.reserve(records.size());
+
+    uint64_t bus_ns_before = driver.nub.bus_ns;
+    uint64_t first_ns = records.front().timestamp_ns;
+    if (idle) {
+        driver.idle_monitor.configure(idle_timeout_ms, idle_probe_ms, idle_window_ms);
+        driver.start_idle(first_ns);
+    }
+    // the drift the mock has accumulated, and how long it stayed past the threshold unnoticed
+    double baseline_drift = 0;
+    uint64_t drifted_ns = 0;
+    uint32_t peak_drift = 0;
+    if (baseline) {
+        driver.baseline_monitor.configure(baseline_interval_ms, baseline_threshold, baseline_quiet_ms);
+        driver.start_baseline(first_ns);
+    }
+    replay_clock::time_point begin = replay_clock::now();
+
+    for (size_t i = 0; i < records.size(); i += backlog) {
+        const TraceRecord& record = records[i];
+        if (speed > 0) {
+            replay_clock::time_point due = begin + std::chrono::nanoseconds(static_cast<uint64_t>((record.timestamp_ns - first_ns) / speed));
+            std::this_thread::sleep_until(due);
+        }
+
+        if (baseline && i) {
+            uint64_t elapsed_ns = record.timestamp_ns - records[i - backlog].timestamp_ns;
+            baseline_drift += baseline_drift_per_min * elapsed_ns / 60e9;
+            driver.nub.drift_baselines(static_cast<uint32_t>(baseline_drift));
+            baseline_drift -= static_cast<uint32_t>(baseline_drift);
+            if (baseline_threshold && driver.nub.baseline_drift > baseline_threshold)
+                drifted_ns += elapsed_ns;
+            peak_drift = std::max(peak_drift, driver.nub.baseline_drift);
+        }
+        driver.run_idle_until(record.timestamp_ns);
+        driver.run_watchdog_until(record.timestamp_ns);
+        driver.run_baseline_until(record.timestamp_ns);
+        if (wedge && i && i % wedge < backlog) {
+            VoodooI2CELANReport report;
+            bool touched = decode_ELAN_report(driver.context, record.frame, &report) == kVoodooI2CELANReportValid && report.contact_mask;
+            driver.nub.wedge_controller(touched ? kMockNubWedgeSilent : kMockNubWedgeErrors);
+        }
+
+        // the device raises its interrupt once the report is ready, with a backlog
+        // the work loop only gets to run after several of them
+        size_t count = std::min(backlog, records.size() - i);
+        for (size_t j = i; j < i + count; j++) {
+            if (records[j].type == kTraceRecordReadError)
+                driver.nub.inject_failures(1, records[j].status);
+            else
+                driver.nub.queue_report(records[j].frame);
+        }
+
+        replay_clock::time_point interrupt = replay_clock::now();
+        driver.interrupt_occurred(record.timestamp_ns, static_cast<int>(count));
+        latencies.push_back(std::chrono::duration_cast<std::chrono::nanoseconds>(replay_clock::now() - interrupt).count());
+    }
+    // whatever the drain budget left behind is picked up by the next interrupts
+    while (driver.nub.pending_reports())
+        driver.interrupt_occurred(records.back().timestamp_ns, static_cast<int>(driver.nub.pending_reports()));
+
+    double seconds = std::chrono::duration<double>(replay_clock::now() - begin).count();
+    // readers following the stream stop once they have caught up
+    driver.raw_stream.detach();
+    unmap_raw_stream_file(stream_memory, stream_length);
+    double recorded = (records.back().timestamp_ns - first_ns) / 1e9;
+    std::sort(latencies.begin(), latencies.end());
+
+    const ReplayStats& stats = driver.stats;
+    printf("device:          prod 0x%02x ic 0x%02x max %ux%u, init %.1f ms (modelled)\n",
+           driver.device_info.product_id, driver.device_info.ic_type,
+           driver.device_info.max_report_x, driver.device_info.max_report_y, driver.init_ns / 1e6);
+    printf("init steps (ms):");
+    for (int i = 0; i < kVoodooI2CELANInitStepCount; i++) {
+        const VoodooI2CELANInitStepTiming& timing = driver.init_sequencer.timings[i];
+        if (timing.attempts)
+            printf(" %s %.2f%s", VoodooI2CELANProtocol::init_step_name(static_cast<VoodooI2CELANInitStep>(i)),
+                   timing.duration_ns / 1e6, timing.attempts > 1 ? "*" : "");
+    }
+    printf("\n");
+    printf("records:         %zu over %.2f s recorded, replayed in %.3f s\n", records.size(), recorded, seconds);
+    const VoodooI2CELANErrorLog& errors = driver.error_log;
+    printf("reports:         %llu valid, %llu filler, %llu invalid, %llu short, %llu read errors\n",
+           static_cast<unsigned long long>(stats.valid_reports),
+           static_cast<unsigned long long>(errors.counts[kVoodooI2CELANErrorFillerReport]),
+           static_cast<unsigned long long>(errors.counts[kVoodooI2CELANErrorInvalidReport]),
+           static_cast<unsigned long long>(errors.counts[kVoodooI2CELANErrorShortRead]),
+           static_cast<unsigned long long>(errors.counts[kVoodooI2CELANErrorReadFailed]));
+    printf("error log:       %llu messages logged, %llu summaries\n",
+           static_cast<unsigned long long>(errors.logged), static_cast<unsigned long long>(stats.error_summaries));
+    printf("contacts:        %llu, %llu frames dispatched\n",
+           static_cast<unsigned long long>(stats.contacts), static_cast<unsigned long long>(stats.dispatched));
+    printf("drain:           %llu reports over %llu interrupts, at most %u per interrupt, %llu frames coalesced\n",
+           static_cast<unsigned long long>(stats.drained), static_cast<unsigned long long>(stats.drain_interrupts),
+           stats.max_drained, static_cast<unsigned long long>(stats.coalesced));
+    printf("frame ring:      %llu frames dropped, %llu pushes found it full, high water %u of %u\n",
+           static_cast<unsigned long long>(driver.frame_ring.dropped), static_cast<unsigned long long>(driver.frame_ring.full),
+           driver.frame_ring.high_water, driver.frame_ring.depth());
+    printf("hover:           %llu hover only reports kept from the dispatch side, %llu proximity changes\n",
+           static_cast<unsigned long long>(driver.stats.hover_reports),
+           static_cast<unsigned long long>(driver.stats.proximity_changes));
+    printf("frame filter:    %llu frames suppressed, %llu of %llu slot updates skipped\n",
+           static_cast<unsigned long long>(driver.frame_filter.suppressed_frames),
+           static_cast<unsigned long long>(driver.frame_filter.skipped_slots),
+           static_cast<unsigned long long>(driver.frame_filter.frames * ETP_MAX_FINGERS));
+    const VoodooI2CELANContactFilter& contact_filter = driver.contact_filter;
+    if (contact_filter.enabled()) {
+        printf("contact filter:  %llu of %llu contact samples held, %llu frames dispatched against %llu unfiltered (%.1f%% fewer)\n",
+               static_cast<unsigned long long>(contact_filter.held_samples), static_cast<unsigned long long>(contact_filter.samples),
+               static_cast<unsigned long long>(stats.dispatched), static_cast<unsigned long long>(stats.unfiltered_dispatched),
+               stats.unfiltered_dispatched ? 100.0 * (stats.unfiltered_dispatched - stats.dispatched) / stats.unfiltered_dispatched : 0.0);
+        printf("filter lag (ms): mean %.2f p50 <= %.2f p99 <= %.2f max %.2f, over %llu moving samples\n",
+               contact_filter.lag.mean() / 1e6, contact_filter.lag.percentile(500) / 1e6,
+               contact_filter.lag.percentile(990) / 1e6, contact_filter.lag.max() / 1e6,
+               static_cast<unsigned long long>(contact_filter.lag.samples()));
+    }
+    const VoodooI2CELANMotionPredictor& predictor = driver.motion_predictor;
+    if (predictor.enabled() && predictor.evaluated) {
+        // not predicting trails the finger by the whole horizon, the error left over is what remains of it
+        double predicted = static_cast<double>(predictor.predicted_error) / predictor.evaluated;
+        double unpredicted = static_cast<double>(predictor.unpredicted_error) / predictor.evaluated;
+        printf("prediction:      %u ms ahead, %llu predictions, %llu checked, mean error %.2f counts against %.2f without, about %.2f ms gained\n",
+               prediction_horizon, static_cast<unsigned long long>(predictor.predictions),
+               static_cast<unsigned long long>(predictor.evaluated), predicted, unpredicted,
+               unpredicted > 0 ? prediction_horizon * (1.0 - predicted / unpredicted) : 0.0);
+    }
+    printf("throughput:      %.0f reports/sec\n", records.size() / seconds);
+    printf("latency (ns):    p50 %llu p99 %llu max %llu\n",
+           static_cast<unsigned long long>(percentile(latencies, 0.50)),
+           static_cast<unsigned long long>(percentile(latencies, 0.99)),
+           static_cast<unsigned long long>(latencies.back()));
+    for (int i = 0; i < kVoodooI2CELANStageCount; i++) {
+        const VoodooI2CELANLatencyHistogram& histogram = driver.latency.stages[i];
+        printf("stage %-9s  %9llu samples, mean %llu ns, p50 <= %llu ns, p99 <= %llu ns, max %llu ns\n",
+               VoodooI2CELANLatencyStats::stage_name(static_cast<VoodooI2CELANLatencyStage>(i)),
+               static_cast<unsigned long long>(histogram.samples()), static_cast<unsigned long long>(histogram.mean()),
+               static_cast<unsigned long long>(histogram.percentile(500)), static_cast<unsigned long long>(histogram.percentile(990)),
+               static_cast<unsigned long long>(histogram.max()));
+    }
+    print_intervals("report interval:", driver.report_intervals);
+    const VoodooI2CELANWatchdog& watchdog = driver.watchdog;
+    printf("watchdog:        %llu read failure, %llu invalid report, %llu stuck contact stalls, %llu contacts released\n",
+           static_cast<unsigned long long>(watchdog.stalls[kVoodooI2CELANStallReadFailures]),
+           static_cast<unsigned long long>(watchdog.stalls[kVoodooI2CELANStallInvalidReports]),
+           static_cast<unsigned long long>(watchdog.stalls[kVoodooI2CELANStallStuckContact]),
+           static_cast<unsigned long long>(stats.released_contacts));
+    printf("recovery:        %llu recovered (%llu fast), %llu failed, mean %.2f ms, p99 <= %.2f ms, max %.2f ms\n",
+           static_cast<unsigned long long>(watchdog.recoveries), static_cast<unsigned long long>(watchdog.fast_recoveries),
+           static_cast<unsigned long long>(watchdog.failed_recoveries), watchdog.recovery_time.mean() / 1e6,
+           watchdog.recovery_time.percentile(990) / 1e6, watchdog.recovery_time.max() / 1e6);
+    if (idle) {
+        const VoodooI2CELANIdleMonitor& monitor = driver.idle_monitor;
+        uint64_t end_ns = records.back().timestamp_ns;
+        printf("idle:           ");
+        for (int i = 0; i < kVoodooI2CELANIdleStateCount; i++) {
+            VoodooI2CELANIdleState state = static_cast<VoodooI2CELANIdleState>(i);
+            printf(" %s %.1f%%", VoodooI2CELANIdleMonitor::state_name(state), 100.0 * monitor.time_in(state, end_ns) / (end_ns - first_ns));
+        }
+        printf(", %llu sleeps, %llu probes (%llu empty), %llu interrupt wakes\n",
+               static_cast<unsigned long long>(monitor.sleeps), static_cast<unsigned long long>(monitor.probes),
+               static_cast<unsigned long long>(monitor.empty_probes), static_cast<unsigned long long>(monitor.interrupt_wakes));
+        printf("pre-warm:        %llu wakes completed while hovering, %llu contacts landed on an awake device after hovering\n",
+               static_cast<unsigned long long>(monitor.hover_wakes), static_cast<unsigned long long>(monitor.prewarmed_contacts));
+        printf("wake latency:    %llu wakes, mean %.2f ms, p99 <= %.2f ms, max %.2f ms\n",
+               static_cast<unsigned long long>(monitor.wake_latency.samples()), monitor.wake_latency.mean() / 1e6,
+               monitor.wake_latency.percentile(990) / 1e6, monitor.wake_latency.max() / 1e6);
+    }
+    if (stream_path)
+        printf("raw stream:      %llu entries published to %s, %llu notifications\n",
+               static_cast<unsigned long long>(driver.raw_stream.recorded), stream_path,
+               static_cast<unsigned long long>(driver.raw_stream.notifications));
+    if (baseline) {
+        const VoodooI2CELANBaselineMonitor& monitor = driver.baseline_monitor;
+        printf("baseline:        %llu samples (%llu aborted), %llu calibrations (%llu requested, %llu for drift), %llu failed, %llu errors\n",
+               static_cast<unsigned long long>(monitor.samples), static_cast<unsigned long long>(monitor.aborted_samples),
+               static_cast<unsigned long long>(driver.nub.calibrations),
+               static_cast<unsigned long long>(monitor.calibrations[kVoodooI2CELANCalibrationRequested]),
+               static_cast<unsigned long long>(monitor.calibrations[kVoodooI2CELANCalibrationDrift]),
+               static_cast<unsigned long long>(monitor.failed_calibrations), static_cast<unsigned long long>(monitor.bus_errors));
+        printf("baseline drift:  max %u seen, %u peak in the mock, past the threshold %.1f%% of the time, %.2f s in calibration mode\n",
+               monitor.max_drift, peak_drift, 100.0 * drifted_ns / (records.back().timestamp_ns - first_ns),
+               monitor.calibration_mode_ns / 1e9);
+    }
+    const VoodooI2CELANFlightRecorder& flight_recorder = driver.flight_recorder;
+    printf("flight recorder: %llu invalid bursts, %llu read failures, %llu watchdog, %llu dumps, %llu entries dropped while frozen, %zu bytes\n",
+           static_cast<unsigned long long>(flight_recorder.anomalies[kVoodooI2CELANFlightAnomalyInvalidBurst]),
+           static_cast<unsigned long long>(flight_recorder.anomalies[kVoodooI2CELANFlightAnomalyReadFailure]),
+           static_cast<unsigned long long>(flight_recorder.anomalies[kVoodooI2CELANFlightAnomalyWatchdog]),
+           static_cast<unsigned long long>(stats.flight_dumps), static_cast<unsigned long long>(flight_recorder.dropped),
+           sizeof(VoodooI2CELANFlightRecorder));
+    if (flight_dump)
+        print_flight_dump(driver);
+    printf("bus (modelled):  %.1f us/report\n", (driver.nub.bus_ns - bus_ns_before) / 1e3 / records.size());
+    return 0;
+}
@@ -0,0 +1,436 @@
+//
+//  ReplayDriver.cpp
+//  VoodooI2CELAN
+//
+//  Copyright © 2017 Kishor Prins. All rights reserved.
+//
+
+#include "ReplayDriver.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+
+static uint64_t host_ns() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+ReplayDriver::ReplayDriver() : frame_held(false), touching(false), proximity(false), drain_budget(ELAN_DRAIN_BUDGET), last_report_status(kVoodooI2CELANReportEmpty), interrupt_ns(0), idle_deadline_ns(0), watchdog_deadline_ns(0), baseline_deadline_ns(0), firmware_begin_ns(0), firmware_input_off_ns(0), device_info_cached(false), last_resume_fast(false), init_ns(0) {
+    memset(&device_info, 0, sizeof(device_info));
+    memset(&context, 0, sizeof(context));
+    memset(&transform_config, 0, sizeof(transform_config));
+    memset(&stats, 0, sizeof(stats));
+    protocol.init(&nub);
+    decode_kernel = decode_ELAN_report;
+    watchdog.configure(ELAN_WATCHDOG_ERROR_LIMIT, ELAN_WATCHDOG_STUCK_CONTACT);
+    keyboard.configure(ELAN_QUIET_TIME_AFTER_TYPING * 1000000ULL);
+    firmware_updater.configure(ELAN_FIRMWARE_PAGE_DELAY, ELAN_FIRMWARE_CHECK_INTERVAL);
+}
+
+bool ReplayDriver::start() {
+    // drive the sequencer like init_timer does, with the mock's clock standing in for the timer
+    uint64_t begin = nub.now_ns();
+    uint32_t delay_ms;
+    init_sequencer.begin(&protocol, &device_info, begin);
+    VoodooI2CELANInitState state;
+    while ((state = init_sequencer.advance(nub.now_ns(), &delay_ms)) == kVoodooI2CELANInitRunning)
+        nub.sleep(delay_ms);
+    init_ns = nub.now_ns() - begin;
+    bool success = state == kVoodooI2CELANInitSucceeded;
+    flight_recorder.record(kVoodooI2CELANFlightReset, 0, kVoodooI2CELANFlightResetInit, &success, sizeof(success));
+    if (!success)
+        return false;
+    device_info_cached = true;
+
+    context.logical_max_x = device_info.max_report_x;
+    context.logical_max_y = device_info.max_report_y;
+    context.pressure_adjustment = device_info.pressure_adjustment;
+    context.width_per_trace_x = device_info.width_per_trace_x;
+    context.width_per_trace_y = device_info.width_per_trace_y;
+    context.invert_y = true;
+    decode_kernel = select_ELAN_decode_kernel(context);
+    transform.configure(transform_config, context.logical_max_x, context.logical_max_y, device_info.hw_phys_x, device_info.hw_phys_y);
+    configure_contact_filter(ELAN_CONTACT_DEADBAND, ELAN_CONTACT_SMOOTHING_SPEED, ELAN_PREDICTION_HORIZON);
+    return true;
+}
+
+void ReplayDriver::configure_contact_filter(uint32_t deadband, uint32_t smoothing_speed, uint32_t horizon_ms) {
+    contact_filter.configure(transform.logical_max_x, transform.logical_max_y, transform.physical_max_x, transform.physical_max_y,
+                             deadband, smoothing_speed);
+    motion_predictor.configure(horizon_ms, transform.logical_max_x, transform.logical_max_y);
+    frame_filter.compare_raw = !contact_filter.enabled() && !motion_predictor.enabled();
+    frame_filter.reset();
+    unfiltered_frame_filter.reset();
+}
+
+bool ReplayDriver::resume_device(bool fast_resume) {
+    protocol.set_power(true);
+    last_resume_fast = fast_resume && device_info_cached && protocol.fast_resume(device_info);
+    flight_recorder.record(kVoodooI2CELANFlightReset, interrupt_ns, last_resume_fast ? kVoodooI2CELANFlightResetFastResume : kVoodooI2CELANFlightResetFullResume,
+                           &last_resume_fast, sizeof(last_resume_fast));
+    if (last_resume_fast)
+        return true;
+
+    device_info_cached = false;
+    bool success = device_info_cached = protocol.init_device(&device_info);
+    flight_recorder.record(kVoodooI2CELANFlightReset, interrupt_ns, kVoodooI2CELANFlightResetInit, &success, sizeof(success));
+    return success;
+}
+
+bool ReplayDriver::begin_firmware_update(const uint8_t* image, uint32_t length) {
+    if (!device_info_cached || firmware_updater.busy() || !firmware_updater.begin(&protocol, device_info, image, length, nub.now_ns()))
+        return false;
+    firmware_begin_ns = nub.now_ns();
+    firmware_input_off_ns = 0;
+    release_contacts(interrupt_ns);
+    proximity = false;
+    idle_deadline_ns = 0;
+    watchdog_deadline_ns = 0;
+    baseline_deadline_ns = 0;
+    watchdog.stop();
+    baseline_monitor.cancel();
+    if (idle_monitor.state() != kVoodooI2CELANIdleActive)
+        protocol.set_sleep(false);
+    idle_monitor.stop(nub.now_ns());
+    return true;
+}
+
+bool ReplayDriver::firmware_step() {
+    uint32_t delay_ms;
+    VoodooI2CELANFirmwareState state = firmware_updater.tick(nub.now_ns(), &delay_ms);
+    if (state == kVoodooI2CELANFirmwareRunning) {
+        nub.sleep(delay_ms);
+        return true;
+    }
+    if (state != kVoodooI2CELANFirmwareSucceeded && state != kVoodooI2CELANFirmwareFailed)
+        return false;
+
+    bool success = state == kVoodooI2CELANFirmwareSucceeded;
+    flight_recorder.record(kVoodooI2CELANFlightReset, 0, kVoodooI2CELANFlightResetFirmware, &success, sizeof(success));
+    start();
+    firmware_input_off_ns = nub.now_ns() - firmware_begin_ns;
+    return false;
+}
+
+void ReplayDriver::resume_firmware_update() {
+    if (firmware_updater.state() == kVoodooI2CELANFirmwareInterrupted)
+        firmware_updater.resume(nub.now_ns());
+}
+
+void ReplayDriver::suspend_device() {
+    if (firmware_updater.busy()) {
+        firmware_updater.interrupt(nub.now_ns());
+        return;
+    }
+    idle_deadline_ns = 0;
+    watchdog_deadline_ns = 0;
+    baseline_deadline_ns = 0;
+    watchdog.stop();
+    baseline_monitor.cancel();
+    idle_monitor.stop(nub.now_ns());
+    if (!device_info_cached)
+        return;
+    protocol.set_sleep(true);
+    protocol.set_power(false);
+}
+
+void ReplayDriver::start_idle(uint64_t now_ns) {
+    idle_monitor.reset(now_ns);
+    idle_deadline_ns = now_ns;
+    run_idle_until(now_ns);
+}
+
+void ReplayDriver::run_idle_until(uint64_t now_ns) {
+    while (idle_deadline_ns && idle_deadline_ns <= now_ns) {
+        uint64_t tick_ns = idle_deadline_ns;
+        uint32_t delay_ms;
+        apply_idle_action(idle_monitor.tick(tick_ns, &delay_ms));
+        idle_deadline_ns = delay_ms ? tick_ns + delay_ms * 1000000ULL : 0;
+    }
+}
+
+void ReplayDriver::start_baseline(uint64_t now_ns) {
+    baseline_monitor.begin(&protocol, now_ns);
+    baseline_deadline_ns = now_ns;
+    run_baseline_until(now_ns);
+}
+
+void ReplayDriver::run_baseline_until(uint64_t now_ns) {
+    while (baseline_deadline_ns && baseline_deadline_ns <= now_ns) {
+        uint64_t tick_ns = baseline_deadline_ns;
+        uint32_t delay_ms;
+        bool available = !touching && idle_monitor.state() == kVoodooI2CELANIdleActive;
+        if (baseline_monitor.tick(tick_ns, available, &delay_ms) == kVoodooI2CELANBaselineCalibrated)
+            flight_recorder.record(kVoodooI2CELANFlightReset, tick_ns, kVoodooI2CELANFlightResetCalibration, NULL, 0);
+        baseline_deadline_ns = delay_ms ? tick_ns + delay_ms * 1000000ULL : 0;
+    }
+}
+
+void ReplayDriver::run_watchdog_until(uint64_t now_ns) {
+    while (watchdog_deadline_ns && watchdog_deadline_ns <= now_ns) {
+        uint64_t tick_ns = watchdog_deadline_ns;
+        uint32_t delay_ms;
+        VoodooI2CELANStall stall = watchdog.tick(tick_ns, &delay_ms);
+        watchdog_deadline_ns = delay_ms ? tick_ns + delay_ms * 1000000ULL : 0;
+        if (stall == kVoodooI2CELANStallStuckContact)
+            baseline_monitor.sample_soon();
+        if (stall != kVoodooI2CELANStallNone)
+            recover_device(tick_ns);
+    }
+}
+
+void ReplayDriver::recover_device(uint64_t now_ns) {
+    uint64_t bus_begin_ns = nub.now_ns();
+
+    flight_anomaly(kVoodooI2CELANFlightAnomalyWatchdog, now_ns);
+    flight_recorder.record(kVoodooI2CELANFlightReset, now_ns, kVoodooI2CELANFlightResetRecovery, NULL, 0);
+    watchdog.recovery_started(now_ns);
+    release_contacts(now_ns);
+    bool baseline_running = baseline_deadline_ns != 0;
+    baseline_deadline_ns = 0;
+    baseline_monitor.cancel();
+
+    bool fast = device_info_cached && protocol.fast_resume(device_info);
+    bool success = fast;
+    bool idle_running = false;
+    if (!fast) {
+        idle_running = idle_deadline_ns != 0;
+        idle_deadline_ns = 0;
+        if (idle_monitor.state() != kVoodooI2CELANIdleActive)
+            protocol.set_sleep(false);
+        idle_monitor.stop(now_ns);
+        device_info_cached = false;
+        success = protocol.init_device(&device_info);
+        device_info_cached = success;
+    }
+    uint64_t end_ns = now_ns + nub.now_ns() - bus_begin_ns;
+    if (success && idle_running)
+        start_idle(end_ns);
+    watchdog.recovery_finished(end_ns, success, fast);
+    if (success)
+        watchdog.reset(end_ns);
+    else
+        watchdog_deadline_ns = end_ns;
+    if (success && baseline_running)
+        start_baseline(end_ns);
+}
+
+void ReplayDriver::flight_anomaly(VoodooI2CELANFlightAnomaly anomaly, uint64_t now_ns) {
+    if (!flight_recorder.freeze(anomaly, now_ns))
+        return;
+
+    flight_dump.clear();
+    VoodooI2CELANFlightEntry entry;
+    for (uint32_t i = 0; i < flight_recorder.count(); i++) {
+        if (flight_recorder.entry(i, &entry))
+            flight_dump.push_back(entry);
+    }
+    stats.flight_dumps++;
+    flight_recorder.thaw();
+}
+
+void ReplayDriver::release_contacts(uint64_t now_ns) {
+    if (!touching || (frame_held && !queue_frame()))
+        return;
+
+    memset(&acquired_frame, 0, sizeof(acquired_frame));
+    acquired_frame.data[0] = ETP_MAX_REPORT_LEN;
+    acquired_frame.data[ETP_REPORT_ID_OFFSET] = ETP_REPORT_ID;
+    acquired_frame.report.report_id = ETP_REPORT_ID;
+    acquired_frame.timestamp = now_ns;
+    acquired_frame.timestamp_ns = now_ns;
+    acquired_frame.times.entry_ns = host_ns();
+    touching = false;
+    stats.released_contacts++;
+    queue_frame();
+    dispatch_frames();
+}
+
+void ReplayDriver::apply_idle_action(VoodooI2CELANIdleAction action) {
+    switch (action) {
+        case kVoodooI2CELANIdleSleep:
+            if (baseline_monitor.busy() || protocol.set_sleep(true) != kIOReturnSuccess)
+                idle_monitor.reset(idle_deadline_ns);
+            else
+                proximity = false;
+            break;
+        case kVoodooI2CELANIdleWake:
+            protocol.set_sleep(false);
+            break;
+        case kVoodooI2CELANIdleNone:
+            break;
+    }
+}
+
+void ReplayDriver::interrupt_occurred(uint64_t timestamp_ns, int count) {
+    // input is off until the firmware update is over
+    if (firmware_updater.busy())
+        return;
+    stats.interrupts++;
+    interrupt_ns = timestamp_ns;
+    // the trace only has the interrupt times, the modelled bus time is added on top of them
+    uint64_t bus_begin_ns = nub.now_ns();
+
+    if (idle_monitor.state() == kVoodooI2CELANIdleAsleep) {
+        uint32_t delay_ms;
+        apply_idle_action(idle_monitor.interrupt(timestamp_ns, &delay_ms));
+        idle_deadline_ns = timestamp_ns + delay_ms * 1000000ULL;
+    }
+
+    bool requeued = frame_held;
+    if (frame_held && !queue_frame())
+        return;
+
+    uint32_t budget = count > 1 ? std::min(static_cast<uint32_t>(count), drain_budget) : 1;
+    uint32_t drained = 0;
+    uint32_t queued = 0;
+
+    for (uint32_t n = 0; n < budget; n++) {
+        VoodooI2CELANStageTimes& times = acquired_frame.times;
+        memset(&times, 0, sizeof(times));
+        times.entry_ns = host_ns();
+
+        VoodooI2CELANReportStatus status = read_report(&times);
+        if (status != kVoodooI2CELANReportValid) {
+            latency.record(times);
+            if (status == kVoodooI2CELANReportFiller)
+                continue;
+            break;
+        }
+        const VoodooI2CELANReport& report = acquired_frame.report;
+        bool contact = report.contact_mask || report.button;
+        if (!drained) {
+            report_intervals.record(timestamp_ns, report.contact_count);
+            idle_monitor.report_received(timestamp_ns + nub.now_ns() - bus_begin_ns, contact, report.hover);
+        }
+        drained++;
+        baseline_monitor.report_received(timestamp_ns + nub.now_ns() - bus_begin_ns, contact || report.hover);
+        if (watchdog.report_received(timestamp_ns + nub.now_ns() - bus_begin_ns, contact))
+            watchdog_deadline_ns = timestamp_ns + watchdog.stuck_contact_ms * 1000000ULL;
+        bool hovered = proximity;
+        if (report.hover != proximity) {
+            proximity = report.hover;
+            stats.proximity_changes++;
+        }
+
+        if (!contact && !touching && (report.hover || hovered)) {
+            stats.hover_reports++;
+            latency.record(times);
+            continue;
+        }
+        touching = contact;
+
+        // as read_ns in the kext, on the trace's timeline
+        acquired_frame.timestamp_ns = n ? timestamp_ns + nub.now_ns() - bus_begin_ns : timestamp_ns;
+        acquired_frame.timestamp = acquired_frame.timestamp_ns;
+        queued++;
+        if (!queue_frame())
+            break;
+    }
+
+    if (requeued || queued)
+        dispatch_frames();
+    if (error_log.summary_due(timestamp_ns)) {
+        if (error_log.total_suppressed())
+            stats.error_summaries++;
+        error_log.summarized(timestamp_ns);
+    }
+    if (drained) {
+        stats.drain_interrupts++;
+        stats.drained += drained;
+        if (drained > stats.max_drained)
+            stats.max_drained = drained;
+    }
+}
+
+VoodooI2CELANReportStatus ReplayDriver::read_report(VoodooI2CELANStageTimes* times) {
+    last_report_status = kVoodooI2CELANReportInvalid;
+    uint64_t bus_begin_ns = nub.now_ns();
+    IOReturn result = protocol.read_report(acquired_frame.data);
+    if (result != kIOReturnSuccess) {
+        error_log.record(kVoodooI2CELANErrorReadFailed, interrupt_ns);
+        flight_recorder.record(kVoodooI2CELANFlightReadError, interrupt_ns, result, NULL, 0);
+        flight_anomaly(kVoodooI2CELANFlightAnomalyReadFailure, interrupt_ns);
+        if (watchdog.read_failed(interrupt_ns))
+            watchdog_deadline_ns = interrupt_ns;
+        return last_report_status;
+    }
+    times->read_ns = host_ns();
+
+    last_report_status = decode_kernel(context, acquired_frame.data, &acquired_frame.report);
+    switch (last_report_status) {
+        case kVoodooI2CELANReportFiller:
+            error_log.record(kVoodooI2CELANErrorFillerReport, interrupt_ns);
+            break;
+        case kVoodooI2CELANReportEmpty:
+            stats.empty_reports++;
+            break;
+        case kVoodooI2CELANReportShort:
+            error_log.record(kVoodooI2CELANErrorShortRead, interrupt_ns);
+            if (watchdog.invalid_report(interrupt_ns))
+                watchdog_deadline_ns = interrupt_ns;
+            break;
+        case kVoodooI2CELANReportInvalid:
+            error_log.record(kVoodooI2CELANErrorInvalidReport, interrupt_ns);
+            if (watchdog.invalid_report(interrupt_ns))
+                watchdog_deadline_ns = interrupt_ns;
+            break;
+        case kVoodooI2CELANReportValid:
+            transform.apply(&acquired_frame.report);
+            times->decoded_ns = host_ns();
+            stats.valid_reports++;
+            stats.contacts += acquired_frame.report.contact_count;
+            break;
+    }
+    // there is no notification port to send to, readers of the host stream poll
+    if (raw_stream.active())
+        raw_stream.record(interrupt_ns, interrupt_ns + nub.now_ns() - bus_begin_ns, acquired_frame.data, last_report_status, acquired_frame.report);
+    VoodooI2CELANFlightAnomaly anomaly = flight_recorder.record_report(interrupt_ns, acquired_frame.data, last_report_status);
+    if (anomaly != kVoodooI2CELANFlightAnomalyNone)
+        flight_anomaly(anomaly, interrupt_ns);
+    return last_report_status;
+}
+
+bool ReplayDriver::queue_frame() {
+    frame_held = frame_ring.push(&acquired_frame) == kVoodooI2CELANFrameFull;
+    return !frame_held;
+}
+
+void ReplayDriver::dispatch_frames() {
+    bool superseded;
+
+    while (frame_ring.pop(&dispatched_frame, &superseded)) {
+        if (superseded && !dispatched_frame.transition)
+            stats.coalesced++;
+        else
+            dispatch_report(&dispatched_frame);
+        latency.record(dispatched_frame.times);
+    }
+    frame_ring.take_producer_wakeup();
+}
+
+void ReplayDriver::dispatch_report(VoodooI2CELANFrame* frame) {
+    frame->times.dispatch_begin_ns = host_ns();
+    uint64_t keyboard_state = keyboard.snapshot();
+    if (VoodooI2CELANKeyboardState::ignored(keyboard_state)) {
+        stats.ignored_reports++;
+        return;
+    }
+    bool quiet = VoodooI2CELANKeyboardState::quiet(keyboard_state, frame->timestamp_ns);
+    if (quiet)
+        stats.quiet_reports++;
+    if (unfiltered_frame_filter.filter(frame->data, frame->report, quiet))
+        stats.unfiltered_dispatched++;
+    contact_filter.filter(&frame->report, frame->timestamp_ns);
+    motion_predictor.predict(&frame->report, frame->timestamp_ns);
+    if (!frame_filter.filter(frame->data, frame->report, quiet))
+        return;
+    stats.dispatched++;
+    frame->times.dispatched_ns = host_ns();
+}
+
+uint32_t ReplayDriver::poll(uint64_t now_ns) {
+    last_report_status = kVoodooI2CELANReportEmpty;
+    interrupt_occurred(now_ns, 1);
+    return poll_scheduler.poll_completed(now_ns, last_report_status == kVoodooI2CELANReportValid);
+}
@@ -0,0 +1,227 @@
+//
+//  ReplayDriver.hpp
+//  VoodooI2CELAN
+//
+//  Copyright © 2017 Kishor Prins. All rights reserved.
+//
+
+#ifndef VOODOOI2C_ELAN_HOST_REPLAY_DRIVER_HPP
+#define VOODOOI2C_ELAN_HOST_REPLAY_DRIVER_HPP
+
+#include "VoodooI2CELANBaselineMonitor.hpp"
+#include "VoodooI2CELANContactFilter.hpp"
+#include "VoodooI2CELANCoordinateTransform.hpp"
+#include "VoodooI2CELANErrorLog.hpp"
+#include "VoodooI2CELANFirmwareUpdater.hpp"
+#include "VoodooI2CELANFlightRecorder.hpp"
+#include "VoodooI2CELANFrameFilter.hpp"
+#include "VoodooI2CELANFrameRing.hpp"
+#include "VoodooI2CELANIdleMonitor.hpp"
+#include "VoodooI2CELANInitSequencer.hpp"
+#include "VoodooI2CELANKeyboardState.hpp"
+#include "VoodooI2CELANLatencyHistogram.hpp"
+#include "VoodooI2CELANMotionPredictor.hpp"
+#include "VoodooI2CELANPollScheduler.hpp"
+#include "VoodooI2CELANProtocol.hpp"
+#include "VoodooI2CELANRawStream.hpp"
+#include "VoodooI2CELANReportDecoder.hpp"
+#include "VoodooI2CELANReportIntervalStats.hpp"
+#include "VoodooI2CELANWatchdog.hpp"
+
+#include <vector>
+
+#include "MockNub.hpp"
+
+struct ReplayStats {
+    uint64_t interrupts;
+    uint64_t valid_reports;
+    uint64_t empty_reports;
+    uint64_t contacts;
+    uint64_t dispatched;
+    uint64_t drain_interrupts;
+    uint64_t drained;
+    uint64_t coalesced;
+    uint64_t hover_reports;
+    uint64_t proximity_changes;
+    uint64_t error_summaries;
+    uint64_t released_contacts;
+    uint64_t ignored_reports;
+    uint64_t quiet_reports;
+    // what would have been dispatched without the contact filter
+    uint64_t unfiltered_dispatched;
+    uint64_t flight_dumps;
+    uint32_t max_drained;
+};
+
+// Same defaults as the kext's QuietTimeAfterTyping, InterruptDrainBudget, WatchdogErrorLimit, WatchdogStuckContactMS,
+// ContactDeadband, ContactSmoothingSpeed, PredictionHorizonMS, BaselineIntervalMS, BaselineDriftThreshold, BaselineQuietTimeMS,
+// FirmwarePageDelayMS and FirmwareCheckInterval, the coordinate transform settings all default to 0
+#define ELAN_QUIET_TIME_AFTER_TYPING 500
+#define ELAN_DRAIN_BUDGET 4
+#define ELAN_WATCHDOG_ERROR_LIMIT 8
+#define ELAN_WATCHDOG_STUCK_CONTACT 1000
+#define ELAN_CONTACT_DEADBAND 0
+#define ELAN_CONTACT_SMOOTHING_SPEED 50
+#define ELAN_PREDICTION_HORIZON 0
+#define ELAN_BASELINE_INTERVAL 0
+#define ELAN_BASELINE_DRIFT_THRESHOLD 50
+#define ELAN_BASELINE_QUIET_TIME 2000
+#define ELAN_FIRMWARE_PAGE_DELAY 0
+#define ELAN_FIRMWARE_CHECK_INTERVAL 8
+
+/* Host stand-in for VoodooI2CELANTouchpadDriver
+ *
+ * Runs the same protocol and decode code as the kext against a MockNub and
+ * mirrors the control flow of start() and interrupt_occurred(), with the
+ * multitouch dispatch reduced to counting. Nothing presses keys unless
+ * the caller does, through keyboard, which may happen from any thread as
+ * it does with message() in the kext. The dispatch side runs right after every interrupt instead of on its own
+ * thread, see elan_ring_stress for the ring under real concurrency.
+ */
+
+class ReplayDriver {
+ public:
+    ReplayDriver();
+
+    /* Mirrors VoodooI2CELANTouchpadDriver::start() and the init_timer steps that follow it
+     *
+     * @return true if the device was initialised, init_ns holds the modelled time it took
+     * and init_sequencer the per step timings
+     */
+    bool start();
+    /* Mirrors the contact filter and predictor setup in VoodooI2CELANTouchpadDriver::update_decode_context()
+     * @deadband @smoothing_speed as ContactDeadband and ContactSmoothingSpeed
+     * @horizon_ms as PredictionHorizonMS
+     */
+    void configure_contact_filter(uint32_t deadband, uint32_t smoothing_speed, uint32_t horizon_ms);
+    /* Mirrors VoodooI2CELANTouchpadDriver::wake_device(), with the init sequence a failed
+     * fast resume falls back to run synchronously like start() does
+     * @fast_resume whether the cached fast path may be used
+     *
+     * @return true if the device is ready for input, last_resume_fast tells which path was taken
+     */
+    bool resume_device(bool fast_resume);
+    /* Mirrors VoodooI2CELANTouchpadDriver::begin_firmware_update(), which turns input off
+     * @image @length the image, which has to stay valid until the update is over
+     *
+     * @return false if the image was refused, firmware_updater.last_error says why
+     */
+    bool begin_firmware_update(const uint8_t* image, uint32_t length);
+    /* Mirrors a firmware_timer step, then waits out its delay on the mock's clock. Once the update
+     * is over the device is initialised again like firmware_finished() does, synchronously like start()
+     *
+     * @return true while there are steps left, false once the update is over or was interrupted
+     */
+    bool firmware_step();
+    /* Mirrors VoodooI2CELANTouchpadDriver::resume_firmware_update() */
+    void resume_firmware_update();
+    /* Mirrors VoodooI2CELANTouchpadDriver::suspend_device() */
+    void suspend_device();
+    /* Starts the idle monitor like enable_input_source() does
+     * @now_ns the current time, on the trace's timeline
+     */
+    void start_idle(uint64_t now_ns);
+    /* Runs every idle_timer tick that is due by @now_ns, on the trace's timeline */
+    void run_idle_until(uint64_t now_ns);
+    /* Mirrors VoodooI2CELANTouchpadDriver::apply_idle_action() */
+    void apply_idle_action(VoodooI2CELANIdleAction action);
+    /* Starts the baseline monitor like enable_input_source() does
+     * @now_ns the current time, on the trace's timeline
+     */
+    void start_baseline(uint64_t now_ns);
+    /* Runs every baseline_timer tick that is due by @now_ns, on the trace's timeline */
+    void run_baseline_until(uint64_t now_ns);
+    /* Runs every watchdog_timer tick that is due by @now_ns, on the trace's timeline */
+    void run_watchdog_until(uint64_t now_ns);
+    /* Mirrors VoodooI2CELANTouchpadDriver::recover_device(), with the full init run
+     * synchronously like start() does
+     * @now_ns the time of the recovery, on the trace's timeline
+     */
+    void recover_device(uint64_t now_ns);
+    /* Mirrors VoodooI2CELANTouchpadDriver::flight_anomaly(), copying the dump into flight_dump
+     * instead of publishing it
+     * @now_ns the time of the anomaly, on the trace's timeline
+     */
+    void flight_anomaly(VoodooI2CELANFlightAnomaly anomaly, uint64_t now_ns);
+    /* Mirrors VoodooI2CELANTouchpadDriver::release_contacts() */
+    void release_contacts(uint64_t now_ns);
+    /* Mirrors VoodooI2CELANTouchpadDriver::interrupt_occurred()
+     * @timestamp_ns when the device signalled the report, on the trace's timeline
+     * @count how many interrupts the (simulated) work loop is behind by
+     *
+     * The stage latencies are taken from the host's steady clock instead.
+     */
+    void interrupt_occurred(uint64_t timestamp_ns, int count);
+    /* Mirrors VoodooI2CELANTouchpadDriver::read_ELAN_report() into acquired_frame */
+    VoodooI2CELANReportStatus read_report(VoodooI2CELANStageTimes* times);
+    /* Mirrors VoodooI2CELANTouchpadDriver::queue_frame() */
+    bool queue_frame();
+    /* Mirrors VoodooI2CELANTouchpadDriver::dispatch_frames() */
+    void dispatch_frames();
+    /* Mirrors VoodooI2CELANTouchpadDriver::dispatch_ELAN_report() */
+    void dispatch_report(VoodooI2CELANFrame* frame);
+    /* Mirrors VoodooI2CELANTouchpadDriver::simulateInterrupt()
+     * @now_ns the (virtual) time of the poll
+     *
+     * @return the interval until the next poll in microseconds
+     */
+    uint32_t poll(uint64_t now_ns);
+
+    MockNub nub;
+    VoodooI2CELANProtocol protocol;
+    VoodooI2CELANInitSequencer init_sequencer;
+    VoodooI2CELANPollScheduler poll_scheduler;
+    VoodooI2CELANDeviceInfo device_info;
+    VoodooI2CELANDecodeContext context;
+    VoodooI2CELANDecodeKernel decode_kernel;
+    VoodooI2CELANFrameRing frame_ring;
+    VoodooI2CELANFrame acquired_frame;
+    bool frame_held;
+    bool touching;
+    bool proximity;
+    VoodooI2CELANFrame dispatched_frame;
+    uint32_t drain_budget;
+    VoodooI2CELANReportStatus last_report_status;
+    VoodooI2CELANErrorLog error_log;
+    // the interrupt being handled, on the trace's timeline
+    uint64_t interrupt_ns;
+    VoodooI2CELANFrameFilter frame_filter;
+    // set before start(), as Rotation, MirrorX and the rest
+    VoodooI2CELANTransformConfig transform_config;
+    VoodooI2CELANCoordinateTransform transform;
+    VoodooI2CELANContactFilter contact_filter;
+    VoodooI2CELANMotionPredictor motion_predictor;
+    // runs on the reports before they are filtered, for comparison
+    VoodooI2CELANFrameFilter unfiltered_frame_filter;
+    VoodooI2CELANKeyboardState keyboard;
+    // every report read, for readers of the mapping the caller attaches it to
+    VoodooI2CELANRawStream raw_stream;
+    VoodooI2CELANFlightRecorder flight_recorder;
+    // the entries of the last flight recorder dump, oldest first
+    std::vector<VoodooI2CELANFlightEntry> flight_dump;
+    VoodooI2CELANIdleMonitor idle_monitor;
+    // when idle_timer would fire next, 0 if it is not armed
+    uint64_t idle_deadline_ns;
+    VoodooI2CELANWatchdog watchdog;
+    // when watchdog_timer would fire next, 0 if it is not armed
+    uint64_t watchdog_deadline_ns;
+    VoodooI2CELANBaselineMonitor baseline_monitor;
+    // when baseline_timer would fire next, 0 if it is not armed
+    uint64_t baseline_deadline_ns;
+
+    VoodooI2CELANFirmwareUpdater firmware_updater;
+    // when input was turned off for the update, on the mock's clock
+    uint64_t firmware_begin_ns;
+    // from turning input off until the device was back up after the last update
+    uint64_t firmware_input_off_ns;
+
+    bool device_info_cached;
+    bool last_resume_fast;
+
+    ReplayStats stats;
+    VoodooI2CELANLatencyStats latency;
+    VoodooI2CELANReportIntervalStats report_intervals;
+    uint64_t init_ns;
+};
+
+#endif /* VOODOOI2C_ELAN_HOST_REPLAY_DRIVER_HPP */
@@ -0,0 +1,66 @@
+//
+//  ResumeBenchmark.cpp
+//  VoodooI2CELAN
+//
+//  Copyright © 2017 Kishor Prins. All rights reserved.
+//
+
+// Compares the modelled wake cost of the full reset against the cached fast
+// resume path, including the fallback when the firmware changed while asleep
+//
+// usage: elan_resume_benchmark [cycles]
+
+#include <cstdio>
+#include <cstdlib>
+
+#include "ReplayDriver.hpp"
+
+struct ResumeResult {
+    uint64_t total_ns;
+    uint64_t transfers;
+    unsigned fast;
+    unsigned failed;
+};
+
+static ResumeResult run(unsigned cycles, bool fast_resume, bool reflash_every_other) {
+    ReplayDriver driver;
+    ResumeResult result = {0, 0, 0, 0};
+    if (!driver.start()) {
+        result.failed = cycles;
+        return result;
+    }
+
+    for (unsigned i = 0; i < cycles; i++) {
+        driver.suspend_device();
+        driver.nub.power_cycle();
+        if (reflash_every_other)
+            driver.nub.set_register16(ETP_I2C_FW_CHECKSUM_CMD, 0x1234 + (i & 1));
+
+        uint64_t begin = driver.nub.now_ns();
+        uint64_t transfers = driver.nub.reads + driver.nub.writes + driver.nub.write_reads;
+        if (!driver.resume_device(fast_resume))
+            result.failed++;
+        result.total_ns += driver.nub.now_ns() - begin;
+        result.transfers += driver.nub.reads + driver.nub.writes + driver.nub.write_reads - transfers;
+        if (driver.last_resume_fast)
+            result.fast++;
+    }
+    return result;
+}
+
+static void print(const char* name, unsigned cycles, const ResumeResult& result) {
+    printf("%-22s %8.2f ms/wake %6.1f transfers/wake  %u/%u fast  %u failed\n", name,
+           result.total_ns / 1e6 / cycles, static_cast<double>(result.transfers) / cycles,
+           result.fast, cycles, result.failed);
+}
+
+int main(int argc, char** argv) {
+    unsigned cycles = argc > 1 ? static_cast<unsigned>(strtoul(argv[1], NULL, 0)) : 1000;
+    if (!cycles)
+        cycles = 1;
+
+    print("full reset", cycles, run(cycles, false, false));
+    print("fast resume", cycles, run(cycles, true, false));
+    print("fast resume, reflash", cycles, run(cycles, true, true));
+    return 0;
+}
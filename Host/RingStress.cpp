@@ -0,0 +1,214 @@
+//
+//  RingStress.cpp
+//  VoodooI2CELAN
+//
+//  Copyright © 2017 Kishor Prins. All rights reserved.
+//
+
+// Runs VoodooI2CELANFrameRing with the producer and the consumer on separate
+// threads, as the kext does with its two work loops, and checks that
+//
+//   every frame comes out in order and exactly as it went in
+//   every transition is dispatched, along with the frame right before it
+//
+// The consumer coalesces superseded motion frames like dispatch_frames() and
+// can be slowed down to stand in for a busy multitouch engine. Latency is
+// measured from push() to the frame being dispatched.
+//
+// usage: elan_ring_stress [--frames N] [--depth N] [--rate HZ] [--consumer-delay-us N] [--seed N]
+//
+//   --rate               reports per second offered by the producer, 0 pushes as fast as possible
+//   --consumer-delay-us  time the consumer spends on each dispatched frame
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+#include "VoodooI2CELANFrameRing.hpp"
+
+#include "SyntheticReports.hpp"
+
+static uint64_t host_ns() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static void spin_until(uint64_t deadline_ns) {
+    while (host_ns() < deadline_ns) {
+    }
+}
+
+static uint64_t percentile(const std::vector<uint64_t>& sorted, double p) {
+    if (sorted.empty())
+        return 0;
+    return sorted[static_cast<size_t>(p * (sorted.size() - 1) + 0.5)];
+}
+
+struct ConsumerResult {
+    ConsumerResult() : popped(0), dispatched(0), coalesced(0), transitions(0), corrupted(0), out_of_order(0), missing_before_transition(0) {}
+
+    uint64_t popped;
+    uint64_t dispatched;
+    uint64_t coalesced;
+    uint64_t transitions;
+    uint64_t corrupted;
+    uint64_t out_of_order;
+    uint64_t missing_before_transition;
+    std::vector<uint64_t> latencies;
+};
+
+int main(int argc, char** argv) {
+    size_t frames = 2000000;
+    uint32_t depth = ELAN_FRAME_RING_DEPTH;
+    uint32_t rate = 0;
+    uint32_t consumer_delay_us = 0;
+    uint32_t seed = 0x5D5D5D5D;
+
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "--frames") && i + 1 < argc)
+            frames = strtoull(argv[++i], NULL, 0);
+        else if (!strcmp(argv[i], "--depth") && i + 1 < argc)
+            depth = static_cast<uint32_t>(strtoul(argv[++i], NULL, 0));
+        else if (!strcmp(argv[i], "--rate") && i + 1 < argc)
+            rate = static_cast<uint32_t>(strtoul(argv[++i], NULL, 0));
+        else if (!strcmp(argv[i], "--consumer-delay-us") && i + 1 < argc)
+            consumer_delay_us = static_cast<uint32_t>(strtoul(argv[++i], NULL, 0));
+        else if (!strcmp(argv[i], "--seed") && i + 1 < argc)
+            seed = static_cast<uint32_t>(strtoul(argv[++i], NULL, 0));
+        else {
+            fprintf(stderr, "usage: %s [--frames N] [--depth N] [--rate HZ] [--consumer-delay-us N] [--seed N]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    // decode everything up front so the producer thread only pushes
+    std::vector<TraceRecord> records;
+    synthesize_session(seed, frames, 100, 0, &records);
+
+    VoodooI2CELANDecodeContext context;
+    context.logical_max_x = 3200;
+    context.logical_max_y = 2000;
+    context.pressure_adjustment = ETP_PRESSURE_OFFSET;
+    context.width_per_trace_x = 3;
+    context.width_per_trace_y = 3;
+    context.invert_y = true;
+
+    std::vector<VoodooI2CELANFrame> source;
+    source.reserve(records.size());
+    for (size_t i = 0; i < records.size(); i++) {
+        VoodooI2CELANFrame frame;
+        memset(&frame, 0, sizeof(frame));
+        if (records[i].type != kTraceRecordReport ||
+            decode_ELAN_report(context, records[i].frame, &frame.report) != kVoodooI2CELANReportValid)
+            continue;
+        memcpy(frame.data, records[i].frame, sizeof(frame.data));
+        // the sequence number stands in for the interrupt time
+        frame.timestamp = source.size();
+        source.push_back(frame);
+    }
+    if (source.empty()) {
+        fprintf(stderr, "No valid reports\n");
+        return 1;
+    }
+
+    VoodooI2CELANFrameRing* ring = new VoodooI2CELANFrameRing();
+    ring->configure(depth);
+
+    std::atomic<bool> producer_done(false);
+    uint64_t pushed_transitions = 0;
+    ConsumerResult result;
+    result.latencies.reserve(source.size());
+
+    std::thread consumer([&]() {
+        VoodooI2CELANFrame frame;
+        bool superseded;
+        uint64_t last_popped = 0, last_dispatched = 0;
+        bool any_popped = false, any_dispatched = false;
+
+        for (;;) {
+            bool done = producer_done.load(std::memory_order_acquire);
+            if (!ring->pop(&frame, &superseded)) {
+                if (done)
+                    break;
+                ring->take_producer_wakeup();
+                std::this_thread::yield();
+                continue;
+            }
+            result.popped++;
+
+            uint64_t index = frame.timestamp;
+            if (index >= source.size() || memcmp(frame.data, source[index].data, sizeof(frame.data)) ||
+                memcmp(&frame.report, &source[index].report, sizeof(frame.report))) {
+                result.corrupted++;
+                continue;
+            }
+            if (any_popped && index <= last_popped)
+                result.out_of_order++;
+            last_popped = index;
+            any_popped = true;
+
+            if (superseded && !frame.transition) {
+                result.coalesced++;
+                continue;
+            }
+
+            if (frame.transition) {
+                result.transitions++;
+                if (index > 0 && (!any_dispatched || last_dispatched != index - 1))
+                    result.missing_before_transition++;
+            }
+            if (consumer_delay_us)
+                spin_until(host_ns() + consumer_delay_us * 1000ULL);
+            result.latencies.push_back(host_ns() - frame.times.entry_ns);
+            result.dispatched++;
+            last_dispatched = index;
+            any_dispatched = true;
+        }
+    });
+
+    uint64_t begin = host_ns();
+    for (size_t i = 0; i < source.size(); i++) {
+        if (rate)
+            spin_until(begin + i * 1000000000ULL / rate);
+
+        VoodooI2CELANFrame& frame = source[i];
+        frame.times.entry_ns = host_ns();
+        // what the kext does with a held frame, minus the wait for the next interrupt
+        while (ring->push(&frame) == kVoodooI2CELANFrameFull)
+            std::this_thread::yield();
+        if (frame.transition)
+            pushed_transitions++;
+    }
+    uint64_t produced_ns = host_ns() - begin;
+    producer_done.store(true, std::memory_order_release);
+    consumer.join();
+    uint64_t consumed_ns = host_ns() - begin;
+
+    std::sort(result.latencies.begin(), result.latencies.end());
+    printf("ring:         depth %u, %zu frames, %s, consumer delay %u us\n", ring->depth(), source.size(),
+           rate ? "paced" : "unpaced", consumer_delay_us);
+    printf("producer:     %.0f frames/sec, %llu dropped, %llu pushes found the ring full, high water %u\n",
+           source.size() / (produced_ns / 1e9), static_cast<unsigned long long>(ring->dropped),
+           static_cast<unsigned long long>(ring->full), ring->high_water);
+    printf("consumer:     %.0f frames/sec, %llu popped, %llu dispatched, %llu coalesced\n",
+           result.popped / (consumed_ns / 1e9), static_cast<unsigned long long>(result.popped),
+           static_cast<unsigned long long>(result.dispatched), static_cast<unsigned long long>(result.coalesced));
+    printf("latency (us): p50 %.2f p99 %.2f p99.9 %.2f max %.2f\n",
+           percentile(result.latencies, 0.50) / 1e3, percentile(result.latencies, 0.99) / 1e3,
+           percentile(result.latencies, 0.999) / 1e3, result.latencies.empty() ? 0.0 : result.latencies.back() / 1e3);
+    printf("transitions:  %llu pushed, %llu dispatched, %llu without the frame before them\n",
+           static_cast<unsigned long long>(pushed_transitions), static_cast<unsigned long long>(result.transitions),
+           static_cast<unsigned long long>(result.missing_before_transition));
+    printf("integrity:    %llu corrupted, %llu out of order\n",
+           static_cast<unsigned long long>(result.corrupted), static_cast<unsigned long long>(result.out_of_order));
+
+    bool ok = !result.corrupted && !result.out_of_order && !result.missing_before_transition &&
+              result.transitions == pushed_transitions;
+    delete ring;
+    printf("%s\n", ok ? "PASS" : "FAIL");
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,143 @@
+//
+//  StreamTool.cpp
+//  VoodooI2CELAN
+//
+//  Copyright © 2017 Kishor Prins. All rights reserved.
+//
+
+// Reads the raw report stream from a file shared with elan_replay --stream,
+// printing every entry or summing them up, and optionally saving the reports
+// as a trace elan_replay can play back
+//
+// usage: elan_stream <stream> [--follow] [--oldest] [--dump] [--trace out]
+//
+//   --follow  keep reading until the producer closes the stream
+//   --oldest  start at the oldest entry still in the ring instead of the next one published
+//   --dump    print every entry, raw bytes and decoded contacts
+//   --trace   write every report read to a trace
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <thread>
+
+#include "RawStreamReader.hpp"
+#include "Trace.hpp"
+
+static void dump_entry(const VoodooI2CELANRawStreamEntry& entry) {
+    printf("%llu %llu.%09llu +%lluus st %u ", static_cast<unsigned long long>(entry.sequence - 1),
+           static_cast<unsigned long long>(entry.interrupt_ns / 1000000000ULL),
+           static_cast<unsigned long long>(entry.interrupt_ns % 1000000000ULL),
+           static_cast<unsigned long long>((entry.read_ns - entry.interrupt_ns) / 1000), entry.status);
+    for (int i = 0; i < ETP_MAX_REPORT_LEN; i++)
+        printf("%02x", entry.data[i]);
+    if (entry.button)
+        printf(" button");
+    if (entry.hover)
+        printf(" hover");
+    for (int slot = 0; slot < ETP_MAX_FINGERS; slot++) {
+        if (!(entry.contact_mask & (1U << slot)))
+            continue;
+        const VoodooI2CELANRawStreamContact& contact = entry.contacts[slot];
+        printf(" [%d] %u,%u p%u", slot, contact.x, contact.y, contact.pressure);
+    }
+    printf("\n");
+}
+
+int main(int argc, char** argv) {
+    const char* path = NULL;
+    const char* trace_path = NULL;
+    bool follow = false;
+    bool oldest = false;
+    bool dump = false;
+    bool usage = false;
+
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "--follow"))
+            follow = true;
+        else if (!strcmp(argv[i], "--oldest"))
+            oldest = true;
+        else if (!strcmp(argv[i], "--dump"))
+            dump = true;
+        else if (!strcmp(argv[i], "--trace") && i + 1 < argc)
+            trace_path = argv[++i];
+        else if (argv[i][0] != '-' && !path)
+            path = argv[i];
+        else
+            usage = true;
+    }
+    if (!path || usage) {
+        fprintf(stderr, "usage: %s <stream> [--follow] [--oldest] [--dump] [--trace out]\n", argv[0]);
+        return 1;
+    }
+
+    size_t length;
+    void* memory = map_raw_stream_file(path, &length);
+    if (!memory) {
+        fprintf(stderr, "Could not map %s\n", path);
+        return 1;
+    }
+    RawStreamReader reader;
+    if (!reader.open(memory, length, oldest)) {
+        fprintf(stderr, "Could not read stream %s: %s\n", path, reader.error);
+        unmap_raw_stream_file(memory, length);
+        return 1;
+    }
+    TraceWriter writer;
+    if (trace_path && !writer.open(trace_path)) {
+        fprintf(stderr, "Could not create %s\n", trace_path);
+        unmap_raw_stream_file(memory, length);
+        return 1;
+    }
+
+    uint64_t statuses[5] = { 0 };
+    uint64_t contacts = 0, waits = 0;
+    uint64_t first_ns = 0, last_ns = 0;
+    VoodooI2CELANRawStreamEntry entry;
+    for (;;) {
+        RawStreamRead result = reader.read(&entry);
+        if (result == kRawStreamClosed || (result == kRawStreamEmpty && !follow))
+            break;
+        if (result == kRawStreamEmpty) {
+            // a file has no notification port, poll until the producer has caught up with the flag
+            waits++;
+            if (reader.prepare_wait()) {
+                while (!reader.backlog() && !reader.closed())
+                    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            }
+            continue;
+        }
+
+        if (reader.read_entries == 1)
+            first_ns = entry.interrupt_ns;
+        last_ns = entry.interrupt_ns;
+        if (entry.status < sizeof(statuses) / sizeof(statuses[0]))
+            statuses[entry.status]++;
+        for (int slot = 0; slot < ETP_MAX_FINGERS; slot++)
+            contacts += (entry.contact_mask >> slot) & 1;
+        if (dump)
+            dump_entry(entry);
+        if (trace_path && !writer.write_report(entry.interrupt_ns, entry.data)) {
+            fprintf(stderr, "Write to %s failed\n", trace_path);
+            break;
+        }
+    }
+    writer.close();
+
+    double seconds = (last_ns - first_ns) / 1e9;
+    printf("entries:   %llu read, %llu lost to the producer lapping the reader, %llu waits\n",
+           static_cast<unsigned long long>(reader.read_entries), static_cast<unsigned long long>(reader.lost),
+           static_cast<unsigned long long>(waits));
+    printf("reports:   %llu valid, %llu filler, %llu empty, %llu short, %llu invalid, %llu contacts\n",
+           static_cast<unsigned long long>(statuses[kVoodooI2CELANReportValid]),
+           static_cast<unsigned long long>(statuses[kVoodooI2CELANReportFiller]),
+           static_cast<unsigned long long>(statuses[kVoodooI2CELANReportEmpty]),
+           static_cast<unsigned long long>(statuses[kVoodooI2CELANReportShort]),
+           static_cast<unsigned long long>(statuses[kVoodooI2CELANReportInvalid]),
+           static_cast<unsigned long long>(contacts));
+    if (seconds > 0)
+        printf("rate:      %.1f reports/sec over %.2f s\n", (reader.read_entries - 1) / seconds, seconds);
+    unmap_raw_stream_file(memory, length);
+    return 0;
+}
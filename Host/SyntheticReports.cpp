@@ -0,0 +1,256 @@
+//
+//  SyntheticReports.cpp
+//  VoodooI2CELAN
+//
+//  Copyright © 2017 Kishor Prins. All rights reserved.
+//
+
+#include "SyntheticReports.hpp"
+
+#include <cstring>
+
+// matches the geometry served by MockNub::load_default_registers()
+static const int kSyntheticMaxX = 3056;
+static const int kSyntheticMaxY = 1740;
+
+uint32_t synthetic_random(uint32_t* state) {
+    uint32_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    *state = x;
+    return x;
+}
+
+static int random_range(uint32_t* seed, int low, int high) {
+    return low + static_cast<int>(synthetic_random(seed) % static_cast<uint32_t>(high - low + 1));
+}
+
+static uint16_t clamp_axis(int value, int max) {
+    if (value < 0)
+        return 0;
+    if (value > max)
+        return static_cast<uint16_t>(max);
+    return static_cast<uint16_t>(value);
+}
+
+void encode_ELAN_report(bool button, uint8_t contact_mask, const SyntheticContact* contacts, uint8_t* report) {
+    memset(report, 0, ETP_MAX_REPORT_LEN);
+    report[0] = ETP_MAX_REPORT_LEN;
+    report[ETP_REPORT_ID_OFFSET] = ETP_REPORT_ID;
+
+    uint8_t tp_info = button ? 0x01 : 0x00;
+    uint8_t* finger_data = &report[ETP_FINGER_DATA_OFFSET];
+    for (int i = 0; i < ETP_MAX_FINGERS; i++) {
+        if (!(contact_mask & (1U << i)))
+            continue;
+        const SyntheticContact& contact = contacts[i];
+        tp_info |= 1U << (3 + i);
+        finger_data[0] = ((contact.x >> 4) & 0xf0) | ((contact.y >> 8) & 0x0f);
+        finger_data[1] = contact.x & 0xff;
+        finger_data[2] = contact.y & 0xff;
+        finger_data[3] = (contact.mk_x & 0x0f) | (contact.mk_y << 4);
+        finger_data[4] = contact.pressure;
+        finger_data += ETP_FINGER_DATA_LEN;
+    }
+    report[ETP_TOUCH_INFO_OFFSET] = tp_info;
+}
+
+void make_random_report(uint32_t* seed, uint8_t* report) {
+    if ((synthetic_random(seed) & 63) == 0) {
+        memset(report, 0, ETP_MAX_REPORT_LEN);
+        report[0] = ETP_MAX_REPORT_LEN;
+        report[ETP_REPORT_ID_OFFSET] = 0xFF;
+        return;
+    }
+
+    SyntheticContact contacts[ETP_MAX_FINGERS];
+    uint8_t mask = 0;
+    for (int i = 0; i < ETP_MAX_FINGERS; i++) {
+        if (synthetic_random(seed) & 1)
+            continue;
+        mask |= 1U << i;
+        contacts[i].x = synthetic_random(seed) & 0x0fff;
+        contacts[i].y = synthetic_random(seed) & 0x0fff;
+        contacts[i].pressure = synthetic_random(seed) & 0xff;
+        contacts[i].mk_x = synthetic_random(seed) & 0x0f;
+        contacts[i].mk_y = synthetic_random(seed) & 0x0f;
+    }
+    encode_ELAN_report(synthetic_random(seed) & 1, mask, contacts, report);
+}
+
+namespace {
+
+class SessionBuilder {
+ public:
+    SessionBuilder(uint32_t seed, size_t frames, uint32_t rate_hz, std::vector<TraceRecord>* records) :
+        seed(seed ? seed : 1), frames(frames), interval_ns(1000000000ULL / (rate_hz ? rate_hz : 100)),
+        now_ns(1000000000ULL), records(records) {}
+
+    bool full() const { return records->size() >= frames; }
+
+    void idle(uint64_t ns) { now_ns += ns; }
+
+    void emit(bool button, uint8_t mask, const SyntheticContact* contacts) {
+        if (full())
+            return;
+
+        // the device clock is not perfect, allow for +-3% jitter per report
+        int64_t jitter = static_cast<int64_t>(interval_ns) * random_range(&seed, -30, 30) / 1000;
+        now_ns += interval_ns + jitter;
+
+        TraceRecord record;
+        record.timestamp_ns = now_ns;
+        record.type = kTraceRecordReport;
+        record.status = kIOReturnSuccess;
+        if (random_range(&seed, 0, 199) == 0) {
+            memset(record.frame, 0, sizeof(record.frame));
+            record.frame[0] = ETP_MAX_REPORT_LEN;
+            record.frame[ETP_REPORT_ID_OFFSET] = 0xFF;
+        } else {
+            encode_ELAN_report(button, mask, contacts, record.frame);
+        }
+        records->push_back(record);
+    }
+
+    void lift() {
+        SyntheticContact none[ETP_MAX_FINGERS];
+        memset(none, 0, sizeof(none));
+        emit(false, 0, none);
+    }
+
+    // a finger above the pad without touching it, the last report tells it has gone
+    void hover(uint32_t count, bool leave) {
+        SyntheticContact none[ETP_MAX_FINGERS];
+        memset(none, 0, sizeof(none));
+        for (uint32_t i = 0; i < count && !full(); i++) {
+            emit(false, 0, none);
+            if (records->back().frame[ETP_REPORT_ID_OFFSET] == ETP_REPORT_ID)
+                records->back().frame[ETP_HOVER_INFO_OFFSET] = ETP_HOVER_EVENT;
+        }
+        if (leave)
+            emit(false, 0, none);
+    }
+
+    uint32_t seed;
+    size_t frames;
+    uint64_t interval_ns;
+    uint64_t now_ns;
+    std::vector<TraceRecord>* records;
+};
+
+SyntheticContact finger_at(uint32_t* seed) {
+    SyntheticContact contact;
+    contact.x = static_cast<uint16_t>(random_range(seed, 200, kSyntheticMaxX - 200));
+    contact.y = static_cast<uint16_t>(random_range(seed, 200, kSyntheticMaxY - 200));
+    contact.pressure = static_cast<uint8_t>(random_range(seed, 20, 50));
+    contact.mk_x = static_cast<uint8_t>(random_range(seed, 2, 4));
+    contact.mk_y = static_cast<uint8_t>(random_range(seed, 2, 4));
+    return contact;
+}
+
+void jitter(uint32_t* seed, SyntheticContact* contact, int amount) {
+    contact->x = clamp_axis(contact->x + random_range(seed, -amount, amount), kSyntheticMaxX);
+    contact->y = clamp_axis(contact->y + random_range(seed, -amount, amount), kSyntheticMaxY);
+}
+
+void move(SyntheticContact* contact, int dx, int dy) {
+    contact->x = clamp_axis(contact->x + dx, kSyntheticMaxX);
+    contact->y = clamp_axis(contact->y + dy, kSyntheticMaxY);
+}
+
+}  // namespace
+
+void synthesize_session(uint32_t seed, size_t frames, uint32_t rate_hz, uint32_t hover_frames, std::vector<TraceRecord>* records) {
+    SessionBuilder session(seed, frames, rate_hz, records);
+    SyntheticContact contacts[ETP_MAX_FINGERS];
+    memset(contacts, 0, sizeof(contacts));
+
+    while (!session.full()) {
+        int gesture = random_range(&session.seed, 0, 5);
+        // every gesture starts with the finger approaching the pad
+        if (gesture && hover_frames)
+            session.hover(hover_frames, false);
+
+        switch (gesture) {
+            case 0: {
+                // nobody touching, the device stays quiet
+                session.idle(static_cast<uint64_t>(random_range(&session.seed, 200, 2000)) * 1000000ULL);
+                break;
+            }
+            case 1: {
+                // tap, possibly a click
+                contacts[0] = finger_at(&session.seed);
+                bool click = random_range(&session.seed, 0, 3) == 0;
+                int length = random_range(&session.seed, 3, 8);
+                for (int i = 0; i < length; i++) {
+                    jitter(&session.seed, &contacts[0], 1);
+                    session.emit(click && i > 0 && i < length - 1, 0x01, contacts);
+                }
+                session.lift();
+                break;
+            }
+            case 2: {
+                // single finger pointer motion
+                contacts[0] = finger_at(&session.seed);
+                int dx = random_range(&session.seed, -20, 20);
+                int dy = random_range(&session.seed, -20, 20);
+                int length = random_range(&session.seed, 30, 150);
+                for (int i = 0; i < length; i++) {
+                    move(&contacts[0], dx, dy);
+                    jitter(&session.seed, &contacts[0], 1);
+                    session.emit(false, 0x01, contacts);
+                }
+                session.lift();
+                break;
+            }
+            case 3: {
+                // two finger scroll
+                contacts[0] = finger_at(&session.seed);
+                contacts[1] = contacts[0];
+                contacts[1].x = clamp_axis(contacts[0].x + 250, kSyntheticMaxX);
+                int dy = random_range(&session.seed, -25, 25);
+                int length = random_range(&session.seed, 30, 120);
+                for (int i = 0; i < length; i++) {
+                    move(&contacts[0], 0, dy);
+                    move(&contacts[1], 0, dy);
+                    session.emit(false, 0x03, contacts);
+                }
+                session.lift();
+                break;
+            }
+            case 4: {
+                // resting palm, mostly stationary with the odd count of noise
+                contacts[0] = finger_at(&session.seed);
+                contacts[0].pressure = 120;
+                contacts[0].mk_x = 9;
+                contacts[0].mk_y = 11;
+                int length = random_range(&session.seed, 50, 300);
+                for (int i = 0; i < length; i++) {
+                    if (random_range(&session.seed, 0, 7) == 0)
+                        jitter(&session.seed, &contacts[0], 2);
+                    session.emit(false, 0x01, contacts);
+                }
+                session.lift();
+                break;
+            }
+            case 5: {
+                // resting thumb while another finger moves
+                contacts[0] = finger_at(&session.seed);
+                contacts[1] = finger_at(&session.seed);
+                int dx = random_range(&session.seed, -15, 15);
+                int dy = random_range(&session.seed, -15, 15);
+                int length = random_range(&session.seed, 30, 150);
+                for (int i = 0; i < length; i++) {
+                    move(&contacts[1], dx, dy);
+                    session.emit(false, 0x03, contacts);
+                }
+                session.lift();
+                break;
+            }
+        }
+
+        if (gesture && hover_frames)
+            session.hover(random_range(&session.seed, 0, hover_frames), true);
+    }
+}
@@ -0,0 +1,48 @@
+//
+//  SyntheticReports.hpp
+//  VoodooI2CELAN
+//
+//  Copyright © 2017 Kishor Prins. All rights reserved.
+//
+
+#ifndef VOODOOI2C_ELAN_HOST_SYNTHETIC_REPORTS_HPP
+#define VOODOOI2C_ELAN_HOST_SYNTHETIC_REPORTS_HPP
+
+#include <vector>
+
+#include "Trace.hpp"
+
+/* Raw (device coordinate space) contact used to build reports */
+struct SyntheticContact {
+    uint16_t x;
+    uint16_t y;
+    uint8_t pressure;
+    uint8_t mk_x;
+    uint8_t mk_y;
+};
+
+/* xorshift32, good enough to spread contacts around the pad */
+uint32_t synthetic_random(uint32_t* state);
+
+/* Encodes a 34 byte report, the inverse of decode_ELAN_report()
+ * @button state of the physical button
+ * @contact_mask bit i set if slot i is touching
+ * @contacts contacts indexed by slot
+ * @report receives ETP_MAX_REPORT_LEN bytes
+ */
+void encode_ELAN_report(bool button, uint8_t contact_mask, const SyntheticContact* contacts, uint8_t* report);
+
+/* Builds a report with a random contact mask and random contact data, one in 64 is 0xFF filler */
+void make_random_report(uint32_t* seed, uint8_t* report);
+
+/* Generates a plausible session of taps, swipes, scrolls, resting palms and idle gaps
+ * @seed random seed
+ * @frames number of report records to generate
+ * @rate_hz the nominal report rate of the device
+ * @hover_frames hover reports sent before a finger lands, up to as many after it lifts, 0 for a
+ * device without hover
+ * @records receives the timestamped reports
+ */
+void synthesize_session(uint32_t seed, size_t frames, uint32_t rate_hz, uint32_t hover_frames, std::vector<TraceRecord>* records);
+
+#endif /* VOODOOI2C_ELAN_HOST_SYNTHETIC_REPORTS_HPP */
@@ -0,0 +1,169 @@
+//
+//  Trace.cpp
+//  VoodooI2CELAN
+//
+//  Copyright © 2017 Kishor Prins. All rights reserved.
+//
+
+#include "Trace.hpp"
+
+#include <cstring>
+
+static bool write_u16(FILE* file, uint16_t value) {
+    uint8_t bytes[2] = { static_cast<uint8_t>(value), static_cast<uint8_t>(value >> 8) };
+    return fwrite(bytes, 1, sizeof(bytes), file) == sizeof(bytes);
+}
+
+static bool write_u64(FILE* file, uint64_t value) {
+    uint8_t bytes[8];
+    for (int i = 0; i < 8; i++)
+        bytes[i] = static_cast<uint8_t>(value >> (8 * i));
+    return fwrite(bytes, 1, sizeof(bytes), file) == sizeof(bytes);
+}
+
+static bool write_varint(FILE* file, uint64_t value) {
+    uint8_t bytes[10];
+    size_t length = 0;
+    do {
+        uint8_t byte = value & 0x7f;
+        value >>= 7;
+        if (value)
+            byte |= 0x80;
+        bytes[length++] = byte;
+    } while (value);
+    return fwrite(bytes, 1, length, file) == length;
+}
+
+static bool read_varint(FILE* file, uint64_t* value) {
+    *value = 0;
+    for (int shift = 0; shift < 64; shift += 7) {
+        int byte = fgetc(file);
+        if (byte == EOF)
+            return false;
+        *value |= static_cast<uint64_t>(byte & 0x7f) << shift;
+        if (!(byte & 0x80))
+            return true;
+    }
+    return false;
+}
+
+bool TraceWriter::open(const char* path) {
+    close();
+    file = fopen(path, "wb");
+    started = false;
+    return file != NULL;
+}
+
+bool TraceWriter::write_record_header(uint64_t timestamp_ns, uint8_t type) {
+    if (!file)
+        return false;
+
+    if (!started) {
+        // the header carries the first timestamp so records only need deltas
+        if (fwrite(ELAN_TRACE_MAGIC, 1, 4, file) != 4
+            || !write_u16(file, ELAN_TRACE_VERSION)
+            || !write_u16(file, ETP_MAX_REPORT_LEN)
+            || !write_u64(file, timestamp_ns))
+            return false;
+        last_ns = timestamp_ns;
+        started = true;
+    }
+
+    uint64_t delta = timestamp_ns >= last_ns ? timestamp_ns - last_ns : 0;
+    last_ns += delta;
+    return write_varint(file, delta) && fputc(type, file) != EOF;
+}
+
+bool TraceWriter::write_report(uint64_t timestamp_ns, const uint8_t* frame) {
+    if (!write_record_header(timestamp_ns, kTraceRecordReport))
+        return false;
+    return fwrite(frame, 1, ETP_MAX_REPORT_LEN, file) == ETP_MAX_REPORT_LEN;
+}
+
+bool TraceWriter::write_read_error(uint64_t timestamp_ns, IOReturn status) {
+    if (!write_record_header(timestamp_ns, kTraceRecordReadError))
+        return false;
+    uint32_t value = static_cast<uint32_t>(status);
+    uint8_t bytes[4];
+    for (int i = 0; i < 4; i++)
+        bytes[i] = static_cast<uint8_t>(value >> (8 * i));
+    return fwrite(bytes, 1, sizeof(bytes), file) == sizeof(bytes);
+}
+
+void TraceWriter::close() {
+    if (file) {
+        fclose(file);
+        file = NULL;
+    }
+}
+
+bool TraceReader::open(const char* path) {
+    close();
+    file = fopen(path, "rb");
+    if (!file)
+        return false;
+
+    uint8_t header[16];
+    if (fread(header, 1, sizeof(header), file) != sizeof(header)
+        || memcmp(header, ELAN_TRACE_MAGIC, 4) != 0
+        || (header[4] | (header[5] << 8)) != ELAN_TRACE_VERSION
+        || (header[6] | (header[7] << 8)) != ETP_MAX_REPORT_LEN) {
+        close();
+        return false;
+    }
+
+    last_ns = 0;
+    for (int i = 0; i < 8; i++)
+        last_ns |= static_cast<uint64_t>(header[8 + i]) << (8 * i);
+    return true;
+}
+
+bool TraceReader::next(TraceRecord* record) {
+    if (!file)
+        return false;
+
+    uint64_t delta;
+    if (!read_varint(file, &delta))
+        return false;
+    int type = fgetc(file);
+    if (type == EOF)
+        return false;
+
+    last_ns += delta;
+    record->timestamp_ns = last_ns;
+    record->type = static_cast<uint8_t>(type);
+    record->status = kIOReturnSuccess;
+
+    switch (type) {
+        case kTraceRecordReport:
+            return fread(record->frame, 1, ETP_MAX_REPORT_LEN, file) == ETP_MAX_REPORT_LEN;
+        case kTraceRecordReadError: {
+            uint8_t bytes[4];
+            if (fread(bytes, 1, sizeof(bytes), file) != sizeof(bytes))
+                return false;
+            record->status = static_cast<IOReturn>(bytes[0] | (bytes[1] << 8) | (bytes[2] << 16) | (static_cast<uint32_t>(bytes[3]) << 24));
+            memset(record->frame, 0, sizeof(record->frame));
+            return true;
+        }
+        default:
+            return false;
+    }
+}
+
+void TraceReader::close() {
+    if (file) {
+        fclose(file);
+        file = NULL;
+    }
+}
+
+bool load_trace(const char* path, std::vector<TraceRecord>* records) {
+    TraceReader reader;
+    if (!reader.open(path))
+        return false;
+
+    TraceRecord record;
+    while (reader.next(&record))
+        records->push_back(record);
+    return true;
+}
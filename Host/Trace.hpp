@@ -0,0 +1,95 @@
+//
+//  Trace.hpp
+//  VoodooI2CELAN
+//
+//  Copyright © 2017 Kishor Prins. All rights reserved.
+//
+
+#ifndef VOODOOI2C_ELAN_HOST_TRACE_HPP
+#define VOODOOI2C_ELAN_HOST_TRACE_HPP
+
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include "VoodooI2CELANPortability.hpp"
+#include "VoodooI2CElanConstants.h"
+
+/* Binary record/replay format for ELAN report streams
+ *
+ * A trace starts with a 16 byte little endian header:
+ *
+ *   offset  size  field
+ *   0       4     magic "ELTR"
+ *   4       2     version (1)
+ *   6       2     frame length (34)
+ *   8       8     timestamp of the first record in ns
+ *
+ * followed by records of the form
+ *
+ *   varint  delta in ns from the previous record (LEB128)
+ *   u8      record type
+ *   ...     payload: frame length bytes for kTraceRecordReport,
+ *           a little endian int32 IOReturn for kTraceRecordReadError
+ *
+ * A typical 100Hz finger stream costs 38 bytes per report.
+ */
+
+#define ELAN_TRACE_MAGIC "ELTR"
+#define ELAN_TRACE_VERSION 1
+
+enum TraceRecordType {
+    kTraceRecordReport = 0,
+    kTraceRecordReadError = 1
+};
+
+struct TraceRecord {
+    uint64_t timestamp_ns;
+    uint8_t type;
+    IOReturn status;
+    uint8_t frame[ETP_MAX_REPORT_LEN];
+};
+
+class TraceWriter {
+ public:
+    TraceWriter() : file(NULL), last_ns(0), started(false) {}
+    ~TraceWriter() { close(); }
+
+    bool open(const char* path);
+    bool write_report(uint64_t timestamp_ns, const uint8_t* frame);
+    bool write_read_error(uint64_t timestamp_ns, IOReturn status);
+    void close();
+
+ private:
+    FILE* file;
+    uint64_t last_ns;
+    bool started;
+
+    bool write_record_header(uint64_t timestamp_ns, uint8_t type);
+};
+
+class TraceReader {
+ public:
+    TraceReader() : file(NULL), last_ns(0) {}
+    ~TraceReader() { close(); }
+
+    bool open(const char* path);
+    /* Reads the next record
+     *
+     * @return false at the end of the trace or on a malformed record
+     */
+    bool next(TraceRecord* record);
+    void close();
+
+ private:
+    FILE* file;
+    uint64_t last_ns;
+};
+
+/* Reads a whole trace into memory
+ *
+ * @return false if the trace could not be opened
+ */
+bool load_trace(const char* path, std::vector<TraceRecord>* records);
+
+#endif /* VOODOOI2C_ELAN_HOST_TRACE_HPP */
@@ -0,0 +1,134 @@
+//
+//  TraceTool.cpp
+//  VoodooI2CELAN
+//
+//  Copyright © 2017 Kishor Prins. All rights reserved.
+//
+
+// Creates and inspects ELAN report traces
+//
+// usage: elan_trace synth <out> [frames] [rate_hz] [seed]
+//        elan_trace dump <trace>
+//        elan_trace stats <trace>
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+#include "VoodooI2CELANReportDecoder.hpp"
+
+#include "SyntheticReports.hpp"
+#include "Trace.hpp"
+
+static int usage(const char* name) {
+    fprintf(stderr, "usage: %s synth <out> [frames] [rate_hz] [seed]\n", name);
+    fprintf(stderr, "       %s dump <trace>\n", name);
+    fprintf(stderr, "       %s stats <trace>\n", name);
+    return 1;
+}
+
+static int synth(int argc, char** argv) {
+    size_t frames = argc > 3 ? strtoull(argv[3], NULL, 0) : 100000;
+    uint32_t rate = argc > 4 ? static_cast<uint32_t>(strtoul(argv[4], NULL, 0)) : 100;
+    uint32_t seed = argc > 5 ? static_cast<uint32_t>(strtoul(argv[5], NULL, 0)) : 0x5D5D5D5D;
+
+    std::vector<TraceRecord> records;
+    synthesize_session(seed, frames, rate, 0, &records);
+
+    TraceWriter writer;
+    if (!writer.open(argv[2])) {
+        fprintf(stderr, "Could not create %s\n", argv[2]);
+        return 1;
+    }
+    for (size_t i = 0; i < records.size(); i++) {
+        if (!writer.write_report(records[i].timestamp_ns, records[i].frame)) {
+            fprintf(stderr, "Write to %s failed\n", argv[2]);
+            return 1;
+        }
+    }
+    writer.close();
+    printf("wrote %zu frames to %s\n", records.size(), argv[2]);
+    return 0;
+}
+
+static int dump(const char* path) {
+    TraceReader reader;
+    if (!reader.open(path)) {
+        fprintf(stderr, "Could not read trace %s\n", path);
+        return 1;
+    }
+
+    TraceRecord record;
+    while (reader.next(&record)) {
+        printf("%llu.%09llu ", static_cast<unsigned long long>(record.timestamp_ns / 1000000000ULL),
+               static_cast<unsigned long long>(record.timestamp_ns % 1000000000ULL));
+        if (record.type == kTraceRecordReadError) {
+            printf("read error 0x%08x\n", static_cast<uint32_t>(record.status));
+            continue;
+        }
+        for (int i = 0; i < ETP_MAX_REPORT_LEN; i++)
+            printf("%02x", record.frame[i]);
+        printf("\n");
+    }
+    return 0;
+}
+
+static int stats(const char* path) {
+    std::vector<TraceRecord> records;
+    if (!load_trace(path, &records) || records.empty()) {
+        fprintf(stderr, "Could not read trace %s\n", path);
+        return 1;
+    }
+
+    VoodooI2CELANDecodeContext context;
+    memset(&context, 0, sizeof(context));
+
+    uint64_t valid = 0, filler = 0, empty = 0, short_reads = 0, invalid = 0, errors = 0, contacts = 0;
+    VoodooI2CELANReport report;
+    for (size_t i = 0; i < records.size(); i++) {
+        if (records[i].type == kTraceRecordReadError) {
+            errors++;
+            continue;
+        }
+        switch (decode_ELAN_report(context, records[i].frame, &report)) {
+            case kVoodooI2CELANReportValid:
+                valid++;
+                contacts += report.contact_count;
+                break;
+            case kVoodooI2CELANReportFiller:
+                filler++;
+                break;
+            case kVoodooI2CELANReportEmpty:
+                empty++;
+                break;
+            case kVoodooI2CELANReportShort:
+                short_reads++;
+                break;
+            case kVoodooI2CELANReportInvalid:
+                invalid++;
+                break;
+        }
+    }
+
+    double seconds = (records.back().timestamp_ns - records.front().timestamp_ns) / 1e9;
+    printf("records:   %zu over %.2f s\n", records.size(), seconds);
+    printf("reports:   %llu valid, %llu filler, %llu empty, %llu short, %llu invalid, %llu read errors\n",
+           static_cast<unsigned long long>(valid), static_cast<unsigned long long>(filler), static_cast<unsigned long long>(empty),
+           static_cast<unsigned long long>(short_reads), static_cast<unsigned long long>(invalid), static_cast<unsigned long long>(errors));
+    printf("contacts:  %llu (%.2f per valid report)\n", static_cast<unsigned long long>(contacts),
+           valid ? static_cast<double>(contacts) / valid : 0.0);
+    return 0;
+}
+
+int main(int argc, char** argv) {
+    if (argc < 3)
+        return usage(argv[0]);
+    if (!strcmp(argv[1], "synth"))
+        return synth(argc, argv);
+    if (!strcmp(argv[1], "dump"))
+        return dump(argv[2]);
+    if (!strcmp(argv[1], "stats"))
+        return stats(argv[2]);
+    return usage(argv[0]);
+}
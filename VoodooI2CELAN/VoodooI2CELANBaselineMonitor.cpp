@@ -0,0 +1,280 @@
+//
+//  VoodooI2CELANBaselineMonitor.cpp
+//  VoodooI2CELAN
+//
+//  Copyright © 2017 Kishor Prins. All rights reserved.
+//
+
+#include "VoodooI2CELANBaselineMonitor.hpp"
+
+#include <string.h>
+
+// at least 1, the caller has to come back for anything already due
+static uint32_t ms_until(uint64_t now_ns, uint64_t when_ns) {
+    if (when_ns <= now_ns)
+        return 1;
+    uint64_t ms = (when_ns - now_ns + 999999) / 1000000;
+    return ms > UINT32_MAX ? UINT32_MAX : static_cast<uint32_t>(ms);
+}
+
+static uint16_t distance(uint16_t a, uint16_t b) {
+    return a > b ? a - b : b - a;
+}
+
+VoodooI2CELANBaselineMonitor::VoodooI2CELANBaselineMonitor() :
+    interval_ms(0),
+    drift_threshold(0),
+    quiet_ms(0),
+    has_reference(false),
+    reference_min(0),
+    reference_max(0),
+    samples(0),
+    aborted_samples(0),
+    failed_calibrations(0),
+    bus_errors(0),
+    max_drift(0),
+    calibration_mode_ns(0),
+    last_calibration_ns(0),
+    last_calibration_reason(kVoodooI2CELANCalibrationRequested),
+    protocol(NULL),
+    current(kVoodooI2CELANBaselineIdle),
+    running(false),
+    pending(false),
+    pending_reason(kVoodooI2CELANCalibrationRequested),
+    calibrating_reason(kVoodooI2CELANCalibrationRequested),
+    spoiled(false),
+    tries(0),
+    last_report_ns(0),
+    next_sample_ns(0),
+    mode_begin_ns(0),
+    entries_written(0) {
+    memset(calibrations, 0, sizeof(calibrations));
+    memset(entries, 0, sizeof(entries));
+}
+
+void VoodooI2CELANBaselineMonitor::configure(uint32_t interval_ms, uint32_t drift_threshold, uint32_t quiet_ms) {
+    this->interval_ms = interval_ms;
+    this->drift_threshold = drift_threshold;
+    this->quiet_ms = quiet_ms;
+}
+
+void VoodooI2CELANBaselineMonitor::begin(VoodooI2CELANProtocol* protocol, uint64_t now_ns) {
+    this->protocol = protocol;
+    current = kVoodooI2CELANBaselineIdle;
+    running = true;
+    // the device has only just come up, give it the same quiet time as after a report
+    last_report_ns = now_ns;
+}
+
+void VoodooI2CELANBaselineMonitor::cancel() {
+    // a calibration that was cut short still has to happen
+    if (current == kVoodooI2CELANBaselineCalibrating) {
+        pending = true;
+        pending_reason = calibrating_reason;
+    }
+    current = kVoodooI2CELANBaselineIdle;
+    running = false;
+}
+
+void VoodooI2CELANBaselineMonitor::report_received(uint64_t now_ns, bool activity) {
+    if (!activity)
+        return;
+    last_report_ns = now_ns;
+    if (current != kVoodooI2CELANBaselineIdle)
+        spoiled = true;
+}
+
+void VoodooI2CELANBaselineMonitor::request_calibration() {
+    pending = true;
+    pending_reason = kVoodooI2CELANCalibrationRequested;
+}
+
+VoodooI2CELANBaselineEvent VoodooI2CELANBaselineMonitor::tick(uint64_t now_ns, bool available, uint32_t* delay_ms) {
+    *delay_ms = 0;
+    if (!running)
+        return kVoodooI2CELANBaselineNone;
+
+    switch (current) {
+        case kVoodooI2CELANBaselineIdle: {
+            uint64_t due_ns = next_due_ns();
+            if (due_ns == UINT64_MAX)
+                return kVoodooI2CELANBaselineNone;
+            if (!available) {
+                // asleep or touched, look again later rather than spinning on it
+                uint32_t retry = quiet_ms > ELAN_BASELINE_SETTLE ? quiet_ms : ELAN_BASELINE_SETTLE;
+                uint32_t delay = ms_until(now_ns, due_ns);
+                *delay_ms = delay > retry ? delay : retry;
+                return kVoodooI2CELANBaselineNone;
+            }
+            if (due_ns > now_ns) {
+                *delay_ms = ms_until(now_ns, due_ns);
+                return kVoodooI2CELANBaselineNone;
+            }
+
+            bool calibrate = pending && (pending_reason == kVoodooI2CELANCalibrationRequested || !last_calibration_ns ||
+                                         now_ns >= last_calibration_ns + ELAN_CALIBRATION_HOLDOFF * 1000000ULL);
+            if (!enter_calibration_mode(now_ns))
+                return fail(now_ns, delay_ms);
+            if (calibrate) {
+                if (protocol->start_calibration() != kIOReturnSuccess) {
+                    leave_calibration_mode(now_ns);
+                    return fail(now_ns, delay_ms);
+                }
+                current = kVoodooI2CELANBaselineCalibrating;
+                calibrating_reason = pending_reason;
+                pending = false;
+                tries = 0;
+            } else {
+                current = kVoodooI2CELANBaselineSampling;
+            }
+            *delay_ms = ELAN_BASELINE_SETTLE;
+            return kVoodooI2CELANBaselineNone;
+        }
+
+        case kVoodooI2CELANBaselineSampling: {
+            uint16_t max_baseline = 0, min_baseline = 0;
+            bool read = spoiled || (protocol->read_baseline(true, &max_baseline) == kIOReturnSuccess &&
+                                    protocol->read_baseline(false, &min_baseline) == kIOReturnSuccess);
+            if (!leave_calibration_mode(now_ns) || !read)
+                return fail(now_ns, delay_ms);
+
+            if (spoiled) {
+                aborted_samples++;
+                *delay_ms = next_delay_ms(now_ns);
+                return kVoodooI2CELANBaselineAborted;
+            }
+            record_sample(now_ns, min_baseline, max_baseline);
+            *delay_ms = next_delay_ms(now_ns);
+            return kVoodooI2CELANBaselineSampled;
+        }
+
+        case kVoodooI2CELANBaselineCalibrating: {
+            bool still_busy = true;
+            if (protocol->read_calibration_result(&still_busy) != kIOReturnSuccess) {
+                pending = true;
+                pending_reason = calibrating_reason;
+                leave_calibration_mode(now_ns);
+                return fail(now_ns, delay_ms);
+            }
+            if (still_busy && ++tries < ELAN_CALIBRATION_TRIES) {
+                *delay_ms = ELAN_BASELINE_SETTLE;
+                return kVoodooI2CELANBaselineNone;
+            }
+            if (!leave_calibration_mode(now_ns))
+                return fail(now_ns, delay_ms);
+
+            last_calibration_ns = now_ns;
+            if (still_busy) {
+                failed_calibrations++;
+                *delay_ms = next_delay_ms(now_ns);
+                return kVoodooI2CELANBaselineCalibrationFailed;
+            }
+            calibrations[calibrating_reason]++;
+            last_calibration_reason = calibrating_reason;
+            // a finger on the pad is part of the new baselines now, do it again once it is gone
+            if (spoiled) {
+                pending = true;
+                pending_reason = calibrating_reason;
+            }
+            // the next sample becomes the reference
+            has_reference = false;
+            next_sample_ns = 0;
+            *delay_ms = next_delay_ms(now_ns);
+            return kVoodooI2CELANBaselineCalibrated;
+        }
+
+        case kVoodooI2CELANBaselineStateCount:
+            break;
+    }
+    return kVoodooI2CELANBaselineNone;
+}
+
+bool VoodooI2CELANBaselineMonitor::enter_calibration_mode(uint64_t now_ns) {
+    spoiled = false;
+    mode_begin_ns = now_ns;
+    return protocol->set_calibration_mode(true) == kIOReturnSuccess;
+}
+
+bool VoodooI2CELANBaselineMonitor::leave_calibration_mode(uint64_t now_ns) {
+    calibration_mode_ns += now_ns - mode_begin_ns;
+    current = kVoodooI2CELANBaselineIdle;
+    return protocol->set_calibration_mode(false) == kIOReturnSuccess;
+}
+
+VoodooI2CELANBaselineEvent VoodooI2CELANBaselineMonitor::fail(uint64_t now_ns, uint32_t* delay_ms) {
+    // whatever mode the device was left in, the watchdog takes over if it stops reporting
+    bus_errors++;
+    current = kVoodooI2CELANBaselineIdle;
+    if (interval_ms)
+        next_sample_ns = now_ns + interval_ms * 1000000ULL;
+    *delay_ms = next_delay_ms(now_ns);
+    return kVoodooI2CELANBaselineBusError;
+}
+
+void VoodooI2CELANBaselineMonitor::record_sample(uint64_t now_ns, uint16_t min_baseline, uint16_t max_baseline) {
+    VoodooI2CELANBaselineSample& sample = entries[entries_written++ % ELAN_BASELINE_HISTORY];
+    sample.timestamp_ns = now_ns;
+    sample.min_baseline = min_baseline;
+    sample.max_baseline = max_baseline;
+    sample.reference = !has_reference;
+    samples++;
+    next_sample_ns = now_ns + interval_ms * 1000000ULL;
+
+    if (!has_reference) {
+        has_reference = true;
+        reference_min = min_baseline;
+        reference_max = max_baseline;
+        sample.drift = 0;
+        return;
+    }
+
+    uint16_t low_drift = distance(min_baseline, reference_min);
+    uint16_t high_drift = distance(max_baseline, reference_max);
+    sample.drift = low_drift > high_drift ? low_drift : high_drift;
+    if (sample.drift > max_drift)
+        max_drift = sample.drift;
+    if (drift_threshold && sample.drift > drift_threshold && !pending) {
+        pending = true;
+        pending_reason = kVoodooI2CELANCalibrationDrift;
+    }
+}
+
+uint64_t VoodooI2CELANBaselineMonitor::next_due_ns() const {
+    uint64_t due_ns = UINT64_MAX;
+
+    if (pending) {
+        due_ns = 0;
+        // drift waits out the holdoff, though the samples carry on meanwhile
+        if (pending_reason == kVoodooI2CELANCalibrationDrift && last_calibration_ns)
+            due_ns = last_calibration_ns + ELAN_CALIBRATION_HOLDOFF * 1000000ULL;
+    }
+    if (interval_ms && next_sample_ns < due_ns)
+        due_ns = next_sample_ns;
+    if (due_ns == UINT64_MAX)
+        return due_ns;
+
+    uint64_t quiet_until = last_report_ns + quiet_ms * 1000000ULL;
+    return due_ns > quiet_until ? due_ns : quiet_until;
+}
+
+uint32_t VoodooI2CELANBaselineMonitor::next_delay_ms(uint64_t now_ns) const {
+    uint64_t due_ns = next_due_ns();
+    return due_ns == UINT64_MAX ? 0 : ms_until(now_ns, due_ns);
+}
+
+uint32_t VoodooI2CELANBaselineMonitor::history_count() const {
+    return entries_written < ELAN_BASELINE_HISTORY ? static_cast<uint32_t>(entries_written) : ELAN_BASELINE_HISTORY;
+}
+
+const VoodooI2CELANBaselineSample& VoodooI2CELANBaselineMonitor::history(uint32_t index) const {
+    return entries[(entries_written - history_count() + index) % ELAN_BASELINE_HISTORY];
+}
+
+const char* VoodooI2CELANBaselineMonitor::reason_name(VoodooI2CELANCalibrationReason reason) {
+    switch (reason) {
+        case kVoodooI2CELANCalibrationRequested: return "Requested";
+        case kVoodooI2CELANCalibrationDrift: return "Drift";
+        case kVoodooI2CELANCalibrationReasonCount: break;
+    }
+    return "Unknown";
+}
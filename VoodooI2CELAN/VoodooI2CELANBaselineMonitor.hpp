@@ -0,0 +1,170 @@
+//
+//  VoodooI2CELANBaselineMonitor.hpp
+//  VoodooI2CELAN
+//
+//  Copyright © 2017 Kishor Prins. All rights reserved.
+//
+
+#ifndef VOODOOI2C_ELAN_BASELINE_MONITOR_HPP
+#define VOODOOI2C_ELAN_BASELINE_MONITOR_HPP
+
+#include <stdint.h>
+
+#include "VoodooI2CELANProtocol.hpp"
+
+#define ELAN_BASELINE_HISTORY 32
+// Time in calibration mode before the baselines can be read, and between checks on a calibration (as Linux waits)
+#define ELAN_BASELINE_SETTLE 250
+// Checks before a calibration that has not finished is given up on
+#define ELAN_CALIBRATION_TRIES 20
+// Minimum time between two calibrations started because of drift
+#define ELAN_CALIBRATION_HOLDOFF 600000
+
+enum VoodooI2CELANBaselineState {
+    kVoodooI2CELANBaselineIdle = 0,      // waiting for the next sample
+    kVoodooI2CELANBaselineSampling,      // in calibration mode, waiting to read the baselines
+    kVoodooI2CELANBaselineCalibrating,   // waiting for the device to finish calibrating
+    kVoodooI2CELANBaselineStateCount
+};
+
+enum VoodooI2CELANCalibrationReason {
+    kVoodooI2CELANCalibrationRequested = 0,  // asked for from user space
+    kVoodooI2CELANCalibrationDrift,          // the baselines drifted past the threshold
+    kVoodooI2CELANCalibrationReasonCount
+};
+
+/* What a tick() did, for the driver to publish */
+enum VoodooI2CELANBaselineEvent {
+    kVoodooI2CELANBaselineNone = 0,
+    kVoodooI2CELANBaselineSampled,
+    kVoodooI2CELANBaselineAborted,            // a finger showed up while sampling
+    kVoodooI2CELANBaselineCalibrated,
+    kVoodooI2CELANBaselineCalibrationFailed,  // the device was still calibrating after ELAN_CALIBRATION_TRIES checks
+    kVoodooI2CELANBaselineBusError
+};
+
+struct VoodooI2CELANBaselineSample {
+    uint64_t timestamp_ns;
+    uint16_t min_baseline;
+    uint16_t max_baseline;
+    // against the reference, 0 for the sample that became the reference
+    uint16_t drift;
+    bool reference;
+};
+
+/* Watches the sensor baselines for drift and recalibrates the device
+ *
+ * Every interval_ms, once nothing has been reported for quiet_ms, the device
+ * is put into calibration mode long enough to read its lowest and highest
+ * baseline. The first sample after a calibration is the reference, the drift
+ * of every later one is how far either baseline has moved away from it. Once
+ * the drift exceeds drift_threshold the device is recalibrated, at most once
+ * per ELAN_CALIBRATION_HOLDOFF, and user space can ask for a calibration at
+ * any time. A report while sampling throws the sample away, a finger on the
+ * pad while calibrating has the calibration run again.
+ *
+ * Like the init sequencer the monitor never sleeps, tick() says how long the
+ * caller should wait before calling it again.
+ */
+
+class VoodooI2CELANBaselineMonitor {
+ public:
+    VoodooI2CELANBaselineMonitor();
+
+    /* Sets the schedule
+     * @interval_ms time between samples, 0 only calibrates on request
+     * @drift_threshold drift that has the device recalibrated, 0 never does
+     * @quiet_ms time without reports before the device may be sampled
+     */
+    void configure(uint32_t interval_ms, uint32_t drift_threshold, uint32_t quiet_ms);
+    /* Starts monitoring, e.g. once the device is ready for input, the reference is kept
+     * @protocol the protocol to talk to the device with
+     * @now_ns the current time
+     */
+    void begin(VoodooI2CELANProtocol* protocol, uint64_t now_ns);
+    /* Abandons a sample or calibration in progress without talking to the device,
+     * e.g. because it is about to be reset or put to sleep
+     */
+    void cancel();
+
+    /* Accounts for a report
+     * @now_ns when the report was read
+     * @activity whether anything touches or hovers above the pad
+     */
+    void report_received(uint64_t now_ns, bool activity);
+    /* Calibrates the next time the pad is quiet */
+    void request_calibration();
+    /* Samples the next time the pad is quiet, e.g. because a contact got stuck */
+    void sample_soon() { next_sample_ns = 0; }
+
+    /* Runs the schedule
+     * @now_ns the current time
+     * @available whether the device may be sampled now, i.e. it is awake and nothing touches it
+     * @delay_ms receives when to call again, 0 if there is nothing to wait for
+     *
+     * @return what happened, for the caller to publish
+     */
+    VoodooI2CELANBaselineEvent tick(uint64_t now_ns, bool available, uint32_t* delay_ms);
+
+    VoodooI2CELANBaselineState state() const { return current; }
+    bool busy() const { return current != kVoodooI2CELANBaselineIdle; }
+    /* The number of samples held, up to ELAN_BASELINE_HISTORY */
+    uint32_t history_count() const;
+    /* A sample from the history
+     * @index 0 for the oldest, up to history_count()
+     */
+    const VoodooI2CELANBaselineSample& history(uint32_t index) const;
+    static const char* reason_name(VoodooI2CELANCalibrationReason reason);
+
+    uint32_t interval_ms;
+    uint32_t drift_threshold;
+    uint32_t quiet_ms;
+
+    /* The sample drift is measured against */
+    bool has_reference;
+    uint16_t reference_min;
+    uint16_t reference_max;
+
+    /* Totals since the monitor was created */
+    uint64_t samples;
+    uint64_t aborted_samples;
+    uint64_t calibrations[kVoodooI2CELANCalibrationReasonCount];
+    uint64_t failed_calibrations;
+    uint64_t bus_errors;
+    uint16_t max_drift;
+    // time the device spent in calibration mode, when it does not report
+    uint64_t calibration_mode_ns;
+    uint64_t last_calibration_ns;
+    VoodooI2CELANCalibrationReason last_calibration_reason;
+
+ private:
+    VoodooI2CELANProtocol* protocol;
+    VoodooI2CELANBaselineState current;
+    bool running;
+    bool pending;
+    VoodooI2CELANCalibrationReason pending_reason;
+    VoodooI2CELANCalibrationReason calibrating_reason;
+    // a report came in while in calibration mode
+    bool spoiled;
+    uint32_t tries;
+    uint64_t last_report_ns;
+    uint64_t next_sample_ns;
+    uint64_t mode_begin_ns;
+    VoodooI2CELANBaselineSample entries[ELAN_BASELINE_HISTORY];
+    uint64_t entries_written;
+
+    bool enter_calibration_mode(uint64_t now_ns);
+    /* Leaves calibration mode, the monitor is idle again either way
+     *
+     * @return false if the device did not take the command
+     */
+    bool leave_calibration_mode(uint64_t now_ns);
+    VoodooI2CELANBaselineEvent fail(uint64_t now_ns, uint32_t* delay_ms);
+    void record_sample(uint64_t now_ns, uint16_t min_baseline, uint16_t max_baseline);
+    /* When the next sample or calibration can start, UINT64_MAX if nothing is scheduled */
+    uint64_t next_due_ns() const;
+    /* The same as a delay from @now_ns, 0 if nothing is scheduled */
+    uint32_t next_delay_ms(uint64_t now_ns) const;
+};
+
+#endif /* VOODOOI2C_ELAN_BASELINE_MONITOR_HPP */
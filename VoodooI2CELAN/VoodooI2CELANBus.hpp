@@ -0,0 +1,52 @@
+//
+//  VoodooI2CELANBus.hpp
+//  VoodooI2CELAN
+//
+//  Copyright © 2017 Kishor Prins. All rights reserved.
+//
+
+#ifndef VOODOOI2C_ELAN_BUS_HPP
+#define VOODOOI2C_ELAN_BUS_HPP
+
+#include "VoodooI2CELANPortability.hpp"
+
+/* The subset of VoodooI2CDeviceNub the ELAN protocol needs
+ *
+ * In the kext this forwards to the real nub, on the host it is implemented by a
+ * mock that serves canned register responses and recorded reports.
+ */
+
+class VoodooI2CELANBus {
+ public:
+    virtual ~VoodooI2CELANBus() {}
+
+    /* Reads raw data from the device
+     * @values a buffer which is large enough to hold @length bytes
+     * @length the number of bytes to read
+     *
+     * @return returns a IOReturn status of the read
+     */
+    virtual IOReturn readI2C(uint8_t* values, uint16_t length) = 0;
+    /* Writes raw data to the device
+     * @values the data to write
+     * @length the number of bytes in @values
+     *
+     * @return returns a IOReturn status of the write
+     */
+    virtual IOReturn writeI2C(uint8_t* values, uint16_t length) = 0;
+    /* Writes a register address and reads back its contents in one transaction
+     * @write_buffer the data to write
+     * @write_length the number of bytes in @write_buffer
+     * @read_buffer a buffer which is large enough to hold @read_length bytes
+     * @read_length the number of bytes to read
+     *
+     * @return returns a IOReturn status of the transaction
+     */
+    virtual IOReturn writeReadI2C(uint8_t* write_buffer, uint16_t write_length, uint8_t* read_buffer, uint16_t read_length) = 0;
+    /* Blocks the caller while the device settles
+     * @ms the number of milliseconds to wait
+     */
+    virtual void sleep(uint32_t ms) = 0;
+};
+
+#endif /* VOODOOI2C_ELAN_BUS_HPP */
@@ -0,0 +1,114 @@
+//
+//  VoodooI2CELANContactFilter.cpp
+//  VoodooI2CELAN
+//
+//  Copyright © 2017 Kishor Prins. All rights reserved.
+//
+
+#include "VoodooI2CELANContactFilter.hpp"
+
+#define ELAN_CONTACT_FILTER_ONE (1 << ELAN_CONTACT_FILTER_SHIFT)
+
+static int32_t abs32(int32_t value) {
+    return value < 0 ? -value : value;
+}
+
+static int32_t to_counts(uint32_t hundredths, uint32_t logical_max, uint32_t physical_max) {
+    if (!physical_max)
+        return 0;
+    uint64_t counts = static_cast<uint64_t>(hundredths) * logical_max / physical_max;
+    // any distance at all is worth at least one count
+    return hundredths && !counts ? 1 : static_cast<int32_t>(counts);
+}
+
+/* Weight of the new position for a finger moving @speed counts per report, out of ELAN_CONTACT_FILTER_ONE */
+static int32_t alpha_for(int32_t speed, int32_t fast) {
+    if (!fast || speed >= fast)
+        return ELAN_CONTACT_FILTER_ONE;
+    return ELAN_CONTACT_FILTER_MIN_ALPHA + (ELAN_CONTACT_FILTER_ONE - ELAN_CONTACT_FILTER_MIN_ALPHA) * speed / fast;
+}
+
+VoodooI2CELANContactFilter::VoodooI2CELANContactFilter() :
+    samples(0),
+    held_samples(0),
+    deadband_x(0),
+    deadband_y(0),
+    fast_x(0),
+    fast_y(0),
+    tracked(0) {
+}
+
+void VoodooI2CELANContactFilter::configure(uint32_t logical_max_x, uint32_t logical_max_y, uint32_t physical_max_x, uint32_t physical_max_y,
+                                           uint32_t deadband, uint32_t smoothing_speed) {
+    deadband_x = to_counts(deadband, logical_max_x, physical_max_x);
+    deadband_y = to_counts(deadband, logical_max_y, physical_max_y);
+    fast_x = to_counts(smoothing_speed, logical_max_x, physical_max_x);
+    fast_y = to_counts(smoothing_speed, logical_max_y, physical_max_y);
+    reset();
+}
+
+void VoodooI2CELANContactFilter::reset() {
+    tracked = 0;
+}
+
+void VoodooI2CELANContactFilter::filter(VoodooI2CELANReport* report, uint64_t timestamp_ns) {
+    if (!enabled())
+        return;
+
+    for (int i = 0; i < ETP_MAX_FINGERS; i++) {
+        if (!(report->contact_mask & (1U << i)))
+            continue;
+
+        VoodooI2CELANContact& contact = report->contacts[i];
+        Slot& slot = slots[i];
+        samples++;
+
+        if (!(tracked & (1U << i))) {
+            slot.moving = false;
+            slot.raw_x = slot.out_x = contact.x;
+            slot.raw_y = slot.out_y = contact.y;
+            slot.smoothed_x = contact.x << ELAN_CONTACT_FILTER_SHIFT;
+            slot.smoothed_y = contact.y << ELAN_CONTACT_FILTER_SHIFT;
+            slot.timestamp_ns = timestamp_ns;
+            continue;
+        }
+
+        int32_t speed_x = abs32(contact.x - slot.raw_x);
+        int32_t speed_y = abs32(contact.y - slot.raw_y);
+        int32_t step_x = alpha_for(speed_x, fast_x) * ((contact.x << ELAN_CONTACT_FILTER_SHIFT) - slot.smoothed_x) / ELAN_CONTACT_FILTER_ONE;
+        int32_t step_y = alpha_for(speed_y, fast_y) * ((contact.y << ELAN_CONTACT_FILTER_SHIFT) - slot.smoothed_y) / ELAN_CONTACT_FILTER_ONE;
+        slot.smoothed_x += step_x;
+        slot.smoothed_y += step_y;
+        int32_t smoothed_x = (slot.smoothed_x + ELAN_CONTACT_FILTER_ONE / 2) >> ELAN_CONTACT_FILTER_SHIFT;
+        int32_t smoothed_y = (slot.smoothed_y + ELAN_CONTACT_FILTER_ONE / 2) >> ELAN_CONTACT_FILTER_SHIFT;
+
+        if (slot.moving) {
+            // settled once the smoothed position creeps less than a quarter of the deadband per report
+            if (abs32(step_x) * 4 < deadband_x << ELAN_CONTACT_FILTER_SHIFT &&
+                abs32(step_y) * 4 < deadband_y << ELAN_CONTACT_FILTER_SHIFT)
+                slot.moving = false;
+        } else if (abs32(smoothed_x - slot.out_x) > deadband_x || abs32(smoothed_y - slot.out_y) > deadband_y) {
+            slot.moving = true;
+        }
+
+        if (slot.moving) {
+            slot.out_x = static_cast<uint16_t>(smoothed_x);
+            slot.out_y = static_cast<uint16_t>(smoothed_y);
+
+            int32_t speed = speed_x > speed_y ? speed_x : speed_y;
+            int32_t error = abs32(contact.x - slot.out_x) > abs32(contact.y - slot.out_y) ?
+                            abs32(contact.x - slot.out_x) : abs32(contact.y - slot.out_y);
+            if (speed && timestamp_ns > slot.timestamp_ns)
+                lag.record(error * (timestamp_ns - slot.timestamp_ns) / speed);
+        } else {
+            held_samples++;
+        }
+
+        slot.raw_x = contact.x;
+        slot.raw_y = contact.y;
+        slot.timestamp_ns = timestamp_ns;
+        contact.x = slot.out_x;
+        contact.y = slot.out_y;
+    }
+    tracked = report->contact_mask;
+}
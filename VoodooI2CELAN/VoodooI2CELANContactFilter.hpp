@@ -0,0 +1,93 @@
+//
+//  VoodooI2CELANContactFilter.hpp
+//  VoodooI2CELAN
+//
+//  Copyright © 2017 Kishor Prins. All rights reserved.
+//
+
+#ifndef VOODOOI2C_ELAN_CONTACT_FILTER_HPP
+#define VOODOOI2C_ELAN_CONTACT_FILTER_HPP
+
+#include <stdint.h>
+
+#include "VoodooI2CELANLatencyHistogram.hpp"
+#include "VoodooI2CELANReportDecoder.hpp"
+
+// Positions are kept with this many fractional bits
+#define ELAN_CONTACT_FILTER_SHIFT 8
+// How much of the new position a slow finger gets, out of 1 << ELAN_CONTACT_FILTER_SHIFT
+#define ELAN_CONTACT_FILTER_MIN_ALPHA 64
+
+/* Takes the jitter out of resting and slowly moving contacts
+ *
+ * Every contact goes through a deadband with hysteresis and an exponential
+ * smoother whose weight grows with the speed of the finger:
+ *
+ *   a resting contact holds its position until the smoothed position has
+ *   moved further than the deadband, it then follows the smoothed position
+ *   until that settles again, moving less than a quarter of the deadband per
+ *   report
+ *
+ *   the smoother gives a slow finger ELAN_CONTACT_FILTER_MIN_ALPHA of the new
+ *   position and a finger moving at the smoothing speed or faster all of it,
+ *   so fast motion gets no lag
+ *
+ * A contact going down is passed through as is. Both limits are set in
+ * hundredths of a millimetre and converted with the device's resolution.
+ * Fixed point throughout, no floating point in the kernel.
+ *
+ * Only used from the dispatch side.
+ */
+
+class VoodooI2CELANContactFilter {
+ public:
+    VoodooI2CELANContactFilter();
+
+    /* Sets the limits for a device, a deadband of 0 turns the filter off
+     * @logical_max_x @logical_max_y the largest coordinates reported
+     * @physical_max_x @physical_max_y the size of the surface in hundredths of a millimetre
+     * @deadband distance a resting contact may jitter, in hundredths of a millimetre
+     * @smoothing_speed speed from which contacts are not smoothed at all, in hundredths of
+     * a millimetre per report
+     */
+    void configure(uint32_t logical_max_x, uint32_t logical_max_y, uint32_t physical_max_x, uint32_t physical_max_y,
+                   uint32_t deadband, uint32_t smoothing_speed);
+    bool enabled() const { return deadband_x || deadband_y; }
+    /* Forgets every contact */
+    void reset();
+
+    /* Filters the coordinates of every contact in place
+     * @report the decoded report, its contacts are updated
+     * @timestamp_ns when the report was read, for the lag estimate
+     */
+    void filter(VoodooI2CELANReport* report, uint64_t timestamp_ns);
+
+    /* Totals since the filter was created */
+    uint64_t samples;
+    uint64_t held_samples;
+    /* Distance between the raw and the filtered position of moving contacts, divided by
+     * their speed, so roughly how far behind the finger the output is
+     */
+    VoodooI2CELANLatencyHistogram lag;
+
+ private:
+    struct Slot {
+        bool moving;
+        uint16_t raw_x;
+        uint16_t raw_y;
+        int32_t smoothed_x;
+        int32_t smoothed_y;
+        uint16_t out_x;
+        uint16_t out_y;
+        uint64_t timestamp_ns;
+    };
+
+    int32_t deadband_x;
+    int32_t deadband_y;
+    int32_t fast_x;
+    int32_t fast_y;
+    uint8_t tracked;
+    Slot slots[ETP_MAX_FINGERS];
+};
+
+#endif /* VOODOOI2C_ELAN_CONTACT_FILTER_HPP */
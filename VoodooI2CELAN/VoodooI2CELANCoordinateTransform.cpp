@@ -0,0 +1,115 @@
+//
+//  VoodooI2CELANCoordinateTransform.cpp
+//  VoodooI2CELAN
+//
+//  Copyright © 2017 Kishor Prins. All rights reserved.
+//
+
+#include "VoodooI2CELANCoordinateTransform.hpp"
+
+static inline uint16_t clamp_to(int64_t value, int64_t max) {
+    // selects rather than branches, the compiler turns these into conditional moves
+    value = value < 0 ? 0 : value;
+    return static_cast<uint16_t>(value > max ? max : value);
+}
+
+VoodooI2CELANCoordinateTransform::VoodooI2CELANCoordinateTransform() {
+    reset(0, 0, 0, 0);
+}
+
+void VoodooI2CELANCoordinateTransform::reset(uint32_t logical_max_x, uint32_t logical_max_y, uint32_t physical_max_x, uint32_t physical_max_y) {
+    this->logical_max_x = logical_max_x;
+    this->logical_max_y = logical_max_y;
+    this->physical_max_x = physical_max_x;
+    this->physical_max_y = physical_max_y;
+    matrix[0][0] = matrix[1][1] = 1LL << ELAN_TRANSFORM_SHIFT;
+    matrix[0][1] = matrix[1][0] = 0;
+    offset[0] = offset[1] = 0;
+    swap_axes = false;
+    is_identity = true;
+}
+
+bool VoodooI2CELANCoordinateTransform::configure(const VoodooI2CELANTransformConfig& config, uint32_t logical_max_x, uint32_t logical_max_y,
+                                                 uint32_t physical_max_x, uint32_t physical_max_y) {
+    reset(logical_max_x, logical_max_y, physical_max_x, physical_max_y);
+
+    int64_t min_x = config.active_min_x;
+    int64_t min_y = config.active_min_y;
+    int64_t max_x = config.active_max_x ? config.active_max_x : logical_max_x;
+    int64_t max_y = config.active_max_y ? config.active_max_y : logical_max_y;
+    if (config.rotation % 90 || config.rotation >= 360 || max_x <= min_x || max_y <= min_y ||
+        max_x > logical_max_x || max_y > logical_max_y || config.scaled_max_x > 0xffff || config.scaled_max_y > 0xffff)
+        return false;
+    int64_t width = max_x - min_x;
+    int64_t height = max_y - min_y;
+
+    // (x - min_x, y - min_y) turned clockwise is rotation * it + shift, with Y growing upwards
+    int64_t rotation[2][2] = { { 1, 0 }, { 0, 1 } };
+    int64_t shift[2] = { 0, 0 };
+    swap_axes = config.rotation == 90 || config.rotation == 270;
+    switch (config.rotation) {
+        case 90:
+            rotation[0][0] = 0; rotation[0][1] = 1;
+            rotation[1][0] = -1; rotation[1][1] = 0;
+            shift[1] = width;
+            break;
+        case 180:
+            rotation[0][0] = -1; rotation[1][1] = -1;
+            shift[0] = width;
+            shift[1] = height;
+            break;
+        case 270:
+            rotation[0][0] = 0; rotation[0][1] = -1;
+            rotation[1][0] = 1; rotation[1][1] = 0;
+            shift[0] = height;
+            break;
+    }
+    int64_t range[2] = { swap_axes ? height : width, swap_axes ? width : height };
+    bool mirror[2] = { config.mirror_x, config.mirror_y };
+    int64_t scaled[2] = { config.scaled_max_x ? config.scaled_max_x : range[0], config.scaled_max_y ? config.scaled_max_y : range[1] };
+
+    for (int axis = 0; axis < 2; axis++) {
+        if (mirror[axis]) {
+            rotation[axis][0] = -rotation[axis][0];
+            rotation[axis][1] = -rotation[axis][1];
+            shift[axis] = range[axis] - shift[axis];
+        }
+        int64_t scale = (scaled[axis] << ELAN_TRANSFORM_SHIFT) / range[axis];
+        matrix[axis][0] = rotation[axis][0] * scale;
+        matrix[axis][1] = rotation[axis][1] * scale;
+        // the active area's corner moves to 0, and the result is rounded rather than cut off
+        offset[axis] = (shift[axis] - rotation[axis][0] * min_x - rotation[axis][1] * min_y) * scale + (1LL << (ELAN_TRANSFORM_SHIFT - 1));
+    }
+
+    this->logical_max_x = static_cast<uint32_t>(scaled[0]);
+    this->logical_max_y = static_cast<uint32_t>(scaled[1]);
+    // the active area is that much of the surface, turned around with it
+    uint32_t active_physical_x = logical_max_x ? static_cast<uint32_t>(physical_max_x * width / logical_max_x) : 0;
+    uint32_t active_physical_y = logical_max_y ? static_cast<uint32_t>(physical_max_y * height / logical_max_y) : 0;
+    this->physical_max_x = swap_axes ? active_physical_y : active_physical_x;
+    this->physical_max_y = swap_axes ? active_physical_x : active_physical_y;
+    is_identity = !config.rotation && !config.mirror_x && !config.mirror_y && width == logical_max_x && height == logical_max_y &&
+                  !min_x && !min_y && scaled[0] == width && scaled[1] == height;
+    return true;
+}
+
+void VoodooI2CELANCoordinateTransform::apply(VoodooI2CELANReport* report) const {
+    if (is_identity)
+        return;
+
+    for (uint32_t mask = report->contact_mask; mask; mask &= mask - 1) {
+        VoodooI2CELANContact& contact = report->contacts[__builtin_ctz(mask)];
+        int64_t x = contact.x;
+        int64_t y = contact.y;
+        contact.x = clamp_to((matrix[0][0] * x + matrix[0][1] * y + offset[0]) >> ELAN_TRANSFORM_SHIFT, logical_max_x);
+        contact.y = clamp_to((matrix[1][0] * x + matrix[1][1] * y + offset[1]) >> ELAN_TRANSFORM_SHIFT, logical_max_y);
+
+        // picked by index rather than swapped under a condition
+        uint8_t mk[2] = { contact.mk_x, contact.mk_y };
+        uint32_t width[2] = { contact.width_x, contact.width_y };
+        contact.mk_x = mk[swap_axes];
+        contact.mk_y = mk[!swap_axes];
+        contact.width_x = width[swap_axes];
+        contact.width_y = width[!swap_axes];
+    }
+}
@@ -0,0 +1,85 @@
+//
+//  VoodooI2CELANCoordinateTransform.hpp
+//  VoodooI2CELAN
+//
+//  Copyright © 2017 Kishor Prins. All rights reserved.
+//
+
+#ifndef VOODOOI2C_ELAN_COORDINATE_TRANSFORM_HPP
+#define VOODOOI2C_ELAN_COORDINATE_TRANSFORM_HPP
+
+#include <stdint.h>
+
+#include "VoodooI2CELANReportDecoder.hpp"
+
+// The matrix and offset have this many fractional bits
+#define ELAN_TRANSFORM_SHIFT 16
+
+/* How a device's coordinates are to be turned around, as read from Info.plist or ACPI */
+struct VoodooI2CELANTransformConfig {
+    // clockwise, in degrees: 0, 90, 180 or 270
+    uint32_t rotation;
+    // after the rotation
+    bool mirror_x;
+    bool mirror_y;
+    // the active area in decoded coordinates, before the rotation, a maximum of 0 for the edge of the surface
+    uint32_t active_min_x;
+    uint32_t active_min_y;
+    uint32_t active_max_x;
+    uint32_t active_max_y;
+    // the range the active area is scaled to after the rotation, 0 keeps its own
+    uint32_t scaled_max_x;
+    uint32_t scaled_max_y;
+};
+
+/* Rotates, mirrors, crops and scales decoded contacts
+ *
+ * All of it is worked out once per device into a fixed point matrix and
+ * offset, so every contact costs two multiply-adds per axis and a clamp to the
+ * new range, whatever the configuration. Contacts outside the active area end
+ * up on its edge. The widths of the contact swap along with the axes, they are
+ * not scaled.
+ *
+ * The coordinates are the ones the decoder hands out, with Y already growing
+ * upwards, so the transform works on what the multitouch engine would see
+ * with the touchpad mounted the usual way.
+ */
+
+class VoodooI2CELANCoordinateTransform {
+ public:
+    VoodooI2CELANCoordinateTransform();
+
+    /* Works the transform out for a device
+     * @config what to do to the coordinates
+     * @logical_max_x @logical_max_y the largest coordinates decoded
+     * @physical_max_x @physical_max_y the size of the surface in hundredths of a millimetre
+     *
+     * @return false if @config does not fit the device, the coordinates are then left as they are
+     */
+    bool configure(const VoodooI2CELANTransformConfig& config, uint32_t logical_max_x, uint32_t logical_max_y,
+                   uint32_t physical_max_x, uint32_t physical_max_y);
+    /* Nothing to do, apply() returns straight away */
+    bool identity() const { return is_identity; }
+
+    /* Transforms the contacts of a decoded report in place
+     * @report the report, only the slots in its contact_mask are touched
+     */
+    void apply(VoodooI2CELANReport* report) const;
+
+    /* The ranges after the transform, what the multitouch interface is told */
+    uint32_t logical_max_x;
+    uint32_t logical_max_y;
+    uint32_t physical_max_x;
+    uint32_t physical_max_y;
+
+ private:
+    // out = (matrix * in + offset) >> ELAN_TRANSFORM_SHIFT
+    int64_t matrix[2][2];
+    int64_t offset[2];
+    bool swap_axes;
+    bool is_identity;
+
+    void reset(uint32_t logical_max_x, uint32_t logical_max_y, uint32_t physical_max_x, uint32_t physical_max_y);
+};
+
+#endif /* VOODOOI2C_ELAN_COORDINATE_TRANSFORM_HPP */
@@ -0,0 +1,78 @@
+//
+//  VoodooI2CELANErrorLog.cpp
+//  VoodooI2CELAN
+//
+//  Copyright © 2017 Kishor Prins. All rights reserved.
+//
+
+#include "VoodooI2CELANErrorLog.hpp"
+
+VoodooI2CELANErrorLog::VoodooI2CELANErrorLog() : logged(0), last_refill_ns(0), next_summary_ns(0), pending(false) {
+    for (int i = 0; i < kVoodooI2CELANErrorClassCount; i++) {
+        counts[i] = 0;
+        suppressed[i] = 0;
+    }
+    configure(ELAN_ERROR_LOG_BURST, ELAN_ERROR_LOG_REFILL_MS, ELAN_ERROR_LOG_SUMMARY_MS);
+}
+
+void VoodooI2CELANErrorLog::configure(uint32_t burst, uint32_t refill_ms, uint32_t summary_ms) {
+    this->burst = burst;
+    refill_ns = (refill_ms ? refill_ms : 1) * 1000000ULL;
+    summary_ns = summary_ms * 1000000ULL;
+    tokens = burst;
+}
+
+bool VoodooI2CELANErrorLog::record(VoodooI2CELANErrorClass error, uint64_t now_ns) {
+    counts[error]++;
+    pending = true;
+    // filler reports are part of the protocol, they are only counted
+    if (error == kVoodooI2CELANErrorFillerReport)
+        return false;
+
+    if (tokens < burst && now_ns > last_refill_ns) {
+        uint64_t earned = (now_ns - last_refill_ns) / refill_ns;
+        if (earned >= burst - tokens) {
+            tokens = burst;
+            last_refill_ns = now_ns;
+        } else {
+            tokens += static_cast<uint32_t>(earned);
+            // keep the remainder so tokens are earned at the same rate however often we look
+            last_refill_ns += earned * refill_ns;
+        }
+    }
+
+    if (!tokens) {
+        suppressed[error]++;
+        return false;
+    }
+    if (tokens == burst)
+        last_refill_ns = now_ns;
+    tokens--;
+    logged++;
+    return true;
+}
+
+void VoodooI2CELANErrorLog::summarized(uint64_t now_ns) {
+    for (int i = 0; i < kVoodooI2CELANErrorClassCount; i++)
+        suppressed[i] = 0;
+    pending = false;
+    next_summary_ns = now_ns + summary_ns;
+}
+
+uint64_t VoodooI2CELANErrorLog::total_suppressed() const {
+    uint64_t total = 0;
+    for (int i = 0; i < kVoodooI2CELANErrorClassCount; i++)
+        total += suppressed[i];
+    return total;
+}
+
+const char* VoodooI2CELANErrorLog::class_name(VoodooI2CELANErrorClass error) {
+    switch (error) {
+        case kVoodooI2CELANErrorReadFailed: return "read failures";
+        case kVoodooI2CELANErrorInvalidReport: return "invalid reports";
+        case kVoodooI2CELANErrorFillerReport: return "filler reports";
+        case kVoodooI2CELANErrorShortRead: return "short reads";
+        case kVoodooI2CELANErrorClassCount: break;
+    }
+    return "unknown";
+}
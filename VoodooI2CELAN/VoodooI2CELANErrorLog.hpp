@@ -0,0 +1,90 @@
+//
+//  VoodooI2CELANErrorLog.hpp
+//  VoodooI2CELAN
+//
+//  Copyright © 2017 Kishor Prins. All rights reserved.
+//
+
+#ifndef VOODOOI2C_ELAN_ERROR_LOG_HPP
+#define VOODOOI2C_ELAN_ERROR_LOG_HPP
+
+#include <stdint.h>
+
+// Up to this many messages in a burst, then one per ELAN_ERROR_LOG_REFILL_MS
+#define ELAN_ERROR_LOG_BURST 5
+#define ELAN_ERROR_LOG_REFILL_MS 1000
+// How often suppressed messages are summed up
+#define ELAN_ERROR_LOG_SUMMARY_MS 10000
+
+/* What went wrong reading a report */
+enum VoodooI2CELANErrorClass {
+    kVoodooI2CELANErrorReadFailed = 0,  // the I2C read itself failed
+    kVoodooI2CELANErrorInvalidReport,   // neither a report, filler nor empty
+    kVoodooI2CELANErrorFillerReport,    // 0xFF filler, expected and never logged
+    kVoodooI2CELANErrorShortRead,       // a report shorter than it has to be
+    kVoodooI2CELANErrorClassCount
+};
+
+/* Counts report errors and decides which of them are worth a log message
+ *
+ * Every error is counted, but messages are limited by a token bucket shared
+ * by all classes, so a flaky bus or a confused firmware cannot flood the
+ * system log from the report path. Whatever was not logged is summed up once
+ * per summary interval instead.
+ *
+ * Single writer, the work loop. The counters may be read from anywhere.
+ */
+
+class VoodooI2CELANErrorLog {
+ public:
+    VoodooI2CELANErrorLog();
+
+    /* Sets the limits
+     * @burst how many messages may be logged back to back
+     * @refill_ms time it takes to earn another message
+     * @summary_ms how often to sum up the suppressed messages
+     */
+    void configure(uint32_t burst, uint32_t refill_ms, uint32_t summary_ms);
+
+    /* Counts an error
+     * @error what went wrong
+     * @now_ns the current time
+     *
+     * @return true if the caller should log it, false if it was only counted
+     */
+    bool record(VoodooI2CELANErrorClass error, uint64_t now_ns);
+    /* Checks whether it is time to sum up, only true if something was suppressed
+     * or counted since the last summary
+     * @now_ns the current time
+     *
+     * @return true if the caller should publish the counters and log a summary of
+     * suppressed[], then call summarized()
+     */
+    bool summary_due(uint64_t now_ns) const {
+        return pending && now_ns >= next_summary_ns;
+    }
+    /* Starts the next summary interval and clears suppressed[]
+     * @now_ns the current time
+     */
+    void summarized(uint64_t now_ns);
+
+    uint64_t total_suppressed() const;
+    static const char* class_name(VoodooI2CELANErrorClass error);
+
+    /* Totals since the log was created */
+    uint64_t counts[kVoodooI2CELANErrorClassCount];
+    uint64_t logged;
+    /* Errors that were not logged since the last summary */
+    uint64_t suppressed[kVoodooI2CELANErrorClassCount];
+
+ private:
+    uint32_t burst;
+    uint64_t refill_ns;
+    uint64_t summary_ns;
+    uint32_t tokens;
+    uint64_t last_refill_ns;
+    uint64_t next_summary_ns;
+    bool pending;
+};
+
+#endif /* VOODOOI2C_ELAN_ERROR_LOG_HPP */
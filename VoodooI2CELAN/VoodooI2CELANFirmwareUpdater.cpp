@@ -0,0 +1,489 @@
+//
+//  VoodooI2CELANFirmwareUpdater.cpp
+//  VoodooI2CELAN
+//
+//  Copyright © 2017 Kishor Prins. All rights reserved.
+//
+
+#include "VoodooI2CELANFirmwareUpdater.hpp"
+
+#include <string.h>
+
+static const uint8_t firmware_signature[ETP_FW_SIGNATURE_SIZE] = { 0xAA, 0x55, 0xCC, 0x33, 0xFF, 0xFF };
+
+VoodooI2CELANFirmwareUpdater::VoodooI2CELANFirmwareUpdater() :
+    page_delay_ms(0),
+    check_interval(1),
+    last_error(NULL),
+    page_writes(0),
+    checks(0),
+    page_retries(0),
+    restarts(0),
+    resumes(0),
+    bus_errors(0),
+    image_checksum(0),
+    device_checksum(0),
+    total_ns(0),
+    write_ns(0),
+    protocol(NULL),
+    image(NULL),
+    length(0),
+    current_state(kVoodooI2CELANFirmwareIdle),
+    current_step(kVoodooI2CELANFirmwareReadMode),
+    iap_mode(false),
+    resuming(false),
+    uncertain(false),
+    written_page(0),
+    verified_page(0),
+    written_checksum(0),
+    verified_checksum(0),
+    retry_page(0),
+    retry_count(0),
+    consecutive_errors(0),
+    setbacks(0),
+    begin_ns(0),
+    write_begin_ns(0),
+    interrupted_ns(0) {
+    memset(&layout, 0, sizeof(layout));
+    memset(page_buffer, 0, sizeof(page_buffer));
+}
+
+void VoodooI2CELANFirmwareUpdater::configure(uint32_t page_delay_ms, uint32_t check_interval) {
+    this->page_delay_ms = page_delay_ms;
+    this->check_interval = check_interval ? check_interval : 1;
+}
+
+bool VoodooI2CELANFirmwareUpdater::page_layout(uint8_t ic_type, uint8_t iap_version, VoodooI2CELANFirmwareLayout* layout) {
+    uint32_t pages;
+    switch (ic_type) {
+        case 0x00: case 0x06: case 0x08:
+            pages = 512;
+            break;
+        case 0x03: case 0x07: case 0x09: case 0x0A: case 0x0B: case 0x0C:
+            pages = 768;
+            break;
+        case 0x0D:
+            pages = 896;
+            break;
+        case 0x0E:
+            pages = 640;
+            break;
+        case 0x10: case 0x14: case 0x15:
+            pages = 1024;
+            break;
+        case 0x11:
+            pages = 1280;
+            break;
+        case 0x13:
+            pages = 2048;
+            break;
+        default:
+            return false;
+    }
+
+    // the signature is at the end of the image, whatever the page size
+    layout->signature_offset = pages * ETP_FW_PAGE_SIZE - ETP_FW_SIGNATURE_SIZE;
+    if ((ic_type == 0x14 || ic_type == 0x15) && iap_version >= 2) {
+        layout->page_size = ETP_FW_PAGE_SIZE_512;
+        layout->page_count = pages / 8;
+    } else if (ic_type >= 0x0D && iap_version >= 1) {
+        layout->page_size = ETP_FW_PAGE_SIZE_128;
+        layout->page_count = pages / 2;
+    } else {
+        layout->page_size = ETP_FW_PAGE_SIZE;
+        layout->page_count = pages;
+    }
+    layout->first_page = 0;
+    return true;
+}
+
+uint16_t VoodooI2CELANFirmwareUpdater::page_checksum(const uint8_t* page, uint16_t page_size) {
+    uint16_t checksum = 0;
+    for (uint16_t i = 0; i + 1 < page_size; i += 2)
+        checksum += page[i] | (page[i + 1] << 8);
+    return checksum;
+}
+
+bool VoodooI2CELANFirmwareUpdater::begin(VoodooI2CELANProtocol* protocol, const VoodooI2CELANDeviceInfo& info, const uint8_t* image, uint32_t length, uint64_t now_ns) {
+    if (busy()) {
+        last_error = "An update is in progress";
+        return false;
+    }
+    if (!page_layout(info.ic_type, info.iap_version, &layout)) {
+        last_error = "Unknown IC type";
+        return false;
+    }
+    if (length < layout.page_count * layout.page_size || length < layout.signature_offset + ETP_FW_SIGNATURE_SIZE) {
+        last_error = "Image is too small for the device";
+        return false;
+    }
+    if (memcmp(image + layout.signature_offset, firmware_signature, sizeof(firmware_signature))) {
+        last_error = "Image has no firmware signature";
+        return false;
+    }
+    // the boot loader is kept, the pages after it are written
+    uint16_t iap_start = image[ETP_IAP_START_ADDR * 2] | (image[ETP_IAP_START_ADDR * 2 + 1] << 8);
+    layout.first_page = iap_start * 2 / layout.page_size;
+    if (layout.first_page >= layout.page_count) {
+        last_error = "Image has an invalid IAP start address";
+        return false;
+    }
+
+    this->protocol = protocol;
+    this->image = image;
+    this->length = length;
+    image_checksum = 0;
+    for (uint32_t page = layout.first_page; page < layout.page_count; page++)
+        image_checksum += checksum_of(page);
+
+    last_error = NULL;
+    page_writes = 0;
+    checks = 0;
+    page_retries = 0;
+    restarts = 0;
+    resumes = 0;
+    bus_errors = 0;
+    device_checksum = 0;
+    total_ns = 0;
+    write_ns = 0;
+    setbacks = 0;
+    consecutive_errors = 0;
+    begin_ns = now_ns;
+    write_begin_ns = 0;
+    restart();
+    current_state = kVoodooI2CELANFirmwareRunning;
+    return true;
+}
+
+VoodooI2CELANFirmwareState VoodooI2CELANFirmwareUpdater::tick(uint64_t now_ns, uint32_t* delay_ms) {
+    *delay_ms = 0;
+    if (current_state != kVoodooI2CELANFirmwareRunning)
+        return current_state;
+
+    if (run_step(now_ns, delay_ms) == kIOReturnSuccess) {
+        consecutive_errors = 0;
+        return current_state;
+    }
+
+    bus_errors++;
+    if (++consecutive_errors < ETP_RETRY_COUNT) {
+        // whether the device took a page it was sent is for the next check to find out
+        if (current_step == kVoodooI2CELANFirmwareWritePage) {
+            uncertain = true;
+            current_step = kVoodooI2CELANFirmwareCheckPages;
+        }
+        *delay_ms = ELAN_FIRMWARE_RETRY_DELAY;
+        return current_state;
+    }
+    consecutive_errors = 0;
+    last_error = "Device stopped answering";
+    pick_up(now_ns, delay_ms);
+    return current_state;
+}
+
+IOReturn VoodooI2CELANFirmwareUpdater::run_step(uint64_t now_ns, uint32_t* delay_ms) {
+    IOReturn retVal;
+    uint16_t value;
+
+    switch (current_step) {
+        case kVoodooI2CELANFirmwareReadMode:
+            retVal = protocol->read_iap_control(&value);
+            if (retVal != kIOReturnSuccess)
+                return retVal;
+            iap_mode = !(value & ETP_I2C_MAIN_MODE_ON);
+            current_step = iap_mode ? kVoodooI2CELANFirmwareResetIAP : kVoodooI2CELANFirmwareSetKey;
+            return kIOReturnSuccess;
+
+        case kVoodooI2CELANFirmwareResetIAP:
+            retVal = protocol->reset_iap();
+            if (retVal != kIOReturnSuccess)
+                return retVal;
+            *delay_ms = 30;
+            current_step = kVoodooI2CELANFirmwareSetKey;
+            return kIOReturnSuccess;
+
+        case kVoodooI2CELANFirmwareSetKey:
+            retVal = protocol->set_flash_key();
+            if (retVal != kIOReturnSuccess)
+                return retVal;
+            *delay_ms = iap_mode ? 50 : 100;
+            current_step = kVoodooI2CELANFirmwareCheckMode;
+            return kIOReturnSuccess;
+
+        case kVoodooI2CELANFirmwareCheckMode:
+            retVal = protocol->read_iap_control(&value);
+            if (retVal != kIOReturnSuccess)
+                return retVal;
+            if (value & ETP_I2C_MAIN_MODE_ON) {
+                start_over("Device did not enter IAP mode", now_ns, delay_ms);
+                return kIOReturnSuccess;
+            }
+            current_step = layout.page_size > ETP_FW_PAGE_SIZE ? kVoodooI2CELANFirmwareSetPageSize : kVoodooI2CELANFirmwareSetKeyAgain;
+            return kIOReturnSuccess;
+
+        case kVoodooI2CELANFirmwareSetPageSize:
+            retVal = protocol->set_iap_page_size(layout.page_size);
+            if (retVal != kIOReturnSuccess)
+                return retVal;
+            current_step = kVoodooI2CELANFirmwareSetKeyAgain;
+            return kIOReturnSuccess;
+
+        case kVoodooI2CELANFirmwareSetKeyAgain:
+            retVal = protocol->set_flash_key();
+            if (retVal != kIOReturnSuccess)
+                return retVal;
+            *delay_ms = 30;
+            current_step = kVoodooI2CELANFirmwareCheckKey;
+            return kIOReturnSuccess;
+
+        case kVoodooI2CELANFirmwareCheckKey:
+            retVal = protocol->read_flash_key(&value);
+            if (retVal != kIOReturnSuccess)
+                return retVal;
+            if (value != ETP_I2C_IAP_PASSWORD) {
+                // lost power while interrupted, the device is back in IAP mode with the flash locked
+                if (resuming) {
+                    restarts++;
+                    restart();
+                } else {
+                    start_over("Device did not take the flash key", now_ns, delay_ms);
+                }
+                return kIOReturnSuccess;
+            }
+            if (resuming) {
+                current_step = kVoodooI2CELANFirmwareCheckPages;
+                return kIOReturnSuccess;
+            }
+            if (!write_begin_ns)
+                write_begin_ns = now_ns;
+            current_step = kVoodooI2CELANFirmwareWritePage;
+            return kIOReturnSuccess;
+
+        case kVoodooI2CELANFirmwareWritePage: {
+            uint16_t checksum = checksum_of(written_page);
+            memcpy(page_buffer + 2, image + written_page * layout.page_size, layout.page_size);
+            retVal = protocol->write_fw_page(page_buffer, layout.page_size, checksum);
+            if (retVal != kIOReturnSuccess)
+                return retVal;
+            page_writes++;
+            written_page++;
+            written_checksum += checksum;
+
+            // the device says nothing about a page until it has been programmed
+            *delay_ms = page_delay_ms ? page_delay_ms : (layout.page_size == ETP_FW_PAGE_SIZE_512 ? 50 : 35);
+            if (written_page == layout.page_count || written_page - verified_page >= check_interval)
+                current_step = kVoodooI2CELANFirmwareCheckPages;
+            return kIOReturnSuccess;
+        }
+
+        case kVoodooI2CELANFirmwareCheckPages:
+            return check_pages(now_ns, delay_ms);
+
+        case kVoodooI2CELANFirmwareReset:
+            retVal = protocol->write_ELAN_cmd(ETP_I2C_STAND_CMD, ETP_I2C_RESET);
+            if (retVal != kIOReturnSuccess)
+                return retVal;
+            *delay_ms = 100;
+            current_step = kVoodooI2CELANFirmwareResetAck;
+            return kIOReturnSuccess;
+
+        case kVoodooI2CELANFirmwareResetAck:
+            retVal = protocol->read_reset_ack();
+            if (retVal != kIOReturnSuccess)
+                return retVal;
+            current_step = kVoodooI2CELANFirmwareVerify;
+            return kIOReturnSuccess;
+
+        case kVoodooI2CELANFirmwareVerify:
+            retVal = protocol->read_checksum(false, &device_checksum);
+            if (retVal != kIOReturnSuccess)
+                return retVal;
+            if (device_checksum != image_checksum) {
+                start_over("Firmware checksum does not match the image", now_ns, delay_ms);
+                return kIOReturnSuccess;
+            }
+            current_step = kVoodooI2CELANFirmwareDone;
+            finish(kVoodooI2CELANFirmwareSucceeded, now_ns);
+            return kIOReturnSuccess;
+
+        case kVoodooI2CELANFirmwareDone:
+            return kIOReturnSuccess;
+    }
+    return kIOReturnSuccess;
+}
+
+IOReturn VoodooI2CELANFirmwareUpdater::check_pages(uint64_t now_ns, uint32_t* delay_ms) {
+    uint16_t checksum, control;
+
+    // reading the control register clears its errors, so it goes last
+    IOReturn retVal = protocol->read_checksum(true, &checksum);
+    if (retVal != kIOReturnSuccess)
+        return retVal;
+    retVal = protocol->read_iap_control(&control);
+    if (retVal != kIOReturnSuccess)
+        return retVal;
+    checks++;
+
+    if (control & ETP_I2C_MAIN_MODE_ON) {
+        start_over("Device left IAP mode", now_ns, delay_ms);
+        return kIOReturnSuccess;
+    }
+
+    // the device takes the pages sent in order and, once it has failed one, no others until its error has been read
+    uint32_t attempted = written_page + (uncertain ? 1 : 0);
+    uint32_t position = 0;
+    uint32_t matches = 0;
+    uint16_t candidate = verified_checksum;
+    for (uint32_t page = verified_page; page <= attempted; page++) {
+        if (candidate == checksum) {
+            position = page;
+            matches++;
+        }
+        if (page < attempted)
+            candidate += checksum_of(page);
+    }
+    // a page that sums to 0 leaves two places the device could be at
+    if (matches != 1) {
+        if (control & (ETP_FW_IAP_PAGE_ERR | ETP_FW_IAP_INTF_ERR))
+            start_over("Device failed a page", now_ns, delay_ms);
+        else
+            start_over(matches ? "Device position is ambiguous" : "Running checksum does not match the pages sent", now_ns, delay_ms);
+        return kIOReturnSuccess;
+    }
+    if (control & (ETP_FW_IAP_PAGE_ERR | ETP_FW_IAP_INTF_ERR)) {
+        if (retry_page != position) {
+            retry_page = position;
+            retry_count = 0;
+        }
+        if (++retry_count >= ETP_RETRY_COUNT) {
+            start_over("Device failed the same page repeatedly", now_ns, delay_ms);
+            return kIOReturnSuccess;
+        }
+    }
+
+    page_retries += written_page > position ? written_page - position : 0;
+    written_page = verified_page = position;
+    written_checksum = verified_checksum = checksum;
+    uncertain = false;
+    resuming = false;
+    if (verified_page < layout.page_count) {
+        current_step = kVoodooI2CELANFirmwareWritePage;
+        return kIOReturnSuccess;
+    }
+    write_ns = now_ns - write_begin_ns;
+    *delay_ms = ELAN_FIRMWARE_RESET_WAIT;
+    current_step = kVoodooI2CELANFirmwareReset;
+    return kIOReturnSuccess;
+}
+
+void VoodooI2CELANFirmwareUpdater::start_over(const char* error, uint64_t now_ns, uint32_t* delay_ms) {
+    last_error = error;
+    restarts++;
+    if (++setbacks > ELAN_FIRMWARE_ATTEMPTS) {
+        finish(kVoodooI2CELANFirmwareFailed, now_ns);
+        return;
+    }
+    restart();
+    *delay_ms = ELAN_FIRMWARE_RETRY_DELAY;
+}
+
+void VoodooI2CELANFirmwareUpdater::restart() {
+    current_step = kVoodooI2CELANFirmwareReadMode;
+    iap_mode = false;
+    resuming = false;
+    uncertain = false;
+    written_page = verified_page = layout.first_page;
+    written_checksum = verified_checksum = 0;
+    retry_page = layout.first_page;
+    retry_count = 0;
+}
+
+void VoodooI2CELANFirmwareUpdater::pick_up(uint64_t now_ns, uint32_t* delay_ms) {
+    resumes++;
+    if (++setbacks > ELAN_FIRMWARE_ATTEMPTS) {
+        finish(kVoodooI2CELANFirmwareFailed, now_ns);
+        return;
+    }
+    *delay_ms = ELAN_FIRMWARE_RESUME_DELAY;
+    // every page is in, only the reset into the new firmware is left
+    if (current_step > kVoodooI2CELANFirmwareCheckPages) {
+        current_step = kVoodooI2CELANFirmwareReset;
+        return;
+    }
+    resuming = true;
+    current_step = kVoodooI2CELANFirmwareCheckKey;
+}
+
+void VoodooI2CELANFirmwareUpdater::interrupt(uint64_t now_ns) {
+    if (current_state != kVoodooI2CELANFirmwareRunning)
+        return;
+    current_state = kVoodooI2CELANFirmwareInterrupted;
+    interrupted_ns = now_ns;
+}
+
+void VoodooI2CELANFirmwareUpdater::resume(uint64_t now_ns) {
+    if (current_state != kVoodooI2CELANFirmwareInterrupted)
+        return;
+    // the time spent interrupted is not the update's
+    begin_ns += now_ns - interrupted_ns;
+    if (write_begin_ns)
+        write_begin_ns += now_ns - interrupted_ns;
+    current_state = kVoodooI2CELANFirmwareRunning;
+    consecutive_errors = 0;
+    resumes++;
+
+    // nothing was written yet, or the device is being reset into the new firmware
+    if (current_step < kVoodooI2CELANFirmwareWritePage) {
+        restart();
+        return;
+    }
+    if (current_step > kVoodooI2CELANFirmwareCheckPages) {
+        current_step = kVoodooI2CELANFirmwareReset;
+        return;
+    }
+    resuming = true;
+    current_step = kVoodooI2CELANFirmwareCheckKey;
+}
+
+void VoodooI2CELANFirmwareUpdater::cancel() {
+    current_state = kVoodooI2CELANFirmwareIdle;
+    image = NULL;
+    length = 0;
+}
+
+void VoodooI2CELANFirmwareUpdater::finish(VoodooI2CELANFirmwareState state, uint64_t now_ns) {
+    current_state = state;
+    total_ns = now_ns - begin_ns;
+    image = NULL;
+    length = 0;
+}
+
+const char* VoodooI2CELANFirmwareUpdater::state_name(VoodooI2CELANFirmwareState state) {
+    switch (state) {
+        case kVoodooI2CELANFirmwareIdle: return "Idle";
+        case kVoodooI2CELANFirmwareRunning: return "Running";
+        case kVoodooI2CELANFirmwareInterrupted: return "Interrupted";
+        case kVoodooI2CELANFirmwareSucceeded: return "Succeeded";
+        case kVoodooI2CELANFirmwareFailed: return "Failed";
+    }
+    return "Unknown";
+}
+
+const char* VoodooI2CELANFirmwareUpdater::step_name(VoodooI2CELANFirmwareStep step) {
+    switch (step) {
+        case kVoodooI2CELANFirmwareReadMode: return "ReadMode";
+        case kVoodooI2CELANFirmwareResetIAP: return "ResetIAP";
+        case kVoodooI2CELANFirmwareSetKey: return "SetKey";
+        case kVoodooI2CELANFirmwareCheckMode: return "CheckMode";
+        case kVoodooI2CELANFirmwareSetPageSize: return "SetPageSize";
+        case kVoodooI2CELANFirmwareSetKeyAgain: return "SetKeyAgain";
+        case kVoodooI2CELANFirmwareCheckKey: return "CheckKey";
+        case kVoodooI2CELANFirmwareWritePage: return "WritePage";
+        case kVoodooI2CELANFirmwareCheckPages: return "CheckPages";
+        case kVoodooI2CELANFirmwareReset: return "Reset";
+        case kVoodooI2CELANFirmwareResetAck: return "ResetAck";
+        case kVoodooI2CELANFirmwareVerify: return "Verify";
+        case kVoodooI2CELANFirmwareDone: return "Done";
+    }
+    return "Unknown";
+}
@@ -0,0 +1,209 @@
+//
+//  VoodooI2CELANFirmwareUpdater.hpp
+//  VoodooI2CELAN
+//
+//  Copyright © 2017 Kishor Prins. All rights reserved.
+//
+
+#ifndef VOODOOI2C_ELAN_FIRMWARE_UPDATER_HPP
+#define VOODOOI2C_ELAN_FIRMWARE_UPDATER_HPP
+
+#include <stdint.h>
+
+#include "VoodooI2CELANProtocol.hpp"
+
+// Restarts and resumes an update may take before it is given up on
+#define ELAN_FIRMWARE_ATTEMPTS 3
+// Wait before a failed transfer is tried again
+#define ELAN_FIRMWARE_RETRY_DELAY 20
+// Wait before resuming once the device stopped answering
+#define ELAN_FIRMWARE_RESUME_DELAY 500
+// Wait after the last page for the device to reset itself, as Linux does
+#define ELAN_FIRMWARE_RESET_WAIT 600
+
+enum VoodooI2CELANFirmwareState {
+    kVoodooI2CELANFirmwareIdle = 0,
+    kVoodooI2CELANFirmwareRunning,
+    kVoodooI2CELANFirmwareInterrupted,  // stopped by interrupt(), waiting for resume()
+    kVoodooI2CELANFirmwareSucceeded,
+    kVoodooI2CELANFirmwareFailed
+};
+
+/* The transactions of an update, in the order they run (Linux's elan_i2c_prepare_fw_update,
+ * elan_i2c_write_fw_block and elan_i2c_finish_fw_update)
+ */
+enum VoodooI2CELANFirmwareStep {
+    kVoodooI2CELANFirmwareReadMode = 0,  // main firmware or IAP mode
+    kVoodooI2CELANFirmwareResetIAP,      // only if the device is in IAP mode already
+    kVoodooI2CELANFirmwareSetKey,        // switches to IAP mode
+    kVoodooI2CELANFirmwareCheckMode,
+    kVoodooI2CELANFirmwareSetPageSize,   // only for pages larger than ETP_FW_PAGE_SIZE
+    kVoodooI2CELANFirmwareSetKeyAgain,   // unlocks the flash
+    kVoodooI2CELANFirmwareCheckKey,
+    kVoodooI2CELANFirmwareWritePage,
+    kVoodooI2CELANFirmwareCheckPages,    // the IAP status and running checksum
+    kVoodooI2CELANFirmwareReset,
+    kVoodooI2CELANFirmwareResetAck,
+    kVoodooI2CELANFirmwareVerify,        // the new firmware's checksum
+    kVoodooI2CELANFirmwareDone,
+    kVoodooI2CELANFirmwareStepCount = kVoodooI2CELANFirmwareDone
+};
+
+/* Where the pages to write are in an image, as Linux's elan_get_fwinfo works it out */
+struct VoodooI2CELANFirmwareLayout {
+    uint16_t page_size;
+    // the first page after the boot loader, the first one written
+    uint32_t first_page;
+    // one past the last page written
+    uint32_t page_count;
+    uint32_t signature_offset;
+};
+
+/* Flashes a firmware image through the device's in application programming (IAP) mode
+ *
+ * Like the init sequencer it never sleeps, tick() runs one transaction and
+ * says how long to wait before the next. Every page is a single write of the
+ * page and its checksum. Instead of reading the IAP status after each of them,
+ * as Linux does, the status and the device's running checksum are read once
+ * every check_interval pages. The device stops taking pages at the first one
+ * it fails, so the checksum is the sum of the pages it took and says which
+ * one it expects next. The pages from there on are written again, and only a
+ * checksum that matches no single position since the last check has the
+ * update start over.
+ *
+ * A transfer that keeps failing, or interrupt() and resume() around system
+ * sleep, has the update pick up where the device is: if it is still in IAP
+ * mode with the flash unlocked and its running checksum matches exactly one
+ * position since the last check, the pages go on from there, otherwise the
+ * update starts over. Either way the new firmware has to come up with the
+ * checksum of the pages written.
+ */
+
+class VoodooI2CELANFirmwareUpdater {
+ public:
+    VoodooI2CELANFirmwareUpdater();
+
+    /* Sets how the pages are streamed
+     * @page_delay_ms wait after each page while the device programs it, 0 for what Linux waits
+     * @check_interval pages written between two checks, 1 checks every page like Linux
+     */
+    void configure(uint32_t page_delay_ms, uint32_t check_interval);
+
+    /* Works out the page layout of a device
+     * @ic_type @iap_version as read by the init sequence
+     * @layout receives the layout
+     *
+     * @return false if the IC type is not one Linux knows how to flash
+     */
+    static bool page_layout(uint8_t ic_type, uint8_t iap_version, VoodooI2CELANFirmwareLayout* layout);
+    /* The sum of a page's little endian words, as the device checks it
+     * @page the page
+     * @page_size its size in bytes
+     */
+    static uint16_t page_checksum(const uint8_t* page, uint16_t page_size);
+
+    /* Checks an image and starts flashing it, nothing is sent to the device if it is not valid
+     * @protocol the protocol to talk to the device with
+     * @info the device info of the device to flash
+     * @image the image, which has to stay valid until the update has finished or failed
+     * @length the image's size in bytes
+     * @now_ns the current time
+     *
+     * @return false if the image does not fit the device, last_error says why
+     */
+    bool begin(VoodooI2CELANProtocol* protocol, const VoodooI2CELANDeviceInfo& info, const uint8_t* image, uint32_t length, uint64_t now_ns);
+    /* Runs the next transaction
+     * @now_ns the current time
+     * @delay_ms receives how long to wait before calling tick() again
+     *
+     * @return kVoodooI2CELANFirmwareRunning while there is more to do, the final state otherwise
+     */
+    VoodooI2CELANFirmwareState tick(uint64_t now_ns, uint32_t* delay_ms);
+    /* Stops the update without talking to the device, e.g. because it is about to lose power
+     * @now_ns the current time
+     */
+    void interrupt(uint64_t now_ns);
+    /* Picks an interrupted update up again
+     * @now_ns the current time
+     */
+    void resume(uint64_t now_ns);
+    /* Forgets the update and the image, whatever state it is in */
+    void cancel();
+
+    VoodooI2CELANFirmwareState state() const { return current_state; }
+    VoodooI2CELANFirmwareStep step() const { return current_step; }
+    /* Running or interrupted, the device is not taking input until the update is over */
+    bool busy() const { return current_state == kVoodooI2CELANFirmwareRunning || current_state == kVoodooI2CELANFirmwareInterrupted; }
+    /* The pages of the image the device is known to hold */
+    uint32_t pages_verified() const { return verified_page - layout.first_page; }
+    uint32_t pages_total() const { return layout.page_count - layout.first_page; }
+    static const char* state_name(VoodooI2CELANFirmwareState state);
+    static const char* step_name(VoodooI2CELANFirmwareStep step);
+
+    uint32_t page_delay_ms;
+    uint32_t check_interval;
+
+    VoodooI2CELANFirmwareLayout layout;
+    /* Description of what went wrong last, the reason for the failure once the update has failed */
+    const char* last_error;
+
+    /* Counters of the last update */
+    // page writes sent, including pages written again
+    uint64_t page_writes;
+    uint64_t checks;
+    // pages written again after the device failed or missed them, without starting over
+    uint64_t page_retries;
+    // times the update went back to the first page
+    uint64_t restarts;
+    uint64_t resumes;
+    uint64_t bus_errors;
+    // the sum of every page, the checksum the new firmware has to report
+    uint16_t image_checksum;
+    uint16_t device_checksum;
+    // from begin() until the update succeeded or failed, time spent interrupted excluded
+    uint64_t total_ns;
+    // from the first page to the last one verified
+    uint64_t write_ns;
+
+ private:
+    VoodooI2CELANProtocol* protocol;
+    const uint8_t* image;
+    uint32_t length;
+    VoodooI2CELANFirmwareState current_state;
+    VoodooI2CELANFirmwareStep current_step;
+    bool iap_mode;
+    // picking up after an interruption rather than starting over
+    bool resuming;
+    // the last page write failed, the device may or may not have taken it
+    bool uncertain;
+    // the next page to write, the pages up to verified_page are confirmed by a check
+    uint32_t written_page;
+    uint32_t verified_page;
+    uint16_t written_checksum;
+    uint16_t verified_checksum;
+    uint32_t retry_page;
+    uint32_t retry_count;
+    uint32_t consecutive_errors;
+    // restarts and resumes the update brought on itself, up to ELAN_FIRMWARE_ATTEMPTS
+    uint32_t setbacks;
+    uint64_t begin_ns;
+    uint64_t write_begin_ns;
+    uint64_t interrupted_ns;
+    uint8_t page_buffer[ETP_FW_PAGE_SIZE_512 + 4];
+
+    IOReturn run_step(uint64_t now_ns, uint32_t* delay_ms);
+    /* Works out from the IAP status and checksum which page the device expects next */
+    IOReturn check_pages(uint64_t now_ns, uint32_t* delay_ms);
+    /* Goes back to the first page, or gives up once out of attempts
+     * @error what went wrong
+     */
+    void start_over(const char* error, uint64_t now_ns, uint32_t* delay_ms);
+    /* Goes back to entering IAP mode, without counting it against the attempts */
+    void restart();
+    /* Has the next tick() find out where the device is, or gives up once out of attempts */
+    void pick_up(uint64_t now_ns, uint32_t* delay_ms);
+    void finish(VoodooI2CELANFirmwareState state, uint64_t now_ns);
+    uint16_t checksum_of(uint32_t page) const { return page_checksum(image + page * layout.page_size, layout.page_size); }
+};
+
+#endif /* VOODOOI2C_ELAN_FIRMWARE_UPDATER_HPP */
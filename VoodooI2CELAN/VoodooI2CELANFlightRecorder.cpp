@@ -0,0 +1,141 @@
+//
+//  VoodooI2CELANFlightRecorder.cpp
+//  VoodooI2CELAN
+//
+//  Copyright © 2017 Kishor Prins. All rights reserved.
+//
+
+#include "VoodooI2CELANFlightRecorder.hpp"
+
+#include <string.h>
+
+static_assert(!(ELAN_FLIGHT_RECORDER_DEPTH & (ELAN_FLIGHT_RECORDER_DEPTH - 1)), "the flight recorder depth has to be a power of two");
+
+VoodooI2CELANFlightRecorder::VoodooI2CELANFlightRecorder() {
+    memset(entries, 0, sizeof(entries));
+    memset(anomalies, 0, sizeof(anomalies));
+    head = 0;
+    is_frozen = false;
+    frozen_head = 0;
+    invalid_run = 0;
+    freezes = 0;
+    last_anomaly = kVoodooI2CELANFlightAnomalyNone;
+    last_freeze_ns = 0;
+    dropped = 0;
+    configure(ELAN_FLIGHT_RECORDER_INVALID_BURST, ELAN_FLIGHT_RECORDER_HOLDOFF);
+}
+
+void VoodooI2CELANFlightRecorder::configure(uint32_t invalid_burst, uint32_t holdoff_ms) {
+    this->invalid_burst = invalid_burst;
+    holdoff_ns = holdoff_ms * 1000000ULL;
+}
+
+void VoodooI2CELANFlightRecorder::record(VoodooI2CELANFlightEvent event, uint64_t now_ns, uint32_t value, const void* data, uint32_t length) {
+    if (__atomic_load_n(&is_frozen, __ATOMIC_ACQUIRE)) {
+        __atomic_fetch_add(&dropped, 1, __ATOMIC_RELAXED);
+        return;
+    }
+
+    uint64_t position = __atomic_fetch_add(&head, 1, __ATOMIC_RELAXED);
+    VoodooI2CELANFlightEntry& slot = entries[position & (ELAN_FLIGHT_RECORDER_DEPTH - 1)];
+    __atomic_store_n(&slot.sequence, 0, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    if (length > sizeof(slot.data))
+        length = sizeof(slot.data);
+    slot.timestamp_ns = now_ns;
+    slot.value = value;
+    slot.event = event;
+    slot.length = static_cast<uint8_t>(length);
+    if (length)
+        memcpy(slot.data, data, length);
+    __atomic_store_n(&slot.sequence, position + 1, __ATOMIC_RELEASE);
+}
+
+VoodooI2CELANFlightAnomaly VoodooI2CELANFlightRecorder::record_report(uint64_t now_ns, const uint8_t* data, VoodooI2CELANReportStatus status) {
+    // an idle device answers every poll with an empty report, which would flush the history that matters
+    if (status == kVoodooI2CELANReportEmpty)
+        return kVoodooI2CELANFlightAnomalyNone;
+    record(kVoodooI2CELANFlightReport, now_ns, status, data, ETP_MAX_REPORT_LEN);
+
+    if (status != kVoodooI2CELANReportInvalid && status != kVoodooI2CELANReportShort) {
+        invalid_run = 0;
+        return kVoodooI2CELANFlightAnomalyNone;
+    }
+    // only the report that completes the burst counts, not every one after it
+    return ++invalid_run == invalid_burst ? kVoodooI2CELANFlightAnomalyInvalidBurst : kVoodooI2CELANFlightAnomalyNone;
+}
+
+bool VoodooI2CELANFlightRecorder::freeze(VoodooI2CELANFlightAnomaly anomaly, uint64_t now_ns) {
+    anomalies[anomaly]++;
+    if (frozen() || (freezes && anomaly != kVoodooI2CELANFlightAnomalyRequested && now_ns < last_freeze_ns + holdoff_ns))
+        return false;
+
+    record(kVoodooI2CELANFlightAnomaly, now_ns, anomaly, NULL, 0);
+    __atomic_store_n(&is_frozen, true, __ATOMIC_SEQ_CST);
+    frozen_head = __atomic_load_n(&head, __ATOMIC_SEQ_CST);
+    freezes++;
+    last_anomaly = anomaly;
+    last_freeze_ns = now_ns;
+    return true;
+}
+
+void VoodooI2CELANFlightRecorder::thaw() {
+    __atomic_store_n(&is_frozen, false, __ATOMIC_RELEASE);
+}
+
+uint32_t VoodooI2CELANFlightRecorder::count() const {
+    uint64_t end = frozen() ? frozen_head : __atomic_load_n(&head, __ATOMIC_ACQUIRE);
+    return end < ELAN_FLIGHT_RECORDER_DEPTH ? static_cast<uint32_t>(end) : ELAN_FLIGHT_RECORDER_DEPTH;
+}
+
+bool VoodooI2CELANFlightRecorder::entry(uint32_t index, VoodooI2CELANFlightEntry* entry) const {
+    uint64_t end = frozen() ? frozen_head : __atomic_load_n(&head, __ATOMIC_ACQUIRE);
+    uint64_t position = end - count() + index;
+    const VoodooI2CELANFlightEntry& slot = entries[position & (ELAN_FLIGHT_RECORDER_DEPTH - 1)];
+
+    // a writer that got its slot just before the freeze may still be at it, or one that got
+    // past the frozen check just before may be overwriting the oldest entry
+    uint64_t before = __atomic_load_n(&slot.sequence, __ATOMIC_ACQUIRE);
+    memcpy(entry, &slot, sizeof(*entry));
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    return before == position + 1 && __atomic_load_n(&slot.sequence, __ATOMIC_RELAXED) == before;
+}
+
+const char* VoodooI2CELANFlightRecorder::event_name(VoodooI2CELANFlightEvent event) {
+    switch (event) {
+        case kVoodooI2CELANFlightReport: return "Report";
+        case kVoodooI2CELANFlightReadError: return "ReadError";
+        case kVoodooI2CELANFlightPower: return "Power";
+        case kVoodooI2CELANFlightKeyboard: return "Keyboard";
+        case kVoodooI2CELANFlightReset: return "Reset";
+        case kVoodooI2CELANFlightAnomaly: return "Anomaly";
+        case kVoodooI2CELANFlightEventCount: break;
+    }
+    return "Unknown";
+}
+
+const char* VoodooI2CELANFlightRecorder::reset_name(VoodooI2CELANFlightResetKind kind) {
+    switch (kind) {
+        case kVoodooI2CELANFlightResetInit: return "Init";
+        case kVoodooI2CELANFlightResetFastResume: return "FastResume";
+        case kVoodooI2CELANFlightResetFullResume: return "FullResume";
+        case kVoodooI2CELANFlightResetRecovery: return "Recovery";
+        case kVoodooI2CELANFlightResetCalibration: return "Calibration";
+        case kVoodooI2CELANFlightResetFirmware: return "Firmware";
+        case kVoodooI2CELANFlightResetKindCount: break;
+    }
+    return "Unknown";
+}
+
+const char* VoodooI2CELANFlightRecorder::anomaly_name(VoodooI2CELANFlightAnomaly anomaly) {
+    switch (anomaly) {
+        case kVoodooI2CELANFlightAnomalyNone: return "None";
+        case kVoodooI2CELANFlightAnomalyInvalidBurst: return "InvalidBurst";
+        case kVoodooI2CELANFlightAnomalyReadFailure: return "ReadFailure";
+        case kVoodooI2CELANFlightAnomalyWatchdog: return "Watchdog";
+        case kVoodooI2CELANFlightAnomalyRequested: return "Requested";
+        case kVoodooI2CELANFlightAnomalyCount: break;
+    }
+    return "Unknown";
+}
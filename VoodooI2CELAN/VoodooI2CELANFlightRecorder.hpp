@@ -0,0 +1,148 @@
+//
+//  VoodooI2CELANFlightRecorder.hpp
+//  VoodooI2CELAN
+//
+//  Copyright © 2017 Kishor Prins. All rights reserved.
+//
+
+#ifndef VOODOOI2C_ELAN_FLIGHT_RECORDER_HPP
+#define VOODOOI2C_ELAN_FLIGHT_RECORDER_HPP
+
+#include <stdint.h>
+
+#include "VoodooI2CELANPortability.hpp"
+#include "VoodooI2CELANReportDecoder.hpp"
+
+#define ELAN_FLIGHT_RECORDER_DEPTH 128
+// Invalid or short reports in a row that count as an anomaly
+#define ELAN_FLIGHT_RECORDER_INVALID_BURST 3
+// Anomalies within this long of the last dump are only counted
+#define ELAN_FLIGHT_RECORDER_HOLDOFF 10000
+
+/* What an entry of the flight recorder holds */
+enum VoodooI2CELANFlightEvent {
+    kVoodooI2CELANFlightReport = 0,  // a report read, value is its VoodooI2CELANReportStatus, data the report
+    kVoodooI2CELANFlightReadError,   // a failed read, value is the IOReturn
+    kVoodooI2CELANFlightPower,       // setPowerState(), value is the power state
+    kVoodooI2CELANFlightKeyboard,    // message() from the keyboard, value is the message code, data its argument
+    kVoodooI2CELANFlightReset,       // the device was (re)initialised, value is a VoodooI2CELANFlightResetKind
+    kVoodooI2CELANFlightAnomaly,     // what froze the recorder, value is a VoodooI2CELANFlightAnomaly
+    kVoodooI2CELANFlightEventCount
+};
+
+enum VoodooI2CELANFlightResetKind {
+    kVoodooI2CELANFlightResetInit = 0,  // the full init sequence
+    kVoodooI2CELANFlightResetFastResume,
+    kVoodooI2CELANFlightResetFullResume,
+    kVoodooI2CELANFlightResetRecovery,  // the watchdog found the controller wedged
+    kVoodooI2CELANFlightResetCalibration,  // the baselines were calibrated again
+    kVoodooI2CELANFlightResetFirmware,     // a firmware update finished, data is whether it succeeded
+    kVoodooI2CELANFlightResetKindCount
+};
+
+enum VoodooI2CELANFlightAnomaly {
+    kVoodooI2CELANFlightAnomalyNone = 0,
+    kVoodooI2CELANFlightAnomalyInvalidBurst,  // ELAN_FLIGHT_RECORDER_INVALID_BURST invalid reports in a row
+    kVoodooI2CELANFlightAnomalyReadFailure,
+    kVoodooI2CELANFlightAnomalyWatchdog,
+    kVoodooI2CELANFlightAnomalyRequested,     // asked for from user space
+    kVoodooI2CELANFlightAnomalyCount
+};
+
+struct VoodooI2CELANFlightEntry {
+    // 1 + the entry's position once written, 0 while it is being written
+    uint64_t sequence;
+    uint64_t timestamp_ns;
+    uint32_t value;
+    uint8_t event;
+    // bytes of data in use
+    uint8_t length;
+    uint8_t data[ETP_MAX_REPORT_LEN];
+    uint8_t reserved[8];
+};
+
+/* Keeps the last ELAN_FLIGHT_RECORDER_DEPTH things that happened to the device
+ *
+ * Reports and read errors come from the work loop, power transitions and
+ * keyboard messages from whatever thread delivers them. Each entry claims its
+ * slot with a single atomic increment, so any of them may record at any time
+ * without a lock. All memory is part of the object, nothing is allocated.
+ *
+ * When something goes wrong freeze() stops recording, so the caller can copy
+ * out the history leading up to it undisturbed, and thaw() starts it again.
+ * Anomalies that come in less than the holdoff after the last one are only
+ * counted, so a controller that keeps failing does not keep the work loop
+ * busy dumping.
+ */
+
+class VoodooI2CELANFlightRecorder {
+ public:
+    VoodooI2CELANFlightRecorder();
+
+    /* Sets what counts as an anomaly
+     * @invalid_burst invalid reports in a row that make an anomaly, 0 never does
+     * @holdoff_ms the minimum time between two freezes
+     */
+    void configure(uint32_t invalid_burst, uint32_t holdoff_ms);
+
+    /* Records an event, from any thread
+     * @event what happened
+     * @now_ns the current time
+     * @value @data @length event specific, see VoodooI2CELANFlightEvent, @length is capped to the entry
+     */
+    void record(VoodooI2CELANFlightEvent event, uint64_t now_ns, uint32_t value, const void* data, uint32_t length);
+    /* Records a report read, from the work loop, empty reports are neither recorded nor end a burst
+     * @now_ns when the read completed
+     * @data the report as read
+     * @status what decoding made of it
+     *
+     * @return kVoodooI2CELANFlightAnomalyInvalidBurst if this completes a burst of invalid reports
+     */
+    VoodooI2CELANFlightAnomaly record_report(uint64_t now_ns, const uint8_t* data, VoodooI2CELANReportStatus status);
+
+    /* Records an anomaly and stops recording, from the work loop
+     * @anomaly what went wrong
+     * @now_ns the current time
+     *
+     * @return true if the recorder is frozen and should be dumped and thawed, false if the
+     * anomaly came within the holdoff and was only counted
+     */
+    bool freeze(VoodooI2CELANFlightAnomaly anomaly, uint64_t now_ns);
+    /* Starts recording again */
+    void thaw();
+    bool frozen() const { return __atomic_load_n(&is_frozen, __ATOMIC_ACQUIRE); }
+
+    /* The number of complete entries held, up to ELAN_FLIGHT_RECORDER_DEPTH */
+    uint32_t count() const;
+    /* Copies out an entry while frozen
+     * @index 0 for the oldest, up to count()
+     * @entry receives the entry
+     *
+     * @return false if the entry was being written when the recorder froze
+     */
+    bool entry(uint32_t index, VoodooI2CELANFlightEntry* entry) const;
+
+    static const char* event_name(VoodooI2CELANFlightEvent event);
+    static const char* reset_name(VoodooI2CELANFlightResetKind kind);
+    static const char* anomaly_name(VoodooI2CELANFlightAnomaly anomaly);
+
+    /* Every anomaly, dumped or not */
+    uint64_t anomalies[kVoodooI2CELANFlightAnomalyCount];
+    uint64_t freezes;
+    VoodooI2CELANFlightAnomaly last_anomaly;
+    uint64_t last_freeze_ns;
+    // events not recorded because the recorder was frozen
+    uint64_t dropped;
+
+ private:
+    VoodooI2CELANFlightEntry entries[ELAN_FLIGHT_RECORDER_DEPTH];
+    uint64_t head;
+    bool is_frozen;
+    // head when the recorder froze, entries from there on are not part of the dump
+    uint64_t frozen_head;
+    uint32_t invalid_burst;
+    uint32_t invalid_run;
+    uint64_t holdoff_ns;
+};
+
+#endif /* VOODOOI2C_ELAN_FLIGHT_RECORDER_HPP */
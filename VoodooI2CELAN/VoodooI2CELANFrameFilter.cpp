@@ -0,0 +1,67 @@
+//
+//  VoodooI2CELANFrameFilter.cpp
+//  VoodooI2CELAN
+//
+//  Copyright © 2017 Kishor Prins. All rights reserved.
+//
+
+#include "VoodooI2CELANFrameFilter.hpp"
+
+#include <string.h>
+
+#define ELAN_ALL_SLOTS ((1U << ETP_MAX_FINGERS) - 1)
+
+bool is_ELAN_contact_transition(const VoodooI2CELANReport& previous, const VoodooI2CELANReport& next) {
+    return previous.contact_mask != next.contact_mask || previous.button != next.button;
+}
+
+VoodooI2CELANFrameFilter::VoodooI2CELANFrameFilter() : compare_raw(true), frames(0), skipped_slots(0), suppressed_frames(0) {
+    reset();
+}
+
+void VoodooI2CELANFrameFilter::reset() {
+    have_previous = false;
+    settled = 0;
+}
+
+static bool contact_changed(const VoodooI2CELANContact& a, const VoodooI2CELANContact& b) {
+    return a.x != b.x || a.y != b.y || a.pressure != b.pressure || a.mk_x != b.mk_x || a.mk_y != b.mk_y;
+}
+
+uint8_t VoodooI2CELANFrameFilter::filter(const uint8_t* report_data, const VoodooI2CELANReport& report, bool refresh_contacts) {
+    uint8_t changed = ELAN_ALL_SLOTS;
+
+    frames++;
+    if (have_previous) {
+        // the length and report ID are the same for every valid report
+        if (compare_raw && !memcmp(previous_data + ETP_TOUCH_INFO_OFFSET, report_data + ETP_TOUCH_INFO_OFFSET, ETP_MAX_REPORT_LEN - ETP_TOUCH_INFO_OFFSET)) {
+            changed = 0;
+        } else {
+            changed = previous.contact_mask ^ report.contact_mask;
+            // every contact carries the button state
+            if (previous.button != report.button)
+                changed |= report.contact_mask | previous.contact_mask;
+
+            uint8_t both = previous.contact_mask & report.contact_mask & ~changed;
+            for (int i = 0; i < ETP_MAX_FINGERS; i++) {
+                if ((both & (1U << i)) && contact_changed(previous.contacts[i], report.contacts[i]))
+                    changed |= 1U << i;
+            }
+        }
+    }
+
+    uint8_t update = changed | (~settled & ELAN_ALL_SLOTS);
+    if (refresh_contacts)
+        update |= report.contact_mask;
+
+    settled = ~changed & ELAN_ALL_SLOTS;
+    memcpy(previous_data, report_data, ETP_MAX_REPORT_LEN);
+    previous = report;
+    have_previous = true;
+
+    for (uint8_t skipped = ~update & ELAN_ALL_SLOTS; skipped; skipped &= skipped - 1)
+        skipped_slots++;
+    if (!update)
+        suppressed_frames++;
+    return update;
+}
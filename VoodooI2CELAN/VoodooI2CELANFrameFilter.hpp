@@ -0,0 +1,59 @@
+//
+//  VoodooI2CELANFrameFilter.hpp
+//  VoodooI2CELAN
+//
+//  Copyright © 2017 Kishor Prins. All rights reserved.
+//
+
+#ifndef VOODOOI2C_ELAN_FRAME_FILTER_HPP
+#define VOODOOI2C_ELAN_FRAME_FILTER_HPP
+
+#include "VoodooI2CELANReportDecoder.hpp"
+
+/* Checks whether going from @previous to @next puts a contact down, lifts one or changes the button
+ *
+ * @return true if the reports on either side must both be dispatched
+ */
+bool is_ELAN_contact_transition(const VoodooI2CELANReport& previous, const VoodooI2CELANReport& next);
+
+/* Works out which transducer slots a report actually changes
+ *
+ * Each transducer value keeps its previous sample, so a slot has to be
+ * updated once more after it stops changing for the multitouch engine to see
+ * it settle. After that, further updates with the same data are no-ops and
+ * are skipped. A frame where every slot is skipped does not need to be
+ * dispatched at all.
+ */
+
+class VoodooI2CELANFrameFilter {
+ public:
+    VoodooI2CELANFrameFilter();
+
+    /* Forgets the previous frame so the next one updates every slot */
+    void reset();
+    /* Compares a report against the previous one
+     * @report_data the raw report as read from the device
+     * @report the decoded @report_data
+     * @refresh_contacts slots with a contact must be updated even if unchanged, because some
+     * state derived from the time (e.g. the quiet period after typing) may have moved on
+     *
+     * @return the slots that need updating, 0 if the frame can be suppressed
+     */
+    uint8_t filter(const uint8_t* report_data, const VoodooI2CELANReport& report, bool refresh_contacts);
+
+    // false when the decoded contacts are filtered, equal raw reports may then still differ
+    bool compare_raw;
+
+    uint64_t frames;
+    uint64_t skipped_slots;
+    uint64_t suppressed_frames;
+
+ private:
+    uint8_t previous_data[ETP_MAX_REPORT_LEN];
+    VoodooI2CELANReport previous;
+    bool have_previous;
+    // slots that did not change in the previous frame either
+    uint8_t settled;
+};
+
+#endif /* VOODOOI2C_ELAN_FRAME_FILTER_HPP */
@@ -0,0 +1,99 @@
+//
+//  VoodooI2CELANFrameRing.cpp
+//  VoodooI2CELAN
+//
+//  Copyright © 2017 Kishor Prins. All rights reserved.
+//
+
+#include "VoodooI2CELANFrameRing.hpp"
+
+#include <string.h>
+
+#include "VoodooI2CELANFrameFilter.hpp"
+
+VoodooI2CELANFrameRing::VoodooI2CELANFrameRing() {
+    pushed = 0;
+    dropped = 0;
+    full = 0;
+    high_water = 0;
+    popped = 0;
+    configure(ELAN_FRAME_RING_DEPTH);
+}
+
+void VoodooI2CELANFrameRing::configure(uint32_t depth) {
+    uint32_t rounded = 2;
+    while (rounded < depth && rounded < ELAN_FRAME_RING_MAX_DEPTH)
+        rounded <<= 1;
+    mask = rounded - 1;
+    reset();
+}
+
+void VoodooI2CELANFrameRing::reset() {
+    __atomic_store_n(&head, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&tail, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&producer_waiting, false, __ATOMIC_RELAXED);
+    have_last = false;
+}
+
+VoodooI2CELANFramePush VoodooI2CELANFrameRing::push(VoodooI2CELANFrame* frame) {
+    VoodooI2CELANFramePush result = kVoodooI2CELANFrameQueued;
+    uint64_t position = head;
+    uint64_t oldest = __atomic_load_n(&tail, __ATOMIC_ACQUIRE);
+
+    // the first frame after a reset has nothing to compare against, so it always counts
+    frame->transition = !have_last || is_ELAN_contact_transition(last, frame->report);
+
+    while (position - oldest > mask) {
+        // only the producer writes slots, so reading the flags of queued frames is safe
+        bool droppable = !slots[oldest & mask].transition && !slots[(oldest + 1) & mask].transition;
+        if (!droppable) {
+            // the consumer may have emptied the ring and gone idle just before the flag was
+            // set, so look again afterwards, otherwise it would never ask for the frame
+            __atomic_store_n(&producer_waiting, true, __ATOMIC_SEQ_CST);
+            if (__atomic_load_n(&tail, __ATOMIC_SEQ_CST) == oldest) {
+                full++;
+                return kVoodooI2CELANFrameFull;
+            }
+            __atomic_store_n(&producer_waiting, false, __ATOMIC_RELAXED);
+            oldest = __atomic_load_n(&tail, __ATOMIC_ACQUIRE);
+            continue;
+        }
+        // losing the race means the consumer took the frame, which makes room just as well
+        if (__atomic_compare_exchange_n(&tail, &oldest, oldest + 1, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+            dropped++;
+            result = kVoodooI2CELANFrameDroppedOldest;
+        }
+        break;
+    }
+
+    memcpy(&slots[position & mask], frame, sizeof(*frame));
+    __atomic_store_n(&head, position + 1, __ATOMIC_RELEASE);
+
+    last = frame->report;
+    have_last = true;
+    pushed++;
+    uint32_t queued = static_cast<uint32_t>(position + 1 - __atomic_load_n(&tail, __ATOMIC_RELAXED));
+    if (queued > high_water)
+        high_water = queued;
+    return result;
+}
+
+bool VoodooI2CELANFrameRing::pop(VoodooI2CELANFrame* frame, bool* superseded) {
+    for (;;) {
+        uint64_t oldest = __atomic_load_n(&tail, __ATOMIC_ACQUIRE);
+        uint64_t position = __atomic_load_n(&head, __ATOMIC_ACQUIRE);
+        if (oldest == position)
+            return false;
+
+        // the producer may drop this frame and reuse its slot while it is being copied,
+        // in which case claiming it below fails and the copy is thrown away
+        memcpy(frame, &slots[oldest & mask], sizeof(*frame));
+        bool newer = oldest + 1 != position && !slots[(oldest + 1) & mask].transition;
+
+        if (__atomic_compare_exchange_n(&tail, &oldest, oldest + 1, false, __ATOMIC_SEQ_CST, __ATOMIC_ACQUIRE)) {
+            *superseded = newer;
+            popped++;
+            return true;
+        }
+    }
+}
@@ -0,0 +1,114 @@
+//
+//  VoodooI2CELANFrameRing.hpp
+//  VoodooI2CELAN
+//
+//  Copyright © 2017 Kishor Prins. All rights reserved.
+//
+
+#ifndef VOODOOI2C_ELAN_FRAME_RING_HPP
+#define VOODOOI2C_ELAN_FRAME_RING_HPP
+
+#include <stdint.h>
+
+#include "VoodooI2CELANLatencyHistogram.hpp"
+#include "VoodooI2CELANReportDecoder.hpp"
+
+#define ELAN_FRAME_RING_MAX_DEPTH 64
+#define ELAN_FRAME_RING_DEPTH 16
+
+/* A report as handed from the acquisition side to the dispatch side */
+struct VoodooI2CELANFrame {
+    uint8_t data[ETP_MAX_REPORT_LEN];
+    VoodooI2CELANReport report;
+    VoodooI2CELANStageTimes times;
+    // when the interrupt fired, in whatever clock units the caller dispatches with
+    uint64_t timestamp;
+    uint64_t timestamp_ns;
+    // set by push(), the contacts or the button differ from the frame pushed before
+    bool transition;
+};
+
+enum VoodooI2CELANFramePush {
+    kVoodooI2CELANFrameQueued = 0,
+    kVoodooI2CELANFrameDroppedOldest,  // queued after dropping the oldest motion frame
+    kVoodooI2CELANFrameFull            // not queued, the ring only holds frames that may not be dropped
+};
+
+/* Lock free single producer, single consumer ring of decoded frames
+ *
+ * The producer (the work loop reading the bus) never waits for the consumer
+ * (the stage feeding the multitouch engine). When the ring is full the oldest
+ * frame is dropped, but only if neither it nor the frame after it is a
+ * transition, so a contact going down or up and the last position before it
+ * always get through. If that is not possible push() fails and the producer
+ * has to hold on to the frame and retry once the consumer has caught up, see
+ * take_producer_wakeup().
+ *
+ * Dropping the oldest frame means the producer also advances the read index,
+ * so the consumer copies a frame out first and only keeps the copy if it can
+ * still claim it afterwards.
+ */
+
+class VoodooI2CELANFrameRing {
+ public:
+    VoodooI2CELANFrameRing();
+
+    /* Sets the number of frames held, rounded up to a power of two between 2 and
+     * ELAN_FRAME_RING_MAX_DEPTH, and empties the ring. Neither side may be running.
+     * @depth the requested depth
+     */
+    void configure(uint32_t depth);
+    /* Empties the ring and forgets the last pushed frame. Neither side may be running */
+    void reset();
+
+    /* Producer side, queues a copy of @frame and sets its transition flag
+     * @frame the frame to queue
+     *
+     * @return whether the frame was queued and if that cost the oldest frame
+     */
+    VoodooI2CELANFramePush push(VoodooI2CELANFrame* frame);
+
+    /* Consumer side, takes the oldest frame
+     * @frame receives the frame
+     * @superseded set if a newer frame that is not a transition is already queued behind it
+     *
+     * @return false if the ring was empty
+     */
+    bool pop(VoodooI2CELANFrame* frame, bool* superseded);
+    /* Consumer side, tells whether a push() has failed since the last call
+     *
+     * @return true if the producer is holding a frame and should be woken up
+     */
+    bool take_producer_wakeup() { return __atomic_exchange_n(&producer_waiting, false, __ATOMIC_SEQ_CST); }
+
+    uint32_t depth() const { return mask + 1; }
+    uint32_t size() const {
+        return static_cast<uint32_t>(__atomic_load_n(&head, __ATOMIC_ACQUIRE) - __atomic_load_n(&tail, __ATOMIC_ACQUIRE));
+    }
+
+    /* Written by the producer */
+    uint64_t pushed;
+    uint64_t dropped;
+    uint64_t full;
+    uint32_t high_water;
+    /* Written by the consumer */
+    uint64_t popped;
+
+ private:
+    VoodooI2CELANFrame slots[ELAN_FRAME_RING_MAX_DEPTH];
+    uint32_t mask;
+
+    // only written by the producer, kept a cache line away from tail
+    uint64_t head;
+    uint8_t head_padding[64 - sizeof(uint64_t)];
+    // advanced by the consumer, and by the producer when it drops the oldest frame
+    uint64_t tail;
+    uint8_t tail_padding[64 - sizeof(uint64_t)];
+    bool producer_waiting;
+
+    // producer state, the frame last pushed
+    VoodooI2CELANReport last;
+    bool have_last;
+};
+
+#endif /* VOODOOI2C_ELAN_FRAME_RING_HPP */
@@ -0,0 +1,150 @@
+//
+//  VoodooI2CELANIdleMonitor.cpp
+//  VoodooI2CELAN
+//
+//  Copyright © 2017 Kishor Prins. All rights reserved.
+//
+
+#include "VoodooI2CELANIdleMonitor.hpp"
+
+static uint32_t ns_to_ms_rounded_up(uint64_t ns) {
+    uint64_t ms = (ns + 999999) / 1000000;
+    return ms ? static_cast<uint32_t>(ms) : 1;
+}
+
+VoodooI2CELANIdleMonitor::VoodooI2CELANIdleMonitor() :
+    idle_timeout_ms(0),
+    probe_interval_ms(0),
+    probe_window_ms(0),
+    sleeps(0),
+    probes(0),
+    interrupt_wakes(0),
+    empty_probes(0),
+    hover_wakes(0),
+    prewarmed_contacts(0),
+    last_wake_latency_ns(0),
+    current(kVoodooI2CELANIdleActive),
+    running(false),
+    state_begin_ns(0),
+    last_report_ns(0),
+    wake_begin_ns(0),
+    hovering(false) {
+    for (int i = 0; i < kVoodooI2CELANIdleStateCount; i++)
+        state_ns[i] = 0;
+}
+
+void VoodooI2CELANIdleMonitor::configure(uint32_t idle_timeout_ms, uint32_t probe_interval_ms, uint32_t probe_window_ms) {
+    this->idle_timeout_ms = idle_timeout_ms;
+    this->probe_interval_ms = probe_interval_ms;
+    // a zero window would put the device back to sleep before it could report
+    this->probe_window_ms = probe_window_ms ? probe_window_ms : 1;
+}
+
+void VoodooI2CELANIdleMonitor::reset(uint64_t now_ns) {
+    enter(kVoodooI2CELANIdleActive, now_ns);
+    running = true;
+    last_report_ns = now_ns;
+    wake_begin_ns = 0;
+    hovering = false;
+}
+
+void VoodooI2CELANIdleMonitor::stop(uint64_t now_ns) {
+    enter(current, now_ns);
+    running = false;
+}
+
+void VoodooI2CELANIdleMonitor::enter(VoodooI2CELANIdleState state, uint64_t now_ns) {
+    if (running)
+        state_ns[current] += now_ns - state_begin_ns;
+    state_begin_ns = now_ns;
+    current = state;
+}
+
+void VoodooI2CELANIdleMonitor::report_received(uint64_t now_ns, bool contact, bool hover) {
+    last_report_ns = now_ns;
+    if (current == kVoodooI2CELANIdleActive) {
+        if (contact && hovering)
+            prewarmed_contacts++;
+        hovering = hover && !contact;
+        return;
+    }
+
+    last_wake_latency_ns = now_ns - wake_begin_ns;
+    wake_latency.record(last_wake_latency_ns);
+    hovering = hover && !contact;
+    if (hovering)
+        hover_wakes++;
+    enter(kVoodooI2CELANIdleActive, now_ns);
+}
+
+VoodooI2CELANIdleAction VoodooI2CELANIdleMonitor::interrupt(uint64_t now_ns, uint32_t* delay_ms) {
+    if (current != kVoodooI2CELANIdleAsleep)
+        return kVoodooI2CELANIdleNone;
+
+    // the device only interrupts while asleep when it has seen a finger, so
+    // wake it and give it the same window as a probe to send the report
+    interrupt_wakes++;
+    wake_begin_ns = now_ns;
+    enter(kVoodooI2CELANIdleProbing, now_ns);
+    *delay_ms = probe_window_ms;
+    return kVoodooI2CELANIdleWake;
+}
+
+VoodooI2CELANIdleAction VoodooI2CELANIdleMonitor::tick(uint64_t now_ns, uint32_t* delay_ms) {
+    *delay_ms = 0;
+
+    switch (current) {
+        case kVoodooI2CELANIdleActive: {
+            if (!idle_timeout_ms)
+                return kVoodooI2CELANIdleNone;
+            uint64_t timeout_ns = idle_timeout_ms * 1000000ULL;
+            // the report may carry a later timestamp than the tick that runs after it
+            uint64_t idle_ns = now_ns > last_report_ns ? now_ns - last_report_ns : 0;
+            if (idle_ns < timeout_ns) {
+                *delay_ms = ns_to_ms_rounded_up(timeout_ns - idle_ns);
+                return kVoodooI2CELANIdleNone;
+            }
+            sleeps++;
+            enter(kVoodooI2CELANIdleAsleep, now_ns);
+            *delay_ms = probe_interval_ms;
+            return kVoodooI2CELANIdleSleep;
+        }
+
+        case kVoodooI2CELANIdleAsleep:
+            if (!probe_interval_ms)
+                return kVoodooI2CELANIdleNone;
+            probes++;
+            wake_begin_ns = now_ns;
+            enter(kVoodooI2CELANIdleProbing, now_ns);
+            *delay_ms = probe_window_ms;
+            return kVoodooI2CELANIdleWake;
+
+        case kVoodooI2CELANIdleProbing:
+            // nobody touched the pad while it was awake
+            empty_probes++;
+            enter(kVoodooI2CELANIdleAsleep, now_ns);
+            *delay_ms = probe_interval_ms;
+            return kVoodooI2CELANIdleSleep;
+
+        case kVoodooI2CELANIdleStateCount:
+            break;
+    }
+    return kVoodooI2CELANIdleNone;
+}
+
+uint64_t VoodooI2CELANIdleMonitor::time_in(VoodooI2CELANIdleState state, uint64_t now_ns) const {
+    uint64_t ns = state_ns[state];
+    if (running && state == current)
+        ns += now_ns - state_begin_ns;
+    return ns;
+}
+
+const char* VoodooI2CELANIdleMonitor::state_name(VoodooI2CELANIdleState state) {
+    switch (state) {
+        case kVoodooI2CELANIdleActive: return "Active";
+        case kVoodooI2CELANIdleAsleep: return "Asleep";
+        case kVoodooI2CELANIdleProbing: return "Probing";
+        case kVoodooI2CELANIdleStateCount: break;
+    }
+    return "Unknown";
+}
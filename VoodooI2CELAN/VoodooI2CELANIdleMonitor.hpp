@@ -0,0 +1,121 @@
+//
+//  VoodooI2CELANIdleMonitor.hpp
+//  VoodooI2CELAN
+//
+//  Copyright © 2017 Kishor Prins. All rights reserved.
+//
+
+#ifndef VOODOOI2C_ELAN_IDLE_MONITOR_HPP
+#define VOODOOI2C_ELAN_IDLE_MONITOR_HPP
+
+#include <stdint.h>
+
+#include "VoodooI2CELANLatencyHistogram.hpp"
+
+enum VoodooI2CELANIdleState {
+    kVoodooI2CELANIdleActive = 0,   // awake and reporting
+    kVoodooI2CELANIdleAsleep,       // in its low power state
+    kVoodooI2CELANIdleProbing,      // woken up to see whether a finger is down
+    kVoodooI2CELANIdleStateCount
+};
+
+/* What the driver has to do to the device */
+enum VoodooI2CELANIdleAction {
+    kVoodooI2CELANIdleNone = 0,
+    kVoodooI2CELANIdleSleep,
+    kVoodooI2CELANIdleWake
+};
+
+/* Decides when to put the device into its low power state at runtime
+ *
+ * After idle_timeout_ms without a report the device is put to sleep. It is
+ * woken up again by an interrupt, or every probe_interval_ms for
+ * probe_window_ms to give a finger the chance to show up on devices that do
+ * not interrupt while asleep or have no usable interrupt at all. The first
+ * report makes it active again, if none arrives within the window it goes
+ * back to sleep. The device only reports while touched or while a finger
+ * hovers above it, so the time since the last report is the time since the
+ * last sign of a finger. A hover report wakes the device just like a contact,
+ * which gets the wake up out of the way before the finger lands.
+ *
+ * The monitor only keeps time, the driver carries out the actions it returns
+ * and calls tick() again after the delay it asks for.
+ */
+
+class VoodooI2CELANIdleMonitor {
+ public:
+    VoodooI2CELANIdleMonitor();
+
+    /* Sets the timeouts, an idle timeout of 0 keeps the device awake
+     * @idle_timeout_ms time without reports before the device is put to sleep
+     * @probe_interval_ms time between probes while asleep, 0 to only wake on interrupts
+     * @probe_window_ms how long a probe waits for a report
+     */
+    void configure(uint32_t idle_timeout_ms, uint32_t probe_interval_ms, uint32_t probe_window_ms);
+    /* Starts over in the active state, e.g. after the device was (re)initialised
+     * @now_ns the current time
+     */
+    void reset(uint64_t now_ns);
+    /* Stops counting time until the next reset(), e.g. while the system sleeps
+     * @now_ns the current time
+     */
+    void stop(uint64_t now_ns);
+
+    /* Accounts for a valid report
+     * @now_ns when the report was read
+     * @contact whether anything touches the surface
+     * @hover whether a finger hovers above it
+     */
+    void report_received(uint64_t now_ns, bool contact, bool hover);
+    /* Accounts for an interrupt
+     * @now_ns when the interrupt fired
+     * @delay_ms receives when tick() should run next, unchanged unless the device has to be woken
+     *
+     * @return kVoodooI2CELANIdleWake if the device is asleep and has to be woken to report
+     */
+    VoodooI2CELANIdleAction interrupt(uint64_t now_ns, uint32_t* delay_ms);
+    /* Runs the timeouts
+     * @now_ns the current time
+     * @delay_ms receives when to call again, 0 if there is nothing to wait for
+     *
+     * @return the action to carry out
+     */
+    VoodooI2CELANIdleAction tick(uint64_t now_ns, uint32_t* delay_ms);
+
+    VoodooI2CELANIdleState state() const { return current; }
+    /* Time spent in @state, including the current stretch
+     * @now_ns the current time
+     */
+    uint64_t time_in(VoodooI2CELANIdleState state, uint64_t now_ns) const;
+    static const char* state_name(VoodooI2CELANIdleState state);
+
+    uint32_t idle_timeout_ms;
+    uint32_t probe_interval_ms;
+    uint32_t probe_window_ms;
+
+    /* Totals since the monitor was created */
+    uint64_t sleeps;
+    uint64_t probes;
+    uint64_t interrupt_wakes;
+    uint64_t empty_probes;
+    /* Wakes completed by a hover report, i.e. before the finger landed */
+    uint64_t hover_wakes;
+    /* Contacts that landed after hovering, with the device already awake */
+    uint64_t prewarmed_contacts;
+    /* Time from the interrupt or probe that woke the device to its first report */
+    VoodooI2CELANLatencyHistogram wake_latency;
+    uint64_t last_wake_latency_ns;
+
+ private:
+    VoodooI2CELANIdleState current;
+    bool running;
+    uint64_t state_begin_ns;
+    uint64_t state_ns[kVoodooI2CELANIdleStateCount];
+    uint64_t last_report_ns;
+    uint64_t wake_begin_ns;
+    bool hovering;
+
+    void enter(VoodooI2CELANIdleState state, uint64_t now_ns);
+};
+
+#endif /* VOODOOI2C_ELAN_IDLE_MONITOR_HPP */
@@ -0,0 +1,82 @@
+//
+//  VoodooI2CELANInitSequencer.cpp
+//  VoodooI2CELAN
+//
+//  Copyright © 2017 Kishor Prins. All rights reserved.
+//
+
+#include "VoodooI2CELANInitSequencer.hpp"
+
+#include <string.h>
+
+VoodooI2CELANInitSequencer::VoodooI2CELANInitSequencer() :
+    total_ns(0),
+    retry_delay_ms(20),
+    step_timeout_ms(500),
+    settle_ms(100),
+    protocol(NULL),
+    info(NULL),
+    current_state(kVoodooI2CELANInitIdle),
+    current_step(kVoodooI2CELANInitReset),
+    begin_ns(0),
+    step_begin_ns(0),
+    finished_step(kVoodooI2CELANInitDone) {
+    memset(timings, 0, sizeof(timings));
+}
+
+void VoodooI2CELANInitSequencer::begin(VoodooI2CELANProtocol* protocol, VoodooI2CELANDeviceInfo* info, uint64_t now_ns) {
+    this->protocol = protocol;
+    this->info = info;
+    memset(timings, 0, sizeof(timings));
+    total_ns = 0;
+    current_state = kVoodooI2CELANInitRunning;
+    current_step = kVoodooI2CELANInitReset;
+    begin_ns = now_ns;
+    step_begin_ns = now_ns;
+    finished_step = kVoodooI2CELANInitDone;
+}
+
+void VoodooI2CELANInitSequencer::cancel() {
+    if (current_state == kVoodooI2CELANInitRunning)
+        current_state = kVoodooI2CELANInitIdle;
+}
+
+VoodooI2CELANInitState VoodooI2CELANInitSequencer::advance(uint64_t now_ns, uint32_t* delay_ms) {
+    *delay_ms = 0;
+    if (current_state != kVoodooI2CELANInitRunning)
+        return current_state;
+
+    // a step is charged up to the moment we come back for the next one, so its
+    // bus time, its settle delay and any timer latency all count against it
+    if (finished_step != kVoodooI2CELANInitDone) {
+        timings[finished_step].duration_ns = now_ns - step_begin_ns;
+        finished_step = kVoodooI2CELANInitDone;
+        step_begin_ns = now_ns;
+    }
+
+    if (current_step == kVoodooI2CELANInitDone) {
+        total_ns = now_ns - begin_ns;
+        current_state = kVoodooI2CELANInitSucceeded;
+        return current_state;
+    }
+
+    VoodooI2CELANInitStepTiming& timing = timings[current_step];
+    timing.attempts++;
+
+    if (!protocol->run_init_step(current_step, info, delay_ms)) {
+        timing.duration_ns = now_ns - step_begin_ns;
+        if (timing.attempts >= ETP_RETRY_COUNT || timing.duration_ns >= step_timeout_ms * 1000000ULL) {
+            total_ns = now_ns - begin_ns;
+            current_state = kVoodooI2CELANInitFailed;
+            return current_state;
+        }
+        *delay_ms = retry_delay_ms;
+        return current_state;
+    }
+
+    finished_step = current_step;
+    current_step = VoodooI2CELANProtocol::next_init_step(current_step, *info);
+    if (current_step == kVoodooI2CELANInitDone)
+        *delay_ms += settle_ms;
+    return current_state;
+}
@@ -0,0 +1,83 @@
+//
+//  VoodooI2CELANInitSequencer.hpp
+//  VoodooI2CELAN
+//
+//  Copyright © 2017 Kishor Prins. All rights reserved.
+//
+
+#ifndef VOODOOI2C_ELAN_INIT_SEQUENCER_HPP
+#define VOODOOI2C_ELAN_INIT_SEQUENCER_HPP
+
+#include "VoodooI2CELANProtocol.hpp"
+
+enum VoodooI2CELANInitState {
+    kVoodooI2CELANInitIdle = 0,
+    kVoodooI2CELANInitRunning,
+    kVoodooI2CELANInitSucceeded,
+    kVoodooI2CELANInitFailed
+};
+
+/* Time spent in one init step, including retries and the delay after it */
+struct VoodooI2CELANInitStepTiming {
+    uint64_t duration_ns;
+    uint8_t attempts;
+};
+
+/* Runs VoodooI2CELANProtocol's init sequence one step at a time
+ *
+ * Instead of sleeping between steps, advance() reports how long the caller
+ * should wait before calling it again, so the driver can drive the sequence
+ * from a timer on its work loop and return from start() straight away. Failed
+ * steps are retried up to ETP_RETRY_COUNT times as long as the step has not
+ * exceeded step_timeout_ms.
+ */
+
+class VoodooI2CELANInitSequencer {
+ public:
+    VoodooI2CELANInitSequencer();
+
+    /* Starts a new init sequence, discarding any sequence in progress
+     * @protocol the protocol to initialise the device with
+     * @info receives the device info, only valid once the sequence has succeeded
+     * @now_ns the current time
+     */
+    void begin(VoodooI2CELANProtocol* protocol, VoodooI2CELANDeviceInfo* info, uint64_t now_ns);
+    /* Runs the next step of the sequence
+     * @now_ns the current time
+     * @delay_ms receives how long to wait before calling advance() again
+     *
+     * @return kVoodooI2CELANInitRunning while there are steps left, the final state otherwise
+     */
+    VoodooI2CELANInitState advance(uint64_t now_ns, uint32_t* delay_ms);
+    /* Abandons the sequence in progress (e.g. when the device goes to sleep) */
+    void cancel();
+
+    VoodooI2CELANInitState state() const { return current_state; }
+    VoodooI2CELANInitStep step() const { return current_step; }
+    /* Description of the failure once the sequence has failed */
+    const char* last_error() const { return protocol ? protocol->last_error : NULL; }
+
+    /* Per step timings of the last sequence, indexed by VoodooI2CELANInitStep */
+    VoodooI2CELANInitStepTiming timings[kVoodooI2CELANInitStepCount];
+    /* Time from begin() until the sequence succeeded or failed */
+    uint64_t total_ns;
+
+    /* Wait between attempts of a failing step */
+    uint32_t retry_delay_ms;
+    /* A step is not retried once it has been running for this long */
+    uint32_t step_timeout_ms;
+    /* Wait after the last step before the device is reported ready */
+    uint32_t settle_ms;
+
+ private:
+    VoodooI2CELANProtocol* protocol;
+    VoodooI2CELANDeviceInfo* info;
+    VoodooI2CELANInitState current_state;
+    VoodooI2CELANInitStep current_step;
+    uint64_t begin_ns;
+    uint64_t step_begin_ns;
+    // the step whose timing is closed by the next advance(), kVoodooI2CELANInitDone if none
+    VoodooI2CELANInitStep finished_step;
+};
+
+#endif /* VOODOOI2C_ELAN_INIT_SEQUENCER_HPP */
@@ -0,0 +1,40 @@
+//
+//  VoodooI2CELANKeyboardState.cpp
+//  VoodooI2CELAN
+//
+//  Copyright © 2017 Kishor Prins. All rights reserved.
+//
+
+#include "VoodooI2CELANKeyboardState.hpp"
+
+VoodooI2CELANKeyboardState::VoodooI2CELANKeyboardState() : quiet_ns(0), state(0) {
+}
+
+void VoodooI2CELANKeyboardState::configure(uint64_t quiet_ns) {
+    this->quiet_ns = quiet_ns;
+}
+
+void VoodooI2CELANKeyboardState::key_pressed(uint64_t key_ns) {
+    uint64_t until = key_ns + quiet_ns;
+    // keep clear of the disabled bit, nobody types 292 years after boot
+    if (until < key_ns || until & ELAN_KEYBOARD_DISABLED)
+        until = ~ELAN_KEYBOARD_DISABLED;
+
+    uint64_t current = __atomic_load_n(&state, __ATOMIC_RELAXED);
+    do {
+        if (until <= (current & ~ELAN_KEYBOARD_DISABLED))
+            return;
+    } while (!__atomic_compare_exchange_n(&state, &current, (current & ELAN_KEYBOARD_DISABLED) | until,
+                                          true, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+}
+
+bool VoodooI2CELANKeyboardState::set_enabled(bool enabled) {
+    uint64_t current = __atomic_load_n(&state, __ATOMIC_RELAXED);
+    uint64_t next;
+    do {
+        next = enabled ? current & ~ELAN_KEYBOARD_DISABLED : current | ELAN_KEYBOARD_DISABLED;
+        if (next == current)
+            return false;
+    } while (!__atomic_compare_exchange_n(&state, &current, next, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+    return true;
+}
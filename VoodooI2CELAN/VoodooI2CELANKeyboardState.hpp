@@ -0,0 +1,64 @@
+//
+//  VoodooI2CELANKeyboardState.hpp
+//  VoodooI2CELAN
+//
+//  Copyright © 2017 Kishor Prins. All rights reserved.
+//
+
+#ifndef VOODOOI2C_ELAN_KEYBOARD_STATE_HPP
+#define VOODOOI2C_ELAN_KEYBOARD_STATE_HPP
+
+#include <stdint.h>
+
+// Set in a snapshot while the keyboard has turned the touchpad off, the rest is the quiet deadline
+#define ELAN_KEYBOARD_DISABLED (1ULL << 63)
+
+/* What the keyboard has told the touchpad, handed from message() to the report path
+ *
+ * The keyboard driver sends its messages from its own context, at any time,
+ * while the work loops read the state for every report. Both the touchpad
+ * switch and the end of the quiet time after the last key press live in a
+ * single word, so a report takes one snapshot() and gets a consistent view
+ * of both without a lock. The deadline is worked out when the key is
+ * pressed, which leaves a single compare for the report path.
+ *
+ * Any number of writers, updates are compare and swap loops.
+ */
+
+class VoodooI2CELANKeyboardState {
+ public:
+    VoodooI2CELANKeyboardState();
+
+    /* Sets how long touches are ignored after a key press, before any message arrives
+     * @quiet_ns the quiet time
+     */
+    void configure(uint64_t quiet_ns);
+
+    /* Moves the quiet deadline out, a key press older than the last one is ignored
+     * @key_ns when the key was pressed
+     */
+    void key_pressed(uint64_t key_ns);
+    /* Turns the touchpad on or off
+     * @enabled whether touches are passed on
+     *
+     * @return true if that changed the state
+     */
+    bool set_enabled(bool enabled);
+    bool enabled() const { return !(snapshot() & ELAN_KEYBOARD_DISABLED); }
+
+    /* Takes the state once for a whole report
+     *
+     * @return the value to hand to ignored() and quiet()
+     */
+    uint64_t snapshot() const { return __atomic_load_n(&state, __ATOMIC_RELAXED); }
+    static bool ignored(uint64_t snapshot) { return snapshot & ELAN_KEYBOARD_DISABLED; }
+    /* @timestamp_ns when the report was read, on the same clock as the key presses */
+    static bool quiet(uint64_t snapshot, uint64_t timestamp_ns) { return timestamp_ns < (snapshot & ~ELAN_KEYBOARD_DISABLED); }
+
+ private:
+    uint64_t quiet_ns;
+    // nothing else is published along with it, relaxed ordering is enough
+    uint64_t state;
+};
+
+#endif /* VOODOOI2C_ELAN_KEYBOARD_STATE_HPP */
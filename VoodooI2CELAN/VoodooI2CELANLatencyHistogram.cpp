@@ -0,0 +1,58 @@
+//
+//  VoodooI2CELANLatencyHistogram.cpp
+//  VoodooI2CELAN
+//
+//  Copyright © 2017 Kishor Prins. All rights reserved.
+//
+
+#include "VoodooI2CELANLatencyHistogram.hpp"
+
+uint64_t VoodooI2CELANLatencyHistogram::percentile(uint32_t per_mille) const {
+    uint64_t samples = this->samples();
+    if (!samples)
+        return 0;
+
+    // no floating point, this also runs in the kernel
+    uint64_t target = samples / 1000 * per_mille + samples % 1000 * per_mille / 1000;
+    uint64_t seen = 0;
+    for (int i = 0; i < ELAN_HISTOGRAM_BUCKETS; i++) {
+        seen += bucket(i);
+        if (seen > target)
+            return i == ELAN_HISTOGRAM_BUCKETS - 1 ? max() : (2ULL << i) - 1;
+    }
+    return max();
+}
+
+void VoodooI2CELANLatencyStats::record(const VoodooI2CELANStageTimes& times) {
+    if (!times.read_ns)
+        return;
+    stages[kVoodooI2CELANStageRead].record(times.read_ns - times.entry_ns);
+
+    if (!times.decoded_ns)
+        return;
+    stages[kVoodooI2CELANStageDecode].record(times.decoded_ns - times.read_ns);
+
+    if (!times.dispatched_ns)
+        return;
+    uint64_t dispatch_begin_ns = times.dispatch_begin_ns ? times.dispatch_begin_ns : times.decoded_ns;
+    stages[kVoodooI2CELANStageQueue].record(dispatch_begin_ns - times.decoded_ns);
+    stages[kVoodooI2CELANStageDispatch].record(times.dispatched_ns - dispatch_begin_ns);
+    stages[kVoodooI2CELANStageTotal].record(times.dispatched_ns - times.entry_ns);
+}
+
+void VoodooI2CELANLatencyStats::reset() {
+    for (int i = 0; i < kVoodooI2CELANStageCount; i++)
+        stages[i].reset();
+}
+
+const char* VoodooI2CELANLatencyStats::stage_name(VoodooI2CELANLatencyStage stage) {
+    switch (stage) {
+        case kVoodooI2CELANStageRead: return "Read";
+        case kVoodooI2CELANStageDecode: return "Decode";
+        case kVoodooI2CELANStageQueue: return "Queue";
+        case kVoodooI2CELANStageDispatch: return "Dispatch";
+        case kVoodooI2CELANStageTotal: return "Total";
+        case kVoodooI2CELANStageCount: break;
+    }
+    return "Unknown";
+}
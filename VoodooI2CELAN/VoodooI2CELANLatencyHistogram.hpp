@@ -0,0 +1,106 @@
+//
+//  VoodooI2CELANLatencyHistogram.hpp
+//  VoodooI2CELAN
+//
+//  Copyright © 2017 Kishor Prins. All rights reserved.
+//
+
+#ifndef VOODOOI2C_ELAN_LATENCY_HISTOGRAM_HPP
+#define VOODOOI2C_ELAN_LATENCY_HISTOGRAM_HPP
+
+#include <stdint.h>
+
+#define ELAN_HISTOGRAM_BUCKETS 32
+
+/* Log2 histogram of durations in nanoseconds
+ *
+ * Bucket 0 counts samples below 2ns, bucket i samples in [2^i, 2^(i+1)) and
+ * the last bucket everything from about 2s up. record() may run on several
+ * threads at once, the acquisition and the dispatch work loop both record,
+ * and never blocks. Readers may run on any thread and only ever see
+ * individually consistent counters. reset() should run while nothing records,
+ * a sample recorded meanwhile may be half cleared.
+ */
+
+class VoodooI2CELANLatencyHistogram {
+ public:
+    VoodooI2CELANLatencyHistogram() { reset(); }
+
+    void record(uint64_t ns) {
+        __atomic_fetch_add(&buckets[bucket_for(ns)], 1, __ATOMIC_RELAXED);
+        __atomic_fetch_add(&count, 1, __ATOMIC_RELAXED);
+        __atomic_fetch_add(&total_ns, ns, __ATOMIC_RELAXED);
+        uint64_t max = __atomic_load_n(&max_ns, __ATOMIC_RELAXED);
+        // a failed exchange leaves the other writer's maximum in max to compare against again
+        while (ns > max && !__atomic_compare_exchange_n(&max_ns, &max, ns, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+        }
+    }
+
+    void reset() {
+        for (int i = 0; i < ELAN_HISTOGRAM_BUCKETS; i++)
+            __atomic_store_n(&buckets[i], 0, __ATOMIC_RELAXED);
+        __atomic_store_n(&count, 0, __ATOMIC_RELAXED);
+        __atomic_store_n(&total_ns, 0, __ATOMIC_RELAXED);
+        __atomic_store_n(&max_ns, 0, __ATOMIC_RELAXED);
+    }
+
+    uint64_t samples() const { return __atomic_load_n(&count, __ATOMIC_RELAXED); }
+    uint64_t bucket(int index) const { return __atomic_load_n(&buckets[index], __ATOMIC_RELAXED); }
+    uint64_t max() const { return __atomic_load_n(&max_ns, __ATOMIC_RELAXED); }
+    uint64_t mean() const {
+        uint64_t samples = this->samples();
+        return samples ? __atomic_load_n(&total_ns, __ATOMIC_RELAXED) / samples : 0;
+    }
+
+    /* Upper bound of the bucket holding the given quantile, e.g. 990 for p99 */
+    uint64_t percentile(uint32_t per_mille) const;
+
+    static int bucket_for(uint64_t ns) {
+        if (ns < 2)
+            return 0;
+        int index = 63 - __builtin_clzll(ns);
+        return index < ELAN_HISTOGRAM_BUCKETS ? index : ELAN_HISTOGRAM_BUCKETS - 1;
+    }
+
+ private:
+    uint64_t buckets[ELAN_HISTOGRAM_BUCKETS];
+    uint64_t count;
+    uint64_t total_ns;
+    uint64_t max_ns;
+};
+
+/* Where the time of a report goes between the interrupt and the multitouch engine */
+enum VoodooI2CELANLatencyStage {
+    kVoodooI2CELANStageRead = 0,    // interrupt entry to the report being read
+    kVoodooI2CELANStageDecode,      // read to decoded report
+    kVoodooI2CELANStageQueue,       // decoded report to the start of its dispatch
+    kVoodooI2CELANStageDispatch,    // start of the dispatch to handleInterruptReport returning
+    kVoodooI2CELANStageTotal,       // interrupt entry to dispatch, dispatched reports only
+    kVoodooI2CELANStageCount
+};
+
+/* Timestamps taken along the report path, 0 where a stage was not reached
+ *
+ * The dispatch of a report starts later than its decode, it waits in the
+ * frame ring until the dispatch stage gets to it.
+ */
+struct VoodooI2CELANStageTimes {
+    uint64_t entry_ns;
+    uint64_t read_ns;
+    uint64_t decoded_ns;
+    uint64_t dispatch_begin_ns;
+    uint64_t dispatched_ns;
+};
+
+class VoodooI2CELANLatencyStats {
+ public:
+    /* Adds the stages that were reached to their histograms */
+    void record(const VoodooI2CELANStageTimes& times);
+    void reset();
+
+    static const char* stage_name(VoodooI2CELANLatencyStage stage);
+
+    VoodooI2CELANLatencyHistogram stages[kVoodooI2CELANStageCount];
+};
+
+#endif /* VOODOOI2C_ELAN_LATENCY_HISTOGRAM_HPP */
@@ -0,0 +1,136 @@
+//
+//  VoodooI2CELANMotionPredictor.cpp
+//  VoodooI2CELAN
+//
+//  Copyright © 2017 Kishor Prins. All rights reserved.
+//
+
+#include "VoodooI2CELANMotionPredictor.hpp"
+
+#define ELAN_PREDICTOR_ONE (1 << ELAN_PREDICTOR_SHIFT)
+
+static int32_t abs32(int32_t value) {
+    return value < 0 ? -value : value;
+}
+
+/* Rounds a fixed point position to counts on the surface */
+static uint16_t to_counts(int64_t position, int32_t max) {
+    int64_t counts = (position + ELAN_PREDICTOR_ONE / 2) >> ELAN_PREDICTOR_SHIFT;
+    if (counts < 0)
+        return 0;
+    return static_cast<uint16_t>(counts > max ? max : counts);
+}
+
+VoodooI2CELANMotionPredictor::VoodooI2CELANMotionPredictor() :
+    predictions(0),
+    evaluated(0),
+    predicted_error(0),
+    unpredicted_error(0),
+    horizon_us(0),
+    max_x(0),
+    max_y(0),
+    tracked(0) {
+}
+
+void VoodooI2CELANMotionPredictor::configure(uint32_t horizon_ms, uint32_t logical_max_x, uint32_t logical_max_y) {
+    horizon_us = horizon_ms * 1000;
+    max_x = static_cast<int32_t>(logical_max_x);
+    max_y = static_cast<int32_t>(logical_max_y);
+    reset();
+}
+
+void VoodooI2CELANMotionPredictor::reset() {
+    tracked = 0;
+}
+
+void VoodooI2CELANMotionPredictor::evaluate(Slot* slot, uint16_t x, uint16_t y, uint64_t timestamp_ns) {
+    if (!slot->evaluating || slot->target_ns > timestamp_ns)
+        return;
+
+    // where the contact was at the target time, the reports around it are a straight line apart
+    int64_t span = static_cast<int64_t>(timestamp_ns - slot->timestamp_ns);
+    int64_t part = static_cast<int64_t>(slot->target_ns - slot->timestamp_ns);
+    int32_t actual_x = slot->measured_x + static_cast<int32_t>((x - slot->measured_x) * part / span);
+    int32_t actual_y = slot->measured_y + static_cast<int32_t>((y - slot->measured_y) * part / span);
+
+    int32_t error_x = abs32(slot->predicted_x - actual_x);
+    int32_t error_y = abs32(slot->predicted_y - actual_y);
+    predicted_error += error_x > error_y ? error_x : error_y;
+    error_x = abs32(slot->unpredicted_x - actual_x);
+    error_y = abs32(slot->unpredicted_y - actual_y);
+    unpredicted_error += error_x > error_y ? error_x : error_y;
+    evaluated++;
+    slot->evaluating = false;
+}
+
+void VoodooI2CELANMotionPredictor::predict(VoodooI2CELANReport* report, uint64_t timestamp_ns) {
+    if (!enabled())
+        return;
+
+    for (int i = 0; i < ETP_MAX_FINGERS; i++) {
+        if (!(report->contact_mask & (1U << i)))
+            continue;
+
+        VoodooI2CELANContact& contact = report->contacts[i];
+        Slot& slot = slots[i];
+        int32_t measured_x = contact.x << ELAN_PREDICTOR_SHIFT;
+        int32_t measured_y = contact.y << ELAN_PREDICTOR_SHIFT;
+        uint64_t gap_ns = timestamp_ns > slot.timestamp_ns ? timestamp_ns - slot.timestamp_ns : 0;
+
+        if (!(tracked & (1U << i)) || !gap_ns || gap_ns > ELAN_PREDICTOR_MAX_GAP_MS * 1000000ULL) {
+            // a new contact is where it landed and not moving yet
+            slot.x = measured_x;
+            slot.y = measured_y;
+            slot.velocity_x = 0;
+            slot.velocity_y = 0;
+            slot.samples = 1;
+            slot.evaluating = false;
+            slot.measured_x = contact.x;
+            slot.measured_y = contact.y;
+            slot.timestamp_ns = timestamp_ns;
+            continue;
+        }
+
+        evaluate(&slot, contact.x, contact.y, timestamp_ns);
+
+        int64_t dt_us = static_cast<int64_t>(gap_ns / 1000);
+        if (!dt_us)
+            dt_us = 1;
+        if (slot.samples == 1) {
+            // the first step gives the velocity to start from
+            slot.velocity_x = static_cast<int32_t>((measured_x - slot.x) * 1000LL / dt_us);
+            slot.velocity_y = static_cast<int32_t>((measured_y - slot.y) * 1000LL / dt_us);
+            slot.x = measured_x;
+            slot.y = measured_y;
+        } else {
+            int32_t expected_x = slot.x + static_cast<int32_t>(slot.velocity_x * dt_us / 1000);
+            int32_t expected_y = slot.y + static_cast<int32_t>(slot.velocity_y * dt_us / 1000);
+            int64_t residual_x = measured_x - expected_x;
+            int64_t residual_y = measured_y - expected_y;
+            slot.x = expected_x + static_cast<int32_t>(residual_x * ELAN_PREDICTOR_ALPHA / ELAN_PREDICTOR_ONE);
+            slot.y = expected_y + static_cast<int32_t>(residual_y * ELAN_PREDICTOR_ALPHA / ELAN_PREDICTOR_ONE);
+            slot.velocity_x += static_cast<int32_t>(residual_x * ELAN_PREDICTOR_BETA * 1000 / ELAN_PREDICTOR_ONE / dt_us);
+            slot.velocity_y += static_cast<int32_t>(residual_y * ELAN_PREDICTOR_BETA * 1000 / ELAN_PREDICTOR_ONE / dt_us);
+        }
+        slot.samples++;
+
+        uint16_t predicted_x = to_counts(slot.x + static_cast<int64_t>(slot.velocity_x) * horizon_us / 1000, max_x);
+        uint16_t predicted_y = to_counts(slot.y + static_cast<int64_t>(slot.velocity_y) * horizon_us / 1000, max_y);
+        predictions++;
+        if (!slot.evaluating) {
+            slot.evaluating = true;
+            slot.target_ns = timestamp_ns + horizon_us * 1000ULL;
+            slot.predicted_x = predicted_x;
+            slot.predicted_y = predicted_y;
+            slot.unpredicted_x = contact.x;
+            slot.unpredicted_y = contact.y;
+        }
+
+        slot.measured_x = contact.x;
+        slot.measured_y = contact.y;
+        slot.timestamp_ns = timestamp_ns;
+        contact.x = predicted_x;
+        contact.y = predicted_y;
+    }
+    tracked = report->contact_mask;
+}
@@ -0,0 +1,94 @@
+//
+//  VoodooI2CELANMotionPredictor.hpp
+//  VoodooI2CELAN
+//
+//  Copyright © 2017 Kishor Prins. All rights reserved.
+//
+
+#ifndef VOODOOI2C_ELAN_MOTION_PREDICTOR_HPP
+#define VOODOOI2C_ELAN_MOTION_PREDICTOR_HPP
+
+#include <stdint.h>
+
+#include "VoodooI2CELANReportDecoder.hpp"
+
+// Positions and velocities are kept with this many fractional bits
+#define ELAN_PREDICTOR_SHIFT 8
+// Gains of the alpha-beta filter, out of 1 << ELAN_PREDICTOR_SHIFT
+#define ELAN_PREDICTOR_ALPHA 192
+#define ELAN_PREDICTOR_BETA 64
+// A contact that was not reported for this long starts over
+#define ELAN_PREDICTOR_MAX_GAP_MS 50
+
+/* Extrapolates contacts a little into the future to make up for the report interval
+ *
+ * Every contact is tracked by an alpha-beta filter on the report timestamps,
+ * which gives a position and a velocity that shrug off the odd noisy report.
+ * The position handed on is the filtered one moved on by the velocity for
+ * the horizon, clamped to the surface. A contact going down starts at rest
+ * where it landed and its second report sets the initial velocity, so taps
+ * are never thrown anywhere. Fixed point throughout.
+ *
+ * Every prediction is also checked against where the contact was reported
+ * once the horizon has passed, interpolated between the reports around it,
+ * and compared with not predicting at all, to see what it buys.
+ *
+ * Only used from the dispatch side.
+ */
+
+class VoodooI2CELANMotionPredictor {
+ public:
+    VoodooI2CELANMotionPredictor();
+
+    /* Sets the horizon and the surface, a horizon of 0 turns prediction off
+     * @horizon_ms how far ahead to predict
+     * @logical_max_x @logical_max_y the largest coordinates predicted
+     */
+    void configure(uint32_t horizon_ms, uint32_t logical_max_x, uint32_t logical_max_y);
+    bool enabled() const { return horizon_us != 0; }
+    /* Forgets every contact */
+    void reset();
+
+    /* Replaces the coordinates of every contact with their prediction
+     * @report the decoded report, its contacts are updated
+     * @timestamp_ns when the report was read
+     */
+    void predict(VoodooI2CELANReport* report, uint64_t timestamp_ns);
+
+    /* Totals since the predictor was created, errors are in counts along the worse axis */
+    uint64_t predictions;
+    uint64_t evaluated;
+    uint64_t predicted_error;
+    uint64_t unpredicted_error;
+
+ private:
+    struct Slot {
+        int32_t x;
+        int32_t y;
+        // counts per millisecond
+        int32_t velocity_x;
+        int32_t velocity_y;
+        uint16_t measured_x;
+        uint16_t measured_y;
+        uint64_t timestamp_ns;
+        uint32_t samples;
+
+        // the prediction waiting to be checked
+        bool evaluating;
+        uint64_t target_ns;
+        uint16_t predicted_x;
+        uint16_t predicted_y;
+        uint16_t unpredicted_x;
+        uint16_t unpredicted_y;
+    };
+
+    void evaluate(Slot* slot, uint16_t x, uint16_t y, uint64_t timestamp_ns);
+
+    uint32_t horizon_us;
+    int32_t max_x;
+    int32_t max_y;
+    uint8_t tracked;
+    Slot slots[ETP_MAX_FINGERS];
+};
+
+#endif /* VOODOOI2C_ELAN_MOTION_PREDICTOR_HPP */
@@ -0,0 +1,77 @@
+//
+//  VoodooI2CELANPollScheduler.cpp
+//  VoodooI2CELAN
+//
+//  Copyright © 2017 Kishor Prins. All rights reserved.
+//
+
+#include "VoodooI2CELANPollScheduler.hpp"
+
+#define POLL_RATE_WINDOW_NS 1000000000ULL
+
+VoodooI2CELANPollScheduler::VoodooI2CELANPollScheduler() :
+    active_interval_us(5000),
+    idle_interval_us(100000),
+    idle_delay_ms(1000),
+    polls(0),
+    empty_polls(0),
+    reports(0),
+    poll_rate(0),
+    report_rate(0),
+    rates_updated(false),
+    current_interval_us(5000),
+    last_contact_ns(0),
+    window_begin_ns(0),
+    window_polls(0),
+    window_reports(0) {
+}
+
+void VoodooI2CELANPollScheduler::configure(uint32_t active_interval_us, uint32_t idle_interval_us, uint32_t idle_delay_ms) {
+    if (!active_interval_us)
+        active_interval_us = 1000;
+    if (idle_interval_us < active_interval_us)
+        idle_interval_us = active_interval_us;
+
+    this->active_interval_us = active_interval_us;
+    this->idle_interval_us = idle_interval_us;
+    this->idle_delay_ms = idle_delay_ms;
+    current_interval_us = active_interval_us;
+}
+
+void VoodooI2CELANPollScheduler::reset(uint64_t now_ns) {
+    current_interval_us = active_interval_us;
+    last_contact_ns = now_ns;
+    window_begin_ns = now_ns;
+    window_polls = 0;
+    window_reports = 0;
+}
+
+uint32_t VoodooI2CELANPollScheduler::poll_completed(uint64_t now_ns, bool report) {
+    polls++;
+    window_polls++;
+    if (report) {
+        reports++;
+        window_reports++;
+    } else {
+        empty_polls++;
+    }
+
+    if (now_ns - window_begin_ns >= POLL_RATE_WINDOW_NS) {
+        uint64_t elapsed_ns = now_ns - window_begin_ns;
+        poll_rate = static_cast<uint32_t>(window_polls * POLL_RATE_WINDOW_NS / elapsed_ns);
+        report_rate = static_cast<uint32_t>(window_reports * POLL_RATE_WINDOW_NS / elapsed_ns);
+        rates_updated = true;
+        window_begin_ns = now_ns;
+        window_polls = 0;
+        window_reports = 0;
+    }
+
+    if (report) {
+        last_contact_ns = now_ns;
+        current_interval_us = active_interval_us;
+    } else if (now_ns - last_contact_ns >= idle_delay_ms * 1000000ULL && current_interval_us < idle_interval_us) {
+        current_interval_us = current_interval_us * 2 > idle_interval_us ? idle_interval_us : current_interval_us * 2;
+    }
+
+    return current_interval_us;
+}
@@ -0,0 +1,71 @@
+//
+//  VoodooI2CELANPollScheduler.hpp
+//  VoodooI2CELAN
+//
+//  Copyright © 2017 Kishor Prins. All rights reserved.
+//
+
+#ifndef VOODOOI2C_ELAN_POLL_SCHEDULER_HPP
+#define VOODOOI2C_ELAN_POLL_SCHEDULER_HPP
+
+#include <stdint.h>
+
+/* Picks the interval of the interrupt simulator when the device has no usable interrupt
+ *
+ * Polls at the active interval while fingers are down and for idle_delay_ms
+ * after the last one lifted, then doubles the interval on every poll until it
+ * reaches the idle interval. The first report, be it a contact or a finger
+ * hovering above the pad, switches straight back to the active interval, so
+ * hovering gets the polling up to speed before the finger lands.
+ */
+
+class VoodooI2CELANPollScheduler {
+ public:
+    VoodooI2CELANPollScheduler();
+
+    /* Sets the scheduling bounds, intervals are clamped so that active <= idle
+     * @active_interval_us interval while the pad is in use
+     * @idle_interval_us longest interval once the pad has been idle
+     * @idle_delay_ms how long after the last contact to keep polling at the active interval
+     */
+    void configure(uint32_t active_interval_us, uint32_t idle_interval_us, uint32_t idle_delay_ms);
+    /* Returns to the active interval, e.g. after a wake
+     * @now_ns the current time
+     */
+    void reset(uint64_t now_ns);
+    /* Accounts for a completed poll and works out when to poll next
+     * @now_ns the time of the poll
+     * @report whether the poll returned a valid report, the device only sends
+     * those while fingers are down or hovering and for the frame where the last one lifts
+     *
+     * @return the interval until the next poll in microseconds
+     */
+    uint32_t poll_completed(uint64_t now_ns, bool report);
+
+    uint32_t interval_us() const { return current_interval_us; }
+    bool idle() const { return current_interval_us > active_interval_us; }
+
+    uint32_t active_interval_us;
+    uint32_t idle_interval_us;
+    uint32_t idle_delay_ms;
+
+    /* Totals since the scheduler was created */
+    uint64_t polls;
+    uint64_t empty_polls;
+    uint64_t reports;
+
+    /* Rates over the last complete one second window */
+    uint32_t poll_rate;
+    uint32_t report_rate;
+    /* Set whenever a window completes and the rates were updated, cleared by the caller */
+    bool rates_updated;
+
+ private:
+    uint32_t current_interval_us;
+    uint64_t last_contact_ns;
+    uint64_t window_begin_ns;
+    uint32_t window_polls;
+    uint32_t window_reports;
+};
+
+#endif /* VOODOOI2C_ELAN_POLL_SCHEDULER_HPP */
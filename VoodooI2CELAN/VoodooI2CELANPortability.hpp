@@ -0,0 +1,45 @@
+//
+//  VoodooI2CELANPortability.hpp
+//  VoodooI2CELAN
+//
+//  Copyright © 2017 Kishor Prins. All rights reserved.
+//
+
+#ifndef VOODOOI2C_ELAN_PORTABILITY_HPP
+#define VOODOOI2C_ELAN_PORTABILITY_HPP
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+/* The kernel independent parts of the driver use IOReturn for bus status so
+ * they read the same as the rest of the driver. Outside of the kernel we only
+ * need the handful of codes they actually return, with their real values.
+ */
+
+#ifdef KERNEL
+
+#include <IOKit/IOReturn.h>
+
+#else
+
+typedef int32_t IOReturn;
+
+#define kIOReturnSuccess 0
+#define kIOReturnError static_cast<IOReturn>(0xe00002bc)
+#define kIOReturnNoMemory static_cast<IOReturn>(0xe00002bd)
+#define kIOReturnNoDevice static_cast<IOReturn>(0xe00002c0)
+#define kIOReturnBadArgument static_cast<IOReturn>(0xe00002c2)
+#define kIOReturnUnsupported static_cast<IOReturn>(0xe00002c7)
+#define kIOReturnIOError static_cast<IOReturn>(0xe00002ca)
+#define kIOReturnBusy static_cast<IOReturn>(0xe00002d5)
+#define kIOReturnTimeout static_cast<IOReturn>(0xe00002d6)
+#define kIOReturnNotReady static_cast<IOReturn>(0xe00002d8)
+#define kIOReturnUnderrun static_cast<IOReturn>(0xe00002e7)
+#define kIOReturnOverrun static_cast<IOReturn>(0xe00002e8)
+#define kIOReturnNotResponding static_cast<IOReturn>(0xe00002ed)
+#define kIOReturnNotFound static_cast<IOReturn>(0xe00002f0)
+
+#endif /* KERNEL */
+
+#endif /* VOODOOI2C_ELAN_PORTABILITY_HPP */
@@ -0,0 +1,402 @@
+//
+//  VoodooI2CELANProtocol.cpp
+//  VoodooI2CELAN
+//
+//  Copyright © 2017 Kishor Prins. All rights reserved.
+//
+
+#include "VoodooI2CELANProtocol.hpp"
+
+void VoodooI2CELANProtocol::init(VoodooI2CELANBus* bus) {
+    this->bus = bus;
+    last_error = NULL;
+}
+
+// A new quirk is a new entry, the report path never looks at this
+static const VoodooI2CELANQuirk quirk_table[] = {
+    { 0x0E, 0x05, 0x07, kVoodooI2CELANQuirkASUSInit },
+    { 0x0E, 0x09, 0x09, kVoodooI2CELANQuirkASUSInit },
+    { 0x0E, 0x13, 0x13, kVoodooI2CELANQuirkASUSInit },
+    { 0x08, 0x26, 0x26, kVoodooI2CELANQuirkASUSInit },
+};
+
+uint32_t VoodooI2CELANProtocol::lookup_quirks(uint8_t product_id, uint8_t ic_type) {
+    uint32_t quirks = 0;
+    for (size_t i = 0; i < sizeof(quirk_table) / sizeof(quirk_table[0]); i++) {
+        const VoodooI2CELANQuirk& entry = quirk_table[i];
+        if (entry.ic_type == ic_type && product_id >= entry.first_product_id && product_id <= entry.last_product_id)
+            quirks |= entry.quirks;
+    }
+    return quirks;
+}
+
+bool VoodooI2CELANProtocol::init_device(VoodooI2CELANDeviceInfo* info) {
+    VoodooI2CELANInitStep step = kVoodooI2CELANInitReset;
+    while (step != kVoodooI2CELANInitDone) {
+        uint32_t delay_ms = 0;
+        if (!run_init_step(step, info, &delay_ms))
+            return false;
+        if (delay_ms)
+            bus->sleep(delay_ms);
+        step = next_init_step(step, *info);
+    }
+    return true;
+}
+
+VoodooI2CELANInitStep VoodooI2CELANProtocol::next_init_step(VoodooI2CELANInitStep step, const VoodooI2CELANDeviceInfo& info) {
+    switch (step) {
+        case kVoodooI2CELANInitICType:
+            // ASUS parts need to be awake before they accept the enable
+            return info.asus_firmware ? kVoodooI2CELANInitWakeUp : kVoodooI2CELANInitEnable;
+        case kVoodooI2CELANInitEnable:
+            return info.asus_firmware ? kVoodooI2CELANInitFWVersion : kVoodooI2CELANInitWakeUp;
+        case kVoodooI2CELANInitWakeUp:
+            return info.asus_firmware ? kVoodooI2CELANInitEnable : kVoodooI2CELANInitFWVersion;
+        case kVoodooI2CELANInitResolution:
+        case kVoodooI2CELANInitDone:
+            return kVoodooI2CELANInitDone;
+        default:
+            return static_cast<VoodooI2CELANInitStep>(step + 1);
+    }
+}
+
+const char* VoodooI2CELANProtocol::init_step_name(VoodooI2CELANInitStep step) {
+    switch (step) {
+        case kVoodooI2CELANInitReset: return "Reset";
+        case kVoodooI2CELANInitResetAck: return "ResetAck";
+        case kVoodooI2CELANInitDescriptor: return "Descriptor";
+        case kVoodooI2CELANInitReportDescriptor: return "ReportDescriptor";
+        case kVoodooI2CELANInitProductID: return "ProductID";
+        case kVoodooI2CELANInitICType: return "ICType";
+        case kVoodooI2CELANInitEnable: return "Enable";
+        case kVoodooI2CELANInitWakeUp: return "WakeUp";
+        case kVoodooI2CELANInitFWVersion: return "FWVersion";
+        case kVoodooI2CELANInitFWChecksum: return "FWChecksum";
+        case kVoodooI2CELANInitIAPVersion: return "IAPVersion";
+        case kVoodooI2CELANInitPressure: return "Pressure";
+        case kVoodooI2CELANInitMaxX: return "MaxX";
+        case kVoodooI2CELANInitMaxY: return "MaxY";
+        case kVoodooI2CELANInitTraces: return "Traces";
+        case kVoodooI2CELANInitResolution: return "Resolution";
+        case kVoodooI2CELANInitDone: return "Done";
+    }
+    return "Unknown";
+}
+
+bool VoodooI2CELANProtocol::run_init_step(VoodooI2CELANInitStep step, VoodooI2CELANDeviceInfo* info, uint32_t* delay_ms) {
+    IOReturn retVal;
+    uint8_t val[3];
+
+    *delay_ms = 0;
+    switch (step) {
+        case kVoodooI2CELANInitReset:
+            retVal = write_ELAN_cmd(ETP_I2C_STAND_CMD, ETP_I2C_RESET);
+            if (retVal != kIOReturnSuccess)
+                return fail("Failed to write RESET cmd");
+            *delay_ms = 100;
+            return true;
+
+        case kVoodooI2CELANInitResetAck:
+            retVal = bus->readI2C(val, ETP_I2C_INF_LENGTH);
+            if (retVal != kIOReturnSuccess)
+                return fail("Failed to get reset acknowledgement");
+            return true;
+
+        case kVoodooI2CELANInitDescriptor:
+            retVal = read_raw_16bit_data(ETP_I2C_DESC_CMD, ETP_I2C_DESC_LENGTH, info->descriptor);
+            if (retVal != kIOReturnSuccess)
+                return fail("Failed to get desc cmd");
+            return true;
+
+        case kVoodooI2CELANInitReportDescriptor:
+            retVal = read_raw_16bit_data(ETP_I2C_REPORT_DESC_CMD, ETP_I2C_REPORT_DESC_LENGTH, info->report_descriptor);
+            if (retVal != kIOReturnSuccess)
+                return fail("Failed to get report cmd");
+            return true;
+
+        case kVoodooI2CELANInitProductID:
+            retVal = read_ELAN_cmd(ETP_I2C_UNIQUEID_CMD, val);
+            if (retVal != kIOReturnSuccess)
+                return fail("Failed to get product ID cmd");
+            info->product_id = val[0];
+            return true;
+
+        case kVoodooI2CELANInitICType:
+            retVal = read_ELAN_cmd(ETP_I2C_SM_VERSION_CMD, val);
+            if (retVal != kIOReturnSuccess)
+                return fail("Failed to get IC type cmd");
+            info->ic_type = val[1];
+            info->quirks = lookup_quirks(info->product_id, info->ic_type);
+            info->asus_firmware = info->quirks & kVoodooI2CELANQuirkASUSInit;
+            return true;
+
+        case kVoodooI2CELANInitEnable:
+            retVal = write_ELAN_cmd(ETP_I2C_SET_CMD, ETP_ENABLE_ABS);
+            if (retVal != kIOReturnSuccess)
+                return fail(info->asus_firmware ? "Failed to send enable cmd (workaround)" : "Failed to send enable cmd");
+            return true;
+
+        case kVoodooI2CELANInitWakeUp:
+            retVal = write_ELAN_cmd(ETP_I2C_STAND_CMD, ETP_I2C_WAKE_UP);
+            if (retVal != kIOReturnSuccess)
+                return fail(info->asus_firmware ? "Failed to send wake up cmd (workaround)" : "Failed to send wake up cmd");
+            if (info->asus_firmware)
+                *delay_ms = 200;
+            return true;
+
+        case kVoodooI2CELANInitFWVersion:
+            retVal = read_ELAN_cmd(ETP_I2C_FW_VERSION_CMD, val);
+            if (retVal != kIOReturnSuccess)
+                return fail("Failed to get version cmd");
+            info->fw_version = val[0];
+            return true;
+
+        case kVoodooI2CELANInitFWChecksum:
+            retVal = read_ELAN_cmd(ETP_I2C_FW_CHECKSUM_CMD, val);
+            if (retVal != kIOReturnSuccess)
+                return fail("Failed to get checksum cmd");
+            info->fw_checksum = val[0] | (val[1] << 8);
+            return true;
+
+        case kVoodooI2CELANInitIAPVersion:
+            retVal = read_ELAN_cmd(ETP_I2C_IAP_VERSION_CMD, val);
+            if (retVal != kIOReturnSuccess)
+                return fail("Failed to get IAP version cmd");
+            info->iap_version = val[0];
+            return true;
+
+        case kVoodooI2CELANInitPressure:
+            retVal = read_ELAN_cmd(ETP_I2C_PRESSURE_CMD, val);
+            if (retVal != kIOReturnSuccess)
+                return fail("Failed to get pressure cmd");
+            if ((val[0] >> 4) & 0x1)
+                info->pressure_adjustment = 0;
+            else
+                info->pressure_adjustment = ETP_PRESSURE_OFFSET;
+            return true;
+
+        case kVoodooI2CELANInitMaxX:
+            retVal = read_ELAN_cmd(ETP_I2C_MAX_X_AXIS_CMD, val);
+            if (retVal != kIOReturnSuccess)
+                return fail("Failed to get max X axis cmd");
+            info->max_report_x = (val[0] | (val[1] << 8)) & 0x0fff;
+            return true;
+
+        case kVoodooI2CELANInitMaxY:
+            retVal = read_ELAN_cmd(ETP_I2C_MAX_Y_AXIS_CMD, val);
+            if (retVal != kIOReturnSuccess)
+                return fail("Failed to get max Y axis cmd");
+            info->max_report_y = (val[0] | (val[1] << 8)) & 0x0fff;
+            return true;
+
+        case kVoodooI2CELANInitTraces:
+            retVal = read_ELAN_cmd(ETP_I2C_XY_TRACENUM_CMD, val);
+            if (retVal != kIOReturnSuccess)
+                return fail("Failed to get XY tracenum cmd");
+            info->x_traces = val[0];
+            info->y_traces = val[1];
+            if (info->x_traces == 0 || info->y_traces == 0)
+                return fail("Traces == 0");
+            return true;
+
+        case kVoodooI2CELANInitResolution:
+            retVal = read_ELAN_cmd(ETP_I2C_RESOLUTION_CMD, val);
+            if (retVal != kIOReturnSuccess)
+                return fail("Failed to get resolution cmd");
+
+            // Resolution in dots per mm
+            info->hw_res_x = (val[0] * 10 + 790) * 10 / 254;
+            info->hw_res_y = (val[1] * 10 + 790) * 10 / 254;
+
+            if (info->hw_res_x == 0 || info->hw_res_y == 0)
+                return fail("HW resolution == 0");
+
+            info->hw_phys_x = info->max_report_x * 100 / info->hw_res_x;
+            info->hw_phys_y = info->max_report_y * 100 / info->hw_res_y;
+            info->width_per_trace_x = info->hw_phys_x / info->x_traces / 100;
+            info->width_per_trace_y = info->hw_phys_y / info->y_traces / 100;
+            return true;
+
+        case kVoodooI2CELANInitDone:
+            return true;
+    }
+    return fail("Unknown init step");
+}
+
+bool VoodooI2CELANProtocol::enable_absolute_mode(bool asus_firmware) {
+    IOReturn retVal;
+    if (asus_firmware) {
+        // ASUS parts need to be awake before they accept the enable
+        retVal = write_ELAN_cmd(ETP_I2C_STAND_CMD, ETP_I2C_WAKE_UP);
+        if (retVal != kIOReturnSuccess)
+            return fail("Failed to send wake up cmd (workaround)");
+        bus->sleep(200);
+        retVal = write_ELAN_cmd(ETP_I2C_SET_CMD, ETP_ENABLE_ABS);
+        if (retVal != kIOReturnSuccess)
+            return fail("Failed to send enable cmd (workaround)");
+    } else {
+        retVal = write_ELAN_cmd(ETP_I2C_SET_CMD, ETP_ENABLE_ABS);
+        if (retVal != kIOReturnSuccess)
+            return fail("Failed to send enable cmd");
+        retVal = write_ELAN_cmd(ETP_I2C_STAND_CMD, ETP_I2C_WAKE_UP);
+        if (retVal != kIOReturnSuccess)
+            return fail("Failed to send wake up cmd");
+    }
+    return true;
+}
+
+bool VoodooI2CELANProtocol::fast_resume(const VoodooI2CELANDeviceInfo& cached) {
+    IOReturn retVal;
+    uint8_t val[3];
+
+    if (!enable_absolute_mode(cached.asus_firmware))
+        return false;
+
+    // the checksum identifies the exact firmware and with it the geometry we cached
+    retVal = read_ELAN_cmd(ETP_I2C_FW_CHECKSUM_CMD, val);
+    if (retVal != kIOReturnSuccess)
+        return fail("Failed to get checksum cmd");
+    if ((val[0] | (val[1] << 8)) != cached.fw_checksum)
+        return fail("Firmware checksum changed since the last reset");
+
+    return true;
+}
+
+IOReturn VoodooI2CELANProtocol::set_sleep(bool sleep) {
+    return write_ELAN_cmd(ETP_I2C_STAND_CMD, sleep ? ETP_I2C_SLEEP : ETP_I2C_WAKE_UP);
+}
+
+IOReturn VoodooI2CELANProtocol::set_power(bool enable) {
+    uint8_t val[3];
+    IOReturn retVal = read_ELAN_cmd(ETP_I2C_POWER_CMD, val);
+    if (retVal != kIOReturnSuccess)
+        return retVal;
+
+    // only the power bit is ours to change, the rest of the register is kept as is
+    uint16_t reg = val[0] | (val[1] << 8);
+    if (enable)
+        reg &= ~ETP_DISABLE_POWER;
+    else
+        reg |= ETP_DISABLE_POWER;
+    return write_ELAN_cmd(ETP_I2C_POWER_CMD, reg);
+}
+
+IOReturn VoodooI2CELANProtocol::set_calibration_mode(bool enable) {
+    return write_ELAN_cmd(ETP_I2C_SET_CMD, ETP_ENABLE_ABS | (enable ? ETP_ENABLE_CALIBRATE : ETP_DISABLE_CALIBRATE));
+}
+
+IOReturn VoodooI2CELANProtocol::read_baseline(bool max_baseline, uint16_t* value) {
+    uint8_t val[3];
+    IOReturn retVal = read_ELAN_cmd(max_baseline ? ETP_I2C_MAX_BASELINE_CMD : ETP_I2C_MIN_BASELINE_CMD, val);
+    if (retVal != kIOReturnSuccess)
+        return retVal;
+    *value = val[0] | (val[1] << 8);
+    return kIOReturnSuccess;
+}
+
+IOReturn VoodooI2CELANProtocol::start_calibration() {
+    return write_ELAN_cmd(ETP_I2C_CALIBRATE_CMD, 1);
+}
+
+IOReturn VoodooI2CELANProtocol::read_calibration_result(bool* busy) {
+    // Linux reads this as an SMBus block, so only the low byte of the register goes out and
+    // the byte count comes back ahead of the data, the result is the first data byte
+    uint8_t command = ETP_I2C_CALIBRATE_CMD & 0xff;
+    uint8_t val[2] = { 0, 0xff };
+    IOReturn retVal = bus->writeReadI2C(&command, sizeof(command), val, sizeof(val));
+    if (retVal != kIOReturnSuccess)
+        return retVal;
+    if (!val[0])
+        return kIOReturnIOError;
+    *busy = val[1] != 0;
+    return kIOReturnSuccess;
+}
+
+IOReturn VoodooI2CELANProtocol::read_iap_control(uint16_t* control) {
+    uint8_t val[3];
+    IOReturn retVal = read_ELAN_cmd(ETP_I2C_IAP_CTRL_CMD, val);
+    if (retVal != kIOReturnSuccess)
+        return retVal;
+    *control = val[0] | (val[1] << 8);
+    return kIOReturnSuccess;
+}
+
+IOReturn VoodooI2CELANProtocol::set_flash_key() {
+    return write_ELAN_cmd(ETP_I2C_IAP_CMD, ETP_I2C_IAP_PASSWORD);
+}
+
+IOReturn VoodooI2CELANProtocol::read_flash_key(uint16_t* key) {
+    uint8_t val[3];
+    IOReturn retVal = read_ELAN_cmd(ETP_I2C_IAP_CMD, val);
+    if (retVal != kIOReturnSuccess)
+        return retVal;
+    *key = val[0] | (val[1] << 8);
+    return kIOReturnSuccess;
+}
+
+IOReturn VoodooI2CELANProtocol::reset_iap() {
+    return write_ELAN_cmd(ETP_I2C_IAP_RESET_CMD, ETP_I2C_IAP_RESET);
+}
+
+IOReturn VoodooI2CELANProtocol::set_iap_page_size(uint16_t page_size) {
+    // the IAP type is the page size in words
+    IOReturn retVal = write_ELAN_cmd(ETP_I2C_IAP_TYPE_CMD, page_size / 2);
+    if (retVal != kIOReturnSuccess)
+        return retVal;
+
+    uint8_t val[3];
+    retVal = read_ELAN_cmd(ETP_I2C_IAP_TYPE_CMD, val);
+    if (retVal != kIOReturnSuccess)
+        return retVal;
+    return (val[0] | (val[1] << 8)) == page_size / 2 ? kIOReturnSuccess : kIOReturnIOError;
+}
+
+IOReturn VoodooI2CELANProtocol::write_fw_page(uint8_t* buffer, uint16_t page_size, uint16_t checksum) {
+    buffer[0] = ETP_I2C_IAP_REG_L;
+    buffer[1] = ETP_I2C_IAP_REG_H;
+    buffer[page_size + 2] = checksum & 0xff;
+    buffer[page_size + 3] = checksum >> 8;
+    return bus->writeI2C(buffer, page_size + 4);
+}
+
+IOReturn VoodooI2CELANProtocol::read_checksum(bool iap, uint16_t* checksum) {
+    uint8_t val[3];
+    IOReturn retVal = read_ELAN_cmd(iap ? ETP_I2C_IAP_CHECKSUM_CMD : ETP_I2C_FW_CHECKSUM_CMD, val);
+    if (retVal != kIOReturnSuccess)
+        return retVal;
+    *checksum = val[0] | (val[1] << 8);
+    return kIOReturnSuccess;
+}
+
+IOReturn VoodooI2CELANProtocol::read_reset_ack() {
+    uint8_t val[ETP_I2C_INF_LENGTH];
+    return bus->readI2C(val, ETP_I2C_INF_LENGTH);
+}
+
+IOReturn VoodooI2CELANProtocol::read_report(uint8_t* report) {
+    return bus->readI2C(report, ETP_MAX_REPORT_LEN);
+}
+
+IOReturn VoodooI2CELANProtocol::read_ELAN_cmd(uint16_t reg, uint8_t* val) {
+    return read_raw_16bit_data(reg, ETP_I2C_INF_LENGTH, val);
+}
+
+IOReturn VoodooI2CELANProtocol::read_raw_16bit_data(uint16_t reg, uint16_t len, uint8_t* values) {
+    // registers are sent little endian, as the device expects
+    uint8_t buffer[] {
+        static_cast<uint8_t>(reg & 0xff),
+        static_cast<uint8_t>(reg >> 8)
+    };
+    return bus->writeReadI2C(buffer, sizeof(buffer), values, len);
+}
+
+// Linux equivalent of elan_i2c_write_cmd function
+IOReturn VoodooI2CELANProtocol::write_ELAN_cmd(uint16_t reg, uint16_t cmd) {
+    uint8_t buffer[] {
+        static_cast<uint8_t>(reg & 0xff),
+        static_cast<uint8_t>(reg >> 8),
+        static_cast<uint8_t>(cmd & 0xff),
+        static_cast<uint8_t>(cmd >> 8)
+    };
+    return bus->writeI2C(buffer, sizeof(buffer));
+}
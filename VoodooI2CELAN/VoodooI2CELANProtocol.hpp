@@ -0,0 +1,279 @@
+//
+//  VoodooI2CELANProtocol.hpp
+//  VoodooI2CELAN
+//
+//  Copyright © 2017 Kishor Prins. All rights reserved.
+//
+
+#ifndef VOODOOI2C_ELAN_PROTOCOL_HPP
+#define VOODOOI2C_ELAN_PROTOCOL_HPP
+
+#include "VoodooI2CELANBus.hpp"
+#include "VoodooI2CElanConstants.h"
+
+/* Device specific behaviour, see the quirk table in VoodooI2CELANProtocol.cpp */
+enum {
+    kVoodooI2CELANQuirkASUSInit = 1 << 0,  // wake up before enabling absolute mode and give it 200ms
+};
+
+/* A quirk table entry, matching one IC type and a range of product IDs */
+struct VoodooI2CELANQuirk {
+    uint8_t ic_type;
+    uint8_t first_product_id;
+    uint8_t last_product_id;
+    uint32_t quirks;
+};
+
+/* Everything the driver learns about the device during initialisation */
+struct VoodooI2CELANDeviceInfo {
+    uint8_t product_id;
+    uint8_t ic_type;
+    uint8_t fw_version;
+    uint16_t fw_checksum;
+    uint8_t iap_version;
+    // kVoodooI2CELANQuirk flags from the quirk table
+    uint32_t quirks;
+    bool asus_firmware;
+
+    int pressure_adjustment;
+
+    uint32_t max_report_x;
+    uint32_t max_report_y;
+    uint32_t x_traces;
+    uint32_t y_traces;
+    uint32_t hw_res_x;
+    uint32_t hw_res_y;
+    uint32_t hw_phys_x;
+    uint32_t hw_phys_y;
+    uint32_t width_per_trace_x;
+    uint32_t width_per_trace_y;
+
+    uint8_t descriptor[ETP_I2C_DESC_LENGTH];
+    uint8_t report_descriptor[ETP_I2C_REPORT_DESC_LENGTH];
+};
+
+/* The individual bus transactions that make up init_device(), in the order
+ * they run for non-ASUS parts (ASUS parts wake before enabling)
+ */
+enum VoodooI2CELANInitStep {
+    kVoodooI2CELANInitReset = 0,
+    kVoodooI2CELANInitResetAck,
+    kVoodooI2CELANInitDescriptor,
+    kVoodooI2CELANInitReportDescriptor,
+    kVoodooI2CELANInitProductID,
+    kVoodooI2CELANInitICType,
+    kVoodooI2CELANInitEnable,
+    kVoodooI2CELANInitWakeUp,
+    kVoodooI2CELANInitFWVersion,
+    kVoodooI2CELANInitFWChecksum,
+    kVoodooI2CELANInitIAPVersion,
+    kVoodooI2CELANInitPressure,
+    kVoodooI2CELANInitMaxX,
+    kVoodooI2CELANInitMaxY,
+    kVoodooI2CELANInitTraces,
+    kVoodooI2CELANInitResolution,
+    kVoodooI2CELANInitDone,
+    kVoodooI2CELANInitStepCount = kVoodooI2CELANInitDone
+};
+
+/* Implements the ELAN I2C protocol (a port of Linux's elan_i2c_i2c.c) on top of
+ * a VoodooI2CELANBus so that it can be exercised without hardware
+ */
+
+class VoodooI2CELANProtocol {
+ public:
+    /* Binds the protocol to a bus, must be called before any other method
+     * @bus the bus used for all transfers
+     */
+    void init(VoodooI2CELANBus* bus);
+
+    /* Looks the device up in the quirk table
+     * @product_id product ID of the ELAN device
+     * @ic_type IC type (provided by the device)
+     *
+     * @return the kVoodooI2CELANQuirk flags of every matching entry, 0 for a well behaved device
+     */
+    static uint32_t lookup_quirks(uint8_t product_id, uint8_t ic_type);
+
+    /* Resets the device and queries everything needed to put it into multitouch mode
+     * @info receives the device identification and geometry
+     *
+     * @return true if the device was initialised properly, last_error describes the failing step otherwise
+     */
+    bool init_device(VoodooI2CELANDeviceInfo* info);
+
+    /* Runs a single step of the initialisation sequence
+     * @step the step to run
+     * @info receives whatever the step reads from the device
+     * @delay_ms receives how long the device needs to settle before the next step
+     *
+     * @return true if the step succeeded, last_error describes the failure otherwise
+     */
+    bool run_init_step(VoodooI2CELANInitStep step, VoodooI2CELANDeviceInfo* info, uint32_t* delay_ms);
+    /* Works out which step follows @step
+     * @step the step that just succeeded
+     * @info the device info gathered so far (the ASUS quirk changes the ordering)
+     *
+     * @return the next step, kVoodooI2CELANInitDone once the sequence is complete
+     */
+    static VoodooI2CELANInitStep next_init_step(VoodooI2CELANInitStep step, const VoodooI2CELANDeviceInfo& info);
+    /* Human readable name of @step, used for logging and the timing properties */
+    static const char* init_step_name(VoodooI2CELANInitStep step);
+
+    /* Brings a previously initialised device back without resetting it
+     * @cached the device info captured by the last successful init_device()
+     *
+     * Only re-enables absolute mode, wakes the device and checks the firmware
+     * checksum against @cached. Callers should fall back to init_device() if
+     * this fails since the device may have been power cycled or reflashed.
+     *
+     * @return true if the device is back in multitouch mode with the cached geometry
+     */
+    bool fast_resume(const VoodooI2CELANDeviceInfo& cached);
+
+    /* Puts the device into its low power state or wakes it up, the configuration is kept
+     * @sleep true to put the device to sleep
+     *
+     * @return returns a IOReturn status of the write
+     */
+    IOReturn set_sleep(bool sleep);
+    /* Switches the power of the sensor on or off (Linux's elan_i2c_power_control)
+     * @enable true to power the sensor
+     *
+     * @return returns a IOReturn status of the read or the write
+     */
+    IOReturn set_power(bool enable);
+
+    /* Switches the device in or out of calibration mode, absolute reporting stays on
+     * (Linux's elan_i2c_set_mode with ETP_ENABLE_CALIBRATE)
+     * @enable true to enter calibration mode
+     *
+     * @return returns a IOReturn status of the write
+     */
+    IOReturn set_calibration_mode(bool enable);
+    /* Reads the highest or lowest sensor baseline, only meaningful in calibration mode
+     * (Linux's elan_i2c_get_baseline_data)
+     * @max_baseline true for the highest baseline, false for the lowest
+     * @value receives the baseline
+     *
+     * @return returns a IOReturn status of the read
+     */
+    IOReturn read_baseline(bool max_baseline, uint16_t* value);
+    /* Has the device measure its baselines again, in calibration mode (Linux's elan_i2c_calibrate)
+     *
+     * @return returns a IOReturn status of the write
+     */
+    IOReturn start_calibration();
+    /* Checks whether a calibration started by start_calibration() has finished
+     * (Linux's elan_i2c_calibrate_result)
+     * @busy receives true while the device is still calibrating
+     *
+     * @return returns a IOReturn status of the read
+     */
+    IOReturn read_calibration_result(bool* busy);
+
+    /* Reads the IAP control register (Linux's elan_i2c_iap_get_mode)
+     * @control receives the register, ETP_I2C_MAIN_MODE_ON while the main firmware runs and
+     * ETP_FW_IAP_PAGE_ERR or ETP_FW_IAP_INTF_ERR once a page write failed
+     *
+     * @return returns a IOReturn status of the read
+     */
+    IOReturn read_iap_control(uint16_t* control);
+    /* Writes the flash key, which switches the device into IAP mode and then unlocks the flash
+     * (Linux's elan_i2c_set_flash_key)
+     *
+     * @return returns a IOReturn status of the write
+     */
+    IOReturn set_flash_key();
+    /* Reads back the flash key, ETP_I2C_IAP_PASSWORD once the flash is unlocked
+     * @key receives the key
+     *
+     * @return returns a IOReturn status of the read
+     */
+    IOReturn read_flash_key(uint16_t* key);
+    /* Restarts the IAP of a device already in IAP mode, the next page written is the first again
+     * (Linux's elan_i2c_iap_reset)
+     *
+     * @return returns a IOReturn status of the write
+     */
+    IOReturn reset_iap();
+    /* Tells the IAP the page size of parts that take more than ETP_FW_PAGE_SIZE at once
+     * (Linux's elan_read_write_iap_type)
+     * @page_size the page size in bytes
+     *
+     * @return returns a IOReturn status of the transfers, kIOReturnIOError if the device did not take it
+     */
+    IOReturn set_iap_page_size(uint16_t page_size);
+    /* Writes one page of firmware in a single transfer (Linux's elan_i2c_write_fw_block)
+     * @buffer @page_size + 4 bytes holding the page at @buffer + 2, the register and the checksum are filled in
+     * @page_size the page size in bytes
+     * @checksum the sum of the page's little endian words
+     *
+     * @return returns a IOReturn status of the write, the result of programming the page is
+     * in the IAP control register
+     */
+    IOReturn write_fw_page(uint8_t* buffer, uint16_t page_size, uint16_t checksum);
+    /* Reads a firmware checksum (Linux's elan_i2c_get_checksum)
+     * @iap true for the sum of the pages written since the flash was unlocked, false for the
+     * checksum of the main firmware
+     * @checksum receives the checksum
+     *
+     * @return returns a IOReturn status of the read
+     */
+    IOReturn read_checksum(bool iap, uint16_t* checksum);
+    /* Reads the two byte acknowledgement a reset is answered with
+     *
+     * @return returns a IOReturn status of the read
+     */
+    IOReturn read_reset_ack();
+
+    /* Reads a single touch report
+     * @report a buffer of at least ETP_MAX_REPORT_LEN bytes
+     *
+     * @return returns a IOReturn status of the read
+     */
+    IOReturn read_report(uint8_t* report);
+
+    /* Reads a ELAN command from the I2C bus
+     * @reg which register to read the data from
+     * @val a buffer which is large enough to hold the ELAN command data
+     *
+     * @return returns a IOReturn status of the reads (usually a representation of I2C bus)
+     */
+    IOReturn read_ELAN_cmd(uint16_t reg, uint8_t* val);
+    /* Reads raw data from the I2C bus
+     * @reg which 16bit register to read the data from
+     * @len the length of the @val buffer
+     * @values a buffer which is large enough to hold the data being read
+     *
+     * @return returns a IOReturn status of the reads (usually a representation of I2C bus)
+     */
+    IOReturn read_raw_16bit_data(uint16_t reg, uint16_t len, uint8_t* values);
+    /* Writes a ELAN command formatted I2C message
+     * @reg which register to write the data to
+     * @cmd the command which we want to write
+     *
+     * @return returns a IOReturn status of the write (usually a representation of I2C bus)
+     */
+    IOReturn write_ELAN_cmd(uint16_t reg, uint16_t cmd);
+
+    /* Description of the step that made the last init_device() or run_init_step() call fail */
+    const char* last_error;
+
+ private:
+    VoodooI2CELANBus* bus;
+
+    /* Switches the device to absolute (multitouch) reporting and wakes it
+     * @asus_firmware whether the ASUS ordering is needed
+     *
+     * @return true if both commands were accepted
+     */
+    bool enable_absolute_mode(bool asus_firmware);
+
+    bool fail(const char* error) {
+        last_error = error;
+        return false;
+    }
+};
+
+#endif /* VOODOOI2C_ELAN_PROTOCOL_HPP */
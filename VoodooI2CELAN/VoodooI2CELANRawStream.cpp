@@ -0,0 +1,112 @@
+//
+//  VoodooI2CELANRawStream.cpp
+//  VoodooI2CELAN
+//
+//  Copyright © 2017 Kishor Prins. All rights reserved.
+//
+
+#include "VoodooI2CELANRawStream.hpp"
+
+#include <string.h>
+
+// readers outside of the driver rely on these, see the README before changing any of them
+static_assert(sizeof(VoodooI2CELANRawStreamHeader) == 128, "raw stream header layout changed");
+static_assert(offsetof(VoodooI2CELANRawStreamHeader, head) == 16, "raw stream header layout changed");
+static_assert(offsetof(VoodooI2CELANRawStreamHeader, waiting) == 64, "raw stream header layout changed");
+static_assert(sizeof(VoodooI2CELANRawStreamEntry) == 128, "raw stream entry layout changed");
+static_assert(offsetof(VoodooI2CELANRawStreamEntry, data) == 24, "raw stream entry layout changed");
+static_assert(offsetof(VoodooI2CELANRawStreamEntry, contacts) == 64, "raw stream entry layout changed");
+
+VoodooI2CELANRawStream::VoodooI2CELANRawStream() {
+    header = NULL;
+    entries = NULL;
+    mask = 0;
+    head = 0;
+    recorded = 0;
+    notifications = 0;
+}
+
+size_t VoodooI2CELANRawStream::memory_size(uint32_t capacity) {
+    return sizeof(VoodooI2CELANRawStreamHeader) + static_cast<size_t>(capacity) * sizeof(VoodooI2CELANRawStreamEntry);
+}
+
+bool VoodooI2CELANRawStream::attach(void* memory, size_t length) {
+    if (length < memory_size(2))
+        return false;
+
+    uint32_t capacity = 2;
+    while (memory_size(capacity * 2) <= length && capacity < (1U << 24))
+        capacity *= 2;
+
+    memset(memory, 0, memory_size(capacity));
+    VoodooI2CELANRawStreamHeader* layout = static_cast<VoodooI2CELANRawStreamHeader*>(memory);
+    layout->magic = ELAN_RAW_STREAM_MAGIC;
+    layout->version = ELAN_RAW_STREAM_VERSION;
+    layout->header_size = sizeof(VoodooI2CELANRawStreamHeader);
+    layout->entry_size = sizeof(VoodooI2CELANRawStreamEntry);
+    layout->capacity = capacity;
+    // a reader checking the magic sees the rest of the header too
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    entries = reinterpret_cast<VoodooI2CELANRawStreamEntry*>(layout + 1);
+    mask = capacity - 1;
+    head = 0;
+    header = layout;
+    return true;
+}
+
+void VoodooI2CELANRawStream::detach() {
+    if (!header)
+        return;
+    __atomic_fetch_or(&header->flags, ELAN_RAW_STREAM_CLOSED, __ATOMIC_SEQ_CST);
+    header = NULL;
+    entries = NULL;
+}
+
+bool VoodooI2CELANRawStream::record(uint64_t interrupt_ns, uint64_t read_ns, const uint8_t* data, VoodooI2CELANReportStatus status,
+                                    const VoodooI2CELANReport& report) {
+    if (!header)
+        return false;
+
+    VoodooI2CELANRawStreamEntry* entry = &entries[head & mask];
+
+    // a reader still copying the entry this overwrites sees the sequence change under it
+    __atomic_store_n(&entry->sequence, 0, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    entry->interrupt_ns = interrupt_ns;
+    entry->read_ns = read_ns;
+    memcpy(entry->data, data, ETP_MAX_REPORT_LEN);
+    entry->status = status;
+    memset(entry->contacts, 0, sizeof(entry->contacts));
+    if (status == kVoodooI2CELANReportValid) {
+        entry->contact_mask = report.contact_mask;
+        entry->button = report.button;
+        entry->hover = report.hover;
+        for (int slot = 0; slot < ETP_MAX_FINGERS; slot++) {
+            if (!(report.contact_mask & (1U << slot)))
+                continue;
+            VoodooI2CELANRawStreamContact& contact = entry->contacts[slot];
+            contact.x = report.contacts[slot].x;
+            contact.y = report.contacts[slot].y;
+            contact.pressure = report.contacts[slot].pressure;
+            contact.mk_x = report.contacts[slot].mk_x;
+            contact.mk_y = report.contacts[slot].mk_y;
+        }
+    } else {
+        entry->contact_mask = 0;
+        entry->button = 0;
+        entry->hover = 0;
+    }
+
+    head++;
+    __atomic_store_n(&entry->sequence, head, __ATOMIC_RELEASE);
+    // pairs with the reader setting waiting and then looking at head again, one of the two sees the other
+    __atomic_store_n(&header->head, head, __ATOMIC_SEQ_CST);
+    recorded++;
+
+    if (!__atomic_load_n(&header->waiting, __ATOMIC_SEQ_CST) || !__atomic_exchange_n(&header->waiting, 0, __ATOMIC_ACQ_REL))
+        return false;
+    notifications++;
+    return true;
+}
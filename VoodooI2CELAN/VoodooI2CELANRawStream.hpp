@@ -0,0 +1,174 @@
+//
+//  VoodooI2CELANRawStream.hpp
+//  VoodooI2CELAN
+//
+//  Copyright © 2017 Kishor Prins. All rights reserved.
+//
+
+#ifndef VOODOOI2C_ELAN_RAW_STREAM_HPP
+#define VOODOOI2C_ELAN_RAW_STREAM_HPP
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "VoodooI2CELANReportDecoder.hpp"
+
+#define ELAN_RAW_STREAM_MAGIC 0x53524C45  // "ELRS"
+#define ELAN_RAW_STREAM_VERSION 1
+#define ELAN_RAW_STREAM_DEPTH 256
+
+/* The layout of the raw report stream, shared between the driver and its readers
+ *
+ * The memory starts with a 128 byte header, little endian like everything else:
+ *
+ *   offset  size  field
+ *   0       4     magic "ELRS"
+ *   4       2     version (1)
+ *   6       2     header size (128)
+ *   8       2     entry size (128)
+ *   12      4     capacity, the number of entries, a power of two
+ *   16      8     head, the number of entries published so far
+ *   24      4     flags, ELAN_RAW_STREAM_CLOSED
+ *   64      4     waiting, the only field readers write
+ *
+ * followed by capacity entries of 128 bytes, entry n of the stream in slot
+ * n % capacity:
+ *
+ *   offset  size  field
+ *   0       8     sequence, n + 1 once published, 0 while being written
+ *   8       8     interrupt time in ns
+ *   16      8     read completion time in ns
+ *   24      34    the report as read from the bus
+ *   58      1     VoodooI2CELANReportStatus
+ *   59      1     contact mask
+ *   60      1     button
+ *   61      1     hover
+ *   64      40    per slot x, y, pressure (u16 each), mk_x, mk_y (u8 each)
+ *
+ * Reserved bytes are 0. The decoded fields are 0 unless the status is valid.
+ *
+ * To read entry n, load its sequence with acquire semantics, copy the entry and
+ * load the sequence again after an acquire fence. The copy is good if both loads
+ * gave n + 1. Anything else means entry n has not been published yet (head is
+ * still at n) or was overwritten meanwhile (head is past n + capacity), and the
+ * reader has lost entries.
+ *
+ * To wait, set waiting to 1 and look at head again. If it has not moved the
+ * driver clears waiting and notifies the reader once it publishes the next
+ * entry, through the port armed with kVoodooI2CELANRawStreamMethodNotify.
+ */
+
+/* Set in VoodooI2CELANRawStreamHeader::flags once the producer has gone away */
+#define ELAN_RAW_STREAM_CLOSED 0x0001
+
+struct VoodooI2CELANRawStreamHeader {
+    /* Written once by the producer when the stream is laid out */
+    uint32_t magic;
+    uint16_t version;
+    uint16_t header_size;
+    uint16_t entry_size;
+    uint16_t reserved0;
+    // a power of two
+    uint32_t capacity;
+    /* Written by the producer, the number of entries published so far */
+    uint64_t head;
+    uint32_t flags;
+    uint8_t reserved1[36];
+    /* Written by readers, a cache line away from the producer's fields */
+    // set by a reader about to wait, cleared by the producer when it sends the notification
+    uint32_t waiting;
+    uint8_t reserved2[60];
+};
+
+struct VoodooI2CELANRawStreamContact {
+    uint16_t x;
+    uint16_t y;
+    uint16_t pressure;
+    uint8_t mk_x;
+    uint8_t mk_y;
+};
+
+struct VoodooI2CELANRawStreamEntry {
+    // 1 + the entry's position in the stream once published, 0 while it is being written
+    uint64_t sequence;
+    // when the interrupt (or the poll) that read the report fired
+    uint64_t interrupt_ns;
+    // when the read completed
+    uint64_t read_ns;
+    // the report as read from the bus
+    uint8_t data[ETP_MAX_REPORT_LEN];
+    // VoodooI2CELANReportStatus
+    uint8_t status;
+    /* The decoded report, all 0 unless status is kVoodooI2CELANReportValid */
+    uint8_t contact_mask;
+    uint8_t button;
+    uint8_t hover;
+    uint16_t reserved0;
+    VoodooI2CELANRawStreamContact contacts[ETP_MAX_FINGERS];
+    uint8_t reserved1[24];
+};
+
+/* What the user client maps and calls, for IOConnectMapMemory64() and IOConnectCallAsyncScalarMethod() */
+enum {
+    kVoodooI2CELANRawStreamMemory = 0
+};
+
+enum {
+    // arms the notification port, the next entry published while the reader is waiting sends a message
+    kVoodooI2CELANRawStreamMethodNotify = 0,
+    kVoodooI2CELANRawStreamMethodCount
+};
+
+/* Producer side of the raw report stream
+ *
+ * Every report read from the bus is copied into a ring in memory shared with
+ * a reader, together with its decoded contacts. The producer never waits for
+ * the reader: once the ring is full the oldest entry is overwritten, and a
+ * reader that falls behind finds out from the entry sequence numbers. Nothing
+ * is recorded and nothing costs more than a load and a branch until
+ * attach() has given the stream its memory.
+ *
+ * attach(), detach() and record() have to run on the same thread, the work loop
+ * in the kext.
+ */
+
+class VoodooI2CELANRawStream {
+ public:
+    VoodooI2CELANRawStream();
+
+    /* Bytes of memory needed for @capacity entries */
+    static size_t memory_size(uint32_t capacity);
+
+    /* Lays out the stream in @memory and starts recording
+     * @memory @length the shared memory, 8 byte aligned
+     *
+     * @return false if @length does not fit two entries
+     */
+    bool attach(void* memory, size_t length);
+    /* Marks the stream closed and stops recording, the memory may be released afterwards */
+    void detach();
+    /* Tells whether a reader is attached, cheap enough to check for every report */
+    bool active() const { return header != NULL; }
+
+    /* Publishes a report
+     * @interrupt_ns @read_ns when the interrupt fired and when the read completed
+     * @data the report as read from the bus
+     * @status what decoding made of it
+     * @report the decoded report, only looked at if @status is kVoodooI2CELANReportValid
+     *
+     * @return true if the reader is waiting and has to be notified
+     */
+    bool record(uint64_t interrupt_ns, uint64_t read_ns, const uint8_t* data, VoodooI2CELANReportStatus status,
+                const VoodooI2CELANReport& report);
+
+    uint64_t recorded;
+    uint64_t notifications;
+
+ private:
+    VoodooI2CELANRawStreamHeader* header;
+    VoodooI2CELANRawStreamEntry* entries;
+    uint32_t mask;
+    uint64_t head;
+};
+
+#endif /* VOODOOI2C_ELAN_RAW_STREAM_HPP */
@@ -0,0 +1,141 @@
+//
+//  VoodooI2CELANReportDecoder.cpp
+//  VoodooI2CELAN
+//
+//  Copyright © 2017 Kishor Prins. All rights reserved.
+//
+
+#include "VoodooI2CELANReportDecoder.hpp"
+
+VoodooI2CELANReportStatus classify_ELAN_report(const uint8_t* report_data) {
+    uint8_t report_id = report_data[ETP_REPORT_ID_OFFSET];
+    if (report_id != ETP_REPORT_ID) {
+        // 0xFF reports are sent by the device as filler and carry no data
+        if (report_id == 0xFF)
+            return kVoodooI2CELANReportFiller;
+        // a zero length report is what a read returns when no report is pending
+        if (report_data[0] == 0 && report_data[1] == 0)
+            return kVoodooI2CELANReportEmpty;
+        return kVoodooI2CELANReportInvalid;
+    }
+    // the first two bytes are the length of the report, Linux rejects anything but a full one
+    if ((report_data[0] | (report_data[1] << 8)) < ETP_MAX_REPORT_LEN)
+        return kVoodooI2CELANReportShort;
+    return kVoodooI2CELANReportValid;
+}
+
+VoodooI2CELANReportStatus decode_ELAN_report(const VoodooI2CELANDecodeContext& context, const uint8_t* report_data, VoodooI2CELANReport* report) {
+    VoodooI2CELANReportStatus status = classify_ELAN_report(report_data);
+    if (status != kVoodooI2CELANReportValid)
+        return status;
+
+    uint8_t report_id = report_data[ETP_REPORT_ID_OFFSET];
+    const uint8_t* finger_data = &report_data[ETP_FINGER_DATA_OFFSET];
+    uint8_t tp_info = report_data[ETP_TOUCH_INFO_OFFSET];
+
+    report->report_id = report_id;
+    report->tp_info = tp_info;
+    report->button = tp_info & 0x01;
+    report->hover = report_data[ETP_HOVER_INFO_OFFSET] & ETP_HOVER_EVENT;
+    report->contact_mask = 0;
+    report->contact_count = 0;
+
+    for (int i = 0; i < ETP_MAX_FINGERS; i++) {
+        if (!(tp_info & (1U << (3 + i))))
+            continue;
+
+        VoodooI2CELANContact& contact = report->contacts[i];
+        uint16_t pos_x = ((finger_data[0] & 0xf0) << 4) | finger_data[1];
+        uint16_t pos_y = ((finger_data[0] & 0x0f) << 8) | finger_data[2];
+        int pressure = finger_data[4] + context.pressure_adjustment;
+
+        if (context.invert_y)
+            pos_y = context.logical_max_y - pos_y;
+
+        if (pressure > ETP_MAX_PRESSURE)
+            pressure = ETP_MAX_PRESSURE;
+
+        contact.x = pos_x;
+        contact.y = pos_y;
+        contact.pressure = pressure;
+        contact.mk_x = finger_data[3] & 0x0f;
+        contact.mk_y = finger_data[3] >> 4;
+        contact.width_x = contact.mk_x * context.width_per_trace_x;
+        contact.width_y = contact.mk_y * context.width_per_trace_y;
+
+        report->contact_mask |= 1U << i;
+        report->contact_count++;
+
+        // finger data is packed, only valid contacts occupy a slot in the report
+        finger_data += ETP_FINGER_DATA_LEN;
+    }
+
+    return kVoodooI2CELANReportValid;
+}
+
+/* decode_ELAN_report() with the per device choices made at compile time
+ * @PressureOffset added to every pressure, 0 or ETP_PRESSURE_OFFSET
+ * @InvertY whether Y grows upwards, as the multitouch engine wants it
+ * @TraceWidth whether the device has a trace width, without one every width is 0
+ */
+template <int PressureOffset, bool InvertY, bool TraceWidth>
+static VoodooI2CELANReportStatus decode_ELAN_report_kernel(const VoodooI2CELANDecodeContext& context, const uint8_t* report_data, VoodooI2CELANReport* report) {
+    VoodooI2CELANReportStatus status = classify_ELAN_report(report_data);
+    if (status != kVoodooI2CELANReportValid)
+        return status;
+
+    const uint8_t* finger_data = &report_data[ETP_FINGER_DATA_OFFSET];
+    uint8_t tp_info = report_data[ETP_TOUCH_INFO_OFFSET];
+
+    report->report_id = ETP_REPORT_ID;
+    report->tp_info = tp_info;
+    report->button = tp_info & 0x01;
+    report->hover = report_data[ETP_HOVER_INFO_OFFSET] & ETP_HOVER_EVENT;
+    report->contact_mask = 0;
+    report->contact_count = 0;
+
+    for (int i = 0; i < ETP_MAX_FINGERS; i++) {
+        if (!(tp_info & (1U << (3 + i))))
+            continue;
+
+        VoodooI2CELANContact& contact = report->contacts[i];
+        uint16_t pos_y = ((finger_data[0] & 0x0f) << 8) | finger_data[2];
+        int pressure = finger_data[4] + PressureOffset;
+
+        contact.x = ((finger_data[0] & 0xf0) << 4) | finger_data[1];
+        contact.y = InvertY ? static_cast<uint16_t>(context.logical_max_y - pos_y) : pos_y;
+        // a byte can only go over the maximum with an offset added
+        contact.pressure = PressureOffset && pressure > ETP_MAX_PRESSURE ? ETP_MAX_PRESSURE : pressure;
+        contact.mk_x = finger_data[3] & 0x0f;
+        contact.mk_y = finger_data[3] >> 4;
+        contact.width_x = TraceWidth ? contact.mk_x * context.width_per_trace_x : 0;
+        contact.width_y = TraceWidth ? contact.mk_y * context.width_per_trace_y : 0;
+
+        report->contact_mask |= 1U << i;
+        report->contact_count++;
+        finger_data += ETP_FINGER_DATA_LEN;
+    }
+
+    return kVoodooI2CELANReportValid;
+}
+
+// indexed by (pressure offset, Y inversion, trace width), one bit each
+static const VoodooI2CELANDecodeKernel decode_kernels[8] = {
+    decode_ELAN_report_kernel<0, false, false>,
+    decode_ELAN_report_kernel<0, false, true>,
+    decode_ELAN_report_kernel<0, true, false>,
+    decode_ELAN_report_kernel<0, true, true>,
+    decode_ELAN_report_kernel<ETP_PRESSURE_OFFSET, false, false>,
+    decode_ELAN_report_kernel<ETP_PRESSURE_OFFSET, false, true>,
+    decode_ELAN_report_kernel<ETP_PRESSURE_OFFSET, true, false>,
+    decode_ELAN_report_kernel<ETP_PRESSURE_OFFSET, true, true>,
+};
+
+VoodooI2CELANDecodeKernel select_ELAN_decode_kernel(const VoodooI2CELANDecodeContext& context) {
+    if (context.pressure_adjustment != 0 && context.pressure_adjustment != ETP_PRESSURE_OFFSET)
+        return decode_ELAN_report;
+
+    int index = (context.pressure_adjustment ? 4 : 0) | (context.invert_y ? 2 : 0) |
+                (context.width_per_trace_x || context.width_per_trace_y ? 1 : 0);
+    return decode_kernels[index];
+}
@@ -0,0 +1,98 @@
+//
+//  VoodooI2CELANReportDecoder.hpp
+//  VoodooI2CELAN
+//
+//  Copyright © 2017 Kishor Prins. All rights reserved.
+//
+
+#ifndef VOODOOI2C_ELAN_REPORT_DECODER_HPP
+#define VOODOOI2C_ELAN_REPORT_DECODER_HPP
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "VoodooI2CElanConstants.h"
+
+/* Kernel independent decoding of the 34 byte ELAN absolute report
+ *
+ * Nothing in here may depend on IOKit so that the exact same code can be
+ * built into the kext and into the host benchmark/replay tools.
+ */
+
+/* Per-device constants needed to turn a raw report into contacts */
+struct VoodooI2CELANDecodeContext {
+    uint32_t logical_max_x;
+    uint32_t logical_max_y;
+    int pressure_adjustment;
+    uint32_t width_per_trace_x;
+    uint32_t width_per_trace_y;
+    bool invert_y;
+};
+
+/* A single decoded finger contact */
+struct VoodooI2CELANContact {
+    uint16_t x;
+    uint16_t y;
+    uint16_t pressure;
+    uint8_t mk_x;
+    uint8_t mk_y;
+    uint32_t width_x;
+    uint32_t width_y;
+};
+
+/* A decoded report, contacts are indexed by slot and only the slots set in
+ * contact_mask hold meaningful data
+ */
+struct VoodooI2CELANReport {
+    uint8_t report_id;
+    uint8_t tp_info;
+    uint8_t contact_mask;
+    uint8_t contact_count;
+    bool button;
+    // a finger is close to the surface, also reported while nothing touches it
+    bool hover;
+    VoodooI2CELANContact contacts[ETP_MAX_FINGERS];
+};
+
+enum VoodooI2CELANReportStatus {
+    kVoodooI2CELANReportValid = 0,
+    kVoodooI2CELANReportFiller,
+    kVoodooI2CELANReportEmpty,
+    kVoodooI2CELANReportShort,
+    kVoodooI2CELANReportInvalid
+};
+
+/* Tells what kind of report a buffer holds without decoding it, common to every decoder
+ * @report_data a buffer of at least ETP_MAX_REPORT_LEN bytes as read from the device
+ *
+ * @return the status decode_ELAN_report() would return
+ */
+VoodooI2CELANReportStatus classify_ELAN_report(const uint8_t* report_data);
+
+/* Decodes a raw ELAN report
+ * @context the per-device decode constants
+ * @report_data a buffer of at least ETP_MAX_REPORT_LEN bytes as read from the device
+ * @report the decoded report, only written to if the report is valid
+ *
+ * @return kVoodooI2CELANReportValid if @report was filled, kVoodooI2CELANReportFiller for 0xFF reports,
+ * kVoodooI2CELANReportEmpty if the device had nothing to send, kVoodooI2CELANReportShort if a report
+ * claims to be shorter than ETP_MAX_REPORT_LEN and kVoodooI2CELANReportInvalid for any other unexpected
+ * report ID
+ */
+VoodooI2CELANReportStatus decode_ELAN_report(const VoodooI2CELANDecodeContext& context, const uint8_t* report_data, VoodooI2CELANReport* report);
+
+/* A decoder with the same contract as decode_ELAN_report(), specialised for one kind of device */
+typedef VoodooI2CELANReportStatus (*VoodooI2CELANDecodeKernel)(const VoodooI2CELANDecodeContext& context, const uint8_t* report_data, VoodooI2CELANReport* report);
+
+/* Picks the decoder for a device, meant to be called once whenever @context changes
+ * @context the per-device decode constants
+ *
+ * The pressure offset, the Y inversion and whether there is a trace width are
+ * compiled into each kernel, so the report path does not test them for every
+ * finger. Contexts no kernel was built for get decode_ELAN_report() itself.
+ *
+ * @return a decoder that gives exactly the same results as decode_ELAN_report() for @context
+ */
+VoodooI2CELANDecodeKernel select_ELAN_decode_kernel(const VoodooI2CELANDecodeContext& context);
+
+#endif /* VOODOOI2C_ELAN_REPORT_DECODER_HPP */
@@ -0,0 +1,75 @@
+//
+//  VoodooI2CELANReportIntervalStats.cpp
+//  VoodooI2CELAN
+//
+//  Copyright © 2017 Kishor Prins. All rights reserved.
+//
+
+#include "VoodooI2CELANReportIntervalStats.hpp"
+
+void VoodooI2CELANReportIntervalStats::reset() {
+    min_us = 0;
+    max_us = 0;
+    jitter_us = 0;
+    count = 0;
+    total_us = 0;
+    total_squared_us = 0;
+    previous_ns = 0;
+    previous_interval_us = 0;
+    jitter_x16 = 0;
+}
+
+void VoodooI2CELANReportIntervalStats::record(uint64_t timestamp_ns, uint8_t contact_count) {
+    uint64_t previous = previous_ns;
+    previous_ns = contact_count ? timestamp_ns : 0;
+
+    if (!previous || timestamp_ns <= previous || timestamp_ns - previous > ELAN_REPORT_GAP_NS) {
+        previous_interval_us = 0;
+        return;
+    }
+
+    uint32_t interval_us = static_cast<uint32_t>((timestamp_ns - previous) / 1000);
+    if (!count || interval_us < min_us)
+        min_us = interval_us;
+    if (interval_us > max_us)
+        max_us = interval_us;
+    count++;
+    total_us += interval_us;
+    total_squared_us += static_cast<uint64_t>(interval_us) * interval_us;
+
+    if (previous_interval_us) {
+        uint32_t difference = interval_us > previous_interval_us ? interval_us - previous_interval_us : previous_interval_us - interval_us;
+        // J += (|D| - J) / 16
+        jitter_x16 = jitter_x16 + difference - (jitter_x16 + 8) / 16;
+        jitter_us = jitter_x16 / 16;
+    }
+    previous_interval_us = interval_us;
+}
+
+uint32_t VoodooI2CELANReportIntervalStats::stddev_us() const {
+    if (count < 2)
+        return 0;
+
+    uint64_t mean = total_us / count;
+    uint64_t mean_square = total_squared_us / count;
+    uint64_t variance = mean_square > mean * mean ? mean_square - mean * mean : 0;
+
+    // integer square root, variance is well below 2^62
+    uint64_t root = 0;
+    for (uint64_t bit = 1ULL << 62; bit; bit >>= 2) {
+        if (variance >= root + bit) {
+            variance -= root + bit;
+            root = (root >> 1) + bit;
+        } else {
+            root >>= 1;
+        }
+    }
+    return static_cast<uint32_t>(root);
+}
+
+uint32_t VoodooI2CELANReportIntervalStats::rate_mhz() const {
+    if (!total_us)
+        return 0;
+    // 1e9 / mean interval in us, as count * 1e9 / total to keep the precision
+    return static_cast<uint32_t>(count * 1000000000ULL / total_us);
+}
@@ -0,0 +1,56 @@
+//
+//  VoodooI2CELANReportIntervalStats.hpp
+//  VoodooI2CELAN
+//
+//  Copyright © 2017 Kishor Prins. All rights reserved.
+//
+
+#ifndef VOODOOI2C_ELAN_REPORT_INTERVAL_STATS_HPP
+#define VOODOOI2C_ELAN_REPORT_INTERVAL_STATS_HPP
+
+#include <stdint.h>
+
+// Longer gaps between reports are pauses in the touch rather than the report period
+#define ELAN_REPORT_GAP_NS 50000000ULL
+
+/* Tracks the interval between consecutive reports of a touch
+ *
+ * Only intervals inside a touch are counted: the chain is broken by a
+ * report without contacts (the lift) and by gaps over ELAN_REPORT_GAP_NS.
+ * Everything is integer arithmetic in microseconds so it can run in the
+ * kernel. jitter_us is the RFC 3550 style smoothed deviation between
+ * successive intervals.
+ */
+
+class VoodooI2CELANReportIntervalStats {
+ public:
+    VoodooI2CELANReportIntervalStats() { reset(); }
+
+    void reset();
+    /* Accounts for a report
+     * @timestamp_ns when the report was signalled by the device
+     * @contact_count the number of contacts in the report
+     */
+    void record(uint64_t timestamp_ns, uint8_t contact_count);
+
+    uint64_t samples() const { return count; }
+    uint32_t mean_us() const { return count ? static_cast<uint32_t>(total_us / count) : 0; }
+    uint32_t stddev_us() const;
+    /* The device's report rate in millihertz, derived from the mean interval */
+    uint32_t rate_mhz() const;
+
+    uint32_t min_us;
+    uint32_t max_us;
+    uint32_t jitter_us;
+
+ private:
+    uint64_t count;
+    uint64_t total_us;
+    uint64_t total_squared_us;
+    uint64_t previous_ns;
+    uint32_t previous_interval_us;
+    // jitter scaled by 16 so the smoothing keeps its precision
+    uint32_t jitter_x16;
+};
+
+#endif /* VOODOOI2C_ELAN_REPORT_INTERVAL_STATS_HPP */
@@ -14,15 +14,42 @@
 #define super IOService
 OSDefineMetaClassAndStructors(VoodooI2CELANTouchpadDriver, IOService);
 
-bool VoodooI2CELANTouchpadDriver::check_ASUS_firmware(UInt8 productId, UInt8 ic_type) {
-    if (ic_type == 0x0E) {
-        switch (productId) {
-            case 0x05 ... 0x07:
-            case 0x09:
-            case 0x13:
-                return true;
-        }
-    } else if (ic_type == 0x08 && productId == 0x26) {
+static inline uint64_t uptime_ns() {
+    uint64_t now, now_ns;
+    clock_get_uptime(&now);
+    absolutetime_to_nanoseconds(now, &now_ns);
+    return now_ns;
+}
+
+static void set_string(OSDictionary* dictionary, const char* key, const char* value) {
+    OSString* string = OSString::withCString(value);
+    if (string) {
+        dictionary->setObject(key, string);
+        string->release();
+    }
+}
+
+static void set_number(OSDictionary* dictionary, const char* key, uint64_t value) {
+    OSNumber* number = OSNumber::withNumber(value, 64);
+    if (number) {
+        dictionary->setObject(key, number);
+        number->release();
+    }
+}
+
+/* Reads a number or boolean setting, from the device nub if it is set there (ACPI) and Info.plist otherwise */
+static bool get_setting(IOService* provider, IOService* driver, const char* key, UInt32* value) {
+    OSObject* object = provider->getProperty(key);
+    if (!object)
+        object = driver->getProperty(key);
+    OSNumber* number = OSDynamicCast(OSNumber, object);
+    if (number) {
+        *value = number->unsigned32BitValue();
+        return true;
+    }
+    OSBoolean* boolean = OSDynamicCast(OSBoolean, object);
+    if (boolean) {
+        *value = boolean->isTrue();
         return true;
     }
     return false;
@@ -33,7 +60,25 @@ bool VoodooI2CELANTouchpadDriver::init(OSDictionary *properties) {
         return false;
 
     interrupt_source = NULL;
+    interrupt_time = 0;
     interrupt_simulator = NULL;
+    init_timer = NULL;
+    idle_timer = NULL;
+    watchdog_timer = NULL;
+    baseline_timer = NULL;
+    firmware_timer = NULL;
+    firmware_image = NULL;
+    firmware_begin_ns = 0;
+    dispatch_work_loop = NULL;
+    dispatch_source = NULL;
+    frame_held = false;
+    touching = false;
+    proximity = false;
+    hover_reports = 0;
+    last_report_status = kVoodooI2CELANReportEmpty;
+    raw_stream_buffer = NULL;
+    raw_stream_client = NULL;
+    raw_stream_notify = false;
 
     // Allocate finger transducers
     transducers = OSArray::withCapacity(ETP_MAX_FINGERS);
@@ -43,9 +88,20 @@ bool VoodooI2CELANTouchpadDriver::init(OSDictionary *properties) {
     DigitiserTransducerType type = kDigitiserTransducerFinger;
     for (int i = 0; i < ETP_MAX_FINGERS; i++) {
         VoodooI2CDigitiserTransducer* transducer = VoodooI2CDigitiserTransducer::transducer(type, NULL);
-        transducers->setObject(transducer);
-        OSSafeReleaseNULL(transducer);
+        if (!transducer || !transducers->setObject(transducer)) {
+            OSSafeReleaseNULL(transducer);
+            return false;
+        }
+        // the array keeps the transducer alive for as long as we do
+        transducer_slots[i] = transducer;
+        transducer->release();
     }
+    event.transducers = transducers;
+    memset(&decode_context, 0, sizeof(decode_context));
+    decode_kernel = decode_ELAN_report;
+    next_statistics_ns = 0;
+    drain_budget = ELAN_DRAIN_BUDGET;
+    memset(&drain_stats, 0, sizeof(drain_stats));
 
     // Allocate the multitouch interface
     mt_interface = OSTypeAlloc(VoodooI2CMultitouchInterface);
@@ -56,6 +112,11 @@ bool VoodooI2CELANTouchpadDriver::init(OSDictionary *properties) {
 
     awake = true;
     ready_for_input = false;
+    mt_interface_registered = false;
+    device_info_cached = false;
+    fast_resume_enabled = true;
+    fast_resumes = 0;
+    full_resumes = 0;
     strlcpy(elan_name, ELAN_NAME, sizeof(elan_name));
     return true;
 }
@@ -65,188 +126,1099 @@ void VoodooI2CELANTouchpadDriver::free() {
 
     OSSafeReleaseNULL(mt_interface);
 
+    OSSafeReleaseNULL(raw_stream_buffer);
+
+    OSSafeReleaseNULL(firmware_image);
+
     IOLog("%s::%s VoodooI2CELAN resources have been deallocated\n", getName(), elan_name);
     super::free();
 }
 
-bool VoodooI2CELANTouchpadDriver::init_device() {
-    if (!reset_device()) {
-        return false;
+IOReturn VoodooI2CELANTouchpadDriver::begin_init() {
+    device_info_cached = false;
+    init_sequencer.begin(&protocol, &device_info, uptime_ns());
+    setProperty("InitState", "Running");
+    init_timer->setTimeoutMS(0);
+    return kIOReturnSuccess;
+}
+
+IOReturn VoodooI2CELANTouchpadDriver::cancel_init() {
+    init_timer->cancelTimeout();
+    init_sequencer.cancel();
+    return kIOReturnSuccess;
+}
+
+void VoodooI2CELANTouchpadDriver::init_step(OSObject* owner, IOTimerEventSource* timer) {
+    uint32_t delay_ms;
+
+    switch (init_sequencer.advance(uptime_ns(), &delay_ms)) {
+        case kVoodooI2CELANInitRunning:
+            init_timer->setTimeoutMS(delay_ms);
+            break;
+        case kVoodooI2CELANInitSucceeded:
+            init_finished(true);
+            break;
+        case kVoodooI2CELANInitFailed:
+            init_finished(false);
+            break;
+        case kVoodooI2CELANInitIdle:
+            break;
     }
-    IOReturn retVal;
-    UInt8 val[3];
+}
 
-    UInt32 max_report_x = 0;
-    UInt32 max_report_y = 0;
+void VoodooI2CELANTouchpadDriver::init_finished(bool success) {
+    flight_recorder.record(kVoodooI2CELANFlightReset, uptime_ns(), kVoodooI2CELANFlightResetInit, &success, sizeof(success));
+    if (watchdog.recovering()) {
+        watchdog.recovery_finished(uptime_ns(), success, false);
+        publish_watchdog_statistics();
+        // still wedged, try again once the backoff has passed
+        if (!success)
+            watchdog_timer->setTimeoutMS(0);
+    }
 
-    retVal = read_ELAN_cmd(ETP_I2C_FW_VERSION_CMD, val);
-    if (retVal != kIOReturnSuccess) {
-        IOLog("%s::%s Failed to get version cmd\n", getName(), device_name);
-        return false;
+    OSDictionary* timings = OSDictionary::withCapacity(kVoodooI2CELANInitStepCount);
+    UInt32 retries = 0;
+    for (int i = 0; i < kVoodooI2CELANInitStepCount; i++) {
+        const VoodooI2CELANInitStepTiming& timing = init_sequencer.timings[i];
+        if (!timing.attempts)
+            continue;
+        retries += timing.attempts - 1;
+        if (timings) {
+            OSNumber* duration = OSNumber::withNumber(timing.duration_ns / 1000, 64);
+            if (duration) {
+                timings->setObject(VoodooI2CELANProtocol::init_step_name(static_cast<VoodooI2CELANInitStep>(i)), duration);
+                duration->release();
+            }
+        }
     }
-    UInt8 version = val[0];
-    retVal = read_ELAN_cmd(ETP_I2C_FW_CHECKSUM_CMD, val);
-    if (retVal != kIOReturnSuccess) {
-        IOLog("%s::%s Failed to get checksum cmd\n", getName(), device_name);
-        return false;
+    if (timings) {
+        setProperty("InitStepTimesUS", timings);
+        timings->release();
     }
-    UInt16 csum = *reinterpret_cast<UInt16 *>(val);
-    retVal = read_ELAN_cmd(ETP_I2C_IAP_VERSION_CMD, val);
-    if (retVal != kIOReturnSuccess) {
-        IOLog("%s::%s Failed to get IAP version cmd\n", getName(), device_name);
-        return false;
+    setProperty("InitTimeUS", init_sequencer.total_ns / 1000, 64);
+    setProperty("InitRetries", retries, 32);
+    // input has been off since the firmware update started, whatever comes of the init
+    if (firmware_begin_ns) {
+        setProperty("FirmwareInputOffTimeMS", (uptime_ns() - firmware_begin_ns) / 1000000, 64);
+        firmware_begin_ns = 0;
     }
-    UInt8 iapversion = val[0];
-    retVal = read_ELAN_cmd(ETP_I2C_PRESSURE_CMD, val);
-    if (retVal != kIOReturnSuccess) {
-        IOLog("%s::%s Failed to get pressure cmd\n", getName(), device_name);
-        return false;
+
+    if (!success) {
+        IOLog("%s::%s Failed to init device during %s step: %s\n", getName(), device_name, VoodooI2CELANProtocol::init_step_name(init_sequencer.step()), init_sequencer.last_error());
+        setProperty("InitState", "Failed");
+        return;
     }
-    if ((val[0] >> 4) & 0x1)
-        pressure_adjustment = 0;
-    else
-        pressure_adjustment = ETP_PRESSURE_OFFSET;
-    retVal = read_ELAN_cmd(ETP_I2C_MAX_X_AXIS_CMD, val);
-    if (retVal != kIOReturnSuccess) {
-        IOLog("%s::%s Failed to get max X axis cmd\n", getName(), device_name);
-        return false;
+
+    IOLog("%s::%s ProdID: %d Vers: %d Csum: %d IAPVers: %d Max X: %d Max Y: %d\n", getName(), device_name, device_info.product_id, device_info.fw_version, device_info.fw_checksum, device_info.iap_version, device_info.max_report_x, device_info.max_report_y);
+    IOLog("%s::%s Init took %llu us (%u retries)\n", getName(), device_name, init_sequencer.total_ns / 1000, retries);
+    if (device_info.asus_firmware)
+        IOLog("%s::%s ASUS trackpad detected, applied workaround\n", getName(), device_name);
+    if (mt_interface)
+        mt_interface->setProperty(kIOHIDProductIDKey, device_info.product_id, 32);
+    update_decode_context();
+    device_info_cached = true;
+    setProperty("InitState", "Ready");
+
+    if (!awake)
+        return;
+
+    enable_input_source();
+    ready_for_input = true;
+    if (mt_interface && !mt_interface_registered) {
+        mt_interface->registerService();
+        mt_interface_registered = true;
     }
-    max_report_x = (*(reinterpret_cast<UInt16 *>(val))) & 0x0fff;
+    IOLog("%s::%s VoodooI2CELAN is ready for input\n", getName(), device_name);
+}
 
-    retVal = read_ELAN_cmd(ETP_I2C_MAX_Y_AXIS_CMD, val);
-    if (retVal != kIOReturnSuccess) {
-        IOLog("%s::%s Failed to get max Y axis cmd\n", getName(), device_name);
-        return false;
+void VoodooI2CELANTouchpadDriver::watchdog_tick(OSObject* owner, IOTimerEventSource* timer) {
+    uint32_t delay_ms;
+
+    VoodooI2CELANStall stall = watchdog.tick(uptime_ns(), &delay_ms);
+    if (stall != kVoodooI2CELANStallNone)
+        recover_device(stall);
+    else if (delay_ms)
+        watchdog_timer->setTimeoutMS(delay_ms);
+}
+
+void VoodooI2CELANTouchpadDriver::recover_device(VoodooI2CELANStall stall) {
+    IOLog("%s::%s Controller stalled (%s), recovering\n", getName(), device_name, VoodooI2CELANWatchdog::stall_name(stall));
+    // keep what led up to the stall before the recovery adds to it
+    flight_anomaly(kVoodooI2CELANFlightAnomalyWatchdog);
+    flight_recorder.record(kVoodooI2CELANFlightReset, uptime_ns(), kVoodooI2CELANFlightResetRecovery, NULL, 0);
+    watchdog.recovery_started(uptime_ns());
+    release_contacts();
+    // the device is reset to its normal mode either way, and a ghost contact may be baseline drift
+    baseline_timer->cancelTimeout();
+    baseline_monitor.cancel();
+    if (stall == kVoodooI2CELANStallStuckContact)
+        baseline_monitor.sample_soon();
+
+    if (fast_resume_enabled && device_info_cached && protocol.fast_resume(device_info)) {
+        watchdog.recovery_finished(uptime_ns(), true, true);
+        enable_input_source();
+        publish_watchdog_statistics();
+        return;
     }
-    max_report_y = (*(reinterpret_cast<UInt16 *>(val))) & 0x0fff;
 
-    retVal = read_ELAN_cmd(ETP_I2C_XY_TRACENUM_CMD, val);
-    if (retVal != kIOReturnSuccess) {
-        IOLog("%s::%s Failed to get XY tracenum cmd\n", getName(), device_name);
-        return false;
+    // an idle tick must not put the device to sleep between init steps, and the idle monitor may have already
+    idle_timer->cancelTimeout();
+    if (idle_monitor.state() != kVoodooI2CELANIdleActive)
+        set_sleep_status(false);
+    idle_monitor.stop(uptime_ns());
+    publish_idle_statistics();
+
+    // the same sequence as the first init, without blocking the work loop
+    ready_for_input = false;
+    begin_init();
+}
+
+void VoodooI2CELANTouchpadDriver::release_contacts() {
+    if (!touching || (frame_held && !queue_frame()))
+        return;
+
+    memset(&acquired_frame, 0, sizeof(acquired_frame));
+    acquired_frame.data[0] = ETP_MAX_REPORT_LEN;
+    acquired_frame.data[ETP_REPORT_ID_OFFSET] = ETP_REPORT_ID;
+    acquired_frame.report.report_id = ETP_REPORT_ID;
+    clock_get_uptime(&acquired_frame.timestamp);
+    absolutetime_to_nanoseconds(acquired_frame.timestamp, &acquired_frame.timestamp_ns);
+    acquired_frame.times.entry_ns = acquired_frame.timestamp_ns;
+    touching = false;
+    // a full ring holds on to the lift until the next interrupt, like any other frame
+    queue_frame();
+    dispatch_source->interruptOccurred(NULL, NULL, 0);
+}
+
+void VoodooI2CELANTouchpadDriver::publish_watchdog_statistics() {
+    setProperty("ReadFailureStallCount", watchdog.stalls[kVoodooI2CELANStallReadFailures], 64);
+    setProperty("InvalidReportStallCount", watchdog.stalls[kVoodooI2CELANStallInvalidReports], 64);
+    setProperty("StuckContactStallCount", watchdog.stalls[kVoodooI2CELANStallStuckContact], 64);
+    setProperty("RecoveryCount", watchdog.recoveries, 64);
+    setProperty("FastRecoveryCount", watchdog.fast_recoveries, 64);
+    setProperty("FailedRecoveryCount", watchdog.failed_recoveries, 64);
+    setProperty("LastRecoveryTimeUS", watchdog.last_recovery_ns / 1000, 64);
+    setProperty("RecoveryTimeP99US", watchdog.recovery_time.percentile(990) / 1000, 64);
+}
+
+void VoodooI2CELANTouchpadDriver::idle_tick(OSObject* owner, IOTimerEventSource* timer) {
+    uint32_t delay_ms;
+
+    apply_idle_action(idle_monitor.tick(uptime_ns(), &delay_ms));
+    if (delay_ms)
+        idle_timer->setTimeoutMS(delay_ms);
+    publish_idle_statistics();
+}
+
+void VoodooI2CELANTouchpadDriver::apply_idle_action(VoodooI2CELANIdleAction action) {
+    switch (action) {
+        case kVoodooI2CELANIdleSleep:
+            if (baseline_monitor.busy() || !set_sleep_status(true)) {
+                // still awake or in calibration mode, count towards the idle timeout again
+                idle_monitor.reset(uptime_ns());
+                break;
+            }
+            // the device does not report hover while asleep
+            if (proximity)
+                set_proximity(false);
+            // there is nothing to poll for until the next probe
+            if (interrupt_simulator)
+                interrupt_simulator->cancelTimeout();
+            break;
+        case kVoodooI2CELANIdleWake:
+            set_sleep_status(false);
+            if (interrupt_simulator) {
+                poll_scheduler.reset(uptime_ns());
+                interrupt_simulator->setTimeoutMS(0);
+            }
+            break;
+        case kVoodooI2CELANIdleNone:
+            break;
     }
+}
 
-    UInt32 x_traces = val[0];
-    UInt32 y_traces = val[1];
+void VoodooI2CELANTouchpadDriver::publish_idle_statistics() {
+    uint64_t now_ns = uptime_ns();
+
+    setProperty("IdleState", VoodooI2CELANIdleMonitor::state_name(idle_monitor.state()));
+    setProperty("ActiveTimeMS", idle_monitor.time_in(kVoodooI2CELANIdleActive, now_ns) / 1000000, 64);
+    setProperty("AsleepTimeMS", idle_monitor.time_in(kVoodooI2CELANIdleAsleep, now_ns) / 1000000, 64);
+    setProperty("ProbingTimeMS", idle_monitor.time_in(kVoodooI2CELANIdleProbing, now_ns) / 1000000, 64);
+    setProperty("IdleSleepCount", idle_monitor.sleeps, 64);
+    setProperty("IdleProbeCount", idle_monitor.probes, 64);
+    setProperty("EmptyIdleProbeCount", idle_monitor.empty_probes, 64);
+    setProperty("IdleInterruptWakeCount", idle_monitor.interrupt_wakes, 64);
+    setProperty("LastWakeLatencyUS", idle_monitor.last_wake_latency_ns / 1000, 64);
+    setProperty("WakeLatencyP99US", idle_monitor.wake_latency.percentile(990) / 1000, 64);
+    setProperty("HoverWakeCount", idle_monitor.hover_wakes, 64);
+    setProperty("PrewarmedContactCount", idle_monitor.prewarmed_contacts, 64);
+}
 
-    if (x_traces == 0 || y_traces == 0) {
-        IOLog("%s::%s Traces == 0\n", getName(), device_name);
-        return false;
+void VoodooI2CELANTouchpadDriver::baseline_tick(OSObject* owner, IOTimerEventSource* timer) {
+    uint32_t delay_ms;
+    uint64_t now_ns = uptime_ns();
+
+    bool available = ready_for_input && awake && !touching && idle_monitor.state() == kVoodooI2CELANIdleActive;
+    switch (baseline_monitor.tick(now_ns, available, &delay_ms)) {
+        case kVoodooI2CELANBaselineCalibrated:
+            IOLog("%s::%s Baselines calibrated (%s)\n", getName(), device_name,
+                  VoodooI2CELANBaselineMonitor::reason_name(baseline_monitor.last_calibration_reason));
+            flight_recorder.record(kVoodooI2CELANFlightReset, now_ns, kVoodooI2CELANFlightResetCalibration, NULL, 0);
+            publish_baseline();
+            break;
+        case kVoodooI2CELANBaselineCalibrationFailed:
+            IOLog("%s::%s Baseline calibration did not finish\n", getName(), device_name);
+            publish_baseline();
+            break;
+        case kVoodooI2CELANBaselineBusError:
+            IOLog("%s::%s Failed to sample the baselines\n", getName(), device_name);
+            publish_baseline();
+            break;
+        case kVoodooI2CELANBaselineSampled:
+        case kVoodooI2CELANBaselineAborted:
+            publish_baseline();
+            break;
+        case kVoodooI2CELANBaselineNone:
+            break;
     }
+    if (delay_ms)
+        baseline_timer->setTimeoutMS(delay_ms);
+}
 
-    retVal = read_ELAN_cmd(ETP_I2C_RESOLUTION_CMD, val);
-    if (retVal != kIOReturnSuccess) {
-        return false;
+IOReturn VoodooI2CELANTouchpadDriver::request_calibration() {
+    baseline_monitor.request_calibration();
+    if (ready_for_input)
+        baseline_timer->setTimeoutMS(0);
+    return kIOReturnSuccess;
+}
+
+void VoodooI2CELANTouchpadDriver::publish_baseline() {
+    uint64_t now_ns = uptime_ns();
+    uint32_t count = baseline_monitor.history_count();
+
+    OSArray* history = OSArray::withCapacity(count);
+    for (uint32_t i = 0; history && i < count; i++) {
+        const VoodooI2CELANBaselineSample& sample = baseline_monitor.history(i);
+        OSDictionary* item = OSDictionary::withCapacity(5);
+        if (!item)
+            break;
+        set_number(item, "AgeS", (now_ns - sample.timestamp_ns) / 1000000000ULL);
+        set_number(item, "Min", sample.min_baseline);
+        set_number(item, "Max", sample.max_baseline);
+        set_number(item, "Drift", sample.drift);
+        if (sample.reference)
+            item->setObject("Reference", kOSBooleanTrue);
+        history->setObject(item);
+        item->release();
+    }
+    if (history) {
+        setProperty("BaselineHistory", history);
+        history->release();
+    }
+
+    OSDictionary* calibrations = OSDictionary::withCapacity(kVoodooI2CELANCalibrationReasonCount);
+    if (calibrations) {
+        for (int i = 0; i < kVoodooI2CELANCalibrationReasonCount; i++)
+            set_number(calibrations, VoodooI2CELANBaselineMonitor::reason_name(static_cast<VoodooI2CELANCalibrationReason>(i)), baseline_monitor.calibrations[i]);
+        setProperty("CalibrationCounts", calibrations);
+        calibrations->release();
     }
-    UInt32 hw_res_x = val[0];
-    UInt32 hw_res_y = val[1];
 
-    // Resolution in dots per mm
-    hw_res_x = (hw_res_x * 10 + 790) * 10 / 254;
-    hw_res_y = (hw_res_y * 10 + 790) * 10 / 254;
+    if (baseline_monitor.has_reference) {
+        setProperty("ReferenceMinBaseline", baseline_monitor.reference_min, 32);
+        setProperty("ReferenceMaxBaseline", baseline_monitor.reference_max, 32);
+    }
+    setProperty("BaselineSampleCount", baseline_monitor.samples, 64);
+    setProperty("AbortedBaselineSampleCount", baseline_monitor.aborted_samples, 64);
+    setProperty("FailedCalibrationCount", baseline_monitor.failed_calibrations, 64);
+    setProperty("BaselineErrorCount", baseline_monitor.bus_errors, 64);
+    setProperty("MaxBaselineDrift", baseline_monitor.max_drift, 32);
+    setProperty("CalibrationModeTimeMS", baseline_monitor.calibration_mode_ns / 1000000, 64);
+}
+
+IOReturn VoodooI2CELANTouchpadDriver::begin_firmware_update(OSData* image) {
+    if (firmware_updater.busy())
+        return kIOReturnBusy;
+    if (!ready_for_input || !device_info_cached) {
+        IOLog("%s::%s The device is not ready for a firmware update\n", getName(), device_name);
+        return kIOReturnNotReady;
+    }
+    if (!firmware_updater.begin(&protocol, device_info, static_cast<const uint8_t*>(image->getBytesNoCopy()), image->getLength(), uptime_ns())) {
+        IOLog("%s::%s Firmware image refused: %s\n", getName(), device_name, firmware_updater.last_error);
+        publish_firmware_update();
+        return kIOReturnBadArgument;
+    }
+    image->retain();
+    firmware_image = image;
+    firmware_begin_ns = uptime_ns();
+
+    // nothing may talk to the device but the updater until the new firmware has been initialised
+    ready_for_input = false;
+    if (interrupt_simulator) {
+        interrupt_simulator->cancelTimeout();
+        interrupt_simulator->disable();
+    } else if (interrupt_source) {
+        interrupt_source->disable();
+    }
+    release_contacts();
+    if (proximity)
+        set_proximity(false);
+    idle_timer->cancelTimeout();
+    watchdog_timer->cancelTimeout();
+    baseline_timer->cancelTimeout();
+    watchdog.stop();
+    baseline_monitor.cancel();
+    // the idle monitor may have put the device to sleep
+    if (idle_monitor.state() != kVoodooI2CELANIdleActive)
+        set_sleep_status(false);
+    idle_monitor.stop(uptime_ns());
+
+    IOLog("%s::%s Updating firmware, %u pages of %u bytes\n", getName(), device_name, firmware_updater.pages_total(), firmware_updater.layout.page_size);
+    publish_firmware_update();
+    firmware_timer->setTimeoutMS(0);
+    return kIOReturnSuccess;
+}
+
+void VoodooI2CELANTouchpadDriver::firmware_step(OSObject* owner, IOTimerEventSource* timer) {
+    uint32_t delay_ms;
+    uint32_t verified = firmware_updater.pages_verified();
+
+    switch (firmware_updater.tick(uptime_ns(), &delay_ms)) {
+        case kVoodooI2CELANFirmwareRunning:
+            if (firmware_updater.pages_verified() != verified)
+                publish_firmware_update();
+            firmware_timer->setTimeoutMS(delay_ms);
+            break;
+        case kVoodooI2CELANFirmwareSucceeded:
+            firmware_finished(true);
+            break;
+        case kVoodooI2CELANFirmwareFailed:
+            firmware_finished(false);
+            break;
+        case kVoodooI2CELANFirmwareIdle:
+        case kVoodooI2CELANFirmwareInterrupted:
+            break;
+    }
+}
+
+IOReturn VoodooI2CELANTouchpadDriver::resume_firmware_update() {
+    if (firmware_updater.state() != kVoodooI2CELANFirmwareInterrupted)
+        return kIOReturnSuccess;
+    IOLog("%s::%s Resuming the firmware update at %u of %u pages\n", getName(), device_name, firmware_updater.pages_verified(), firmware_updater.pages_total());
+    firmware_updater.resume(uptime_ns());
+    publish_firmware_update();
+    firmware_timer->setTimeoutMS(0);
+    return kIOReturnSuccess;
+}
+
+void VoodooI2CELANTouchpadDriver::firmware_finished(bool success) {
+    if (success)
+        IOLog("%s::%s Firmware updated in %llu ms, checksum 0x%04x (%llu restarts, %llu resumes)\n", getName(), device_name,
+              firmware_updater.total_ns / 1000000, firmware_updater.device_checksum, firmware_updater.restarts, firmware_updater.resumes);
+    else
+        IOLog("%s::%s Firmware update failed during %s step: %s\n", getName(), device_name,
+              VoodooI2CELANFirmwareUpdater::step_name(firmware_updater.step()), firmware_updater.last_error);
+    flight_recorder.record(kVoodooI2CELANFlightReset, uptime_ns(), kVoodooI2CELANFlightResetFirmware, &success, sizeof(success));
+    publish_firmware_update();
+    OSSafeReleaseNULL(firmware_image);
+
+    // the new firmware may report a different geometry, and a failed update leaves the device wherever it got to
+    begin_init();
+}
+
+void VoodooI2CELANTouchpadDriver::publish_firmware_update() {
+    OSDictionary* update = OSDictionary::withCapacity(16);
+    if (!update)
+        return;
+
+    set_string(update, "State", VoodooI2CELANFirmwareUpdater::state_name(firmware_updater.state()));
+    set_string(update, "Step", VoodooI2CELANFirmwareUpdater::step_name(firmware_updater.step()));
+    if (firmware_updater.last_error)
+        set_string(update, "Error", firmware_updater.last_error);
+    set_number(update, "PageSize", firmware_updater.layout.page_size);
+    set_number(update, "Pages", firmware_updater.pages_total());
+    set_number(update, "PagesWritten", firmware_updater.pages_verified());
+    set_number(update, "PageWrites", firmware_updater.page_writes);
+    set_number(update, "Checks", firmware_updater.checks);
+    set_number(update, "PageRetries", firmware_updater.page_retries);
+    set_number(update, "Restarts", firmware_updater.restarts);
+    set_number(update, "Resumes", firmware_updater.resumes);
+    set_number(update, "BusErrors", firmware_updater.bus_errors);
+    set_number(update, "ImageChecksum", firmware_updater.image_checksum);
+    if (firmware_updater.state() == kVoodooI2CELANFirmwareSucceeded || firmware_updater.state() == kVoodooI2CELANFirmwareFailed) {
+        set_number(update, "DeviceChecksum", firmware_updater.device_checksum);
+        set_number(update, "TimeMS", firmware_updater.total_ns / 1000000);
+    }
+    if (firmware_updater.write_ns)
+        set_number(update, "PagesPerSecond", firmware_updater.pages_total() * 1000000000ULL / firmware_updater.write_ns);
+    setProperty("FirmwareUpdateStatus", update);
+    update->release();
+}
+
+void VoodooI2CELANTouchpadDriver::set_proximity(bool hover) {
+    proximity = hover;
+    setProperty("Proximity", hover);
+}
+
+IOReturn VoodooI2CELANTouchpadDriver::suspend_device() {
+    // nothing is read until wake, a frame still held for the ring is dropped along with the ring
+    frame_held = false;
+    touching = false;
+
+    if (firmware_updater.busy()) {
+        // whatever state the flash is in, the update finds out on wake rather than the device being put to sleep
+        firmware_timer->cancelTimeout();
+        firmware_updater.interrupt(uptime_ns());
+        publish_firmware_update();
+        return kIOReturnSuccess;
+    }
+
+    cancel_init();
+    idle_timer->cancelTimeout();
+    watchdog_timer->cancelTimeout();
+    baseline_timer->cancelTimeout();
+    watchdog.stop();
+    idle_monitor.stop(uptime_ns());
+    baseline_monitor.cancel();
+    publish_idle_statistics();
+    publish_errors(uptime_ns());
+    if (proximity)
+        set_proximity(false);
+
+    if (!device_info_cached)
+        return kIOReturnSuccess;
+    // the same as Linux does for a touchpad that is not a wake source
+    set_sleep_status(true);
+    if (protocol.set_power(false) != kIOReturnSuccess)
+        IOLog("%s::%s Failed to power down the device\n", getName(), device_name);
+    return kIOReturnSuccess;
+}
+
+IOReturn VoodooI2CELANTouchpadDriver::wake_device() {
+    if (resume_device()) {
+        enable_input_source();
+        return kIOReturnSuccess;
+    }
+
+    // the same sequence as the first init, without blocking the work loop, init_finished() enables input
+    ready_for_input = false;
+    return begin_init();
+}
 
-    if (hw_res_x == 0 || hw_res_y == 0) {
-        IOLog("%s::%s HW resolution == 0\n", getName(), device_name);
+bool VoodooI2CELANTouchpadDriver::set_sleep_status(bool enable) {
+    if (protocol.set_sleep(enable) != kIOReturnSuccess) {
+        IOLog("%s::%s Failed to %s the device\n", getName(), device_name, enable ? "put to sleep" : "wake up");
         return false;
     }
+    return true;
+}
 
-    UInt32 hw_phys_x = max_report_x * 100 / hw_res_x;
-    UInt32 hw_phys_y = max_report_y * 100 / hw_res_y;
-    width_per_trace_x = hw_phys_x / x_traces / 100;
-    width_per_trace_y = hw_phys_y / y_traces / 100;
+void VoodooI2CELANTouchpadDriver::update_decode_context() {
+    decode_context.logical_max_x = mt_interface ? device_info.max_report_x : 0;
+    decode_context.logical_max_y = mt_interface ? device_info.max_report_y : 0;
+    decode_context.pressure_adjustment = device_info.pressure_adjustment;
+    decode_context.width_per_trace_x = device_info.width_per_trace_x;
+    decode_context.width_per_trace_y = device_info.width_per_trace_y;
+    decode_context.invert_y = mt_interface != NULL;
+    decode_kernel = select_ELAN_decode_kernel(decode_context);
+    if (!transform.configure(transform_config, decode_context.logical_max_x, decode_context.logical_max_y,
+                             device_info.hw_phys_x, device_info.hw_phys_y) && mt_interface)
+        IOLog("%s::%s Coordinate transform does not fit the device (%u x %u), ignoring it\n", getName(), device_name,
+              decode_context.logical_max_x, decode_context.logical_max_y);
+    else if (!transform.identity())
+        IOLog("%s::%s Coordinates transformed to %u x %u (%u x %u)\n", getName(), device_name,
+              transform.logical_max_x, transform.logical_max_y, transform.physical_max_x, transform.physical_max_y);
+    // the dispatch side is in the middle of the frames decoded before, it catches up and changes over there
+    if (dispatch_work_loop)
+        dispatch_work_loop->runAction(OSMemberFunctionCast(IOWorkLoop::Action, this, &VoodooI2CELANTouchpadDriver::configure_dispatch), this);
+}
 
-    IOLog("%s::%s ProdID: %d Vers: %d Csum: %d IAPVers: %d Max X: %d Max Y: %d\n", getName(), device_name, product_id, version, csum, iapversion, max_report_x, max_report_y);
+IOReturn VoodooI2CELANTouchpadDriver::configure_dispatch() {
+    flush_frames();
+    // everything after the decoder sees the transformed surface
     if (mt_interface) {
-        mt_interface->physical_max_x = hw_phys_x;
-        mt_interface->physical_max_y = hw_phys_y;
-        mt_interface->logical_max_x = max_report_x;
-        mt_interface->logical_max_y = max_report_y;
+        mt_interface->physical_max_x = transform.physical_max_x;
+        mt_interface->physical_max_y = transform.physical_max_y;
+        mt_interface->logical_max_x = transform.logical_max_x;
+        mt_interface->logical_max_y = transform.logical_max_y;
+        contact_filter.configure(transform.logical_max_x, transform.logical_max_y,
+                                 transform.physical_max_x, transform.physical_max_y,
+                                 contact_deadband, contact_smoothing_speed);
+    }
+    motion_predictor.configure(prediction_horizon, transform.logical_max_x, transform.logical_max_y);
+    frame_filter.compare_raw = !contact_filter.enabled() && !motion_predictor.enabled();
+    frame_filter.reset();
+    return kIOReturnSuccess;
+}
+
+void VoodooI2CELANTouchpadDriver::publish_statistics(uint64_t now_ns) {
+    if (now_ns < next_statistics_ns)
+        return;
+    next_statistics_ns = now_ns + 1000000000ULL;
+
+    setProperty("FrameCount", frame_filter.frames, 64);
+    setProperty("SkippedSlotCount", frame_filter.skipped_slots, 64);
+    setProperty("SuppressedFrameCount", frame_filter.suppressed_frames, 64);
+    setProperty("HeldContactCount", contact_filter.held_samples, 64);
+    setProperty("ContactFilterLagP99US", contact_filter.lag.percentile(990) / 1000, 64);
+    setProperty("DrainInterruptCount", drain_stats.interrupts, 64);
+    setProperty("DrainedReportCount", drain_stats.reports, 64);
+    setProperty("MaxReportsPerInterrupt", drain_stats.max_per_interrupt, 32);
+    setProperty("CoalescedFrameCount", drain_stats.coalesced, 64);
+    setProperty("FrameRingHighWater", frame_ring.high_water, 32);
+    setProperty("FrameRingDroppedCount", frame_ring.dropped, 64);
+    setProperty("FrameRingFullCount", frame_ring.full, 64);
+    setProperty("HoverReportCount", hover_reports, 64);
+    setProperty("RawStreamEntryCount", raw_stream.recorded, 64);
+    setProperty("RawStreamNotificationCount", raw_stream.notifications, 64);
+    publish_latency();
+
+    OSDictionary* intervals = OSDictionary::withCapacity(7);
+    if (intervals) {
+        const struct {
+            const char* key;
+            uint64_t value;
+        } values[] = {
+            { "Count", report_intervals.samples() },
+            { "MeanUS", report_intervals.mean_us() },
+            { "MinUS", report_intervals.min_us },
+            { "MaxUS", report_intervals.max_us },
+            { "StdDevUS", report_intervals.stddev_us() },
+            { "JitterUS", report_intervals.jitter_us },
+            { "RateMilliHz", report_intervals.rate_mhz() },
+        };
+        for (size_t i = 0; i < sizeof(values) / sizeof(values[0]); i++) {
+            OSNumber* number = OSNumber::withNumber(values[i].value, 64);
+            if (number) {
+                intervals->setObject(values[i].key, number);
+                number->release();
+            }
+        }
+        setProperty("ReportInterval", intervals);
+        intervals->release();
+    }
+}
+
+void VoodooI2CELANTouchpadDriver::publish_latency() {
+    OSDictionary* stages = OSDictionary::withCapacity(kVoodooI2CELANStageCount);
+    if (!stages)
+        return;
+
+    for (int i = 0; i < kVoodooI2CELANStageCount; i++) {
+        const VoodooI2CELANLatencyHistogram& histogram = latency.stages[i];
+        OSDictionary* stage = OSDictionary::withCapacity(5);
+        OSArray* buckets = OSArray::withCapacity(ELAN_HISTOGRAM_BUCKETS);
+        if (!stage || !buckets) {
+            OSSafeReleaseNULL(stage);
+            OSSafeReleaseNULL(buckets);
+            continue;
+        }
+
+        // trailing empty buckets are left out to keep the property small
+        int used = ELAN_HISTOGRAM_BUCKETS;
+        while (used > 0 && !histogram.bucket(used - 1))
+            used--;
+        for (int j = 0; j < used; j++) {
+            OSNumber* count = OSNumber::withNumber(histogram.bucket(j), 64);
+            if (count) {
+                buckets->setObject(count);
+                count->release();
+            }
+        }
+
+        const struct {
+            const char* key;
+            uint64_t value;
+        } values[] = {
+            { "Count", histogram.samples() },
+            { "MeanNS", histogram.mean() },
+            { "MaxNS", histogram.max() },
+            { "P99NS", histogram.percentile(990) },
+        };
+        for (size_t j = 0; j < sizeof(values) / sizeof(values[0]); j++) {
+            OSNumber* number = OSNumber::withNumber(values[j].value, 64);
+            if (number) {
+                stage->setObject(values[j].key, number);
+                number->release();
+            }
+        }
+        stage->setObject("Log2Buckets", buckets);
+        buckets->release();
+
+        stages->setObject(VoodooI2CELANLatencyStats::stage_name(static_cast<VoodooI2CELANLatencyStage>(i)), stage);
+        stage->release();
+    }
+
+    setProperty("LatencyHistograms", stages);
+    stages->release();
+}
+
+IOReturn VoodooI2CELANTouchpadDriver::reset_statistics() {
+    report_intervals.reset();
+    // both loops record latencies, holding the dispatch loop's gate from this one keeps them both out
+    dispatch_work_loop->runAction(OSMemberFunctionCast(IOWorkLoop::Action, this, &VoodooI2CELANTouchpadDriver::reset_latency), this);
+    publish_latency();
+    return kIOReturnSuccess;
+}
+
+IOReturn VoodooI2CELANTouchpadDriver::reset_latency() {
+    latency.reset();
+    return kIOReturnSuccess;
+}
+
+bool VoodooI2CELANTouchpadDriver::caller_is_administrator(const char* action) {
+    if (IOUserClient::clientHasPrivilege(current_task(), kIOClientPrivilegeAdministrator) == kIOReturnSuccess)
+        return true;
+    IOLog("%s::%s Refusing to %s for a process without administrator privileges\n", getName(), device_name, action);
+    return false;
+}
+
+void VoodooI2CELANTouchpadDriver::flight_anomaly(VoodooI2CELANFlightAnomaly anomaly) {
+    if (flight_recorder.freeze(anomaly, uptime_ns()))
+        publish_flight_recorder();
+}
+
+IOReturn VoodooI2CELANTouchpadDriver::request_flight_dump() {
+    flight_anomaly(kVoodooI2CELANFlightAnomalyRequested);
+    return kIOReturnSuccess;
+}
+
+void VoodooI2CELANTouchpadDriver::publish_flight_recorder() {
+    uint32_t count = flight_recorder.count();
+    OSDictionary* dump = OSDictionary::withCapacity(3);
+    OSArray* entries = OSArray::withCapacity(count);
+    OSDictionary* anomalies = OSDictionary::withCapacity(kVoodooI2CELANFlightAnomalyCount);
+
+    if (dump && entries && anomalies) {
+        uint64_t frozen_ns = flight_recorder.last_freeze_ns;
+        VoodooI2CELANFlightEntry entry;
+        for (uint32_t i = 0; i < count; i++) {
+            // torn by a writer that raced the freeze
+            if (!flight_recorder.entry(i, &entry))
+                continue;
+            OSDictionary* item = OSDictionary::withCapacity(5);
+            if (!item)
+                break;
+
+            VoodooI2CELANFlightEvent event = static_cast<VoodooI2CELANFlightEvent>(entry.event);
+            set_string(item, "Event", VoodooI2CELANFlightRecorder::event_name(event));
+            set_number(item, "AgeUS", frozen_ns > entry.timestamp_ns ? (frozen_ns - entry.timestamp_ns) / 1000 : 0);
+            set_number(item, "Value", entry.value);
+            if (event == kVoodooI2CELANFlightReset)
+                set_string(item, "Kind", VoodooI2CELANFlightRecorder::reset_name(static_cast<VoodooI2CELANFlightResetKind>(entry.value)));
+            else if (event == kVoodooI2CELANFlightAnomaly)
+                set_string(item, "Kind", VoodooI2CELANFlightRecorder::anomaly_name(static_cast<VoodooI2CELANFlightAnomaly>(entry.value)));
+            OSData* data = entry.length ? OSData::withBytes(entry.data, entry.length) : NULL;
+            if (data) {
+                item->setObject("Data", data);
+                data->release();
+            }
+            entries->setObject(item);
+            item->release();
+        }
+
+        for (int i = kVoodooI2CELANFlightAnomalyNone + 1; i < kVoodooI2CELANFlightAnomalyCount; i++)
+            set_number(anomalies, VoodooI2CELANFlightRecorder::anomaly_name(static_cast<VoodooI2CELANFlightAnomaly>(i)), flight_recorder.anomalies[i]);
+
+        set_string(dump, "Anomaly", VoodooI2CELANFlightRecorder::anomaly_name(flight_recorder.last_anomaly));
+        dump->setObject("Entries", entries);
+        dump->setObject("AnomalyCounts", anomalies);
+        setProperty("FlightRecorder", dump);
+        setProperty("FlightRecorderDumpCount", flight_recorder.freezes, 64);
+        IOLog("%s::%s Flight recorder dumped %u entries (%s)\n", getName(), device_name, entries->getCount(),
+              VoodooI2CELANFlightRecorder::anomaly_name(flight_recorder.last_anomaly));
+    }
+
+    OSSafeReleaseNULL(dump);
+    OSSafeReleaseNULL(entries);
+    OSSafeReleaseNULL(anomalies);
+    flight_recorder.thaw();
+}
+
+IOReturn VoodooI2CELANTouchpadDriver::setProperties(OSObject* properties) {
+    OSDictionary* dictionary = OSDynamicCast(OSDictionary, properties);
+    if (!dictionary)
+        return kIOReturnBadArgument;
+
+    OSBoolean* reset = OSDynamicCast(OSBoolean, dictionary->getObject("ResetLatencyHistograms"));
+    if (reset && reset->isTrue() && workLoop && dispatch_work_loop) {
+        if (!caller_is_administrator("reset the latency histograms"))
+            return kIOReturnNotPrivileged;
+        // the statistics are written from the work loops, reset them there
+        workLoop->runAction(OSMemberFunctionCast(IOWorkLoop::Action, this, &VoodooI2CELANTouchpadDriver::reset_statistics), this);
+        IOLog("%s::%s Latency histograms reset\n", getName(), device_name);
+        return kIOReturnSuccess;
+    }
+
+    OSBoolean* dump = OSDynamicCast(OSBoolean, dictionary->getObject("DumpFlightRecorder"));
+    if (dump && dump->isTrue() && workLoop) {
+        if (!caller_is_administrator("dump the flight recorder"))
+            return kIOReturnNotPrivileged;
+        workLoop->runAction(OSMemberFunctionCast(IOWorkLoop::Action, this, &VoodooI2CELANTouchpadDriver::request_flight_dump), this);
+        return kIOReturnSuccess;
+    }
+
+    OSData* firmware = OSDynamicCast(OSData, dictionary->getObject("FirmwareUpdate"));
+    if (firmware && workLoop) {
+        if (!caller_is_administrator("flash firmware"))
+            return kIOReturnNotPrivileged;
+        return workLoop->runAction(OSMemberFunctionCast(IOWorkLoop::Action, this, &VoodooI2CELANTouchpadDriver::begin_firmware_update), this, firmware);
+    }
+
+    OSBoolean* calibrate = OSDynamicCast(OSBoolean, dictionary->getObject("CalibrateBaseline"));
+    if (calibrate && calibrate->isTrue() && workLoop) {
+        if (!caller_is_administrator("calibrate the touchpad"))
+            return kIOReturnNotPrivileged;
+        workLoop->runAction(OSMemberFunctionCast(IOWorkLoop::Action, this, &VoodooI2CELANTouchpadDriver::request_calibration), this);
+        IOLog("%s::%s Baseline calibration requested\n", getName(), device_name);
+        return kIOReturnSuccess;
+    }
+
+    return kIOReturnUnsupported;
+}
+
+IOReturn VoodooI2CELANTouchpadDriver::open_raw_stream(IOService* client) {
+    if (!workLoop)
+        return kIOReturnNotReady;
+    return workLoop->runAction(OSMemberFunctionCast(IOWorkLoop::Action, this, &VoodooI2CELANTouchpadDriver::attach_raw_stream), this, client);
+}
+
+void VoodooI2CELANTouchpadDriver::close_raw_stream(IOService* client) {
+    if (workLoop)
+        workLoop->runAction(OSMemberFunctionCast(IOWorkLoop::Action, this, &VoodooI2CELANTouchpadDriver::detach_raw_stream), this, client);
+}
+
+IOMemoryDescriptor* VoodooI2CELANTouchpadDriver::copy_raw_stream_memory(IOService* client) {
+    IOMemoryDescriptor* memory = NULL;
+    if (workLoop)
+        workLoop->runAction(OSMemberFunctionCast(IOWorkLoop::Action, this, &VoodooI2CELANTouchpadDriver::get_raw_stream_memory), this, client, &memory);
+    return memory;
+}
+
+IOReturn VoodooI2CELANTouchpadDriver::get_raw_stream_memory(IOService* client, IOMemoryDescriptor** memory) {
+    if (client != raw_stream_client || !raw_stream_buffer)
+        return kIOReturnNotOpen;
+    raw_stream_buffer->retain();
+    *memory = raw_stream_buffer;
+    return kIOReturnSuccess;
+}
+
+IOReturn VoodooI2CELANTouchpadDriver::arm_raw_stream_notification(io_user_reference_t* reference) {
+    if (!workLoop)
+        return kIOReturnNotOpen;
+    return workLoop->runAction(OSMemberFunctionCast(IOWorkLoop::Action, this, &VoodooI2CELANTouchpadDriver::set_raw_stream_notification), this, reference);
+}
+
+IOReturn VoodooI2CELANTouchpadDriver::attach_raw_stream(IOService* client) {
+    if (raw_stream_client)
+        return kIOReturnExclusiveAccess;
+
+    // fresh memory for every client, whatever an earlier one still has mapped is left behind
+    raw_stream_buffer = IOBufferMemoryDescriptor::withOptions(kIODirectionInOut | kIOMemoryKernelUserShared,
+                                                              VoodooI2CELANRawStream::memory_size(ELAN_RAW_STREAM_DEPTH), page_size);
+    if (!raw_stream_buffer)
+        return kIOReturnNoMemory;
+    memset(raw_stream_buffer->getBytesNoCopy(), 0, raw_stream_buffer->getLength());
+    if (!raw_stream.attach(raw_stream_buffer->getBytesNoCopy(), raw_stream_buffer->getLength())) {
+        OSSafeReleaseNULL(raw_stream_buffer);
+        return kIOReturnNoMemory;
+    }
+
+    raw_stream_client = client;
+    raw_stream_notify = false;
+    IOLog("%s::%s Raw report stream opened, %u entries\n", getName(), device_name, ELAN_RAW_STREAM_DEPTH);
+    return kIOReturnSuccess;
+}
+
+IOReturn VoodooI2CELANTouchpadDriver::detach_raw_stream(IOService* client) {
+    if (client != raw_stream_client)
+        return kIOReturnSuccess;
+
+    raw_stream.detach();
+    // the client's mappings hold on to the memory for as long as they need it
+    OSSafeReleaseNULL(raw_stream_buffer);
+    raw_stream_client = NULL;
+    raw_stream_notify = false;
+    IOLog("%s::%s Raw report stream closed after %llu entries\n", getName(), device_name, raw_stream.recorded);
+    return kIOReturnSuccess;
+}
+
+IOReturn VoodooI2CELANTouchpadDriver::set_raw_stream_notification(io_user_reference_t* reference) {
+    if (!raw_stream_client)
+        return kIOReturnNotOpen;
+
+    memcpy(raw_stream_notification, reference, sizeof(raw_stream_notification));
+    raw_stream_notify = true;
+    return kIOReturnSuccess;
+}
+
+void VoodooI2CELANTouchpadDriver::enable_input_source() {
+    // the device is awake now, start counting towards the idle timeout
+    idle_monitor.reset(uptime_ns());
+    idle_timer->setTimeoutMS(0);
+    watchdog.reset(uptime_ns());
+    baseline_monitor.begin(&protocol, uptime_ns());
+    baseline_timer->setTimeoutMS(0);
+
+    if (interrupt_simulator) {
+        poll_scheduler.reset(uptime_ns());
+        interrupt_simulator->setTimeoutMS(200);
+        interrupt_simulator->enable();
+    } else if (interrupt_source) {
+        interrupt_source->enable();
     }
-    return true;
 }
 
 void VoodooI2CELANTouchpadDriver::interrupt_occurred(OSObject* owner, IOInterruptEventSource* src, int intCount) {
     if (!ready_for_input || !awake)
         return;
 
-    parse_ELAN_report();
+    // prefer the time the interrupt fired over the time the work loop got to it
+    AbsoluteTime timestamp = __atomic_exchange_n(&interrupt_time, 0, __ATOMIC_RELAXED);
+    if (!timestamp)
+        clock_get_uptime(&timestamp);
+    uint64_t timestamp_ns;
+    absolutetime_to_nanoseconds(timestamp, &timestamp_ns);
+
+    // the device only interrupts while asleep if it has seen a finger, wake it up to report
+    if (src && idle_monitor.state() == kVoodooI2CELANIdleAsleep) {
+        uint32_t delay_ms;
+        apply_idle_action(idle_monitor.interrupt(timestamp_ns, &delay_ms));
+        idle_timer->setTimeoutMS(delay_ms);
+    }
+
+    // a frame the ring had no room for goes first, the device holds on to anything newer meanwhile
+    bool requeued = frame_held;
+    if (frame_held && !queue_frame())
+        return;
+
+    // every interrupt the work loop fell behind on is another report queued on the device
+    UInt32 budget = intCount > 1 ? min(static_cast<UInt32>(intCount), drain_budget) : 1;
+    UInt32 drained = 0;
+    UInt32 queued = 0;
+
+    for (UInt32 n = 0; n < budget; n++) {
+        VoodooI2CELANStageTimes& times = acquired_frame.times;
+        memset(&times, 0, sizeof(times));
+        times.entry_ns = n ? uptime_ns() : timestamp_ns;
+
+        VoodooI2CELANReportStatus status = read_ELAN_report(acquired_frame.data, &acquired_frame.report, &times);
+        if (status != kVoodooI2CELANReportValid) {
+            latency.record(times);
+            // a 0xFF filler report carries nothing but may have more queued behind it, anything else ends the drain
+            if (status == kVoodooI2CELANReportFiller)
+                continue;
+            break;
+        }
+        const VoodooI2CELANReport& report = acquired_frame.report;
+        bool contact = report.contact_mask || report.button;
+        if (!drained) {
+            report_intervals.record(timestamp_ns, report.contact_count);
+            // hovering counts as activity, so the device is fully awake by the time the finger lands
+            idle_monitor.report_received(times.read_ns, contact, report.hover);
+        }
+        drained++;
+        // calibration mode has to wait until nothing is near the pad
+        baseline_monitor.report_received(times.read_ns, contact || report.hover);
+        // a contact going down starts the clock on it getting stuck
+        if (watchdog.report_received(times.read_ns, contact))
+            watchdog_timer->setTimeoutMS(watchdog.stuck_contact_ms);
+        bool hovered = proximity;
+        if (report.hover != proximity)
+            set_proximity(report.hover);
+
+        // a finger approaching or leaving with nothing touching before or now has nothing for the multitouch engine
+        if (!contact && !touching && (report.hover || hovered)) {
+            hover_reports++;
+            latency.record(times);
+            continue;
+        }
+        touching = contact;
+
+        // only the first report is the one that interrupted, the ones drained after it were
+        // queued on the device meanwhile and keep their spacing for the multitouch engine and the predictor
+        if (n) {
+            acquired_frame.timestamp_ns = times.read_ns;
+            nanoseconds_to_absolutetime(times.read_ns, &acquired_frame.timestamp);
+        } else {
+            acquired_frame.timestamp = timestamp;
+            acquired_frame.timestamp_ns = timestamp_ns;
+        }
+        queued++;
+        if (!queue_frame())
+            break;
+    }
+
+    if (requeued || queued)
+        dispatch_source->interruptOccurred(NULL, NULL, 0);
+    if (error_log.summary_due(timestamp_ns))
+        publish_errors(timestamp_ns);
+    if (drained) {
+        drain_stats.interrupts++;
+        drain_stats.reports += drained;
+        if (drained > drain_stats.max_per_interrupt)
+            drain_stats.max_per_interrupt = drained;
+    }
 }
 
-IOReturn VoodooI2CELANTouchpadDriver::parse_ELAN_report() {
-    if (!api) {
-        IOLog("%s::%s API is null\n", getName(), device_name);
-        return kIOReturnError;
+bool VoodooI2CELANTouchpadDriver::queue_frame() {
+    // the dispatch side wakes us up through interrupt_source once it has made room
+    frame_held = frame_ring.push(&acquired_frame) == kVoodooI2CELANFrameFull;
+    return !frame_held;
+}
+
+void VoodooI2CELANTouchpadDriver::dispatch_frames(OSObject* owner, IOInterruptEventSource* src, int intCount) {
+    bool superseded;
+
+    while (frame_ring.pop(&dispatched_frame, &superseded)) {
+        // only the newest of a run of motion frames needs dispatching, as long as
+        // the frames on both sides of a contact going down or up are kept
+        if (superseded && !dispatched_frame.transition)
+            drain_stats.coalesced++;
+        else
+            dispatch_ELAN_report(&dispatched_frame);
+        latency.record(dispatched_frame.times);
     }
 
-    UInt8 reportData[ETP_MAX_REPORT_LEN];
-    memset(&reportData, 0, sizeof(reportData));
+    if (frame_ring.take_producer_wakeup() && interrupt_source)
+        interrupt_source->signalInterrupt();
+}
+
+IOReturn VoodooI2CELANTouchpadDriver::flush_frames() {
+    dispatch_frames(this, dispatch_source, 0);
+    frame_ring.reset();
+    return kIOReturnSuccess;
+}
 
-    IOReturn retVal = api->readI2C(reportData, sizeof(reportData));
+bool VoodooI2CELANTouchpadDriver::interrupt_filter(IOFilterInterruptEventSource* src) {
+    AbsoluteTime timestamp;
+    clock_get_uptime(&timestamp);
+    __atomic_store_n(&interrupt_time, timestamp, __ATOMIC_RELAXED);
+    return true;
+}
+
+VoodooI2CELANReportStatus VoodooI2CELANTouchpadDriver::read_ELAN_report(UInt8* data, VoodooI2CELANReport* report, VoodooI2CELANStageTimes* times) {
+    last_report_status = kVoodooI2CELANReportInvalid;
+    if (!api) {
+        if (error_log.record(kVoodooI2CELANErrorReadFailed, uptime_ns()))
+            IOLog("%s::%s API is null\n", getName(), device_name);
+        return last_report_status;
+    }
+
+    IOReturn retVal = protocol.read_report(data);
     if (retVal != kIOReturnSuccess) {
-        IOLog("%s::%s Failed to handle input\n", getName(), device_name);
-        return retVal;
+        uint64_t now_ns = uptime_ns();
+        if (error_log.record(kVoodooI2CELANErrorReadFailed, now_ns))
+            IOLog("%s::%s Failed to handle input (0x%x)\n", getName(), device_name, retVal);
+        flight_recorder.record(kVoodooI2CELANFlightReadError, now_ns, retVal, NULL, 0);
+        flight_anomaly(kVoodooI2CELANFlightAnomalyReadFailure);
+        if (watchdog.read_failed(now_ns))
+            watchdog_timer->setTimeoutMS(0);
+        return last_report_status;
     }
+    times->read_ns = uptime_ns();
 
-    if (!transducers)
-        return kIOReturnBadArgument;
+    last_report_status = decode_kernel(decode_context, data, report);
+    switch (last_report_status) {
+        case kVoodooI2CELANReportValid:
+            transform.apply(report);
+            times->decoded_ns = uptime_ns();
+            break;
+        case kVoodooI2CELANReportFiller:
+            error_log.record(kVoodooI2CELANErrorFillerReport, times->read_ns);
+            break;
+        case kVoodooI2CELANReportShort:
+            if (error_log.record(kVoodooI2CELANErrorShortRead, times->read_ns))
+                IOLog("%s::%s Short report (%d bytes)\n", getName(), device_name, data[0] | (data[1] << 8));
+            if (watchdog.invalid_report(times->read_ns))
+                watchdog_timer->setTimeoutMS(0);
+            break;
+        case kVoodooI2CELANReportInvalid:
+            if (error_log.record(kVoodooI2CELANErrorInvalidReport, times->read_ns))
+                IOLog("%s::%s Invalid report (%d)\n", getName(), device_name, data[ETP_REPORT_ID_OFFSET]);
+            if (watchdog.invalid_report(times->read_ns))
+                watchdog_timer->setTimeoutMS(0);
+            break;
+        case kVoodooI2CELANReportEmpty:
+            // the read found nothing pending
+            break;
+    }
+
+    VoodooI2CELANFlightAnomaly anomaly = flight_recorder.record_report(times->read_ns, data, last_report_status);
+    if (anomaly != kVoodooI2CELANFlightAnomalyNone)
+        flight_anomaly(anomaly);
 
-    UInt8 report_id = reportData[ETP_REPORT_ID_OFFSET];
-    if (report_id != ETP_REPORT_ID) {
-        // Ignore 0xFF reports
-        if (report_id == 0xFF)
-            return kIOReturnSuccess;
+    // a load and a branch unless a user client is reading the stream
+    if (raw_stream.active() && raw_stream.record(times->entry_ns, times->read_ns, data, last_report_status, *report) && raw_stream_notify)
+        IOUserClient::sendAsyncResult64(raw_stream_notification, kIOReturnSuccess, NULL, 0);
 
-        IOLog("%s::%s Invalid report (%d)\n", getName(), device_name, report_id);
-        return kIOReturnError;
+    return last_report_status;
+}
+
+void VoodooI2CELANTouchpadDriver::publish_errors(uint64_t now_ns) {
+    uint64_t suppressed = error_log.total_suppressed();
+    if (suppressed) {
+        IOLog("%s::%s Suppressed %llu messages: %llu %s, %llu %s, %llu %s\n", getName(), device_name, suppressed,
+              error_log.suppressed[kVoodooI2CELANErrorReadFailed], VoodooI2CELANErrorLog::class_name(kVoodooI2CELANErrorReadFailed),
+              error_log.suppressed[kVoodooI2CELANErrorInvalidReport], VoodooI2CELANErrorLog::class_name(kVoodooI2CELANErrorInvalidReport),
+              error_log.suppressed[kVoodooI2CELANErrorShortRead], VoodooI2CELANErrorLog::class_name(kVoodooI2CELANErrorShortRead));
     }
+    error_log.summarized(now_ns);
+
+    setProperty("ReadErrorCount", error_log.counts[kVoodooI2CELANErrorReadFailed], 64);
+    setProperty("InvalidReportCount", error_log.counts[kVoodooI2CELANErrorInvalidReport], 64);
+    setProperty("FillerReportCount", error_log.counts[kVoodooI2CELANErrorFillerReport], 64);
+    setProperty("ShortReadCount", error_log.counts[kVoodooI2CELANErrorShortRead], 64);
+    setProperty("LoggedErrorCount", error_log.logged, 64);
+}
+
+void VoodooI2CELANTouchpadDriver::dispatch_ELAN_report(VoodooI2CELANFrame* frame) {
+    const UInt8* reportData = frame->data;
+    const VoodooI2CELANReport& report = frame->report;
+    VoodooI2CELANStageTimes* times = &frame->times;
+    AbsoluteTime timestamp = frame->timestamp;
+    uint64_t timestamp_ns = frame->timestamp_ns;
+    times->dispatch_begin_ns = uptime_ns();
 
     // Check if input is disabled via ApplePS2Keyboard request
-    if (ignoreall)
-        return kIOReturnSuccess;
+    uint64_t keyboard_state = keyboard.snapshot();
+    if (VoodooI2CELANKeyboardState::ignored(keyboard_state))
+        return;
+
+    // hold resting fingers still and smooth slow ones before deciding what changed
+    contact_filter.filter(&frame->report, timestamp_ns);
+    motion_predictor.predict(&frame->report, timestamp_ns);
 
     // Ignore input for specified time after keyboard usage
-    AbsoluteTime timestamp;
-    clock_get_uptime(&timestamp);
-    uint64_t timestamp_ns;
-    absolutetime_to_nanoseconds(timestamp, &timestamp_ns);
+    bool quiet = VoodooI2CELANKeyboardState::quiet(keyboard_state, timestamp_ns);
+    UInt8 update_mask = frame_filter.filter(reportData, report, quiet);
+    publish_statistics(timestamp_ns);
+    // nothing moved since the last dispatch, don't bother the multitouch engine
+    if (!update_mask)
+        return;
 
-    UInt8* finger_data = &reportData[ETP_FINGER_DATA_OFFSET];
-    UInt8 tp_info = reportData[ETP_TOUCH_INFO_OFFSET];
-    int numFingers = 0;
     for (int i = 0; i < ETP_MAX_FINGERS; i++) {
-        VoodooI2CDigitiserTransducer* transducer = OSDynamicCast(VoodooI2CDigitiserTransducer,  transducers->getObject(i));
-        if (!transducer) {
+        if (!(update_mask & (1U << i)))
             continue;
-        }
+
+        VoodooI2CDigitiserTransducer* transducer = transducer_slots[i];
         transducer->type = kDigitiserTransducerFinger;
-        bool contactValid = tp_info & (1U << (3 + i));
+        bool contactValid = report.contact_mask & (1U << i);
         transducer->is_valid = contactValid;
         if (contactValid) {
-            UInt16 posX = ((finger_data[0] & 0xf0) << 4) | finger_data[1];
-            UInt16 posY = ((finger_data[0] & 0x0f) << 8) | finger_data[2];
-            UInt16 pressure = finger_data[4] + pressure_adjustment;
-            UInt8 mk_x = (finger_data[3] & 0x0f);
-            UInt8 mk_y = (finger_data[3] >> 4);
-            unsigned int x_mm = mk_x * width_per_trace_x;
-            unsigned int y_mm = mk_y * width_per_trace_y;
-
-            if (mt_interface) {
-                transducer->logical_max_x = mt_interface->logical_max_x;
-                transducer->logical_max_y = mt_interface->logical_max_y;
-                posY = transducer->logical_max_y - posY;
-            }
+            const VoodooI2CELANContact& contact = report.contacts[i];
+
+            transducer->logical_max_x = mt_interface->logical_max_x;
+            transducer->logical_max_y = mt_interface->logical_max_y;
 
             // unsigned int major = max(area_x, area_y);
             // unsigned int minor = min(area_x, area_y);
 
-            if (pressure > ETP_MAX_PRESSURE)
-                pressure = ETP_MAX_PRESSURE;
-
-            transducer->coordinates.x.update(posX, timestamp);
-            transducer->coordinates.y.update(posY, timestamp);
+            transducer->coordinates.x.update(contact.x, timestamp);
+            transducer->coordinates.y.update(contact.y, timestamp);
             // transducer->touch_major.update(major, timestamp);
             // transducer->touch_minor.update(minor, timestamp);
-            transducer->physical_button.update(tp_info & 0x01, timestamp);
+            transducer->physical_button.update(report.button, timestamp);
 
             // Reset confidence state if new valid contact
             if (!transducer->tip_switch.value()) {
@@ -255,8 +1227,7 @@ IOReturn VoodooI2CELANTouchpadDriver::parse_ELAN_report() {
 
             if (transducer->confidence.value()) {
                 // 25mm comes from Microsoft precision touchpad specs
-                bool valid_size = pressure < 80 && x_mm < 25 && y_mm < 25;
-                bool quiet = (timestamp_ns - keytime) < maxaftertyping;
+                bool valid_size = contact.pressure < 80 && contact.width_x < 25 && contact.width_y < 25;
                 transducer->confidence.update(valid_size && !quiet, timestamp);
             }
 
@@ -264,9 +1235,7 @@ IOReturn VoodooI2CELANTouchpadDriver::parse_ELAN_report() {
             transducer->id = i;
             transducer->secondary_id = i;
             // transducer->pressure_physical_max = ETP_MAX_PRESSURE;
-            // transducer->tip_pressure.update(pressure, timestamp);
-            numFingers += 1;
-            finger_data += ETP_FINGER_DATA_LEN;
+            // transducer->tip_pressure.update(contact.pressure, timestamp);
         } else {
             transducer->id = i;
             transducer->secondary_id = i;
@@ -280,16 +1249,12 @@ IOReturn VoodooI2CELANTouchpadDriver::parse_ELAN_report() {
         }
     }
 
-    // create new VoodooI2CMultitouchEvent
-    VoodooI2CMultitouchEvent event;
-    event.contact_count = numFingers;
-    event.transducers = transducers;
+    event.contact_count = report.contact_count;
 
     // send the event into the multitouch interface
     if (mt_interface)
         mt_interface->handleInterruptReport(event, timestamp);
-
-    return kIOReturnSuccess;
+    times->dispatched_ns = uptime_ns();
 }
 
 VoodooI2CELANTouchpadDriver* VoodooI2CELANTouchpadDriver::probe(IOService* provider, SInt32* score) {
@@ -317,6 +1282,8 @@ VoodooI2CELANTouchpadDriver* VoodooI2CELANTouchpadDriver::probe(IOService* provi
         IOLog("%s::%s Could not get VoodooI2C API instance\n", getName(), device_name);
         return NULL;
     }
+    bus.api = api;
+    protocol.init(&bus);
     return this;
 }
 
@@ -339,87 +1306,40 @@ bool VoodooI2CELANTouchpadDriver::publish_multitouch_interface() {
     mt_interface->setProperty(kIOHIDDisplayIntegratedKey, false);
     // 0x04f3 is Elan's Vendor Id
     mt_interface->setProperty(kIOHIDVendorIDKey, 0x04f3, 32);
-    mt_interface->setProperty(kIOHIDProductIDKey, product_id, 32);
 
     return true;
 }
 
-IOReturn VoodooI2CELANTouchpadDriver::read_ELAN_cmd(UInt16 reg, UInt8* val) {
-    return read_raw_16bit_data(reg, ETP_I2C_INF_LENGTH, val);
-}
-
-IOReturn VoodooI2CELANTouchpadDriver::read_raw_16bit_data(UInt16 reg, size_t len, UInt8* values) {
-    IOReturn retVal = kIOReturnSuccess;
-    UInt16 buffer[] {
-        reg
-    };
-    retVal = api->writeReadI2C(reinterpret_cast<UInt8*>(&buffer), sizeof(buffer), values, len);
-    return retVal;
-}
-
-bool VoodooI2CELANTouchpadDriver::reset_device() {
-    IOReturn retVal = kIOReturnSuccess;
-    retVal = write_ELAN_cmd(ETP_I2C_STAND_CMD, ETP_I2C_RESET);
-    if (retVal != kIOReturnSuccess) {
-        IOLog("%s::%s Failed to write RESET cmd\n", getName(), device_name);
-        return false;
-    }
-    IOSleep(100);
-    UInt8 val[256];
-    UInt8 val2[3];
-    retVal = api->readI2C(val, ETP_I2C_INF_LENGTH);
-    if (retVal != kIOReturnSuccess) {
-        IOLog("%s::%s Failed to get reset acknowledgement\n", getName(), device_name);
-        return false;;
-    }
-    retVal = read_raw_16bit_data(ETP_I2C_DESC_CMD, ETP_I2C_DESC_LENGTH, val);
-    if (retVal != kIOReturnSuccess) {
-        IOLog("%s::%s  Failed to get desc cmd\n", getName(), device_name);
-        return false;
+bool VoodooI2CELANTouchpadDriver::resume_device() {
+    uint64_t begin, end;
+    uint64_t elapsed_ns;
+    bool fast = false;
+
+    clock_get_uptime(&begin);
+    // the sensor was powered down by suspend_device()
+    if (protocol.set_power(true) != kIOReturnSuccess)
+        IOLog("%s::%s Failed to power up the device\n", getName(), device_name);
+    if (fast_resume_enabled && device_info_cached) {
+        fast = protocol.fast_resume(device_info);
+        if (!fast)
+            IOLog("%s::%s Fast resume failed (%s), falling back to a full reset\n", getName(), device_name, protocol.last_error);
     }
-    retVal = read_raw_16bit_data(ETP_I2C_REPORT_DESC_CMD, ETP_I2C_REPORT_DESC_LENGTH, val);
-    if (retVal != kIOReturnSuccess) {
-        IOLog("%s::%s Failed to get report cmd\n", getName(), device_name);
+    clock_get_uptime(&end);
+    absolutetime_to_nanoseconds(end - begin, &elapsed_ns);
+
+    flight_recorder.record(kVoodooI2CELANFlightReset, uptime_ns(), fast ? kVoodooI2CELANFlightResetFastResume : kVoodooI2CELANFlightResetFullResume,
+                           &fast, sizeof(fast));
+    if (!fast) {
+        // the reset is left to the init sequence, which publishes its own timings
+        full_resumes++;
+        setProperty("FullResumeCount", full_resumes, 32);
         return false;
     }
-    // get the product ID
-    retVal = read_ELAN_cmd(ETP_I2C_UNIQUEID_CMD, val2);
-    if (retVal != kIOReturnSuccess) {
-        IOLog("%s::%s Failed to get product ID cmd\n", getName(), device_name);
-        return false;
-    }
-    product_id = val2[0];
-    retVal = read_ELAN_cmd(ETP_I2C_SM_VERSION_CMD, val2);
-    if (retVal != kIOReturnSuccess) {
-        IOLog("%s::%s Failed to get IC type cmd\n", getName(), device_name);
-        return false;
-    }
-    UInt8 ictype = val2[1];
-    if (check_ASUS_firmware(product_id, ictype)) {
-        IOLog("%s::%s ASUS trackpad detected, applying workaround\n", getName(), device_name);
-        retVal = write_ELAN_cmd(ETP_I2C_STAND_CMD, ETP_I2C_WAKE_UP);
-        if (retVal != kIOReturnSuccess) {
-            IOLog("%s::%s Failed to send wake up cmd (workaround)\n", getName(), device_name);
-            return false;
-        }
-        IOSleep(200);
-        retVal =  write_ELAN_cmd(ETP_I2C_SET_CMD, ETP_ENABLE_ABS);
-        if (retVal != kIOReturnSuccess) {
-            IOLog("%s::%s Failed to send enable cmd (workaround)\n", getName(), device_name);
-            return false;
-        }
-    } else {
-        retVal = write_ELAN_cmd(ETP_I2C_SET_CMD, ETP_ENABLE_ABS);
-        if (retVal != kIOReturnSuccess) {
-            IOLog("%s::%s Failed to send enable cmd\n", getName(), device_name);
-            return false;
-        }
-        retVal = write_ELAN_cmd(ETP_I2C_STAND_CMD, ETP_I2C_WAKE_UP);
-        if (retVal != kIOReturnSuccess) {
-            IOLog("%s::%s Failed to send wake up cmd\n", getName(), device_name);
-            return false;
-        }
-    }
+
+    fast_resumes++;
+    setProperty("FastResumeCount", fast_resumes, 32);
+    setProperty("LastResumeTimeUS", elapsed_ns / 1000, 64);
+    IOLog("%s::%s Fast resume took %llu us\n", getName(), device_name, elapsed_ns / 1000);
     return true;
 }
 
@@ -436,6 +1356,50 @@ void VoodooI2CELANTouchpadDriver::release_resources() {
         OSSafeReleaseNULL(interrupt_simulator);
     }
 
+    if (dispatch_source) {
+        dispatch_source->disable();
+        dispatch_work_loop->removeEventSource(dispatch_source);
+        OSSafeReleaseNULL(dispatch_source);
+    }
+
+    OSSafeReleaseNULL(dispatch_work_loop);
+
+    if (idle_timer) {
+        idle_timer->cancelTimeout();
+        workLoop->removeEventSource(idle_timer);
+        OSSafeReleaseNULL(idle_timer);
+    }
+
+    if (watchdog_timer) {
+        watchdog_timer->cancelTimeout();
+        workLoop->removeEventSource(watchdog_timer);
+        OSSafeReleaseNULL(watchdog_timer);
+    }
+
+    if (baseline_timer) {
+        baseline_timer->cancelTimeout();
+        workLoop->removeEventSource(baseline_timer);
+        OSSafeReleaseNULL(baseline_timer);
+    }
+
+    if (firmware_timer) {
+        firmware_timer->cancelTimeout();
+        workLoop->removeEventSource(firmware_timer);
+        OSSafeReleaseNULL(firmware_timer);
+    }
+    firmware_updater.cancel();
+
+    if (init_timer) {
+        init_timer->cancelTimeout();
+        workLoop->removeEventSource(init_timer);
+        OSSafeReleaseNULL(init_timer);
+    }
+
+    // nothing records anymore, the client finds the stream closed
+    raw_stream.detach();
+    raw_stream_client = NULL;
+    raw_stream_notify = false;
+
     OSSafeReleaseNULL(workLoop);
 
     if (api) {
@@ -443,12 +1407,14 @@ void VoodooI2CELANTouchpadDriver::release_resources() {
             api->close(this);
         }
         api = nullptr;
+        bus.api = nullptr;
     }
 }
 
 IOReturn VoodooI2CELANTouchpadDriver::setPowerState(unsigned long longpowerStateOrdinal, IOService* whatDevice) {
     if (whatDevice != this)
         return kIOReturnInvalid;
+    flight_recorder.record(kVoodooI2CELANFlightPower, uptime_ns(), static_cast<uint32_t>(longpowerStateOrdinal), NULL, 0);
 
     if (longpowerStateOrdinal == 0) {
         if (awake) {
@@ -458,22 +1424,30 @@ IOReturn VoodooI2CELANTouchpadDriver::setPowerState(unsigned long longpowerState
                 interrupt_source->disable();
             }
 
+            // an init still in flight or the idle monitor would be talking to a device that is about to lose power
+            workLoop->runAction(OSMemberFunctionCast(IOWorkLoop::Action, this, &VoodooI2CELANTouchpadDriver::suspend_device), this);
+            // nothing is being read anymore, let the dispatch side catch up and start from scratch on wake
+            dispatch_work_loop->runAction(OSMemberFunctionCast(IOWorkLoop::Action, this, &VoodooI2CELANTouchpadDriver::flush_frames), this);
+
             IOLog("%s::%s Going to sleep\n", getName(), device_name);
             awake = false;
         }
     } else {
         if (!awake) {
-            reset_device();
             awake = true;
 
-            if (interrupt_simulator) {
-                interrupt_simulator->setTimeoutMS(200);
-                interrupt_simulator->enable();
-            } else if (interrupt_source) {
-                interrupt_source->enable();
+            if (firmware_updater.state() == kVoodooI2CELANFirmwareInterrupted) {
+                // input stays off until the update is over
+                workLoop->runAction(OSMemberFunctionCast(IOWorkLoop::Action, this, &VoodooI2CELANTouchpadDriver::resume_firmware_update), this);
+            } else if (device_info_cached) {
+                // the device is talked to and the timers armed from the work loop, like everywhere else
+                workLoop->runAction(OSMemberFunctionCast(IOWorkLoop::Action, this, &VoodooI2CELANTouchpadDriver::wake_device), this);
+            } else {
+                // start() never finished initialising the device, so start over
+                workLoop->runAction(OSMemberFunctionCast(IOWorkLoop::Action, this, &VoodooI2CELANTouchpadDriver::begin_init), this);
             }
 
-            IOLog("%s::%s Woke up and reset device\n", getName(), device_name);
+            IOLog("%s::%s Woke up device\n", getName(), device_name);
         }
     }
     return kIOPMAckImplied;
@@ -484,9 +1458,119 @@ bool VoodooI2CELANTouchpadDriver::start(IOService* provider) {
         return false;
 
     // Read QuietTimeAfterTyping configuration value (if available)
+    uint64_t maxaftertyping = ELAN_QUIET_TIME_AFTER_TYPING * 1000000ULL;
     OSNumber* quietTimeAfterTyping = OSDynamicCast(OSNumber, getProperty("QuietTimeAfterTyping"));
     if (quietTimeAfterTyping != NULL)
         maxaftertyping = quietTimeAfterTyping->unsigned64BitValue() * 1000000; // Convert to nanoseconds
+    keyboard.configure(maxaftertyping);
+
+    // How many queued reports a single interrupt may read
+    OSNumber* drainBudget = OSDynamicCast(OSNumber, getProperty("InterruptDrainBudget"));
+    if (drainBudget != NULL && drainBudget->unsigned32BitValue() > 0)
+        drain_budget = drainBudget->unsigned32BitValue();
+
+    // How many decoded frames may wait for the multitouch engine
+    OSNumber* ringDepth = OSDynamicCast(OSNumber, getProperty("FrameRingDepth"));
+    if (ringDepth != NULL)
+        frame_ring.configure(ringDepth->unsigned32BitValue());
+    setProperty("FrameRingDepth", frame_ring.depth(), 32);
+
+    // Polling bounds used when the device has no usable interrupt
+    UInt32 poll_interval = INTERRUPT_SIMULATOR_TIMEOUT;
+    UInt32 idle_poll_interval = INTERRUPT_SIMULATOR_IDLE_TIMEOUT;
+    UInt32 poll_idle_delay = INTERRUPT_SIMULATOR_IDLE_DELAY;
+    OSNumber* number = OSDynamicCast(OSNumber, getProperty("PollIntervalMS"));
+    if (number != NULL)
+        poll_interval = number->unsigned32BitValue();
+    number = OSDynamicCast(OSNumber, getProperty("IdlePollIntervalMS"));
+    if (number != NULL)
+        idle_poll_interval = number->unsigned32BitValue();
+    number = OSDynamicCast(OSNumber, getProperty("PollIdleDelayMS"));
+    if (number != NULL)
+        poll_idle_delay = number->unsigned32BitValue();
+    poll_scheduler.configure(poll_interval * 1000, idle_poll_interval * 1000, poll_idle_delay);
+
+    // Runtime low power mode, IdleTimeoutMS = 0 keeps the device awake, an interrupt wakes it unless IdleProbeIntervalMS asks for probes as well
+    UInt32 idle_timeout = ELAN_IDLE_TIMEOUT;
+    UInt32 idle_probe_interval = ELAN_IDLE_PROBE_INTERVAL;
+    UInt32 idle_probe_window = ELAN_IDLE_PROBE_WINDOW;
+    number = OSDynamicCast(OSNumber, getProperty("IdleTimeoutMS"));
+    if (number != NULL)
+        idle_timeout = number->unsigned32BitValue();
+    number = OSDynamicCast(OSNumber, getProperty("IdleProbeIntervalMS"));
+    if (number != NULL)
+        idle_probe_interval = number->unsigned32BitValue();
+    number = OSDynamicCast(OSNumber, getProperty("IdleProbeWindowMS"));
+    if (number != NULL)
+        idle_probe_window = number->unsigned32BitValue();
+
+    // Re-initialise a wedged controller, a limit of 0 turns that check off
+    UInt32 watchdog_error_limit = ELAN_WATCHDOG_ERROR_LIMIT;
+    UInt32 watchdog_stuck_contact = ELAN_WATCHDOG_STUCK_CONTACT;
+    number = OSDynamicCast(OSNumber, getProperty("WatchdogErrorLimit"));
+    if (number != NULL)
+        watchdog_error_limit = number->unsigned32BitValue();
+    number = OSDynamicCast(OSNumber, getProperty("WatchdogStuckContactMS"));
+    if (number != NULL)
+        watchdog_stuck_contact = number->unsigned32BitValue();
+    watchdog.configure(watchdog_error_limit, watchdog_stuck_contact);
+
+    // Deadband and smoothing for contact coordinates, in hundredths of a mm (ContactDeadband = 0 disables)
+    contact_deadband = ELAN_CONTACT_DEADBAND;
+    contact_smoothing_speed = ELAN_CONTACT_SMOOTHING_SPEED;
+    number = OSDynamicCast(OSNumber, getProperty("ContactDeadband"));
+    if (number != NULL)
+        contact_deadband = number->unsigned32BitValue();
+    number = OSDynamicCast(OSNumber, getProperty("ContactSmoothingSpeed"));
+    if (number != NULL)
+        contact_smoothing_speed = number->unsigned32BitValue();
+
+    // Extrapolate contacts this far ahead to make up for the report interval (0 disables)
+    prediction_horizon = ELAN_PREDICTION_HORIZON;
+    number = OSDynamicCast(OSNumber, getProperty("PredictionHorizonMS"));
+    if (number != NULL)
+        prediction_horizon = number->unsigned32BitValue();
+
+    // Sample the baselines while the pad is idle and recalibrate once they drift, off unless a machine sets BaselineIntervalMS,
+    // properties of the device nub (ACPI) take precedence
+    UInt32 baseline_interval = ELAN_BASELINE_INTERVAL;
+    UInt32 baseline_drift_threshold = ELAN_BASELINE_DRIFT_THRESHOLD;
+    UInt32 baseline_quiet_time = ELAN_BASELINE_QUIET_TIME;
+    get_setting(provider, this, "BaselineIntervalMS", &baseline_interval);
+    get_setting(provider, this, "BaselineDriftThreshold", &baseline_drift_threshold);
+    get_setting(provider, this, "BaselineQuietTimeMS", &baseline_quiet_time);
+    baseline_monitor.configure(baseline_interval, baseline_drift_threshold, baseline_quiet_time);
+
+    // How firmware pages are streamed, FirmwarePageDelayMS = 0 waits as long as Linux does and FirmwareCheckInterval = 1 checks every page
+    UInt32 firmware_page_delay = ELAN_FIRMWARE_PAGE_DELAY;
+    UInt32 firmware_check_interval = ELAN_FIRMWARE_CHECK_INTERVAL;
+    number = OSDynamicCast(OSNumber, getProperty("FirmwarePageDelayMS"));
+    if (number != NULL)
+        firmware_page_delay = number->unsigned32BitValue();
+    number = OSDynamicCast(OSNumber, getProperty("FirmwareCheckInterval"));
+    if (number != NULL)
+        firmware_check_interval = number->unsigned32BitValue();
+    firmware_updater.configure(firmware_page_delay, firmware_check_interval);
+
+    // Rotate (clockwise, in degrees), mirror, crop and scale the coordinates, properties of the device nub (ACPI) take precedence
+    memset(&transform_config, 0, sizeof(transform_config));
+    UInt32 setting = 0;
+    get_setting(provider, this, "Rotation", &transform_config.rotation);
+    if (get_setting(provider, this, "MirrorX", &setting))
+        transform_config.mirror_x = setting;
+    if (get_setting(provider, this, "MirrorY", &setting))
+        transform_config.mirror_y = setting;
+    get_setting(provider, this, "ActiveAreaMinX", &transform_config.active_min_x);
+    get_setting(provider, this, "ActiveAreaMinY", &transform_config.active_min_y);
+    get_setting(provider, this, "ActiveAreaMaxX", &transform_config.active_max_x);
+    get_setting(provider, this, "ActiveAreaMaxY", &transform_config.active_max_y);
+    get_setting(provider, this, "ScaledMaxX", &transform_config.scaled_max_x);
+    get_setting(provider, this, "ScaledMaxY", &transform_config.scaled_max_y);
+
+    // Skip the reset and re-probe on wake unless disabled (FastResume = false)
+    OSBoolean* fastResume = OSDynamicCast(OSBoolean, getProperty("FastResume"));
+    if (fastResume != NULL)
+        fast_resume_enabled = fastResume->isTrue();
 
     workLoop = this->getWorkLoop();
     if (!workLoop) {
@@ -500,8 +1584,22 @@ bool VoodooI2CELANTouchpadDriver::start(IOService* provider) {
         goto start_exit;
     }
 
-    // set interrupts AFTER device is initialised
-    interrupt_source = IOInterruptEventSource::interruptEventSource(this, OSMemberFunctionCast(IOInterruptEventAction, this, &VoodooI2CELANTouchpadDriver::interrupt_occurred), api, 0);
+    // a slow multitouch engine must not hold up the next bus read, so it gets its own thread
+    dispatch_work_loop = IOWorkLoop::workLoop();
+    if (!dispatch_work_loop) {
+        IOLog("%s::%s Could not create the dispatch work loop\n", getName(), elan_name);
+        goto start_exit;
+    }
+    dispatch_source = IOInterruptEventSource::interruptEventSource(this, OSMemberFunctionCast(IOInterruptEventAction, this, &VoodooI2CELANTouchpadDriver::dispatch_frames));
+    if (!dispatch_source) {
+        IOLog("%s::%s Could not get dispatch event source\n", getName(), elan_name);
+        goto start_exit;
+    }
+    dispatch_work_loop->addEventSource(dispatch_source);
+    dispatch_source->enable();
+
+    // interrupts are only enabled once the init sequence has finished
+    interrupt_source = IOFilterInterruptEventSource::filterInterruptEventSource(this, OSMemberFunctionCast(IOInterruptEventAction, this, &VoodooI2CELANTouchpadDriver::interrupt_occurred), OSMemberFunctionCast(IOFilterInterruptAction, this, &VoodooI2CELANTouchpadDriver::interrupt_filter), api, 0);
 
     if (!interrupt_source) {
         IOLog("%s::%s Could not get interrupt event source, trying to fallback on polling\n", getName(), elan_name);
@@ -510,32 +1608,64 @@ bool VoodooI2CELANTouchpadDriver::start(IOService* provider) {
             IOLog("%s::%s Could not get timer event source\n", getName(), elan_name);
             goto start_exit;
         }
-        publish_multitouch_interface();
-        if (!init_device()) {
-            IOLog("%s::%s Failed to init device\n", getName(), elan_name);
-            goto start_exit;
-        }
         workLoop->addEventSource(interrupt_simulator);
-        interrupt_simulator->setTimeoutMS(200);
-        IOLog("%s::%s Polling mode initialisation succeeded.", getName(), elan_name);
+        interrupt_simulator->disable();
+        IOLog("%s::%s Falling back to polling mode\n", getName(), elan_name);
     } else {
-        publish_multitouch_interface();
-        if (!init_device()) {
-            IOLog("%s::%s Failed to init device\n", getName(), elan_name);
-            goto start_exit;
-        }
         workLoop->addEventSource(interrupt_source);
-        interrupt_source->enable();
     }
-    
+
+    // without an interrupt only the probes can tell that the pad is being touched again
+    if (interrupt_simulator && !idle_probe_interval)
+        idle_probe_interval = ELAN_POLLING_IDLE_PROBE_INTERVAL;
+    idle_monitor.configure(idle_timeout, idle_probe_interval, idle_probe_window);
+
+    idle_timer = IOTimerEventSource::timerEventSource(this, OSMemberFunctionCast(IOTimerEventSource::Action, this, &VoodooI2CELANTouchpadDriver::idle_tick));
+    if (!idle_timer) {
+        IOLog("%s::%s Could not get idle timer event source\n", getName(), elan_name);
+        goto start_exit;
+    }
+    workLoop->addEventSource(idle_timer);
+
+    watchdog_timer = IOTimerEventSource::timerEventSource(this, OSMemberFunctionCast(IOTimerEventSource::Action, this, &VoodooI2CELANTouchpadDriver::watchdog_tick));
+    if (!watchdog_timer) {
+        IOLog("%s::%s Could not get watchdog timer event source\n", getName(), elan_name);
+        goto start_exit;
+    }
+    workLoop->addEventSource(watchdog_timer);
+
+    baseline_timer = IOTimerEventSource::timerEventSource(this, OSMemberFunctionCast(IOTimerEventSource::Action, this, &VoodooI2CELANTouchpadDriver::baseline_tick));
+    if (!baseline_timer) {
+        IOLog("%s::%s Could not get baseline timer event source\n", getName(), elan_name);
+        goto start_exit;
+    }
+    workLoop->addEventSource(baseline_timer);
+
+    firmware_timer = IOTimerEventSource::timerEventSource(this, OSMemberFunctionCast(IOTimerEventSource::Action, this, &VoodooI2CELANTouchpadDriver::firmware_step));
+    if (!firmware_timer) {
+        IOLog("%s::%s Could not get firmware timer event source\n", getName(), elan_name);
+        goto start_exit;
+    }
+    workLoop->addEventSource(firmware_timer);
+
+    init_timer = IOTimerEventSource::timerEventSource(this, OSMemberFunctionCast(IOTimerEventSource::Action, this, &VoodooI2CELANTouchpadDriver::init_step));
+    if (!init_timer) {
+        IOLog("%s::%s Could not get init timer event source\n", getName(), elan_name);
+        goto start_exit;
+    }
+    workLoop->addEventSource(init_timer);
+
+    publish_multitouch_interface();
+
     PMinit();
     api->joinPMtree(this);
     registerPowerDriver(this, VoodooI2CIOPMPowerStates, kVoodooI2CIOPMNumberPowerStates);
-    IOSleep(100);
-    ready_for_input = true;
     setProperty("VoodooI2CServices Supported", kOSBooleanTrue);
+
+    // the device is reset and probed from init_timer, start() does not wait for it
+    workLoop->runAction(OSMemberFunctionCast(IOWorkLoop::Action, this, &VoodooI2CELANTouchpadDriver::begin_init), this);
+
     IOLog("%s::%s VoodooI2CELAN has started\n", getName(), elan_name);
-    mt_interface->registerService();
     registerService();
     return true;
 start_exit:
@@ -544,8 +1674,19 @@ start_exit:
 }
 
 void VoodooI2CELANTouchpadDriver::simulateInterrupt(OSObject* owner, IOTimerEventSource *timer) {
+    last_report_status = kVoodooI2CELANReportEmpty;
     interrupt_occurred(owner, NULL, 0);
-    interrupt_simulator->setTimeoutMS(INTERRUPT_SIMULATOR_TIMEOUT);
+
+    interrupt_simulator->setTimeoutUS(poll_scheduler.poll_completed(uptime_ns(), last_report_status == kVoodooI2CELANReportValid));
+
+    if (poll_scheduler.rates_updated) {
+        poll_scheduler.rates_updated = false;
+        setProperty("PollCount", poll_scheduler.polls, 64);
+        setProperty("EmptyPollCount", poll_scheduler.empty_polls, 64);
+        setProperty("PollRate", poll_scheduler.poll_rate, 32);
+        setProperty("ReportRate", poll_scheduler.report_rate, 32);
+        setProperty("PollIntervalUS", poll_scheduler.interval_us(), 32);
+    }
 }
 
 void VoodooI2CELANTouchpadDriver::stop(IOService* provider) {
@@ -563,45 +1704,33 @@ void VoodooI2CELANTouchpadDriver::unpublish_multitouch_interface() {
     }
 }
 
-// Linux equivalent of elan_i2c_write_cmd function
-IOReturn VoodooI2CELANTouchpadDriver::write_ELAN_cmd(UInt16 reg, UInt16 cmd) {
-    UInt16 buffer[] {
-        reg,
-        cmd
-    };
-    IOReturn retVal = kIOReturnSuccess;
-    retVal = api->writeI2C(reinterpret_cast<UInt8*>(&buffer), sizeof(buffer));
-    return retVal;
-}
-
 IOReturn VoodooI2CELANTouchpadDriver::message(UInt32 type, IOService* provider, void* argument) {
     switch (type) {
         case kKeyboardGetTouchStatus:
         {
 #if DEBUG
-            IOLog("%s::getEnabledStatus = %s\n", getName(), ignoreall ? "false" : "true");
+            IOLog("%s::getEnabledStatus = %s\n", getName(), keyboard.enabled() ? "true" : "false");
 #endif
             bool* pResult = (bool*)argument;
-            *pResult = !ignoreall;
+            *pResult = keyboard.enabled();
             break;
         }
         case kKeyboardSetTouchStatus:
         {
             bool enable = *((bool*)argument);
+            flight_recorder.record(kVoodooI2CELANFlightKeyboard, uptime_ns(), type & 0x3fff, &enable, sizeof(enable));
 #if DEBUG
             IOLog("%s::setEnabledStatus = %s\n", getName(), enable ? "true" : "false");
 #endif
-            // ignoreall is true when trackpad has been disabled
-            if (enable == ignoreall) {
-                // save state, and update LED
-                ignoreall = !enable;
-            }
+            keyboard.set_enabled(enable);
             break;
         }
         case kKeyboardKeyPressTime:
         {
             //  Remember last time key was pressed
-            keytime = *((uint64_t*)argument);
+            uint64_t keytime = *((uint64_t*)argument);
+            keyboard.key_pressed(keytime);
+            flight_recorder.record(kVoodooI2CELANFlightKeyboard, uptime_ns(), type & 0x3fff, &keytime, sizeof(keytime));
 #if DEBUG
             IOLog("%s::keyPressed = %llu\n", getName(), keytime);
 #endif
@@ -9,8 +9,11 @@
 #ifndef VOODOOI2C_ELAN_TOUCHPAD_DRIVER_HPP
 #define VOODOOI2C_ELAN_TOUCHPAD_DRIVER_HPP
 
+#include <IOKit/IOBufferMemoryDescriptor.h>
+#include <IOKit/IOFilterInterruptEventSource.h>
 #include <IOKit/IOService.h>
 #include <IOKit/IOTimerEventSource.h>
+#include <IOKit/IOUserClient.h>
 
 #include "../../../VoodooI2C/VoodooI2C/VoodooI2CDevice/VoodooI2CDeviceNub.hpp"
 
@@ -19,8 +22,46 @@
 
 #include "../../../Dependencies/helpers.hpp"
 
+#include "VoodooI2CELANBaselineMonitor.hpp"
+#include "VoodooI2CELANContactFilter.hpp"
+#include "VoodooI2CELANCoordinateTransform.hpp"
+#include "VoodooI2CELANErrorLog.hpp"
+#include "VoodooI2CELANFirmwareUpdater.hpp"
+#include "VoodooI2CELANFlightRecorder.hpp"
+#include "VoodooI2CELANFrameFilter.hpp"
+#include "VoodooI2CELANFrameRing.hpp"
+#include "VoodooI2CELANIdleMonitor.hpp"
+#include "VoodooI2CELANInitSequencer.hpp"
+#include "VoodooI2CELANKeyboardState.hpp"
+#include "VoodooI2CELANLatencyHistogram.hpp"
+#include "VoodooI2CELANMotionPredictor.hpp"
+#include "VoodooI2CELANPollScheduler.hpp"
+#include "VoodooI2CELANProtocol.hpp"
+#include "VoodooI2CELANRawStream.hpp"
+#include "VoodooI2CELANReportDecoder.hpp"
+#include "VoodooI2CELANReportIntervalStats.hpp"
+#include "VoodooI2CELANWatchdog.hpp"
+
 #define ELAN_NAME "elan"
+#define ELAN_QUIET_TIME_AFTER_TYPING 500
 #define INTERRUPT_SIMULATOR_TIMEOUT 5
+#define INTERRUPT_SIMULATOR_IDLE_TIMEOUT 100
+#define INTERRUPT_SIMULATOR_IDLE_DELAY 1000
+#define ELAN_DRAIN_BUDGET 4
+#define ELAN_IDLE_TIMEOUT 10000
+#define ELAN_IDLE_PROBE_INTERVAL 0
+#define ELAN_POLLING_IDLE_PROBE_INTERVAL 250
+#define ELAN_IDLE_PROBE_WINDOW 30
+#define ELAN_WATCHDOG_ERROR_LIMIT 8
+#define ELAN_WATCHDOG_STUCK_CONTACT 1000
+#define ELAN_CONTACT_DEADBAND 0
+#define ELAN_CONTACT_SMOOTHING_SPEED 50
+#define ELAN_PREDICTION_HORIZON 0
+#define ELAN_BASELINE_INTERVAL 0
+#define ELAN_BASELINE_DRIFT_THRESHOLD 50
+#define ELAN_BASELINE_QUIET_TIME 2000
+#define ELAN_FIRMWARE_PAGE_DELAY 0
+#define ELAN_FIRMWARE_CHECK_INTERVAL 8
 
 // Message types defined by ApplePS2Keyboard
 enum {
@@ -30,6 +71,26 @@ enum {
     kKeyboardKeyPressTime = iokit_vendor_specific_msg(110)      // notify of timestamp a non-modifier key was pressed (data is uint64_t*)
 };
 
+/* Forwards the ELAN protocol's bus accesses to the VoodooI2C device nub */
+
+class VoodooI2CELANNubBus : public VoodooI2CELANBus {
+ public:
+    VoodooI2CDeviceNub* api;
+
+    IOReturn readI2C(uint8_t* values, uint16_t length) override {
+        return api->readI2C(values, length);
+    }
+    IOReturn writeI2C(uint8_t* values, uint16_t length) override {
+        return api->writeI2C(values, length);
+    }
+    IOReturn writeReadI2C(uint8_t* write_buffer, uint16_t write_length, uint8_t* read_buffer, uint16_t read_length) override {
+        return api->writeReadI2C(write_buffer, write_length, read_buffer, read_length);
+    }
+    void sleep(uint32_t ms) override {
+        IOSleep(ms);
+    }
+};
+
 /* Main class that handles all communication between macOS, VoodooI2C, and a I2C based ELAN touchpad */
 
 class VoodooI2CELANTouchpadDriver : public IOService {
@@ -63,8 +124,39 @@ class VoodooI2CELANTouchpadDriver : public IOService {
      */
     void stop(IOService* device) override;
 
+    /* Starts recording every report read to the raw report stream, for VoodooI2CELANUserClient
+     * @client the user client reading the stream
+     *
+     * @return kIOReturnExclusiveAccess if another client is reading it already
+     */
+    IOReturn open_raw_stream(IOService* client);
+    /* Stops recording and forgets the notification port
+     * @client the user client that opened the stream
+     */
+    void close_raw_stream(IOService* client);
+    /* The memory holding the raw report stream, retained for the caller
+     * @client the user client that opened the stream
+     *
+     * @return NULL unless @client is the one reading the stream
+     */
+    IOMemoryDescriptor* copy_raw_stream_memory(IOService* client);
+    /* Has the stream's reader notified when it waits for the next entry
+     * @reference the async reference of the reader's call, holding its port
+     *
+     * @return kIOReturnNotOpen if the stream is not being recorded
+     */
+    IOReturn arm_raw_stream_notification(io_user_reference_t* reference);
+
  protected:
     IOReturn setPowerState(unsigned long longpowerStateOrdinal, IOService* whatDevice) override;
+    /* Handles requests from user space, setting ResetLatencyHistograms to true clears the histograms
+     * setting DumpFlightRecorder to true dumps the flight recorder, setting CalibrateBaseline to true
+     * recalibrates the sensor the next time it is not touched and setting FirmwareUpdate to the data
+     * of a firmware image flashes it
+     *
+     * @return kIOReturnSuccess if the request was understood, an error if the firmware image was refused
+     */
+    IOReturn setProperties(OSObject* properties) override;
 
  private:
     bool awake;
@@ -73,91 +165,321 @@ class VoodooI2CELANTouchpadDriver : public IOService {
     char device_name[10];
     char elan_name[5];
 
-    int pressure_adjustment;
-    int product_id;
+    VoodooI2CELANNubBus bus;
+    VoodooI2CELANProtocol protocol;
+    VoodooI2CELANDeviceInfo device_info;
+    bool device_info_cached;
 
-    unsigned int width_per_trace_x;
-    unsigned int width_per_trace_y;
+    bool fast_resume_enabled;
+    UInt32 fast_resumes;
+    UInt32 full_resumes;
 
-    IOInterruptEventSource* interrupt_source;
+    IOFilterInterruptEventSource* interrupt_source;
+    // set by interrupt_filter, consumed by interrupt_occurred
+    AbsoluteTime interrupt_time;
     VoodooI2CMultitouchInterface *mt_interface;
+    bool mt_interface_registered;
     OSArray* transducers;
+    // borrowed from transducers so the report path needs no lookups or casts
+    VoodooI2CDigitiserTransducer* transducer_slots[ETP_MAX_FINGERS];
+
+    // everything the report path needs, set up once the device is known
+    VoodooI2CELANDecodeContext decode_context;
+    // picked for decode_context by update_decode_context()
+    VoodooI2CELANDecodeKernel decode_kernel;
+    VoodooI2CMultitouchEvent event;
+
+    // reports are read on workLoop and fed to the multitouch engine from dispatch_work_loop,
+    // workLoop may run actions on dispatch_work_loop but never the other way round
+    VoodooI2CELANFrameRing frame_ring;
+    // owned by the acquisition side, frame_held if the ring had no room for it
+    VoodooI2CELANFrame acquired_frame;
+    bool frame_held;
+    // whether the last frame queued had anything touching, frames in between that only hover are not queued
+    bool touching;
+    // a finger is hovering above the pad, published as Proximity
+    bool proximity;
+    uint64_t hover_reports;
+    // owned by the dispatch side
+    VoodooI2CELANFrame dispatched_frame;
+    IOWorkLoop* dispatch_work_loop;
+    IOInterruptEventSource* dispatch_source;
+    UInt32 drain_budget;
+    struct {
+        uint64_t interrupts;
+        uint64_t reports;
+        UInt32 max_per_interrupt;
+        // written by the dispatch side
+        uint64_t coalesced;
+    } drain_stats;
+    VoodooI2CELANFrameFilter frame_filter;
+    // applied on the acquisition side right after decoding, the dispatch side only reads it in configure_dispatch()
+    VoodooI2CELANCoordinateTransform transform;
+    VoodooI2CELANTransformConfig transform_config;
+    VoodooI2CELANContactFilter contact_filter;
+    UInt32 contact_deadband;
+    UInt32 contact_smoothing_speed;
+    VoodooI2CELANMotionPredictor motion_predictor;
+    UInt32 prediction_horizon;
+    VoodooI2CELANLatencyStats latency;
+    VoodooI2CELANReportIntervalStats report_intervals;
+    uint64_t next_statistics_ns;
     IOWorkLoop* workLoop;
 
     IOTimerEventSource* interrupt_simulator;
-    
-    bool ignoreall;
-    uint64_t maxaftertyping = 500000000;
-    uint64_t keytime = 0;
+    VoodooI2CELANPollScheduler poll_scheduler;
+    VoodooI2CELANReportStatus last_report_status;
+    VoodooI2CELANErrorLog error_log;
 
-    /* Handles any interrupts that the ELAN device generates
-     * @productId product ID of the ELAN device
-     * @ic_type IC type (provided by the device)
+    IOTimerEventSource* init_timer;
+    VoodooI2CELANInitSequencer init_sequencer;
+
+    IOTimerEventSource* idle_timer;
+    VoodooI2CELANIdleMonitor idle_monitor;
+
+    IOTimerEventSource* watchdog_timer;
+    VoodooI2CELANWatchdog watchdog;
+
+    IOTimerEventSource* baseline_timer;
+    VoodooI2CELANBaselineMonitor baseline_monitor;
+
+    IOTimerEventSource* firmware_timer;
+    VoodooI2CELANFirmwareUpdater firmware_updater;
+    // the image being flashed, held until the update has finished
+    OSData* firmware_image;
+    // when input was turned off for the update, 0 once the device is back up
+    uint64_t firmware_begin_ns;
+
+    // written by message() from the keyboard's context, read once per report
+    VoodooI2CELANKeyboardState keyboard;
+
+    // the recent history of the device, dumped to FlightRecorder when something goes wrong
+    VoodooI2CELANFlightRecorder flight_recorder;
+
+    // every report read, for the user client, only recorded while raw_stream_client is set
+    VoodooI2CELANRawStream raw_stream;
+    // allocated for each client, so a mapping left over from the last one never sees the next one's reports
+    IOBufferMemoryDescriptor* raw_stream_buffer;
+    IOService* raw_stream_client;
+    OSAsyncReference64 raw_stream_notification;
+    bool raw_stream_notify;
+
+    /* Starts the init sequence on the work loop, interrupts are enabled once it has finished
      *
-     * @return returns true if this ELAN device is ASUS manufactured
+     * @return kIOReturnSuccess, the result of the sequence is reported by init_finished
      */
-    bool check_ASUS_firmware(UInt8 productId, UInt8 ic_type);
-
-    /* Sends the appropriate ELAN protocol packets to
-     * initialise the device into multitouch mode
+    IOReturn begin_init();
+    /* Stops an init sequence in progress, e.g. because the device is going to sleep
+     *
+     * @return kIOReturnSuccess
+     */
+    IOReturn cancel_init();
+    /* Runs the next init step, rearming init_timer for as long as the device needs to settle */
+    void init_step(OSObject* owner, IOTimerEventSource* timer);
+    /* Publishes the results of the init sequence and starts taking input if it succeeded
+     * @success whether the sequence succeeded
+     */
+    void init_finished(bool success);
+    /* Puts the device to sleep or wakes it as the idle monitor decides */
+    void idle_tick(OSObject* owner, IOTimerEventSource* timer);
+    /* Carries out an action of the idle monitor
+     * @action what to do to the device
+     */
+    void apply_idle_action(VoodooI2CELANIdleAction action);
+    /* Publishes the time spent in each idle state and the wake latency */
+    void publish_idle_statistics();
+    /* Recovers the device if the watchdog has found it wedged */
+    void watchdog_tick(OSObject* owner, IOTimerEventSource* timer);
+    /* Initialises a wedged device again, through the cached fast path if it can or else
+     * through the init sequence, whose init_finished() reports back to the watchdog
+     * @stall what the watchdog found
+     */
+    void recover_device(VoodooI2CELANStall stall);
+    /* Lifts whatever was touching when the reports stopped, so nothing stays pressed */
+    void release_contacts();
+    /* Publishes the stall and recovery counters */
+    void publish_watchdog_statistics();
+    /* Samples the baselines or recalibrates as the baseline monitor decides */
+    void baseline_tick(OSObject* owner, IOTimerEventSource* timer);
+    /* Has the baselines calibrated again as soon as the pad is not touched, runs on the work loop
+     *
+     * @return kIOReturnSuccess
+     */
+    IOReturn request_calibration();
+    /* Publishes the latest baselines, their history and the calibration counters */
+    void publish_baseline();
+    /* Checks a firmware image, turns input off and starts flashing it, runs on the work loop
+     * @image the image, retained until the update has finished
+     *
+     * @return kIOReturnSuccess if the update has started, kIOReturnBadArgument if the image does
+     * not fit the device, kIOReturnNotReady or kIOReturnBusy if the device cannot be flashed now
+     */
+    IOReturn begin_firmware_update(OSData* image);
+    /* Runs the next step of the update, rearming firmware_timer while there is more to do */
+    void firmware_step(OSObject* owner, IOTimerEventSource* timer);
+    /* Picks up an update that system sleep interrupted, runs on the work loop
+     *
+     * @return kIOReturnSuccess
+     */
+    IOReturn resume_firmware_update();
+    /* Publishes the result of the update and initialises the device again, which turns input back on
+     * @success whether the new firmware was verified
+     */
+    void firmware_finished(bool success);
+    /* Publishes the state and counters of the update as FirmwareUpdateStatus */
+    void publish_firmware_update();
+    /* Publishes whether a finger is hovering above the pad
+     * @hover the hover state of the latest report
+     */
+    void set_proximity(bool hover);
+    /* Stops the init sequence and the idle monitor and powers the device down for system sleep,
+     * or interrupts a firmware update, which leaves the device alone, and forgets the acquisition
+     * side's frame state for flush_frames(), runs on the work loop
+     *
+     * @return kIOReturnSuccess
+     */
+    IOReturn suspend_device();
+    /* Brings the device back with resume_device() and enables input, or starts the init sequence
+     * if it needs a full reset, runs on the work loop
+     *
+     * @return kIOReturnSuccess
+     */
+    IOReturn wake_device();
+    /* Publishes the report path counters, at most once a second
+     * @now_ns the current time
+     */
+    void publish_statistics(uint64_t now_ns);
+    /* Publishes the per stage latency histograms as LatencyHistograms */
+    void publish_latency();
+    /* Clears the report interval statistics and the latency histograms and publishes them, runs on the work loop
+     *
+     * @return kIOReturnSuccess
+     */
+    IOReturn reset_statistics();
+    /* Clears the latency histograms, runs on the dispatch work loop
+     *
+     * @return kIOReturnSuccess
+     */
+    IOReturn reset_latency();
+    /* Whether the process that set a property may have it acted upon, logs the refusal if not
+     * @action what the property asks for, for the log
+     */
+    bool caller_is_administrator(const char* action);
+    /* Freezes the flight recorder and dumps it, unless the last dump was too recent, runs on the work loop
+     * @anomaly what went wrong
+     */
+    void flight_anomaly(VoodooI2CELANFlightAnomaly anomaly);
+    /* Dumps the flight recorder because user space asked for it, runs on the work loop
+     *
+     * @return kIOReturnSuccess
+     */
+    IOReturn request_flight_dump();
+    /* Publishes the frozen flight recorder as FlightRecorder and starts it again */
+    void publish_flight_recorder();
+    /* Lays out the raw report stream and starts recording, runs on the work loop
+     * @client the user client reading the stream
+     *
+     * @return kIOReturnSuccess, kIOReturnExclusiveAccess or kIOReturnNoMemory
+     */
+    IOReturn attach_raw_stream(IOService* client);
+    /* Stops recording, runs on the work loop
+     * @client the user client that opened the stream
+     *
+     * @return kIOReturnSuccess
+     */
+    IOReturn detach_raw_stream(IOService* client);
+    /* Hands out the stream's memory, runs on the work loop
+     * @client the user client asking for it
+     * @memory receives the memory, retained, if @client is reading the stream
      *
-     * @return true if the device was initialised properly
+     * @return kIOReturnSuccess or kIOReturnNotOpen
      */
-    bool init_device();
+    IOReturn get_raw_stream_memory(IOService* client, IOMemoryDescriptor** memory);
+    /* Stores the reader's async reference, runs on the work loop
+     * @reference the async reference
+     *
+     * @return kIOReturnSuccess or kIOReturnNotOpen
+     */
+    IOReturn set_raw_stream_notification(io_user_reference_t* reference);
+    /* Recomputes decode_context and the transform from the device info, runs on the work loop
+     *
+     * The dispatch side is reconfigured through configure_dispatch(). The work loop's gate is
+     * held meanwhile, so nothing is queued until it is done.
+     */
+    void update_decode_context();
+    /* Dispatches what is still queued, then sets the ranges of the multitouch interface, the contact
+     * filter and the predictor from the transform, runs on dispatch_work_loop from update_decode_context()
+     *
+     * @return kIOReturnSuccess
+     */
+    IOReturn configure_dispatch();
+    /* Enables whichever of the interrupt source or the interrupt simulator is in use */
+    void enable_input_source();
     /* Handles any interrupts that the ELAN device generates
      * by spawning a thread that is out of the inerrupt context
      *
      */
     void interrupt_occurred(OSObject* owner, IOInterruptEventSource* src, int intCount);
-    /* Reads the ELAN report (touch data) in the I2C bus and generates a VoodooI2C multitouch event
+    /* Records when the interrupt fired, runs in the primary interrupt context
      *
-     * @return returns a IOReturn status of the reads (usually a representation of I2C bus)
+     * @return true so that interrupt_occurred is always scheduled
      */
-    IOReturn parse_ELAN_report();
-    /* Initialises the VoodooI2C multitouch classes
+    bool interrupt_filter(IOFilterInterruptEventSource* src);
+    /* Hands acquired_frame to the dispatch side
      *
-     * @return true if the VoodooI2C multitouch classes were properly initialised
+     * @return false if the ring is full, the frame is then held and queued first on the next interrupt
      */
-    bool publish_multitouch_interface();
-    /* Reads a ELAN command from the I2C bus
-     * @reg which register to read the data from
-     * @val a buffer which is large enough to hold the ELAN command data
+    bool queue_frame();
+    /* Feeds every queued frame to the multitouch engine, runs on dispatch_work_loop
+     *
+     */
+    void dispatch_frames(OSObject* owner, IOInterruptEventSource* src, int intCount);
+    /* Dispatches whatever is still queued and empties the ring, runs on dispatch_work_loop
+     * while the acquisition side is stopped
+     *
+     * @return kIOReturnSuccess
+     */
+    IOReturn flush_frames();
+    /* Reads and decodes a single ELAN report (touch data) from the I2C bus
+     * @data receives the raw report
+     * @report receives the decoded report
+     * @times receives the time at which the read and decode completed
      *
-     * @return returns a IOReturn status of the reads (usually a representation of I2C bus)
+     * @return the status of the report, kVoodooI2CELANReportInvalid if the read failed
+     */
+    VoodooI2CELANReportStatus read_ELAN_report(UInt8* data, VoodooI2CELANReport* report, VoodooI2CELANStageTimes* times);
+    /* Publishes the error counters and sums up the messages error_log held back, runs on the work loop
+     * @now_ns the current time
+     */
+    void publish_errors(uint64_t now_ns);
+    /* Generates a VoodooI2C multitouch event from a frame taken off the ring
+     * @frame the frame to dispatch, its timestamp is used for every update of the event
      */
-    IOReturn read_ELAN_cmd(UInt16 reg, UInt8* val);
-    /* Reads raw data from the I2C bus
-     * @reg which 16bit register to read the data from
-     * @len the length of the @val buffer
-     * @vaue a buffer which is large enough to hold the data being read
+    void dispatch_ELAN_report(VoodooI2CELANFrame* frame);
+    /* Initialises the VoodooI2C multitouch classes
      *
-     * @return returns a IOReturn status of the reads (usually a representation of I2C bus)
+     * @return true if the VoodooI2C multitouch classes were properly initialised
      */
-    IOReturn read_raw_16bit_data(UInt16 reg, size_t len, UInt8* values);
+    bool publish_multitouch_interface();
     /* Releases any allocated resources (called by stop)
      *
      */
     void release_resources();
-    /* Releases any allocated resources
+    /* Powers the device back up after a system wake and fast resumes it from the cached device info
      *
-     * @return true if the ELAN device was reset succesfully
+     * @return true if the device is ready for input, false if it needs the full init sequence
      */
-    bool reset_device();
+    bool resume_device();
     /* Enables or disables the ELAN device for sleep
+     * @enable true to put the device into its low power state, false to wake it up
      *
+     * @return true if the device accepted the command
      */
-    void set_sleep_status(bool enable);
+    bool set_sleep_status(bool enable);
     /* Releases any allocated VoodooI2C multitouch device
      *
      */
     void unpublish_multitouch_interface();
-    /* Writes a ELAN command formatted I2C message
-     * @reg which register to write the data to
-     * @cmd the command which we want to write
-     *
-     * @return returns a IOReturn status of the reads (usually a representation of I2C bus)
-     */
-    IOReturn write_ELAN_cmd(UInt16 reg, UInt16 cmd);
 
     /*
      * Called by ApplePS2Controller to notify of keyboard interactions
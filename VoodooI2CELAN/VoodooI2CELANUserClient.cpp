@@ -0,0 +1,78 @@
+//
+//  VoodooI2CELANUserClient.cpp
+//  VoodooI2CELAN
+//
+//  Copyright © 2017 Kishor Prins. All rights reserved.
+//
+
+#include "VoodooI2CELANUserClient.hpp"
+
+#include "VoodooI2CELANTouchpadDriver.hpp"
+
+#define super IOUserClient
+OSDefineMetaClassAndStructors(VoodooI2CELANUserClient, IOUserClient);
+
+const IOExternalMethodDispatch VoodooI2CELANUserClient::methods[kVoodooI2CELANRawStreamMethodCount] = {
+    // kVoodooI2CELANRawStreamMethodNotify, no arguments, the port comes with the async call
+    { reinterpret_cast<IOExternalMethodAction>(&VoodooI2CELANUserClient::arm_notification), 0, 0, 0, 0 }
+};
+
+bool VoodooI2CELANUserClient::initWithTask(task_t owning_task, void* security_id, UInt32 type, OSDictionary* properties) {
+    if (clientHasPrivilege(security_id, kIOClientPrivilegeAdministrator) != kIOReturnSuccess) {
+        IOLog("%s Refusing to open the raw report stream for a process without administrator privileges\n", getName());
+        return false;
+    }
+    driver = NULL;
+    return super::initWithTask(owning_task, security_id, type, properties);
+}
+
+bool VoodooI2CELANUserClient::start(IOService* provider) {
+    driver = OSDynamicCast(VoodooI2CELANTouchpadDriver, provider);
+    if (!driver || !super::start(provider))
+        return false;
+
+    if (driver->open_raw_stream(this) != kIOReturnSuccess) {
+        driver = NULL;
+        return false;
+    }
+    return true;
+}
+
+IOReturn VoodooI2CELANUserClient::clientClose() {
+    if (driver) {
+        driver->close_raw_stream(this);
+        driver = NULL;
+    }
+    terminate();
+    return kIOReturnSuccess;
+}
+
+IOReturn VoodooI2CELANUserClient::clientMemoryForType(UInt32 type, IOOptionBits* options, IOMemoryDescriptor** memory) {
+    if (type != kVoodooI2CELANRawStreamMemory || !driver)
+        return kIOReturnBadArgument;
+
+    // retained for us, the mapping holds on to the memory even after the driver has let go of it
+    IOMemoryDescriptor* stream = driver->copy_raw_stream_memory(this);
+    if (!stream)
+        return kIOReturnNotOpen;
+
+    *memory = stream;
+    *options = 0;
+    return kIOReturnSuccess;
+}
+
+IOReturn VoodooI2CELANUserClient::externalMethod(uint32_t selector, IOExternalMethodArguments* arguments,
+                                                 IOExternalMethodDispatch* dispatch, OSObject* target, void* reference) {
+    if (selector >= kVoodooI2CELANRawStreamMethodCount)
+        return kIOReturnBadArgument;
+
+    dispatch = const_cast<IOExternalMethodDispatch*>(&methods[selector]);
+    return super::externalMethod(selector, arguments, dispatch, this, reference);
+}
+
+IOReturn VoodooI2CELANUserClient::arm_notification(VoodooI2CELANUserClient* target, void* reference, IOExternalMethodArguments* arguments) {
+    if (!target->driver || !arguments->asyncWakePort)
+        return kIOReturnBadArgument;
+    // the reference carries the port, as filled in by IOConnectCallAsyncScalarMethod()
+    return target->driver->arm_raw_stream_notification(arguments->asyncReference);
+}
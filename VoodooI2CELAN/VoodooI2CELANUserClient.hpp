@@ -0,0 +1,53 @@
+//
+//  VoodooI2CELANUserClient.hpp
+//  VoodooI2CELAN
+//
+//  Copyright © 2017 Kishor Prins. All rights reserved.
+//
+
+#ifndef VOODOOI2C_ELAN_USER_CLIENT_HPP
+#define VOODOOI2C_ELAN_USER_CLIENT_HPP
+
+#include <IOKit/IOUserClient.h>
+
+#include "VoodooI2CELANRawStream.hpp"
+
+class VoodooI2CELANTouchpadDriver;
+
+/* Gives user space the raw report stream
+ *
+ * Mapping kVoodooI2CELANRawStreamMemory maps the stream's ring, laid out as
+ * described in VoodooI2CELANRawStream.hpp. Recording starts when the client
+ * opens and stops when it closes, one client at a time. The only call is
+ * kVoodooI2CELANRawStreamMethodNotify, an async method that arms the port the
+ * driver sends a message to whenever it publishes an entry while the reader
+ * has set the waiting flag. Opening the client takes administrator privileges.
+ */
+
+class VoodooI2CELANUserClient : public IOUserClient {
+    OSDeclareDefaultStructors(VoodooI2CELANUserClient);
+
+ public:
+    /* Only lets administrators open the client, the stream holds every touch and click
+     *
+     * @return false if the task opening it is not privileged
+     */
+    bool initWithTask(task_t owning_task, void* security_id, UInt32 type, OSDictionary* properties) override;
+    /* Attaches to the driver and starts recording
+     *
+     * @return false if another client is already reading the stream
+     */
+    bool start(IOService* provider) override;
+    IOReturn clientClose() override;
+    IOReturn clientMemoryForType(UInt32 type, IOOptionBits* options, IOMemoryDescriptor** memory) override;
+    IOReturn externalMethod(uint32_t selector, IOExternalMethodArguments* arguments, IOExternalMethodDispatch* dispatch,
+                            OSObject* target, void* reference) override;
+
+ private:
+    VoodooI2CELANTouchpadDriver* driver;
+
+    static IOReturn arm_notification(VoodooI2CELANUserClient* target, void* reference, IOExternalMethodArguments* arguments);
+    static const IOExternalMethodDispatch methods[kVoodooI2CELANRawStreamMethodCount];
+};
+
+#endif /* VOODOOI2C_ELAN_USER_CLIENT_HPP */
@@ -0,0 +1,152 @@
+//
+//  VoodooI2CELANWatchdog.cpp
+//  VoodooI2CELAN
+//
+//  Copyright © 2017 Kishor Prins. All rights reserved.
+//
+
+#include "VoodooI2CELANWatchdog.hpp"
+
+static uint32_t ns_to_ms_rounded_up(uint64_t ns) {
+    uint64_t ms = (ns + 999999) / 1000000;
+    return ms ? static_cast<uint32_t>(ms) : 1;
+}
+
+VoodooI2CELANWatchdog::VoodooI2CELANWatchdog() :
+    error_limit(0),
+    stuck_contact_ms(0),
+    recoveries(0),
+    fast_recoveries(0),
+    failed_recoveries(0),
+    last_recovery_ns(0),
+    read_failures(0),
+    invalid_reports(0),
+    touching(false),
+    last_report_ns(0),
+    pending(kVoodooI2CELANStallNone),
+    stall_begin_ns(0),
+    in_recovery(false),
+    backoff_ms(ELAN_WATCHDOG_BACKOFF_MS),
+    last_attempt_ns(0),
+    next_attempt_ns(0) {
+    for (int i = 0; i < kVoodooI2CELANStallCount; i++)
+        stalls[i] = 0;
+}
+
+void VoodooI2CELANWatchdog::configure(uint32_t error_limit, uint32_t stuck_contact_ms) {
+    this->error_limit = error_limit;
+    this->stuck_contact_ms = stuck_contact_ms;
+}
+
+void VoodooI2CELANWatchdog::reset(uint64_t now_ns) {
+    read_failures = 0;
+    invalid_reports = 0;
+    touching = false;
+    last_report_ns = now_ns;
+    // the device was initialised from elsewhere, e.g. on wake, which is as good as a recovery
+    if (!in_recovery)
+        pending = kVoodooI2CELANStallNone;
+}
+
+void VoodooI2CELANWatchdog::stop() {
+    pending = kVoodooI2CELANStallNone;
+    in_recovery = false;
+}
+
+void VoodooI2CELANWatchdog::set_stall(VoodooI2CELANStall stall, uint64_t now_ns) {
+    pending = stall;
+    stalls[stall]++;
+    stall_begin_ns = now_ns;
+}
+
+bool VoodooI2CELANWatchdog::read_failed(uint64_t now_ns) {
+    if (!error_limit || pending || ++read_failures < error_limit)
+        return false;
+    set_stall(kVoodooI2CELANStallReadFailures, now_ns);
+    return true;
+}
+
+bool VoodooI2CELANWatchdog::invalid_report(uint64_t now_ns) {
+    if (!error_limit || pending || ++invalid_reports < error_limit)
+        return false;
+    set_stall(kVoodooI2CELANStallInvalidReports, now_ns);
+    return true;
+}
+
+bool VoodooI2CELANWatchdog::report_received(uint64_t now_ns, bool contact) {
+    bool went_down = contact && !touching;
+
+    read_failures = 0;
+    invalid_reports = 0;
+    last_report_ns = now_ns;
+    touching = contact;
+    return went_down && stuck_contact_ms && !pending;
+}
+
+VoodooI2CELANStall VoodooI2CELANWatchdog::tick(uint64_t now_ns, uint32_t* delay_ms) {
+    *delay_ms = 0;
+    // init_finished() or the fast path reports back, nothing to do until then
+    if (in_recovery)
+        return kVoodooI2CELANStallNone;
+
+    if (!pending && touching && stuck_contact_ms) {
+        uint64_t limit_ns = stuck_contact_ms * 1000000ULL;
+        uint64_t quiet_ns = now_ns > last_report_ns ? now_ns - last_report_ns : 0;
+        if (quiet_ns < limit_ns) {
+            *delay_ms = ns_to_ms_rounded_up(limit_ns - quiet_ns);
+            return kVoodooI2CELANStallNone;
+        }
+        set_stall(kVoodooI2CELANStallStuckContact, now_ns);
+    }
+
+    if (!pending)
+        return kVoodooI2CELANStallNone;
+    if (now_ns < next_attempt_ns) {
+        *delay_ms = ns_to_ms_rounded_up(next_attempt_ns - now_ns);
+        return kVoodooI2CELANStallNone;
+    }
+    return pending;
+}
+
+void VoodooI2CELANWatchdog::recovery_started(uint64_t now_ns) {
+    in_recovery = true;
+
+    // a recovery that held for the longest backoff starts the next burst from scratch
+    if (last_attempt_ns && now_ns - last_attempt_ns < ELAN_WATCHDOG_MAX_BACKOFF_MS * 1000000ULL)
+        backoff_ms = backoff_ms * 2 > ELAN_WATCHDOG_MAX_BACKOFF_MS ? ELAN_WATCHDOG_MAX_BACKOFF_MS : backoff_ms * 2;
+    else
+        backoff_ms = ELAN_WATCHDOG_BACKOFF_MS;
+    last_attempt_ns = now_ns;
+    next_attempt_ns = now_ns + backoff_ms * 1000000ULL;
+}
+
+void VoodooI2CELANWatchdog::recovery_finished(uint64_t now_ns, bool success, bool fast) {
+    in_recovery = false;
+    if (!success) {
+        failed_recoveries++;
+        return;
+    }
+
+    recoveries++;
+    if (fast)
+        fast_recoveries++;
+    last_recovery_ns = now_ns - stall_begin_ns;
+    recovery_time.record(last_recovery_ns);
+
+    pending = kVoodooI2CELANStallNone;
+    read_failures = 0;
+    invalid_reports = 0;
+    touching = false;
+    last_report_ns = now_ns;
+}
+
+const char* VoodooI2CELANWatchdog::stall_name(VoodooI2CELANStall stall) {
+    switch (stall) {
+        case kVoodooI2CELANStallNone: return "None";
+        case kVoodooI2CELANStallReadFailures: return "ReadFailures";
+        case kVoodooI2CELANStallInvalidReports: return "InvalidReports";
+        case kVoodooI2CELANStallStuckContact: return "StuckContact";
+        case kVoodooI2CELANStallCount: break;
+    }
+    return "Unknown";
+}
@@ -0,0 +1,134 @@
+//
+//  VoodooI2CELANWatchdog.hpp
+//  VoodooI2CELAN
+//
+//  Copyright © 2017 Kishor Prins. All rights reserved.
+//
+
+#ifndef VOODOOI2C_ELAN_WATCHDOG_HPP
+#define VOODOOI2C_ELAN_WATCHDOG_HPP
+
+#include <stdint.h>
+
+#include "VoodooI2CELANLatencyHistogram.hpp"
+
+// The first recovery of a burst runs at once, the second waits this long after it, every further one twice as long up to the maximum
+#define ELAN_WATCHDOG_BACKOFF_MS 100
+#define ELAN_WATCHDOG_MAX_BACKOFF_MS 10000
+
+/* Why the controller is considered wedged */
+enum VoodooI2CELANStall {
+    kVoodooI2CELANStallNone = 0,
+    kVoodooI2CELANStallReadFailures,    // too many reads failed in a row
+    kVoodooI2CELANStallInvalidReports,  // too many invalid or short reports in a row
+    kVoodooI2CELANStallStuckContact,    // a contact is down but the reports stopped
+    kVoodooI2CELANStallCount
+};
+
+/* Notices when the controller has wedged and paces the attempts to recover it
+ *
+ * The report path tells the watchdog about every read, it keeps the count of
+ * consecutive failures and whether anything is touching. The device reports
+ * continuously while touched, so a contact without a report for
+ * stuck_contact_ms means the controller stopped talking. A controller that
+ * stops interrupting while nothing is touching looks just like an untouched
+ * pad and is left to the idle monitor's probes.
+ *
+ * The first stall is recovered from immediately. Further recoveries back
+ * off exponentially while the stalls keep coming, from 100 ms up to 10 s
+ * after the previous attempt, so a controller that cannot be recovered does
+ * not keep the work loop busy resetting it. The backoff starts over once a
+ * recovery held for the maximum backoff.
+ *
+ * Only used from the work loop.
+ */
+
+class VoodooI2CELANWatchdog {
+ public:
+    VoodooI2CELANWatchdog();
+
+    /* Sets the stall conditions, a limit of 0 turns its check off
+     * @error_limit consecutive failed reads, or invalid reports, that make a stall
+     * @stuck_contact_ms time a contact may go without a report
+     */
+    void configure(uint32_t error_limit, uint32_t stuck_contact_ms);
+    /* Starts watching a freshly initialised device
+     * @now_ns the current time
+     */
+    void reset(uint64_t now_ns);
+    /* Forgets the stall and any recovery in progress, e.g. because the system goes to sleep */
+    void stop();
+
+    /* Accounts for a failed read
+     * @now_ns the current time
+     *
+     * @return true if this read made a stall, the caller should tick() right away
+     */
+    bool read_failed(uint64_t now_ns);
+    /* Accounts for an invalid or short report
+     * @now_ns the current time
+     *
+     * @return true if this report made a stall, the caller should tick() right away
+     */
+    bool invalid_report(uint64_t now_ns);
+    /* Accounts for a valid report
+     * @now_ns when the report was read
+     * @contact whether anything touches the surface
+     *
+     * @return true if a contact just went down, the caller should tick() after stuck_contact_ms
+     */
+    bool report_received(uint64_t now_ns, bool contact);
+
+    /* Looks for a stall
+     * @now_ns the current time
+     * @delay_ms receives when to tick again, 0 if there is nothing to watch
+     *
+     * @return the stall to recover from now, kVoodooI2CELANStallNone while there is none or
+     * the backoff has not passed yet
+     */
+    VoodooI2CELANStall tick(uint64_t now_ns, uint32_t* delay_ms);
+
+    /* Accounts for the start of a recovery, the watchdog stays quiet until it has finished
+     * @now_ns the current time
+     */
+    void recovery_started(uint64_t now_ns);
+    /* Accounts for the end of a recovery
+     * @now_ns the current time
+     * @success whether the device was initialised again, if not the stall stands and the next
+     * tick() retries after the backoff
+     * @fast whether the cached fast path was enough
+     */
+    void recovery_finished(uint64_t now_ns, bool success, bool fast);
+    bool recovering() const { return in_recovery; }
+
+    static const char* stall_name(VoodooI2CELANStall stall);
+
+    uint32_t error_limit;
+    uint32_t stuck_contact_ms;
+
+    /* Totals since the watchdog was created */
+    uint64_t stalls[kVoodooI2CELANStallCount];
+    uint64_t recoveries;
+    uint64_t fast_recoveries;
+    uint64_t failed_recoveries;
+    /* Time from noticing the stall to the device being initialised again */
+    VoodooI2CELANLatencyHistogram recovery_time;
+    uint64_t last_recovery_ns;
+
+ private:
+    uint32_t read_failures;
+    uint32_t invalid_reports;
+    bool touching;
+    uint64_t last_report_ns;
+
+    VoodooI2CELANStall pending;
+    uint64_t stall_begin_ns;
+    bool in_recovery;
+    uint32_t backoff_ms;
+    uint64_t last_attempt_ns;
+    uint64_t next_attempt_ns;
+
+    void set_stall(VoodooI2CELANStall stall, uint64_t now_ns);
+};
+
+#endif /* VOODOOI2C_ELAN_WATCHDOG_HPP */
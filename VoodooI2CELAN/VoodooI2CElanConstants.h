@@ -26,6 +26,7 @@
 #define ETP_I2C_PRESSURE_CMD  0x010A
 #define ETP_I2C_IAP_VERSION_CMD  0x0110
 #define ETP_I2C_SET_CMD   0x0300
+#define ETP_I2C_IAP_TYPE_CMD  0x0304
 #define ETP_I2C_POWER_CMD  0x0307
 #define ETP_I2C_FW_CHECKSUM_CMD  0x030F
 #define ETP_I2C_IAP_CTRL_CMD  0x0310
@@ -46,6 +47,15 @@
 #define ETP_I2C_IAP_REG_L  0x01
 #define ETP_I2C_IAP_REG_H  0x06
 
+/* Elan firmware update (from elan_i2c.h) */
+#define ETP_FW_IAP_PAGE_ERR (1 << 5)
+#define ETP_FW_IAP_INTF_ERR (1 << 4)
+#define ETP_FW_PAGE_SIZE 64
+#define ETP_FW_PAGE_SIZE_128 128
+#define ETP_FW_PAGE_SIZE_512 512
+#define ETP_FW_SIGNATURE_SIZE 6
+#define ETP_IAP_START_ADDR 0x0083
+
 #define ETP_ENABLE_ABS  0x0001
 #define ETP_ENABLE_CALIBRATE 0x0002
 #define ETP_DISABLE_CALIBRATE 0x0000
@@ -64,6 +74,7 @@
 #define ETP_TOUCH_INFO_OFFSET 3
 #define ETP_FINGER_DATA_OFFSET 4
 #define ETP_HOVER_INFO_OFFSET 30
+#define ETP_HOVER_EVENT  0x40
 #define ETP_MAX_REPORT_LEN 34
 
 #endif /* LinuxELANI2C_h */